@@ -2,6 +2,14 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <math.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <pthread.h>
+#include <stdatomic.h>
 
 #include "pstrings.h"
 #include "stack.h"
@@ -47,6 +55,469 @@ struct expression_tree{
 struct expression_tree_wrapper{
     char *expression_string;   // the expression that expression_tree was built from
     ExTree expression_tree;     // the expression tree built from the expression string
+
+    // if the tree was parsed in parts, on several threads, and joined (see
+    // ExParallel_parse()), the wrappers of those parts, whose expression 
+    // strings hold most of its tokens; NULL otherwise
+    ExTreeWrapper *parts;
+    uint32_t part_count;
+};
+
+
+/* A hash-consed version of an ExTree: every distinct subexpression is stored
+   exactly once, as a node in a flat array, and identical subtrees all refer to
+   that one node by its index (id). The tree thus becomes a DAG.
+   Built by ExDag_new() from an ExTree. 
+   The nodes are stored in post-order, so the children of a node always have
+   lower ids than the node itself, and the last node is the root.
+*/
+typedef struct expression_dag *ExDag;
+
+struct expression_dag_node{
+    uint8_t opcode;     // ExP_OP_*; ExP_OP_LITERAL if the node is an operand
+    uint32_t left;      // id of the left child (only meaningful for operators)
+    uint32_t right;     // id of the right child (only meaningful for operators)
+    int32_t literal;    // the value of the operand (only meaningful for operands)
+};
+
+struct expression_dag{
+    uint32_t count;         // number of distinct nodes
+    uint32_t deduplicated;  // number of tree nodes that turned out to be duplicates
+    struct expression_dag_node *nodes;
+    int32_t *values;        // the value of each node, memoized during ExDag_evaluate()
+
+    // open-addressing hash table mapping node contents to id+1 (0 means empty slot);
+    // only needed while building
+    uint32_t *table;
+    uint32_t table_mask;    // table size - 1; the size is a power of 2
+};
+
+
+
+// opcodes of the nodes in an ExProgram (see below)
+enum expression_opcode{
+    ExP_OP_LITERAL,     // an operand
+    ExP_OP_ADD,
+    ExP_OP_SUB,
+    ExP_OP_MUL,
+    ExP_OP_DIV,
+    ExP_OP_POW,
+
+    // comparisons and logical operators: the result is 1 (true) or 0 (false)
+    ExP_OP_LT,          // <
+    ExP_OP_LE,          // <=
+    ExP_OP_EQ,          // ==
+    ExP_OP_NE,          // !=
+    ExP_OP_AND,         // &&, only evaluates its right operand if the left one is true
+    ExP_OP_OR,          // ||, only evaluates its right operand if the left one is false
+
+    // c ? a : b is stored as two binary nodes, ? with c on the left and
+    // the : node on the right, the : node holding a and b. Only one of
+    // a and b is evaluated.
+    ExP_OP_COND,        // ?
+    ExP_OP_ELSE,        // : (computes nothing by itself)
+
+    // function calls: f(a, b, c) is stored as the CALL node f, holding the
+    // list of its arguments as its only (left) child. The list is a left-deep
+    // chain of ARGS nodes, ,(,(a, b), c); a single argument is its own list.
+    // In an ExProgram (and an ExDag), 'right' of a CALL node is the id of
+    // the function (see ExCall_lookup()) rather than the index of a node.
+    ExP_OP_ARGS,        // , (computes nothing by itself)
+    ExP_OP_CALL,
+
+    // control flow, only found in ExPrograms, to skip the operands that
+    // && || and ?: don't need: 'right' is the index of the node to continue at
+    ExP_OP_SKIP_FALSE,  // skip if the value of node 'left' is 0
+    ExP_OP_SKIP_TRUE,   // skip if it isn't
+    ExP_OP_JUMP,        // always skip
+
+    // specialized operators, substituted by ExProgram_specialize() when the
+    // right operand is a constant; 'right' then holds what's noted below
+    // instead of the index of the constant
+    ExP_OP_DIV_POW2,    // division by 2^right: a shift with sign correction
+    ExP_OP_DIV_MAGIC,   // division by a constant: 'right' is an index into divisors[]
+    ExP_OP_MUL_POW2,    // multiplication by 2^right: a shift
+    ExP_OP_POW_CONST,   // exponentiation to the power 'right'
+
+    // formula sets and shape caches only (see the ExFormula and ExShape 
+    // functions): an operand read from the program's inputs[], 'left' being
+    // its index there; the value of another formula, or a literal
+    ExP_OP_REFERENCE
+};
+
+/* A compiled expression: the expression tree stored as a structure of arrays
+   rather than as pointer-linked, individually malloc-ated nodes.
+   Node i is described by opcodes[i], left[i] and right[i]:
+   - for operators, left[i] and right[i] are the indices of the children
+   - for operands (ExP_OP_LITERAL), left[i] and right[i] are the low and high 
+     32 bits of the operand's value, stored inline, so no string is kept around
+   The nodes are stored in post-order: children always come before their
+   parents and the root is the last node. That means evaluation is a single 
+   sequential sweep over the arrays.
+
+   All the arrays live in the same heap block as the struct itself, so an
+   ExProgram is a single allocation (plus the divisors table, for programs 
+   dividing by constants), freed by ExP_program_destroy().
+   At 9 bytes per node (plus 4 bytes of scratch for evaluation) it is about 
+   3 times smaller than an ExTree node with its malloc overhead and its token string.
+*/
+struct expression_program{
+    uint32_t count;     // number of nodes
+    uint8_t *opcodes;   // ExP_OP_*
+    uint32_t *left;
+    uint32_t *right;
+    int32_t *values;    // scratch space: the value of each node during ExP_run()
+
+    // the divisors of the ExP_OP_DIV_MAGIC nodes; a separate allocation, 
+    // only made if there are any (NULL otherwise)
+    struct expression_divisor *divisors;
+
+    // the values ExP_OP_REFERENCE nodes read (formula sets and shape caches
+    // only; NULL otherwise)
+    const int32_t *inputs;
+};
+
+/* Division by the constant divisor as a multiplication by a 'magic' 
+   reciprocal, a shift and a correction (see ExP_divide_magic()).
+*/
+struct expression_divisor{
+    uint32_t node;      // index of the node holding the divisor
+    int32_t magic;      // the multiplier
+    uint8_t shift;
+    int8_t correction;  // +1: add the dividend after multiplying, -1: subtract it, 0: neither
+};
+
+
+/* A function that expressions can call: one of the built-in ones, or one
+   registered with ExP_register_function(). See the ExCall functions.
+*/
+struct expression_function{
+    char name[32];
+    ex_function function;
+    uint32_t min_arguments;
+    uint32_t max_arguments;
+};
+
+// the ids of the built-in functions
+enum expression_builtin{
+    ExCall_MIN,
+    ExCall_MAX,
+    ExCall_ABS,
+    ExCall_CLAMP,
+    ExCall_BUILTINS     // how many there are; registered functions come next
+};
+
+
+/* A large infix expression parsed on several threads (see ExParallel_parse())
+   is first cut into chunks of about the same size, which are scanned 
+   concurrently: once to find how the parenthesis nesting depth changes over
+   each one, then, knowing the depth at the start of each chunk, to find 
+   the operators outside of any parentheses.
+   The expression is then cut again into parts at the lowest-precedence
+   ones of those operators, and the parts are parsed concurrently.
+*/
+enum expression_token_kind{
+    ExParallel_NONE,        // no token (yet)
+    ExParallel_NUMBER,
+    ExParallel_NAME,
+    ExParallel_FUNCTION,    // the name of a function
+    ExParallel_OPEN,        // (
+    ExParallel_CLOSE,       // )
+    ExParallel_OPERATOR
+};
+
+// what the operands of an expression being checked may be besides integers
+// (see ExCheck_operand()), or'ed together
+enum expression_operands{
+    ExCheck_INTEGERS = 0,   // integers only: the expression is computed in int32_t or int64_t
+    ExCheck_NAMES = 1,      // names (variables), which have no value
+    ExCheck_FRACTIONS = 2   // fractional parts and exponents (2.5e3), which only ExP_compute_double() reads
+};
+
+struct expression_parallel_chunk{
+    const char *expression;
+    size_t length;          // the length of the whole expression
+    size_t start, end;      // the part of it this chunk covers
+
+    // found by ExParallel_lex()
+    int64_t depth;          // the change in depth over the chunk; then, the depth at its start
+    int64_t min_depth;      // the lowest depth reached, relative to the start
+    uint8_t first, last;    // the kinds of its first and last tokens
+    bool irregular;         // a token that can't follow the one before it, like an operator another one
+
+    // found by ExParallel_split(), among the operators outside of any parentheses
+    uint8_t precedence;     // the lowest precedence; UINT8_MAX if there are none
+    size_t split;           // the position of the first operator of that precedence
+    uint32_t splits;        // how many operators of that precedence there are
+};
+
+struct expression_parallel_part{
+    const char *expression;
+    size_t start, end;
+    uint32_t operators;     // how many of the operators the expression is cut at are inside it
+    ExTreeWrapper wrapper;  // the part, parsed
+};
+
+
+/* Where the ExTree_traverse_* functions write their output: a fixed-size
+   buffer that's passed on whenever it fills up, so the memory used doesn't
+   depend on the size of the output. Either
+   - buffer is the final destination, a string of the exact size of the
+     output (output is NULL, fd -1): nothing is ever passed on
+   - or it's flushed to the callback output, or to the file descriptor fd
+     with writev(), together with whatever didn't fit in it
+*/
+typedef struct expression_sink *ExSink;
+
+struct expression_sink{
+    char *buffer;
+    size_t size;            // capacity of buffer
+    size_t used;            // bytes in buffer, not passed on yet
+    uint64_t written;       // bytes of output so far, passed on or not
+    bool separate;          // whether the next token needs a space before it
+    bool failed;            // a write to fd failed, or the tree written couldn't be walked
+
+    ex_stream_output output;
+    void *context;          // passed back to output
+    int fd;
+};
+
+
+/* State of an incremental ("push") parser, which is fed an expression in
+   arbitrarily-sized chunks and evaluates and/or converts it as it goes,
+   without ever holding the whole expression in memory. 
+   Memory use is bounded by the nesting depth of the expression, not its size.
+   See ExP_stream_new().
+*/
+struct expression_stream_frame{
+    char operator[3];   // an operator awaiting its operands (prefix input), or on the
+                        // shunting-yard stack (infix input, where it can be a '(')
+    int32_t function;   // the id of the function, if it's a call, else -1
+    bool have_left;     // prefix input: whether its left operand has been seen already
+    bool parenthesized; // prefix input to infix: whether it's written in parentheses,
+                        // with its operands
+};
+
+struct expression_stream_value{
+    int32_t value;
+    ex_error_kind error;    // ExP_ERROR_DIVISION or ExP_ERROR_OVERFLOW, if computing it divides by 0
+    uint32_t arguments;     // the last value of an argument list: how many values, from this
+                            // one down, the list is made of; 0 for a value of its own
+    bool is_else;           // the second branch of a ?:, the first one being the value below
+};
+
+struct expression_stream{
+    ex_notation NOTATION;   // the notation of the input
+    ex_targets TARGETS;     // what to produce: the value and/or one notation
+    ex_stream_output output;    // where converted text is written
+    void *context;          // passed back to output
+
+    bool failed;            // set on malformed input; every later call then fails
+    bool complete;          // a whole expression has been seen (prefix input)
+    bool wrote_token;       // whether a token has been written out yet (for spacing)
+    uint8_t previous;       // the kind of the last token (infix input, see ExParallel_may_follow())
+
+    // the operand currently being read; it may span several chunks
+    char *token;
+    uint32_t token_length, token_size;
+    bool in_name;           // whether it's a name so far, so that an 'x' is part of it
+
+    // the last character of the last chunk, held back until the next one
+    // tells whether it's the start of a two-character operator, or an 'x' 
+    // that starts a name
+    char held;
+    bool holding;
+
+    // the values of the operands waiting for their operator: postfix input,
+    // or what the other notations are turned into
+    struct expression_stream_value *values;
+    uint32_t values_count, values_size;
+
+    // prefix: the operators waiting for their operands; infix: the 
+    // shunting-yard operator stack
+    struct expression_stream_frame *frames;
+    uint32_t frames_count, frames_size;
+
+    // the limits of the thread that created the stream (see ExP_set_limits()),
+    // and what's been read against them so far
+    ex_limits limits;
+    uint64_t tokens;
+    uint32_t parentheses;   // infix input: how deeply they nest at this point
+    bool exceeded;          // the input went over the limits (stream->failed is set too)
+};
+
+
+/* A conversion between prefix and postfix done without a tree (see 
+   ExSpan_convert()), or just a check of the expression: the input is read
+   token by token, and the operators waiting for their operands are kept
+   as spans of it, on a stack no deeper than the expression. The stacks
+   start out inside the struct, so that checking an expression that isn't
+   deeply nested allocates nothing.
+*/
+typedef struct expression_span *ExSpan;
+
+// how many items the stacks of an ExSpan, and those of the other single
+// passes over an expression, hold before they move to the heap
+#define ExSpan_LOCAL 32
+
+struct expression_span_frame{
+    size_t start;           // where the operator's token is in the input
+    uint32_t length;        // and its length
+    bool is_call;           // a function, with a single operand (its argument list)
+    bool have_first;        // whether its first operand, in reading order, is complete
+    bool first_is_else;     // whether that operand is the : of a ?:
+    uint32_t first_arguments;   // that operand's ExSpan_convert() arguments
+};
+
+struct expression_span{
+    const char *expression;
+    size_t length;
+    bool backwards;         // postfix input, read from its end, to prefix
+    size_t position;        // where reading goes on from
+    bool failed;            // memory couldn't be allocated
+    uint8_t operands;       // the operands accepted besides integers (see enum expression_operands)
+
+    // backwards: the starts of the tokens of the run of characters without
+    // spaces being read, split from its start as ExP_refine() does it
+    size_t *run;
+    uint32_t run_count, run_size;
+    size_t run_end;
+    size_t local_run[ExSpan_LOCAL];
+
+    // the output: sink (forwards), or the bytes before cursor (backwards,
+    // moving down); both NULL to only check the expression
+    ExSink sink;
+    char *cursor;
+    bool wrote_token;
+
+    struct expression_span_frame *frames;
+    uint32_t frames_count, frames_size;
+    struct expression_span_frame local_frames[ExSpan_LOCAL];
+};
+
+
+/* A walk over an ExTree that doesn't recurse, so that no tree is too deep 
+   for it (an expression of a few MB can be a chain of a million operators):
+   the nodes on the path from the root down to the current one are kept on
+   a stack instead, each with how far the walk through it has got. Like 
+   those of an ExSpan, the stack starts out inside the struct.
+*/
+struct expression_tree_frame{
+    ExTree node;
+    uint8_t state;          // how many of its operands have been walked, roughly
+};
+
+struct expression_tree_walk{
+    struct expression_tree_frame *frames;
+    uint32_t count, size;
+    bool failed;            // memory couldn't be allocated
+    struct expression_tree_frame local[ExSpan_LOCAL];
+};
+
+
+/* A set of named formulas that refer to each other by name, like the cells
+   of a spreadsheet (see ExP_formulas_new()). Each formula is compiled once,
+   into an ExProgram whose ExP_OP_REFERENCE nodes read the values of the
+   formulas it refers to from the set's values[]. Those references are the
+   edges of the dependency graph, recalculated in topological order.
+*/
+struct expression_formula{
+    char *name;
+    ExProgram program;      // NULL for a value set with ExP_formulas_set_value()
+    bool defined;           // false for a name only referred to so far
+    bool dirty;             // changed since it was last computed
+    bool affected;          // to be computed by the recalculation under way
+    uint32_t pending;       // how many of its sources that still has to wait for
+
+    uint32_t *sources;      // the formulas it refers to, each listed once
+    uint32_t source_count;
+    uint32_t *dependents;   // the formulas referring to it
+    uint32_t dependent_count, dependent_size;
+};
+
+struct expression_formulas{
+    struct expression_formula *formulas;
+    int32_t *values;        // values[i]: the value of formulas[i]
+    uint32_t count, formulas_size, values_size;
+
+    // hash table of the names, with linear probing: index + 1, 0 if empty
+    uint32_t *table;
+    uint32_t table_size;    // a power of 2, more than twice count
+
+    // the thread pool computing the large levels of the graph; its threads 
+    // are started the first time there's one, and each takes formulas off 
+    // work[] until there are none left
+    uint32_t threads;       // how many threads to compute on, the caller's included
+    bool started;
+    pthread_t *workers;
+    uint32_t worker_count;
+    pthread_mutex_t lock;
+    pthread_cond_t start;   // a new batch of work, or stopping
+    pthread_cond_t finished;    // busy went down to 0
+    uint64_t generation;    // incremented with every batch
+    uint32_t busy;          // the workers not done with the current batch
+    bool stopping;
+    const uint32_t *work;
+    uint32_t work_count;
+    atomic_uint next;       // the index in work[] of the next formula to take
+};
+
+
+/* A cache of compiled programs keyed by the shape of expressions: the
+   expression with each of its integer literals (operands made only of
+   digits) replaced by ExShape_SLOT, so that '1 * (2 + 3 / 4)' and
+   '7 * (5 + 9 / 2)' share one program. Its literals are ExP_OP_REFERENCE
+   nodes, the i-th one from the left reading the i-th literal of the 
+   expression being computed from the program's inputs[].
+   See the ExShape functions.
+*/
+
+// the byte standing for a literal in a shape; expressions containing it
+// (always malformed) aren't cached
+#define ExShape_SLOT '#'
+
+// how many expressions of the same shape ExP_shapes_compute_batch() 
+// evaluates side by side
+#define ExShape_LANES 8
+
+struct expression_shape{
+    char *key;              // the shape, not NUL-terminated
+    uint32_t key_length;
+    uint32_t hash;
+    ex_notation notation;
+    ExProgram program;
+    uint32_t literals;      // how many literals the shape has
+    bool lanes;             // no control flow: can be evaluated ExShape_LANES at a time
+
+    // batches: the literals of the expressions of this shape waiting to be
+    // evaluated together, literal i of lane l in lane_inputs[i * ExShape_LANES + l],
+    // and the indices of their results
+    int32_t *lane_inputs;
+    uint32_t lane_results[ExShape_LANES];
+    uint32_t lane_count;
+};
+
+struct expression_shapes{
+    struct expression_shape *shapes;
+    uint32_t count, shapes_size;
+    uint32_t capacity;      // at most this many shapes are kept
+
+    // hash table of the shapes, with linear probing: index + 1, 0 if empty
+    uint32_t *table;
+    uint32_t table_size;    // a power of 2, more than twice count
+
+    // the expression just scanned: its shape, and its literals
+    char *key;
+    uint32_t key_size;
+    int32_t *literals;
+    uint32_t literals_size;
+
+    // batches: the values of the nodes for ExShape_evaluate_lanes(), 
+    // ExShape_LANES per node, and the shapes with expressions waiting
+    int32_t *lane_values;
+    uint32_t lane_values_size;
+    uint32_t *waiting;
+    uint32_t waiting_count, waiting_size;
 };
 
 
@@ -60,6 +531,206 @@ struct expression_tree_wrapper{
 /* ----------------------- Private Functions ------------------------- */
 
 
+/*               * * * Phase reporting * * *                         */
+
+
+// the hook set with ExP_set_phase_hook(); NULL if none
+static ex_phase_hook ExP_phase_hook = NULL;
+static void *ExP_phase_context = NULL;
+
+
+static void ExP_phase(ex_phase PHASE, int starting){
+    /* Report the start (starting is 1) or the end (0) of PHASE to the hook, if any */
+    if (ExP_phase_hook){
+        ExP_phase_hook(PHASE, starting, ExP_phase_context);
+    }
+}
+
+
+
+/*               * * * ExFormat functions * * *                         */
+
+/* Formatting integers without allocating (unlike str_from_int()) and 
+   without dividing per digit: the number of digits comes from the 
+   position of the highest set bit, and the digits are written two at a 
+   time from a table of all 100 pairs.
+*/
+
+
+static const char ExFormat_pairs[201] = 
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+// 10^i
+static const uint64_t ExFormat_powers[20] = {
+    1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL,
+    100000000ULL, 1000000000ULL, 10000000000ULL, 100000000000ULL, 1000000000000ULL,
+    10000000000000ULL, 100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL,
+    100000000000000000ULL, 1000000000000000000ULL, 10000000000000000000ULL
+};
+
+
+static uint32_t ExFormat_count_digits(uint64_t value){
+    /* Return the number of decimal digits of value (1 for 0). 
+       bits * 1233 / 4096 is floor(bits * log10(2)), which is either the 
+       number of digits or one less: one comparison tells which.
+    */
+    uint32_t bits = 64 - __builtin_clzll(value | 1);
+    uint32_t guess = (bits * 1233) >> 12;
+
+    return guess + 1 - ((value | 1) < ExFormat_powers[guess]);
+}
+
+
+static uint32_t ExFormat_int64(int64_t value, char buffer[]){
+    /* Write value in decimal, NUL-terminated, to buffer, which has room
+       for at least ExP_INT_STRING bytes. Return the length written, not 
+       counting the NUL.
+    */
+    uint64_t magnitude = value < 0 ? 0 - (uint64_t)value : (uint64_t)value;
+    uint32_t length = (value < 0) + ExFormat_count_digits(magnitude);
+    char *digit = &buffer[length];
+
+    *digit = '\0';
+    while (magnitude >= 100){
+        uint32_t pair = (uint32_t)(magnitude % 100) * 2;
+        magnitude /= 100;
+        *--digit = ExFormat_pairs[pair + 1];
+        *--digit = ExFormat_pairs[pair];
+    }
+    if (magnitude >= 10){
+        *--digit = ExFormat_pairs[magnitude * 2 + 1];
+        *--digit = ExFormat_pairs[magnitude * 2];
+    }
+    else{
+        *--digit = (char)('0' + magnitude);
+    }
+    if (value < 0){
+        *--digit = '-';
+    }
+    return length;
+}
+
+
+
+/*               * * * ExSink functions * * *                         */
+
+
+static void ExSink_init(ExSink sink, char *buffer, size_t size, ex_stream_output output, void *context, int fd){
+    /* Set up sink to write into buffer, of size bytes, flushed to output 
+       (if not NULL) or fd (if not -1)
+    */
+    sink->buffer = buffer;
+    sink->size = size;
+    sink->used = 0;
+    sink->written = 0;
+    sink->separate = false;
+    sink->failed = false;
+    sink->output = output;
+    sink->context = context;
+    sink->fd = fd;
+}
+
+
+static void ExSink_writev(ExSink sink, const char *text, size_t length){
+    /* Write the contents of the buffer of sink, followed by the length bytes
+       of text, to its file descriptor, in as few system calls as possible
+       (usually one): retrying after partial writes and interruptions.
+    */
+    struct iovec parts[2] = {
+        {.iov_base = sink->buffer, .iov_len = sink->used},
+        {.iov_base = (char *)text, .iov_len = length},
+    };
+    uint32_t first = 0;     // the first part not completely written yet
+
+    while (first < 2 && !sink->failed){
+        if (!parts[first].iov_len){
+            first++;
+            continue;
+        }
+        ssize_t written = writev(sink->fd, &parts[first], 2 - first);
+        if (written < 0){
+            sink->failed = errno != EINTR;
+            continue;
+        }
+        // skip what was written
+        while (first < 2 && (size_t)written >= parts[first].iov_len){
+            written -= parts[first].iov_len;
+            first++;
+        }
+        if (first < 2){
+            parts[first].iov_base = (char *)parts[first].iov_base + written;
+            parts[first].iov_len -= written;
+        }
+    }
+}
+
+
+static void ExSink_write(ExSink sink, const char *text, size_t length){
+    /* Write the length bytes of text to sink */
+    sink->written += length;
+
+    if (sink->used + length <= sink->size){
+        memcpy(sink->buffer + sink->used, text, length);
+        sink->used += length;
+        return;
+    }
+    // doesn't fit: pass on the buffer (never the case for strings, sized exactly)
+    if (sink->output){
+        sink->output(sink->buffer, sink->used, sink->context);
+        sink->used = 0;
+
+        if (length > sink->size){
+            sink->output(text, length, sink->context);
+        }else{
+            memcpy(sink->buffer, text, length);
+            sink->used = length;
+        }
+    }
+    else if (sink->fd >= 0){
+        // the buffer and text in a single writev()
+        ExSink_writev(sink, text, length);
+        sink->used = 0;
+    }
+}
+
+
+static void ExSink_token(ExSink sink, char *token){
+    /* Write token to sink, preceded by a space unless it's the first one */
+    if (sink->separate){
+        ExSink_write(sink, " ", 1);
+    }
+    ExSink_write(sink, token, str_len(token));
+    sink->separate = true;
+}
+
+
+static void ExSink_file_output(const char *text, size_t length, void *file){
+    /* The output callback of sinks writing to a FILE * (errors are left to ferror()) */
+    fwrite(text, 1, length, (FILE *)file);
+}
+
+
+static void ExSink_flush(ExSink sink){
+    /* Pass on whatever is left in the buffer of sink */
+    if (!sink->used){
+        return;
+    }
+    if (sink->output){
+        sink->output(sink->buffer, sink->used, sink->context);
+    }
+    else if (sink->fd >= 0){
+        ExSink_writev(sink, NULL, 0);
+    }
+    else{
+        return;     // a string: the output stays where it is
+    }
+    sink->used = 0;
+}
+
+
+
 /*               * * * ExTree functions * * *                         */
 
 
@@ -88,6 +759,8 @@ static void ExTree_init(ExTreeWrapper *tree_wrapper, char *expression_string){
 
     (*tree_wrapper)->expression_tree = NULL;
     (*tree_wrapper)->expression_string = expression_string;
+    (*tree_wrapper)->parts = NULL;
+    (*tree_wrapper)->part_count = 0;
 }
 
 
@@ -134,6 +807,88 @@ static ExTree ExTree_insert_left(ExTree tree, ExTree left_child){
 // forward declaration of ExP_eval, since it's defined down below in the next section,
 // but referred to in t he body of ExTree_traverse()
 static int32_t ExP_eval(char *operator, int32_t left_operand, int32_t right_operand);
+static uint8_t ExP_opcode(char *operator);
+// ditto, from the ExCall section
+static int32_t ExCall_lookup(const char *name);
+static uint32_t ExCall_arguments(ExTree list, ExTree arguments[]);
+static int32_t ExCall_apply(uint32_t function, const int32_t arguments[], uint32_t count);
+// and from the ExSpan and ExCheck sections: the stacks of the walks without
+// recursion, and the errors found while evaluating
+static bool ExSpan_reserve(void **array, void *local, uint32_t *size, uint32_t needed, size_t item_size);
+static bool ExCheck_fail(ex_error_kind kind, size_t offset);
+
+
+static uint8_t ExTree_opcode(ExTree tree){
+    /* Return the opcode (ExP_OP_*) of the node tree: ExP_OP_LITERAL for
+       operands, ExP_OP_CALL for function calls (the only nodes with a 
+       left child and no right one), else that of its operator token.
+       Unlike ExP_opcode(), function names are never mistaken for
+       operators ('xor' isn't an x).
+    */
+    if (!tree->right){
+        return tree->left ? ExP_OP_CALL : ExP_OP_LITERAL;
+    }
+    return ExP_opcode(tree->token);
+}
+
+static void ExTree_walk_push(struct expression_tree_walk *walk, ExTree node){
+    /* Push node onto the stack of walk, to be walked through next. If
+       memory couldn't be allocated, set walk->failed and record that with 
+       ExCheck_fail() instead.
+    */
+    if (!ExSpan_reserve((void **)&walk->frames, walk->local, &walk->size, walk->count + 1, \
+                sizeof(struct expression_tree_frame))){
+        walk->failed = true;
+        ExCheck_fail(ExP_ERROR_MEMORY, 0);
+        return;
+    }
+    walk->frames[walk->count++] = (struct expression_tree_frame){node, 0};
+}
+
+
+static void ExTree_walk_init(struct expression_tree_walk *walk, ExTree tree){
+    /* Start a walk over tree, from its root */
+    walk->frames = walk->local;
+    walk->count = 0;
+    walk->size = ExSpan_LOCAL;
+    walk->failed = false;
+    if (tree){
+        ExTree_walk_push(walk, tree);
+    }
+}
+
+
+static void ExTree_walk_free(struct expression_tree_walk *walk){
+    /* Free the stack of walk, if it outgrew the struct */
+    if (walk->frames != walk->local){
+        free(walk->frames);
+    }
+}
+
+
+static ExTree ExTree_walk_next(struct expression_tree_walk *walk){
+    /* Return the next node of walk in post-order (a node after its left
+       operand, then its right one), or NULL once the whole tree has been
+       walked, or if memory for the stack couldn't be allocated 
+       (walk->failed is set then).
+    */
+    while (walk->count && !walk->failed){
+        struct expression_tree_frame *frame = &walk->frames[walk->count - 1];
+        ExTree node = frame->node;
+        if (frame->state < 2){
+            ExTree child = frame->state++ ? node->right : node->left;
+            if (child){
+                ExTree_walk_push(walk, child);
+            }
+            continue;
+        }
+        walk->count--;
+        return node;
+    }
+    return NULL;
+}
+
+
 //
 static int32_t ExTree_traverse(ExTree tree){
     /* Traverse the expression tree 'tree', and compute a 
@@ -156,944 +911,7564 @@ static int32_t ExTree_traverse(ExTree tree){
        are converted to ints with str_to_int() before being passed to
        ExP_eval(), thus essentially doing the exact opposite of the
        initial implementation.
-    */
-    if(tree->left == NULL && tree->right == NULL){
-        return str_to_int(tree->token);
-    }
-    else{
-        int32_t left = ExTree_traverse(tree->left); 
-        int32_t right = ExTree_traverse(tree->right);
-        int32_t res = ExP_eval(tree->token, left, right);
-        return res;
 
-    }
-}
+       && and || only evaluate their right operand when needed, and
+       c ? a : b only evaluates one of a and b.
 
-static char *ExTree_traverse_postorder(ExTree ex_tree, char **string_ref){
-    /* Traverse the expression tree ex_tree in post-order, building
-       a postfix expression, stored in *string_ref. 
-       
-       This modifies the string that string_ref points to back in caller space.
-       Thus the caller should mainting two pointers to its string: one to be modified 
-       by ExTree_traverse_post_order() and one kept intact, out of harm's way.
+       The tree is walked without recursion (see struct expression_tree_walk),
+       the values of the operands done so far being kept on a stack of their 
+       own. If memory for those stacks can't be allocated, that's recorded 
+       with ExCheck_fail(), and the result is 0.
     */
-    if (!ex_tree){
-        return NULL;
-    }
-    ExTree_traverse_postorder(ex_tree->left, string_ref);
-    ExTree_traverse_postorder(ex_tree->right, string_ref);
+    struct expression_tree_walk walk;
+    int32_t local_values[ExSpan_LOCAL];
+    int32_t *values = local_values;
+    uint32_t values_count = 0, values_size = ExSpan_LOCAL;
+
+    ExTree_walk_init(&walk, tree);
+    while (walk.count && !walk.failed){
+        // every step pushes at most one value
+        if (!ExSpan_reserve((void **)&values, local_values, &values_size, values_count + 1, sizeof(int32_t))){
+            walk.failed = true;
+            ExCheck_fail(ExP_ERROR_MEMORY, 0);
+            break;
+        }
+        struct expression_tree_frame *frame = &walk.frames[walk.count - 1];
+        ExTree node = frame->node;
 
-    // copy the token in the current tree node into the array
-    int32_t copied = str_copy(*string_ref, ex_tree->token);
-    // str_copy() returns the index in string_ref where it finished copying
-    // the token, +1; so if the token is 2 chars-long, the returned value will be
-    // 2, having copied one char into index0, one into index1, and stopped at 2,
-    // which is what it then returns
-    (*string_ref)+= copied;     // move to the next index available for subsequent insertions
+        switch (ExTree_opcode(node)){
+            case ExP_OP_LITERAL:
+                values[values_count++] = str_to_int(node->token);
+                walk.count--;
+                break;
 
-    // follow it with white space
-    *(*string_ref) = ' ';
-    (*string_ref)++;    // move forward in the string;
+            case ExP_OP_AND:
+            case ExP_OP_OR:
+            {
+                bool is_and = ExTree_opcode(node) == ExP_OP_AND;
+                if (frame->state == 0){
+                    frame->state = 1;
+                    ExTree_walk_push(&walk, node->left);
+                }
+                else if (frame->state == 1 && (is_and ? values[values_count - 1] : !values[values_count - 1])){
+                    // the right operand decides
+                    frame->state = 2;
+                    values_count--;
+                    ExTree_walk_push(&walk, node->right);
+                }
+                else{
+                    values[values_count - 1] = values[values_count - 1] != 0;
+                    walk.count--;
+                }
+                break;
+            }
 
-    // return a pointer in the newly formed expression, where the computing left off
-    // the whole expression ahs been computed. The caller should use this poimnter
-    // to insert a NULL there and terminate the string
-    return *string_ref;
-}
+            case ExP_OP_COND:
+            {
+                ExTree branches = node->right;
+                if (!branches->left || ExP_opcode(branches->token) != ExP_OP_ELSE){
+                    values[values_count++] = 0;     // a ? without its :
+                    walk.count--;
+                }
+                else if (frame->state == 0){
+                    frame->state = 1;
+                    ExTree_walk_push(&walk, node->left);
+                }
+                else{
+                    // the node is replaced with the branch taken
+                    *frame = (struct expression_tree_frame){values[--values_count] ? branches->left : branches->right, 0};
+                }
+                break;
+            }
 
+            case ExP_OP_CALL:
+            {
+                ExTree arguments[ExP_MAX_ARGUMENTS];
+                uint32_t count = ExCall_arguments(node->left, arguments);
 
-static char *ExTree_traverse_preorder(ExTree ex_tree, char **string_ref){
-    /* Traverse ex_tree in pre-order and build a char array based on its 
-       nodes. Since the traversal is pre-order, the result will be an
-       expression in prefix notation.
-       
-       This modifies the string that string_ref points to back in caller space.
-       Thus the caller should mainting two pointers to its string. 
+                // the arguments one at a time, then the call on their values
+                if (frame->state < count){
+                    ExTree_walk_push(&walk, arguments[frame->state++]);
+                    break;
+                }
+                values_count -= count;
+                values[values_count] = ExCall_apply(ExCall_lookup(node->token), &values[values_count], count);
+                values_count++;
+                walk.count--;
+                break;
+            }
+
+            default:
+                if (frame->state < 2){
+                    ExTree_walk_push(&walk, frame->state++ ? node->right : node->left);
+                    break;
+                }
+                values_count--;
+                values[values_count - 1] = ExP_eval(node->token, values[values_count - 1], values[values_count]);
+                walk.count--;
+                break;
+        }
+    }
+    int32_t result = (values_count && !walk.failed) ? values[0] : 0;
+
+    ExTree_walk_free(&walk);
+    if (values != local_values){
+        free(values);
+    }
+    return result;
+}
 
-       One to be modified by ExTree_traverse_preorder() and one kept intact,
-       out of harm's way.
+static void ExTree_traverse_postorder(ExTree ex_tree, ExSink sink){
+    /* Traverse the expression tree ex_tree in post-order, writing
+       a postfix expression to sink, one space-separated token at a time.
+       The walk doesn't recurse; if its stack can't be allocated, sink 
+       is marked as failed.
     */
-    if (!ex_tree){
-        return NULL;
+    struct expression_tree_walk walk;
+    ExTree_walk_init(&walk, ex_tree);
+
+    while (walk.count && !walk.failed){
+        struct expression_tree_frame *frame = &walk.frames[walk.count - 1];
+        ExTree node = frame->node;
+
+        // the operands first, then the token in the node itself
+        if (frame->state == 0 && node->left){
+            frame->state = 1;
+            ExTree_walk_push(&walk, node->left);
+        }
+        else if (frame->state < 2 && node->right){
+            frame->state = 2;
+            ExTree_walk_push(&walk, node->right);
+        }
+        else{
+            ExSink_token(sink, node->token);
+            walk.count--;
+        }
     }
+    sink->failed = sink->failed || walk.failed;
+    ExTree_walk_free(&walk);
+}
 
-    // copy the token in the current tree node into the array
-    int32_t copied = str_copy(*string_ref, ex_tree->token);
-    // str_copy() returns the index in string_ref where it finished copying
-    // the token, +1; so if the token is 2 chars-long, the returned value will be
-    // 2, having copied one char into index0, one into index1, and stopped at 2,
-    // which is what it then returns
-    (*string_ref)+= copied;     // move to the next index available for subsequent insertions
- 
 
-    // follow it with white space 
-    *(*string_ref) = ' ';
-    (*string_ref)++;    // move forward in the string;
+static void ExTree_traverse_preorder(ExTree ex_tree, ExSink sink){
+    /* Traverse ex_tree in pre-order, writing its nodes to sink. Since the 
+       traversal is pre-order, the result will be an expression in prefix notation.
+       As in ExTree_traverse_postorder(), the walk doesn't recurse.
+    */
+    struct expression_tree_walk walk;
+    ExTree_walk_init(&walk, ex_tree);
 
-    // return a pointer in the newly formed expression, where the computing left off
-    // the whole expression has been computed. The caller should decrement this pointer
-    // and insert a NULL there to terminate the string (i.e. the previous character is
-    // white space, and that's where the NUL should be inserted, since the string ends here)
-    ExTree_traverse_preorder(ex_tree->left, string_ref);
-    ExTree_traverse_preorder(ex_tree->right, string_ref);
+    while (walk.count && !walk.failed){
+        ExTree node = walk.frames[--walk.count].node;
 
-    return *string_ref;
+        // write the token in the current tree node, then its operands: the
+        // right one is pushed first, to come out last
+        ExSink_token(sink, node->token);
+        if (node->right){
+            ExTree_walk_push(&walk, node->right);
+        }
+        if (node->left){
+            ExTree_walk_push(&walk, node->left);
+        }
+    }
+    sink->failed = sink->failed || walk.failed;
+    ExTree_walk_free(&walk);
 }
 
 
 
-// declaration here because it's used in the following function; (defined in down below in
+// declarations here because they're used in the following functions; (defined in down below in
 // the file, in another section)
-static bool ExP_is_operator(char the_char);
-
-static char *ExTree_traverse_inorder(ExTree ex_tree, char **string_ref){
-    /* Traverse ex_tree in-order, building an infix expression stored in
-       *string_ref.
+static bool ExP_is_operator_token(char *token);
+static bool ExP_binds_tighter(char *operator1, char *operator2);
+
+static bool ExP_needs_parentheses(char *parent, char *child, bool is_right){
+    /* Determine whether, in infix, the operator child, the root of the left 
+       or right (is_right) operand of the operator parent, has to be put in 
+       parentheses with its operands, for the expression to parse back the 
+       same. That's the case when ExP_parse_infix() would otherwise group the
+       operators differently:
+       - an operator before parent keeps its operands, unless parent binds
+         tighter: 1 * 2 + 3, but (1 + 2) * 3
+       - an operator after parent only gets parent's right operand if it
+         binds tighter: 1 + 2 * 3, but 1 - (2 - 3) and 1 - (2 + 3)
+       The : of c ? a : b never needs them, being written in between its 
+       own operands.
+    */
+    if (child[0] == ':'){
+        return false;
+    }
+    if (is_right){
+        return !ExP_binds_tighter(child, parent);
+    }
+    return ExP_binds_tighter(parent, child);
+}
 
-       This modifies the string that string_ref points to back in caller space.
-       Thus the caller should mainting two pointers to its string. 
-       One to be modified by ExTree_traverse_preorder() and one kept intact,
-       out of harm's way.
+static bool ExTree_needs_parentheses(ExTree parent, ExTree child, bool is_right){
+    /* Determine whether ExTree_traverse_inorder() has to put child, the left
+       or right (is_right) operand of parent, in parentheses (see 
+       ExP_needs_parentheses()). Operands and function calls never need them.
     */
-    if (!ex_tree){
-        return NULL;
+    if (!child || !child->left || !child->right){
+        return false;
     }
+    return ExP_needs_parentheses(parent->token, child->token, is_right);
+}
 
-    // only insert parentheses if the current token is an operator 
-    // this bool will be checked twice below to determine the insertion of both
-    // the opening and the closing parenthesis
-    bool parentheses = false; 
-    parentheses = ExP_is_operator(ex_tree->token[0]);
+static void ExTree_traverse_inorder(ExTree ex_tree, ExSink sink){
+    /* Traverse ex_tree in-order, writing an infix expression to sink. 
+       Parentheses are only put where they're needed (see
+       ExTree_needs_parentheses()), so the expression parses back into
+       exactly the same tree.
+       As in ExTree_traverse_postorder(), the walk doesn't recurse: each
+       node is gone through three times, before, in between and after its
+       operands.
+    */
+    struct expression_tree_walk walk;
+    ExTree_walk_init(&walk, ex_tree);
+
+    while (walk.count && !walk.failed){
+        struct expression_tree_frame *frame = &walk.frames[walk.count - 1];
+        ExTree node = frame->node;
+
+        // a function call: the name, then its arguments (joined by the , nodes
+        // of the argument list) in parentheses
+        if (node->left && !node->right){
+            if (frame->state++ == 0){
+                ExSink_write(sink, node->token, str_len(node->token));
+                ExSink_write(sink, "(", 1);
+                ExTree_walk_push(&walk, node->left);
+            }else{
+                ExSink_write(sink, ")", 1);
+                walk.count--;
+            }
+            continue;
+        }
 
-    // copy the token in the current tree node into the array
-    if (parentheses){
-        *(*string_ref) = '(';
-        (*string_ref)++;    // move forward in the string;
-    }
-    ExTree_traverse_inorder(ex_tree->left, string_ref);
+        // each operand in parentheses only if needed; checked twice below to
+        // determine the insertion of both the opening and the closing parenthesis
+        bool left_parentheses = ExTree_needs_parentheses(node, node->left, false);
+        bool right_parentheses = ExTree_needs_parentheses(node, node->right, true);
 
-    // how many characters the token consisted of+1 (when the token string reached NULL,
-    // and the index stopped incrementing in str_copy())
-    int32_t copied = str_copy(*string_ref, ex_tree->token);
-    (*string_ref)+= copied;
+        switch (frame->state++){
+            case 0:
+                if (left_parentheses){
+                    ExSink_write(sink, "(", 1);
+                }
+                if (node->left){
+                    ExTree_walk_push(&walk, node->left);
+                }
+                break;
 
-    // return a pointer in the newly formed expression, where the computing left off
-    // the whole expression ahs been computed. The caller should use this poimnter
-    // to insert a NULL there and terminate the string
-    ExTree_traverse_inorder(ex_tree->right, string_ref);
+            case 1:
+                if (left_parentheses){
+                    ExSink_write(sink, ")", 1);
+                }
+                // x, the operator, gets spaces around it: next to a name, it would 
+                // become part of it ('2xa'). (A leaf is a number or a name, such as 'xb'.)
+                if (node->left && node->token[0] == 'x'){
+                    ExSink_write(sink, " x ", 3);
+                }else{
+                    ExSink_write(sink, node->token, str_len(node->token));
+                }
+                if (right_parentheses){
+                    ExSink_write(sink, "(", 1);
+                }
+                if (node->right){
+                    ExTree_walk_push(&walk, node->right);
+                }
+                break;
 
-    // add closing parenthesis as well (if parentheses is true)
-    if (parentheses){
-        *(*string_ref) = ')';
-        (*string_ref)++;
+            default:
+                if (right_parentheses){
+                    ExSink_write(sink, ")", 1);
+                }
+                walk.count--;
+                break;
+        }
     }
-
-    return *string_ref;
+    sink->failed = sink->failed || walk.failed;
+    ExTree_walk_free(&walk);
 }
 
 
 
-static void ExTree_cut_down(ExTree tree){
-    /* Recursively free all memory allocated to tree.
-
-       Meant to be called by ExTree_destroy().
+static bool ExTree_measure(ExTree tree, uint32_t *token_chars, uint32_t *nodes, uint32_t *parentheses){
+    /* Add to *token_chars the combined length of all the tokens in tree,
+       to *nodes the number of nodes, and to *parentheses the number of
+       pairs of parentheses (or of spaces, around x) ExTree_traverse_inorder()
+       writes: one per function call, and one per operand that needs them.
+       This is everything needed to know the exact size of the strings 
+       ExTree_traverse_preorder(), _inorder() and _postorder() write.
+       The walk doesn't recurse: return false if its stack couldn't be 
+       allocated (recorded with ExCheck_fail()).
     */
-    if (tree == NULL){
-        return;
-    }
-    ExTree_cut_down(tree->left);
-    ExTree_cut_down(tree->right);
+    struct expression_tree_walk walk;
+    ExTree_walk_init(&walk, tree);
+
+    while (walk.count && !walk.failed){
+        ExTree node = walk.frames[--walk.count].node;
 
-    free(tree);
-    return;
+        *token_chars += str_len(node->token);
+        (*nodes)++;
+        if (node->left && !node->right){
+            (*parentheses)++;
+        }
+        else if (node->left){
+            *parentheses += ExTree_needs_parentheses(node, node->left, false) + \
+                            ExTree_needs_parentheses(node, node->right, true) + (node->token[0] == 'x');
+        }
+        if (node->left){
+            ExTree_walk_push(&walk, node->left);
+        }
+        if (node->right){
+            ExTree_walk_push(&walk, node->right);
+        }
+    }
+    ExTree_walk_free(&walk);
+    return !walk.failed;
 }
 
 
-static void ExTree_destroy(ExTreeWrapper *tree_wrapper_ref){
-    /* Free all heap memory associated with *tree_wrapper_ref
-       then set tree_wrapper_ref to NULL.
-    */
-    if (tree_wrapper_ref == NULL){  // nothing to do
-        return;
+static void ExTree_write(ExTree tree, ex_targets TARGET, ExSink sink){
+    /* Write tree to sink in the one notation in TARGET */
+    switch (TARGET){
+        case ExP_TO_PREFIX:
+            ExTree_traverse_preorder(tree, sink);
+            break;
+
+        case ExP_TO_INFIX:
+            ExTree_traverse_inorder(tree, sink);
+            break;
+
+        default:
+            ExTree_traverse_postorder(tree, sink);
+            break;
     }
-    if (*tree_wrapper_ref == NULL){
-        tree_wrapper_ref = NULL;
-        return;
+}
+
+
+
+// declaration here because it's used by the rebalancing functions below; defined
+// further down, in the ExP section
+static char ExP_chain_operator(char *token);
+
+// ditto, used by the ExProgram functions further down
+static uint8_t ExP_opcode(char *operator);
+static int32_t ExP_apply(uint8_t opcode, int32_t left_operand, int32_t right_operand);
+static int32_t ExP_power(int32_t base, int32_t exponent);
+
+static uint32_t ExTree_chain_length(ExTree tree, char chain_op){
+    /* Return the number of operands in the chain of chain_op operators rooted
+       at tree. An operand is any subtree whose root is not chain_op.
+       E.g. for 1 + 2 + (3 * 4) + 5 there are 4 operands: 1, 2, (3*4) and 5.
+
+       The chain is walked without recursion, its operators on a stack that
+       stays shallow for left-deep chains (those ExP_parse_postfix() builds)
+       and right-deep ones alike. Return 0 if memory for it couldn't be 
+       allocated.
+    */
+    struct expression_tree_walk walk;
+    uint32_t count = 0;
+
+    ExTree_walk_init(&walk, tree);
+    while (walk.count && !walk.failed){
+        ExTree node = walk.frames[--walk.count].node;
+        if (ExP_chain_operator(node->token) != chain_op){
+            count++;
+            continue;
+        }
+        ExTree_walk_push(&walk, node->right);
+        ExTree_walk_push(&walk, node->left);
     }
-    else{
-        ExTree_cut_down((*tree_wrapper_ref)->expression_tree);
-        free((*tree_wrapper_ref)->expression_string);
-        free(*tree_wrapper_ref);
-        
-        *tree_wrapper_ref = NULL;
+    ExTree_walk_free(&walk);
+
+    return walk.failed ? 0 : count;
+}
+
+
+static bool ExTree_collect_chain(ExTree tree, char chain_op, ExTree operands[], uint32_t *operand_count,
+                                 ExTree nodes[], uint32_t *node_count){
+    /* Flatten the chain of chain_op operators rooted at tree.
+       The operands are stored in operands[], in the same left-to-right order
+       they appear in the expression, and the operator nodes themselves are
+       stored in nodes[] so that ExTree_build_balanced() can reuse them rather
+       than allocating new ones. The order of nodes[] is irrelevant.
+       Walked as in ExTree_chain_length(); return false if memory for that
+       couldn't be allocated.
+    */
+    struct expression_tree_walk walk;
+
+    ExTree_walk_init(&walk, tree);
+    while (walk.count && !walk.failed){
+        ExTree node = walk.frames[--walk.count].node;
+        if (ExP_chain_operator(node->token) != chain_op){
+            operands[(*operand_count)++] = node;
+            continue;
+        }
+        nodes[(*node_count)++] = node;
+        // the left operand is taken off the stack first
+        ExTree_walk_push(&walk, node->right);
+        ExTree_walk_push(&walk, node->left);
     }
+    ExTree_walk_free(&walk);
+
+    return !walk.failed;
 }
 
 
+static ExTree ExTree_build_balanced(ExTree operands[], uint32_t low, uint32_t high,
+                                    ExTree nodes[], uint32_t *nodes_left){
+    /* Build a balanced tree over operands[low, high), taking the operator
+       nodes to use from the top of nodes[]. Operand order is preserved, so
+       only associativity (not commutativity) is relied upon. (The recursion
+       is only as deep as the balanced tree.)
+    */
+    if (high - low == 1){
+        return operands[low];
+    }
+    uint32_t middle = low + (high - low) / 2;
+    ExTree tree = nodes[--(*nodes_left)];
 
-/*               * * * ExP functions * * *                         */
+    tree = ExTree_insert_left(tree, ExTree_build_balanced(operands, low, middle, nodes, nodes_left));
+    tree = ExTree_insert_right(tree, ExTree_build_balanced(operands, middle, high, nodes, nodes_left));
+    return tree;
+}
 
 
-static bool ExP_is_operator(char the_char){
-    /* Determine whether the_char is an operator.
-       If it is, return true, else false.
+static bool ExTree_rebalance_chain(ExTree *place, char chain_op){
+    /* Rebalance the chain of chain_op operators at *place (see 
+       ExTree_rebalance()), storing the new root there. Return false,
+       leaving the chain as it is, if memory couldn't be allocated.
     */
-    switch(the_char){
-        case '+':
-            return true;
-            break;  // not needed
+    uint32_t length = ExTree_chain_length(*place, chain_op);
+    ExTree *operands = length ? malloc(sizeof(ExTree) * length) : NULL;
+    ExTree *nodes = length ? malloc(sizeof(ExTree) * length) : NULL;
+    uint32_t operand_count = 0;
+    uint32_t node_count = 0;
+
+    bool collected = operands && nodes && \
+                     ExTree_collect_chain(*place, chain_op, operands, &operand_count, nodes, &node_count);
+    if (collected){
+        *place = ExTree_build_balanced(operands, 0, operand_count, nodes, &node_count);
+    }
+    free(operands);
+    free(nodes);
+    return collected;
+}
 
-        case '-':
-            return true;
-            break;
 
-        case '*':
-        case 'x':
-            return true;
-            break;
+static ExTree ExTree_rebalance(ExTree tree){
+    /* Reassociate every chain of the same associative operator (+, or * and x)
+       in tree into a balanced tree and return the new root.
+       E.g. ((((1+2)+3)+4)+5) becomes ((1+2)+(3+(4+5))): the depth of a chain
+       of n operands drops from n-1 to log2(n).
 
-        case '/':
-            return true;
-            break;
+       No nodes are allocated or freed, the existing operator nodes are
+       relinked. Since ExP_eval() does + and * in wrapping (mod 2^32)
+       arithmetic, the result is exactly the same as for the original tree,
+       overflow included.
 
-        case '^':
-            return true;
-            break;
+       There's no recursion: a stack holds the places (the root, or a child
+       of a node) of the subtrees left to rebalance. Rebalancing is only an
+       optimization: if memory can't be allocated, the rest of the tree is
+       left as it is.
+    */
+    ExTree root = tree;
+    ExTree *local_places[ExSpan_LOCAL];
+    ExTree **places = local_places;
+    uint32_t count = 0, size = ExSpan_LOCAL;
+    places[count++] = &root;
+
+    while (count){
+        ExTree *place = places[--count];
+        ExTree node = *place;
+        if (!node || (node->left == NULL && node->right == NULL)){
+            continue;
+        }
 
-        // for the purposes of parsing infix expressions, the parenthesis
-        // is considered an operator and so true is returned upon testing
-        case '(':
-        case ')':
-            return true;
+        char chain_op = ExP_chain_operator(node->token);
+        if (!chain_op){
+            // not an associative operator: nothing to reassociate here, but there
+            // may be chains further down
+            if (!ExSpan_reserve((void **)&places, local_places, &size, count + 2, sizeof(ExTree *))){
+                break;
+            }
+            places[count++] = &node->right;
+            places[count++] = &node->left;
+            continue;
+        }
+        if (!ExTree_rebalance_chain(place, chain_op)){
             break;
+        }
 
-        default:
-            return false;
+        // the operands can themselves contain chains of some other operator:
+        // they're the children of the chain's nodes that aren't chain nodes
+        struct expression_tree_walk walk;
+        ExTree_walk_init(&walk, *place);
+        while (walk.count && !walk.failed){
+            ExTree chain_node = walk.frames[--walk.count].node;
+            ExTree *children[2] = {&chain_node->left, &chain_node->right};
+
+            for (uint32_t i = 0; i < 2 && !walk.failed; i++){
+                if (ExP_chain_operator((*children[i])->token) == chain_op){
+                    ExTree_walk_push(&walk, *children[i]);
+                }
+                else if (!ExSpan_reserve((void **)&places, local_places, &size, count + 1, sizeof(ExTree *))){
+                    walk.failed = true;
+                }
+                else{
+                    places[count++] = children[i];
+                }
+            }
+        }
+        ExTree_walk_free(&walk);
+        if (walk.failed){
             break;
+        }
+    }
+    if (places != local_places){
+        free(places);
     }
+    return root;
 }
 
 
 
-static uint8_t ExP_get_precedence(char *operator){
-    /*Look up the precedence for operator, and return that. 
-      Meant to be called from ExP_has_higher_precedence().
+static void ExTree_cut_down(ExTree tree){
+    /* Free all memory allocated to tree.
 
+       Meant to be called by ExTree_destroy().
+       No recursion, and no stack either, however deep the tree: whenever
+       the root has a left child, the tree is rotated right, until it has
+       none; then it's freed and its right child is next.
     */
-    uint8_t precedence = 0;
-    switch (operator[0]){
+    while (tree){
+        if (tree->left){
+            ExTree left = tree->left;
+            tree->left = left->right;
+            left->right = tree;
+            tree = left;
+            continue;
+        }
+        ExTree right = tree->right;
+        free(tree);
+        tree = right;
+    }
+}
 
-        case '+':
-        case '-':
-            precedence = 1;
-            break;
 
-        case '*':
-        case 'x':
-        case '/':
-            precedence = 2;
-            break;
+static void ExTree_destroy(ExTreeWrapper *tree_wrapper_ref){
+    /* Free all heap memory associated with *tree_wrapper_ref
+       then set tree_wrapper_ref to NULL.
+    */
+    if (tree_wrapper_ref == NULL){  // nothing to do
+        return;
+    }
+    if (*tree_wrapper_ref == NULL){
+        tree_wrapper_ref = NULL;
+        return;
+    }
+    else{
+        ExP_phase(ExP_PHASE_DESTROY, 1);
+        ExTree_cut_down((*tree_wrapper_ref)->expression_tree);
+        free((*tree_wrapper_ref)->expression_string);
+        ExP_phase(ExP_PHASE_DESTROY, 0);
 
-        case '^':
-            precedence = 3;
-            break;
+        // the parts' trees are already gone, cut down with the whole tree
+        for (uint32_t i = 0; i < (*tree_wrapper_ref)->part_count; i++){
+            (*tree_wrapper_ref)->parts[i]->expression_tree = NULL;
+            ExTree_destroy(&(*tree_wrapper_ref)->parts[i]);
+        }
+        free((*tree_wrapper_ref)->parts);
+        free(*tree_wrapper_ref);
+        
+        *tree_wrapper_ref = NULL;
     }
-    return precedence;
 }
 
 
-static bool ExP_has_higher_precedence(char *operator1, char *operator2){
-    /* Return true if operator1 has higher precedence than operator2,
-       else false.
+
+/*               * * * ExDag functions * * *                         */
+
+
+static uint32_t ExTree_count_nodes(ExTree tree){
+    /* Return the number of nodes in tree, walked without recursion; 0 if 
+       memory for the walk couldn't be allocated
     */
-    return (ExP_get_precedence(operator1) > ExP_get_precedence(operator2)) ? true : false;
+    struct expression_tree_walk walk;
+    uint32_t count = 0;
+
+    ExTree_walk_init(&walk, tree);
+    while (ExTree_walk_next(&walk)){
+        count++;
+    }
+    ExTree_walk_free(&walk);
+
+    return walk.failed ? 0 : count;
 }
 
 
-static bool ExP_has_same_precedence(char *operator1, char *operator2){
-    /* Return true if operator1 and operator2 have the same precedence,
-       lse otherwise.
+static uint32_t ExDag_hash(uint8_t opcode, uint32_t left, uint32_t right, int32_t literal){
+    /* Mix the contents of a node into a 32-bit hash.
+       (multiply-xorshift mixing, as in the murmur3 finalizer)
     */
-    return (ExP_get_precedence(operator1) == ExP_get_precedence(operator2)) ? true : false;
+    uint32_t hash = opcode;
+    hash = hash * 0x9E3779B1u ^ left;
+    hash = hash * 0x9E3779B1u ^ right;
+    hash = hash * 0x9E3779B1u ^ (uint32_t)literal;
+    hash ^= hash >> 16;
+    hash *= 0x85EBCA6Bu;
+    hash ^= hash >> 13;
+    hash *= 0xC2B2AE35u;
+    hash ^= hash >> 16;
+    return hash;
 }
 
 
+static uint32_t ExDag_intern(ExDag dag, uint8_t opcode, uint32_t left, uint32_t right, int32_t literal){
+    /* Look up the node (opcode, left, right, literal) in dag and return its id.
+       If there's no such node yet, add it first.
+    */
+    uint32_t slot = ExDag_hash(opcode, left, right, literal) & dag->table_mask;
 
+    while (dag->table[slot]){
+        struct expression_dag_node *node = &dag->nodes[dag->table[slot] - 1];
 
-static int32_t ExP_eval(char *operator, int32_t left_operand, int32_t right_operand){
-// PV: static char *ExP_eval(char *operator, char *left_operand, char *right_operand)
-    /* Evaluate the expression consisting of the two operands and
-       operator and return the result.
-    
-       The operands are int32_t integers. The calling function has to convert its
-       data, if it's in char-array format instead, to int32_t types by calling
-       str_to_int().
-    */
-    int32_t result;
-    switch (operator[0]){
-        case '+':
-            result = left_operand + right_operand; 
-            //PV: result = str_to_int(left_operand) + str_to_int(right_operand); 
-            break;  
+        if (node->opcode == opcode && node->left == left && \
+                node->right == right && node->literal == literal){
+            dag->deduplicated++;
+            return dag->table[slot] - 1;
+        }
+        slot = (slot + 1) & dag->table_mask;    // linear probing
+    }
 
-        case '-':
-            result = left_operand - right_operand; 
-            break;
+    uint32_t id = dag->count++;
+    dag->nodes[id].opcode = opcode;
+    dag->nodes[id].left = left;
+    dag->nodes[id].right = right;
+    dag->nodes[id].literal = literal;
+    dag->table[slot] = id + 1;
 
-        case '*':
-        case 'x':
-            result = left_operand * right_operand; 
-            break;
+    return id;
+}
 
-        case '/':
-            result = left_operand / right_operand; 
-            break;
 
-        case '^':   // exponentiation
-            result = left_operand << right_operand; 
+static bool ExDag_build(ExDag dag, ExTree tree){
+    /* Hash-cons tree into dag, bottom-up: its root is the last node added.
+       Operands are keyed by their value, operators by their opcode
+       ('*' and 'x' are the same) and the ids of their children -- so two 
+       subtrees get the same id if and only if they're structurally identical.
+       Function calls are keyed by the id of their argument list and the
+       id of the function, stored in 'right'.
 
-        default:
-            return false;
+       The tree is walked in post-order without recursion, the ids of the
+       subtrees done so far kept on a stack. Return false if memory for the
+       walk couldn't be allocated.
+    */
+    struct expression_tree_walk walk;
+    uint32_t local_ids[ExSpan_LOCAL];
+    uint32_t *ids = local_ids;
+    uint32_t count = 0, size = ExSpan_LOCAL;
+
+    ExTree_walk_init(&walk, tree);
+    for (ExTree node = ExTree_walk_next(&walk); node; node = ExTree_walk_next(&walk)){
+        if (!ExSpan_reserve((void **)&ids, local_ids, &size, count + 1, sizeof(uint32_t))){
+            walk.failed = true;
             break;
+        }
+        if (node->left == NULL && node->right == NULL){
+            ids[count++] = ExDag_intern(dag, ExP_OP_LITERAL, 0, 0, str_to_int(node->token));
+        }
+        else if (!node->right){
+            ids[count - 1] = ExDag_intern(dag, ExP_OP_CALL, ids[count - 1], (uint32_t)ExCall_lookup(node->token), 0);
+        }
+        else{
+            count--;
+            ids[count - 1] = ExDag_intern(dag, ExP_opcode(node->token), ids[count - 1], ids[count], 0);
+        }
     }
-     // PV: return str_from_int(result);
-    return result;
+    ExTree_walk_free(&walk);
+    if (ids != local_ids){
+        free(ids);
+    }
+    return !walk.failed;
+}
+
+
+static void ExDag_destroy(ExDag *dag_ref){
+    /* Free all heap memory associated with *dag_ref,
+       then set *dag_ref to NULL.
+    */
+    if (dag_ref == NULL || *dag_ref == NULL){
+        return;
+    }
+    free((*dag_ref)->nodes);
+    free((*dag_ref)->values);
+    free((*dag_ref)->table);
+    free(*dag_ref);
 
+    *dag_ref = NULL;
 }
 
-static char *ExP_refine(char *unformatted, ex_notation NOTATION){
-    /* Copy the contents from the unformatted array into another array,
-       allocated dynamically, but add whitespace around the operator
-       tokens as needed.
 
-       Return this 'refined' array to the caller for safe parsing.
-       Called to 'sanitize' the input to be fed to ExP_tokenize().
+static ExDag ExDag_new(ExTree tree){
+    /* Build a hash-consed DAG out of tree and return it.
+       tree itself is left untouched; it can be destroyed independently.
+
+       Return NULL if memory couldn't be allocated, or if tree has any of 
+       the lazily-evaluated operators && || ?: -- a DAG evaluates every
+       node, and a node shared with a branch that isn't taken couldn't be
+       skipped anyway.
     */
-    int32_t size = 2*str_len(unformatted);
-    char *refined = calloc(size, sizeof(char));     // allocate and initialize everything to 0
-        if (!refined){
+    ExDag dag = calloc(1, sizeof(struct expression_dag));
+    if (!dag){
+        return NULL;
+    }
+    uint32_t tree_nodes = ExTree_count_nodes(tree);
+    if (!tree_nodes){
+        ExDag_destroy(&dag);
+        return NULL;
+    }
+
+    // keep the table at most half full
+    uint32_t table_size = 1;
+    while (table_size < 2 * tree_nodes){
+        table_size <<= 1;
+    }
+    dag->table_mask = table_size - 1;
+    dag->table = calloc(table_size, sizeof(uint32_t));
+    dag->nodes = malloc(sizeof(struct expression_dag_node) * tree_nodes);
+    dag->values = malloc(sizeof(int32_t) * tree_nodes);
+
+    if (!dag->table || !dag->nodes || !dag->values){
+        ExDag_destroy(&dag);
+        return NULL;
+    }
+    if (!ExDag_build(dag, tree)){
+        ExDag_destroy(&dag);
+        return NULL;
+    }
+
+    // the table is only needed while building
+    free(dag->table);
+    dag->table = NULL;
+
+    for (uint32_t i = 0; i < dag->count; i++){
+        uint8_t opcode = dag->nodes[i].opcode;
+        if (opcode == ExP_OP_AND || opcode == ExP_OP_OR || opcode == ExP_OP_COND || opcode == ExP_OP_ELSE){
+            ExDag_destroy(&dag);
             return NULL;
         }
+    }
 
-    uint32_t ind_refined = 0;   // track the position in the 'refined' array
-    refined[ind_refined] = '\0';    // initialize to NUL
+    return dag;
+}
 
 
-    for (uint32_t i = 0; unformatted[i] != '\0'; i++){
+static int32_t ExDag_evaluate(ExDag dag){
+    /* Evaluate dag and return the result.
+       Since the nodes are stored children-first, a single pass over the
+       array computes every distinct subexpression exactly once; a node shared
+       by several parents is computed once and its memoized value reused.
+    */
+    for (uint32_t i = 0; i < dag->count; i++){
+        struct expression_dag_node *node = &dag->nodes[i];
 
-        if(unformatted[i] == ' '){
-            // don't add space if there's one just before
-            if (ind_refined > 0 && refined[ind_refined-1] != ' '){     // if the previous char is not whitespace
-                refined[ind_refined] = ' ';     // then add whitespace here
-                ind_refined++;
-            }
+        if (node->opcode == ExP_OP_LITERAL){
+            dag->values[i] = node->literal;
         }
-
-        // if current is operator or parenthesis, make sure it has white space before and
-        // after
-        else if(ExP_is_operator(unformatted[i]) || \
-                (unformatted[i] == '(' || unformatted[i] == ')')
-                ){
-            //add space before it if there's no space at that index in the array already
-            //added. no out-of-bounds error can occur since the left-most element is 
-            //always an operand in a valid postfix expression 
-            // edit: it will crash, of course, if it's a prefix expression, since the
-            // first char is an operator there
-            if (ind_refined > 0 && refined[ind_refined-1] != ' '){
-                refined[ind_refined] = ' ';
-                ind_refined++;
+        else if (node->opcode == ExP_OP_CALL){
+            // the values of the arguments, collected going up the , chain
+            int32_t arguments[ExP_MAX_ARGUMENTS];
+            uint32_t count = 1;
+            for (uint32_t list = node->left; dag->nodes[list].opcode == ExP_OP_ARGS; list = dag->nodes[list].left){
+                count++;
             }
-            refined[ind_refined] = unformatted[i];
-            //add a space after it as well
-            refined[ind_refined+1] = ' ';
-            ind_refined += 2;
+            uint32_t list = node->left;
+            for (uint32_t j = count - 1; j > 0; j--){
+                arguments[j] = dag->values[dag->nodes[list].right];
+                list = dag->nodes[list].left;
+            }
+            arguments[0] = dag->values[list];
+
+            dag->values[i] = ExCall_apply(node->right, arguments, count);
         }
-            // if it's not whitespace or an operator, insert it as it is. 
-            // this counts on the input being an otherwise valid expression and not
-            // containing non-numeric character and whatnot
         else{
-            refined[ind_refined] = unformatted[i];
-            ind_refined++;
+            dag->values[i] = ExP_apply(node->opcode, dag->values[node->left], dag->values[node->right]);
         }
-
-    } 
-    // postfix expressions always end with an operator, so white space will be added after
-    // it, and the index in the array incremented to after that newly-added space. 
-    // ind-refined-1 below thus refers to the white space. Set it to null, since the
-    // expression ends here.
-    if (NOTATION == POSTFIX){
-        refined[ind_refined-1] = '\0';
     }
-    return refined;
+    return dag->values[dag->count - 1];
 }
 
 
-static char *ExP_tokenize(char string_arg[], char delimiter){
-    /* Return the next token in string_arg when called.
 
-       A token is a substring delimitated by delimiter.
-       e.g. 'my_name_is_x' has 4 tokens and 3 delimiter
-       instances..
+/*               * * * ExProgram functions * * *                         */
 
-       The initial call to the function has to specify the 
-       string to tokenize. After that, unless another string
-       needs to be tokenized, the function is called with NULL
-       as the first argument, to indicate that it should continue
-       tokenizing the same string.
 
-       The function maintains internal state by using static variables.
-       Since the whole input string is not tokenized at once, but bit by
-       bit with each call, this is a form of lazy evaluation.
+static ExProgram ExProgram_new(uint32_t count){
+    /* Allocate an ExProgram with room for count nodes, in a single heap block
+       (see struct expression_program).
+       Return NULL if memory couldn't be allocated.
     */
+    // the 32-bit arrays go first, right after the struct, so they're all aligned;
+    // the byte-sized opcodes go last
+    size_t size = sizeof(struct expression_program) + \
+                  (size_t)count * (3 * sizeof(uint32_t) + sizeof(uint8_t));
+    ExProgram program = malloc(size);
+    if (!program){
+        return NULL;
+    }
+    program->count = 0;
+    program->divisors = NULL;
+    program->inputs = NULL;
+    program->left = (uint32_t *)(program + 1);
+    program->right = program->left + count;
+    program->values = (int32_t *)(program->right + count);
+    program->opcodes = (uint8_t *)(program->values + count);
+
+    return program;
+}
 
-    // static variables, only initialized when string_arg is not NULL 
-    static char *input_string;
-    static char *token;    // a pointer to the next token found;
-    static int32_t index;
-    static char *res;
 
-    // if string_arg is not NULL, (re) initialize the static variables (internal state)
-     if (string_arg){
-        input_string = string_arg;
-        token = input_string;
-        index = 0;
-        res = NULL;
-     }
-   
+static uint32_t ExProgram_emit(ExProgram program, uint8_t opcode, uint32_t left, uint32_t right){
+    /* Append a node to program and return its index */
+    uint32_t index = program->count++;
+    program->opcodes[index] = opcode;
+    program->left[index] = left;
+    program->right[index] = right;
 
-    while(input_string[index] != '\0'){
-        if (input_string[index] == delimiter){
-            res = token; 
-            input_string[index] = '\0';  // replace the delimiter with a NUL, to terminate the string (token) here
-            token = &input_string[index+1]; // make token point to the first char after NULL
-            index++;
+    return index;
+}
 
-            return res;
-        }
-        index++;
-    }
-    // the loop is exhausted; last token -> return it
-    // NOTE: what's left here is the rest of the original input string from after the last token
-    // until the final Nul
 
-    // return this last bit
-    res = token;
-    // then set token to null, so that on the next call the reurn value is null
-    token = NULL;
-    return res;
+static uint32_t ExProgram_emit_literal(ExProgram program, int64_t literal){
+    /* Append an operand node with the value literal to program and return its index.
+       The value is split into two 32-bit halves, stored in left and right.
+    */
+    return ExProgram_emit(program, ExP_OP_LITERAL, (uint32_t)(uint64_t)literal, \
+                          (uint32_t)((uint64_t)literal >> 32));
 }
 
 
+static int64_t ExProgram_literal(ExProgram program, uint32_t index){
+    /* Return the value of the operand node at index */
+    return (int64_t)(((uint64_t)program->right[index] << 32) | program->left[index]);
+}
 
-static ExTreeWrapper ExP_parse_postfix(char postfix_expression[]){
-    /* Parse postfix_expression and build an expression 
-       tree out of it. Wrap the expression tree inside
-       an ExTreeWrapper, and return that.
 
-       postfix_expression is assumed to be a valid 
-       expression in polish postfix notation. The first
-       character is always an operand and the last character
-       is always an operator. 
-       
-       Blank spaces are used to separate operands. I.e.
-       '374+' is not a valid expression, since it could be
-       either 37+4 or 3+74, depending on how the parsing is
-       done. '3 7+' and '3 7 +', on the other hand, are both
-       valid expressins. Spaces are necessary between operands,
-       but not necessary between operators or an operator and an
-       operand. 
+static bool ExProgram_is_conditional(ExTree tree){
+    /* Determine whether tree is a well-formed c ? a : b */
+    return ExTree_opcode(tree) == ExP_OP_COND && tree->right->left && \
+           ExP_opcode(tree->right->token) == ExP_OP_ELSE;
+}
 
-       The postfix_expression argument is a string, and as such
-       it has to be Nul-terminated, or it's not valid input.
+
+static uint32_t ExProgram_count_nodes(ExTree tree){
+    /* Return the number of nodes ExProgram_emit_tree() emits for tree: one
+       per tree node, plus the control flow nodes of && || and ?:
+       The tree is walked without recursion; return 0 if memory for that
+       couldn't be allocated.
     */
-    Stack operands_stack;
-    Stack_init(&operands_stack);
+    struct expression_tree_walk walk;
+    uint32_t count = 0;
+
+    ExTree_walk_init(&walk, tree);
+    for (ExTree node = ExTree_walk_next(&walk); node; node = ExTree_walk_next(&walk)){
+        count++;
+        if (!node->right){      // an operand, or a function call
+            continue;
+        }
+        uint8_t opcode = ExP_opcode(node->token);
+
+        if (opcode == ExP_OP_AND || opcode == ExP_OP_OR){
+            count += 1;
+        }
+        else if (ExProgram_is_conditional(node)){
+            count += 2;
+        }
+    }
+    ExTree_walk_free(&walk);
 
-    postfix_expression = ExP_refine(postfix_expression, POSTFIX); 
+    return walk.failed ? 0 : count;
+}
 
-    // ExTree wrapper with a pointer to an exp tree and a pointer to the expression char
-    // array it's based on -- tracks both for deallocation purposes
-    ExTreeWrapper tree_wrapper;
-    ExTree_init(&tree_wrapper, postfix_expression);
 
-    ExTree result = NULL;
-    char *current = ExP_tokenize(postfix_expression, ' ');
+static bool ExProgram_emit_tree(ExProgram program, ExTree tree){
+    /* Append the nodes of tree to program, in post-order: its root last.
 
-    while(current){
-        // current is an operand
-        if(!ExP_is_operator(current[0])){
-            // make current a new tree with no children
-            ExTree new = ExTree_new(current);
-            
-            // push this new childless tree onto the stack
-            StackItem operand = Stack_make_item(new);
-            Stack_push(operands_stack, operand);
+       For && and ||, a skip node after the left operand jumps over the right 
+       one when it's not needed. c ? a : b becomes
+            c, SKIP_FALSE(c) to b, a, JUMP to the : node, b, :(a, b), ?(c, :)
+       so only one of a and b is evaluated.
 
-            current = ExP_tokenize(NULL, ' '); 
+       The tree is walked without recursion (see struct expression_tree_walk),
+       the indices of the nodes emitted that are still to be used as operands
+       (or patched, for the skips and jumps) being kept on a stack of their 
+       own. Return false if memory for those stacks couldn't be allocated.
+    */
+    struct expression_tree_walk walk;
+    uint32_t local_indices[ExSpan_LOCAL];
+    uint32_t *indices = local_indices;
+    uint32_t count = 0, size = ExSpan_LOCAL;
+
+    ExTree_walk_init(&walk, tree);
+    while (walk.count && !walk.failed){
+        // every step pushes at most one index
+        if (!ExSpan_reserve((void **)&indices, local_indices, &size, count + 1, sizeof(uint32_t))){
+            walk.failed = true;
+            ExCheck_fail(ExP_ERROR_MEMORY, 0);
+            break;
         }
-        else{   // current is an operator, compute
-            // make a new tree with the operator as the key and 
-            // the two operands as its children
-            ExTree new_tree = ExTree_new(current);
-            // get the children from the stack
-            ExTree right_operand = Stack_pop(operands_stack);
-            ExTree left_operand = Stack_pop(operands_stack);
-            
-            // assign the children to the parent tree
-            new_tree = ExTree_insert_right(new_tree, right_operand);
-            new_tree = ExTree_insert_left(new_tree, left_operand);
-            result = new_tree;
+        struct expression_tree_frame *frame = &walk.frames[walk.count - 1];
+        ExTree node = frame->node;
+        uint8_t opcode = ExTree_opcode(node);
 
-            // push the tree onto the stack
-            StackItem new = Stack_make_item(new_tree);
-            Stack_push(operands_stack, new);
+        if (opcode == ExP_OP_LITERAL){
+            indices[count++] = ExProgram_emit_literal(program, str_to_int(node->token));
+            walk.count--;
+        }
+        else if (opcode == ExP_OP_CALL){
+            if (frame->state++ == 0){
+                ExTree_walk_push(&walk, node->left);
+                continue;
+            }
+            indices[count - 1] = ExProgram_emit(program, ExP_OP_CALL, indices[count - 1], \
+                                                (uint32_t)ExCall_lookup(node->token));
+            walk.count--;
+        }
+        else if (opcode == ExP_OP_AND || opcode == ExP_OP_OR){
+            // left, the skip, right
+            switch (frame->state++){
+                case 0:
+                    ExTree_walk_push(&walk, node->left);
+                    break;
+
+                case 1:
+                    indices[count] = ExProgram_emit(program, opcode == ExP_OP_AND ? ExP_OP_SKIP_FALSE : \
+                                                    ExP_OP_SKIP_TRUE, indices[count - 1], 0);
+                    count++;
+                    ExTree_walk_push(&walk, node->right);
+                    break;
+
+                default:
+                    count -= 2;
+                    program->right[indices[count]] = program->count;  // the && or || node itself
+                    indices[count - 1] = ExProgram_emit(program, opcode, indices[count - 1], indices[count + 1]);
+                    walk.count--;
+                    break;
+            }
+        }
+        else if (ExProgram_is_conditional(node)){
+            // the condition, the skip, the branch taken if true, the jump, the other branch
+            switch (frame->state++){
+                case 0:
+                    ExTree_walk_push(&walk, node->left);
+                    break;
+
+                case 1:
+                    indices[count] = ExProgram_emit(program, ExP_OP_SKIP_FALSE, indices[count - 1], 0);
+                    count++;
+                    ExTree_walk_push(&walk, node->right->left);
+                    break;
+
+                case 2:
+                    indices[count++] = ExProgram_emit(program, ExP_OP_JUMP, 0, 0);
+                    program->right[indices[count - 3]] = program->count;
+                    ExTree_walk_push(&walk, node->right->right);
+                    break;
+
+                default:
+                {
+                    count -= 4;
+                    program->right[indices[count + 2]] = program->count;
+                    uint32_t branches = ExProgram_emit(program, ExP_OP_ELSE, indices[count + 1], indices[count + 3]);
+                    indices[count - 1] = ExProgram_emit(program, ExP_OP_COND, indices[count - 1], branches);
+                    walk.count--;
+                    break;
+                }
+            }
+        }
+        else if (frame->state < 2){
+            ExTree_walk_push(&walk, frame->state++ ? node->right : node->left);
+        }
+        else{
+            // a ? without its : computes nothing, like a : by itself
+            count--;
+            indices[count - 1] = ExProgram_emit(program, opcode == ExP_OP_COND ? ExP_OP_ELSE : opcode, \
+                                                indices[count - 1], indices[count]);
+            walk.count--;
+        }
+    }
+    ExTree_walk_free(&walk);
+    if (indices != local_indices){
+        free(indices);
+    }
+    return !walk.failed;
+}
 
-            current = ExP_tokenize(NULL, ' '); 
+
+static ExProgram ExProgram_from_tree(ExTree tree){
+    /* Compile tree into an ExProgram and return it (NULL on allocation failure) */
+    uint32_t count = ExProgram_count_nodes(tree);
+    ExProgram program = count ? ExProgram_new(count) : NULL;
+    if (program && !ExProgram_emit_tree(program, tree)){
+        ExP_program_destroy(&program);
+    }
+    return program;
+}
+
+
+static ExProgram ExProgram_from_dag(ExDag dag){
+    /* Compile dag into an ExProgram and return it (NULL on allocation failure).
+       The DAG nodes are already stored children-first, so they map one-to-one
+       onto program nodes; shared nodes simply have several parents.
+    */
+    ExProgram program = ExProgram_new(dag->count);
+    if (!program){
+        return NULL;
+    }
+    for (uint32_t i = 0; i < dag->count; i++){
+        struct expression_dag_node *node = &dag->nodes[i];
+
+        if (node->opcode == ExP_OP_LITERAL){
+            ExProgram_emit_literal(program, node->literal);
+        }
+        else{
+            ExProgram_emit(program, node->opcode, node->left, node->right);
         }
     }
-    Stack_destroy(&operands_stack);
-    tree_wrapper->expression_tree = result; 
-    return tree_wrapper; 
+    return program;
 }
 
 
+static bool ExProgram_is_constant(ExProgram program, uint32_t index, int32_t *constant){
+    /* If the node at index is an operand, store its value in *constant
+       and return true, else return false.
+    */
+    if (program->opcodes[index] != ExP_OP_LITERAL){
+        return false;
+    }
+    *constant = (int32_t)ExProgram_literal(program, index);
+    return true;
+}
 
-static char *ExP_infix_shunt(char infix_exp[]){
-    /* Turn infix expression into a postfix expression
-       using the shunting-yard algorithm.
 
-       Once in postfix notation, this can either be returned as is,
-       if the request if for the conversion of an infix-notation
-       expression into a postfix-notation expression, 
-       or the postfix-notation functions can be called 
-       to deal with the newly-obtained postfix expression
-       in order to build a syntax tree out of it and/or
-       to convert it to a prefix-notation string.
-       
-       infix_expression is assumed to be a valid infix-notation
-       expression. 
-       Operands must be white-space separated, but there's no
-       such requirement between operands or an operand and 
-       and an operator or anything and parentheses.
+static uint8_t ExProgram_log2(int32_t constant){
+    /* Return k if constant is 2^k (k >= 0), or 0xFF if it's not a power of 2 */
+    if (constant <= 0 || (constant & (constant - 1))){
+        return 0xFF;
+    }
+    uint8_t k = 0;
+    while (constant > 1){
+        constant >>= 1;
+        k++;
+    }
+    return k;
+}
 
-       The infix_expression argument is a string, and as such
-       it has to be Nul-terminated, or it's not valid input.
-    
-       The value returned is a dynamically-allocated char array.
-       The caller is responsible for freeing it when no longer
-       needed.
+
+static void ExProgram_magic(int32_t divisor, struct expression_divisor *magic){
+    /* Compute the magic multiplier and shift for signed division by divisor,
+       with |divisor| >= 2: the smallest multiplier such that 
+       (multiplier * n) >> (32 + shift), corrected, is n / divisor for every 
+       int32_t n. See Hacker's Delight, chapter 10 ("Integer Division by 
+       Constants"), which this follows.
     */
-    Stack operators_stack;
-    Stack_init(&operators_stack);
-    
-    // string for str_tokenize() to operate on and modify; used as the 'input' string
-    char *refined_ex = ExP_refine(infix_exp, INFIX); 
-    // use infix_expression as the output string i.e. for writing the new, resultant postfix expression.
+    const uint32_t two31 = 0x80000000u;
+    uint32_t absolute = divisor < 0 ? -(uint32_t)divisor : (uint32_t)divisor;
+    uint32_t t = two31 + ((uint32_t)divisor >> 31);
+    uint32_t absolute_nc = t - 1 - t % absolute;
+
+    uint32_t p = 31;
+    uint32_t q1 = two31 / absolute_nc;      // 2^p / |nc|
+    uint32_t r1 = two31 - q1 * absolute_nc; // 2^p % |nc|
+    uint32_t q2 = two31 / absolute;         // 2^p / |divisor|
+    uint32_t r2 = two31 - q2 * absolute;    // 2^p % |divisor|
+    uint32_t delta;
+
+    do{
+        p++;
+        q1 *= 2;
+        r1 *= 2;
+        if (r1 >= absolute_nc){
+            q1++;
+            r1 -= absolute_nc;
+        }
+        q2 *= 2;
+        r2 *= 2;
+        if (r2 >= absolute){
+            q2++;
+            r2 -= absolute;
+        }
+        delta = absolute - r2;
+    }while (q1 < delta || (q1 == delta && r1 == 0));
 
-    // allocate memory for a new array, double the size of the string argument, to play it
-    // safe, since white space is going to be added
-    // this is what's going to be returned at the end
-    char *infix_expression = malloc(sizeof(char) * str_len(infix_exp) *2);
-    if (!infix_expression){
-        return NULL;
+    magic->magic = (int32_t)(q2 + 1);
+    if (divisor < 0){
+        magic->magic = (int32_t)(-(uint32_t)magic->magic);
     }
-    // index is used to track the current position in infix_expression (aforementioned)
-    char *index = infix_expression;
+    magic->shift = p - 32;
+
+    // when the multiplier overflowed into the sign bit (or the divisor is 
+    // negative and the multiplier isn't), the dividend has to be added 
+    // (subtracted) back in
+    if (divisor > 0 && magic->magic < 0){
+        magic->correction = 1;
+    }else if (divisor < 0 && magic->magic > 0){
+        magic->correction = -1;
+    }else{
+        magic->correction = 0;
+    }
+}
 
-    char *current = ExP_tokenize(refined_ex, ' ');
 
-    ////////////////////////////// PARSE ///////////////////////////
+static void ExProgram_specialize(ExProgram program){
+    /* Strength reduction: replace the operators that have a constant right
+       operand with cheaper specialized versions:
+       - n / 2^k becomes a shift, corrected so that it rounds towards 0
+       - n / d, for any other constant d other than 0 and -1, becomes a
+         multiplication by a magic reciprocal (ExProgram_magic())
+       - n * 2^k (or 2^k * n) becomes a shift
+       - n ^ e, for a constant e >= 0, becomes ExP_OP_POW_CONST, with the 
+         common small exponents unrolled
 
-    while(current != NULL){
-        // current is an operand, copy it to the output
-        if(!ExP_is_operator(current[0])){
-            index += str_copy(index, current);
-            
-            current = ExP_tokenize(NULL, ' '); 
-        }
+       The results are exactly the same as for the generic operators, 
+       including overflow and rounding.
+    */
+    uint32_t divisor_count = 0;
+    int32_t constant;
 
-        else{// if current is an operator
-            
-            // if the stack is empty, or if current is a left parenthesis, or if the
-            // top of the stack is a left parenthesis, push current onto the stack
-            if (Stack_count(operators_stack) == 0 || \
-                    *current == '(' || \
-                    *(char *)Stack_peek(operators_stack) == '(' \
-                ){
-                StackItem new = Stack_make_item(current);
-                Stack_push(operators_stack, new);
+    for (uint32_t i = 0; i < program->count; i++){
+        uint8_t opcode = program->opcodes[i];
 
-                current = ExP_tokenize(NULL, ' ');
-            }
-            // if current is a right parenthesis, pop from the stack until a matching left
-            // parenthesis is found, sending everything in between the parentheses to the
-            // output
-            else if (current[0] == ')'){
-                while (true){
-                    char *popped = Stack_pop(operators_stack);
-                    if (*popped == '('){
-                        break;
-                    }
-                    index += str_copy(index, popped);
-                    // add whitespace
-                    *index = ' ';
-                    index++;
+        // only these are specialized; and for literals and control flow nodes, 
+        // left and right aren't the indices of operands
+        if (opcode != ExP_OP_DIV && opcode != ExP_OP_MUL && opcode != ExP_OP_POW){
+            continue;
+        }
+        if (opcode == ExP_OP_MUL && !ExProgram_is_constant(program, program->right[i], &constant) && \
+                ExProgram_is_constant(program, program->left[i], &constant)){
+            // put the constant on the right
+            uint32_t left = program->left[i];
+            program->left[i] = program->right[i];
+            program->right[i] = left;
+        }
+        if (!ExProgram_is_constant(program, program->right[i], &constant)){
+            continue;
+        }
+
+        switch (opcode){
+            case ExP_OP_DIV:
+                if (ExProgram_log2(constant) != 0xFF){
+                    program->opcodes[i] = ExP_OP_DIV_POW2;
+                    program->right[i] = ExProgram_log2(constant);
                 }
-                current = ExP_tokenize(NULL, ' ');
+                else if (constant != 0 && constant != -1){
+                    divisor_count++;    // specialized below, once the table is allocated
                 }
+                break;
 
-            // if current has higher precedence than the top of the stack
-            // push it onto the stack. Left-associativity is assumed
-            else if (ExP_has_higher_precedence(current, (char *)Stack_peek(operators_stack))){
-                StackItem new = Stack_make_item(current);
-                Stack_push(operators_stack, new);
-
-                current = ExP_tokenize(NULL, ' ');
-            }
-            // else if the top of the stack and current have the same precedence (left
-            // associativity is assumed) or the top of the stack has higher 
-            // precedence than current, pop from the stack and write to the output
-            // string until that's no longer the case
-            else if (!ExP_has_higher_precedence(current, (char *)Stack_peek(operators_stack))){
-                while (true){
-                    char *popped = Stack_pop(operators_stack);
-                    index += str_copy(index, popped);
-                    // add whitespace as well
-                    *index = ' ';
-                    index++;
-
-                    // stop popping when the condition becomes false, i.e. a
-                    // lower-precedence top-of-the-stack is found or the stack is empty
-                    if ((!Stack_count(operators_stack)) || \
-                        (ExP_has_higher_precedence(current, (char *)Stack_peek(operators_stack))) || \
-                        (*(char *)Stack_peek(operators_stack) == '(') \
-                        ){
-                        break;
-                    }
+            case ExP_OP_MUL:
+                if (ExProgram_log2(constant) != 0xFF){
+                    program->opcodes[i] = ExP_OP_MUL_POW2;
+                    program->right[i] = ExProgram_log2(constant);
                 }
-                // it's safe now to push current onto the stack
-                StackItem new = Stack_make_item(current);
-                Stack_push(operators_stack, new);
+                break;
 
-                current = ExP_tokenize(NULL, ' ');
-            } 
+            case ExP_OP_POW:
+                if (constant >= 0){
+                    program->opcodes[i] = ExP_OP_POW_CONST;
+                    program->right[i] = (uint32_t)constant;
+                }
+                break;
         }
-        // add whitespace after evey single token, if the previous char isn't white space
-        // but only if it's not the first index in the string
-        if (index != infix_expression && *(index-1) != ' '){
-            *index = ' ';
-            index++;
+    }
+
+    if (!divisor_count){
+        return;
+    }
+    program->divisors = malloc(sizeof(struct expression_divisor) * divisor_count);
+    if (!program->divisors){
+        return;     // the divisions stay as they are
+    }
+
+    divisor_count = 0;
+    for (uint32_t i = 0; i < program->count; i++){
+        if (program->opcodes[i] == ExP_OP_DIV && \
+                ExProgram_is_constant(program, program->right[i], &constant) && \
+                constant != 0 && constant != -1){
+            struct expression_divisor *divisor = &program->divisors[divisor_count];
+            ExProgram_magic(constant, divisor);
+            divisor->node = program->right[i];
+
+            program->opcodes[i] = ExP_OP_DIV_MAGIC;
+            program->right[i] = divisor_count++;
         }
     }
-    // the loop is finished, current is NULL: the expression has been parsed
-    // if there are any operators left over on the stack, pop them all and write
-    // them to the output string
-    while (Stack_count(operators_stack)){
-        index += str_copy(index, (char *)Stack_pop(operators_stack));
-        // add white space after each operator as well
-        *index = ' ';
-        index++;
+}
+
+
+static int32_t ExProgram_divide_pow2(int32_t dividend, uint32_t k){
+    /* Return dividend / 2^k, rounded towards 0 like the / operator:
+       an arithmetic shift rounds towards -infinity, so negative dividends
+       get 2^k - 1 added first.
+    */
+    if (k == 0){
+        return dividend;
+    }
+    uint32_t bias = (uint32_t)(dividend >> 31) >> (32 - k);
+    return (int32_t)((uint32_t)dividend + bias) >> k;
+}
+
+
+static int32_t ExProgram_divide_magic(int32_t dividend, struct expression_divisor *divisor){
+    /* Return dividend / the divisor that *divisor was computed for */
+    int32_t quotient = (int32_t)(((int64_t)divisor->magic * dividend) >> 32);
+
+    if (divisor->correction > 0){
+        quotient = (int32_t)((uint32_t)quotient + (uint32_t)dividend);
+    }else if (divisor->correction < 0){
+        quotient = (int32_t)((uint32_t)quotient - (uint32_t)dividend);
+    }
+    quotient >>= divisor->shift;
+    // round towards 0: add 1 if the quotient is negative
+    return quotient + (int32_t)((uint32_t)quotient >> 31);
+}
+
+
+static int32_t ExProgram_power(int32_t base, uint32_t exponent){
+    /* Return base raised to the constant power exponent; the small 
+       exponents are unrolled, the rest are done by repeated squaring
+    */
+    uint32_t b = (uint32_t)base;
+    switch (exponent){
+        case 0:
+            return 1;
+
+        case 1:
+            return base;
+
+        case 2:
+            return (int32_t)(b * b);
+
+        case 3:
+            return (int32_t)(b * b * b);
+
+        case 4:
+            b *= b;
+            return (int32_t)(b * b);
+
+        default:
+            return ExP_power(base, (int32_t)exponent);
+    }
+}
+
+
+static uint32_t ExProgram_arguments(ExProgram program, uint32_t list, int32_t arguments[]){
+    /* Store in arguments[] the values of the arguments in the argument list
+       of a function call, whose root is node list, and return their number.
+       The list is a left-deep chain of , nodes: the last argument is the 
+       right operand of the topmost one.
+    */
+    uint32_t count = 1;
+    for (uint32_t node = list; program->opcodes[node] == ExP_OP_ARGS; node = program->left[node]){
+        count++;
+    }
+    for (uint32_t i = count - 1; i > 0; i--){
+        arguments[i] = program->values[program->right[list]];
+        list = program->left[list];
+    }
+    arguments[0] = program->values[list];
+
+    return count;
+}
+
+
+static int32_t ExProgram_evaluate(ExProgram program){
+    /* Evaluate program and return the result.
+       One sequential pass over the node arrays: by the time a node is reached,
+       the values of its children have already been computed.
+    */
+    int32_t *values = program->values;
+
+    for (uint32_t i = 0; i < program->count; i++){
+        uint8_t opcode = program->opcodes[i];
+        uint32_t right = program->right[i];
+
+        switch (opcode){
+            case ExP_OP_LITERAL:
+                values[i] = (int32_t)ExProgram_literal(program, i);
+                break;
+
+            case ExP_OP_REFERENCE:
+                values[i] = program->inputs[program->left[i]];
+                break;
+
+            case ExP_OP_DIV_POW2:
+                values[i] = ExProgram_divide_pow2(values[program->left[i]], right);
+                break;
+
+            case ExP_OP_DIV_MAGIC:
+                values[i] = ExProgram_divide_magic(values[program->left[i]], &program->divisors[right]);
+                break;
+
+            case ExP_OP_MUL_POW2:
+                values[i] = (int32_t)((uint32_t)values[program->left[i]] << right);
+                break;
+
+            case ExP_OP_POW_CONST:
+                values[i] = ExProgram_power(values[program->left[i]], right);
+                break;
+
+            // control flow: continue at node right (the loop increments i)
+            case ExP_OP_SKIP_FALSE:
+                if (!values[program->left[i]]){
+                    i = right - 1;
+                }
+                break;
+
+            case ExP_OP_SKIP_TRUE:
+                if (values[program->left[i]]){
+                    i = right - 1;
+                }
+                break;
+
+            case ExP_OP_JUMP:
+                i = right - 1;
+                break;
+
+            // the operand that was skipped, if any, is never read
+            case ExP_OP_AND:
+                values[i] = values[program->left[i]] ? values[right] != 0 : 0;
+                break;
+
+            case ExP_OP_OR:
+                values[i] = values[program->left[i]] ? 1 : values[right] != 0;
+                break;
+
+            case ExP_OP_ELSE:
+            case ExP_OP_ARGS:
+                values[i] = 0;
+                break;
+
+            case ExP_OP_CALL:   // right is the id of the function
+            {
+                int32_t arguments[ExP_MAX_ARGUMENTS];
+                uint32_t count = ExProgram_arguments(program, program->left[i], arguments);
+                values[i] = ExCall_apply(right, arguments, count);
+                break;
+            }
+
+            case ExP_OP_COND:   // right is the : node, holding both branches
+                values[i] = values[program->left[i]] ? values[program->left[right]] : values[program->right[right]];
+                break;
+
+            default:
+                values[i] = ExP_apply(opcode, values[program->left[i]], values[right]);
+                break;
+        }
+    }
+    return values[program->count - 1];
+}
+
+
+
+/*               * * * ExCall functions * * *                         */
+
+/* Function calls. Every function has an id: the index of its entry in
+   ExCall_functions[]. The built-in ones come first, in the order of
+   enum expression_builtin, followed by the ones registered with
+   ExP_register_function(), in the order they were registered.
+
+   Names are looked up when an expression is parsed (and, since trees 
+   don't keep the ids, by the tree evaluators); ExPrograms only store 
+   the id. The built-in names are found with a perfect hash, fixed at 
+   compile time: one probe and one string comparison. Registered names 
+   are in an open-addressing table, only searched once there are any.
+*/
+
+
+static bool ExP_is_name_start(char the_char);
+
+
+static int32_t ExCall_min(const int32_t arguments[], uint32_t count){
+    /* The built-in min(a, b, ...) */
+    int32_t result = arguments[0];
+    for (uint32_t i = 1; i < count; i++){
+        if (arguments[i] < result){
+            result = arguments[i];
+        }
+    }
+    return result;
+}
+
+
+static int32_t ExCall_max(const int32_t arguments[], uint32_t count){
+    /* The built-in max(a, b, ...) */
+    int32_t result = arguments[0];
+    for (uint32_t i = 1; i < count; i++){
+        if (arguments[i] > result){
+            result = arguments[i];
+        }
+    }
+    return result;
+}
+
+
+static int32_t ExCall_abs(const int32_t arguments[], uint32_t count){
+    /* The built-in abs(a). Like - it wraps around: abs(INT32_MIN) is INT32_MIN */
+    (void)count;
+    return arguments[0] < 0 ? (int32_t)(0u - (uint32_t)arguments[0]) : arguments[0];
+}
+
+
+static int32_t ExCall_clamp(const int32_t arguments[], uint32_t count){
+    /* The built-in clamp(a, low, high): min(max(a, low), high) */
+    (void)count;
+    int32_t result = arguments[0] < arguments[1] ? arguments[1] : arguments[0];
+    return result > arguments[2] ? arguments[2] : result;
+}
+
+
+static struct expression_function ExCall_functions[64] = {
+    [ExCall_MIN] = {"min", ExCall_min, 1, ExP_MAX_ARGUMENTS},
+    [ExCall_MAX] = {"max", ExCall_max, 1, ExP_MAX_ARGUMENTS},
+    [ExCall_ABS] = {"abs", ExCall_abs, 1, 1},
+    [ExCall_CLAMP] = {"clamp", ExCall_clamp, 3, 3},
+};
+static uint32_t ExCall_count = ExCall_BUILTINS;    // how many entries of ExCall_functions[] are used
+
+// the perfect hash table of the built-in names: id+1 of the function in
+// slot ExCall_builtin_hash(name) (0 means empty slot). 
+// (3*'m' + 'n' + 3) % 8 = 0, and likewise abs: 1, max: 2, clamp: 6.
+static const uint8_t ExCall_builtin_slots[8] = {
+    [0] = ExCall_MIN + 1,
+    [1] = ExCall_ABS + 1,
+    [2] = ExCall_MAX + 1,
+    [6] = ExCall_CLAMP + 1,
+};
+
+// the registered names: id+1 of the function (0 means empty slot), with
+// linear probing; twice as many slots as functions, so it's at most half full
+static uint8_t ExCall_slots[128];
+
+
+static uint32_t ExCall_builtin_hash(const char *name, size_t length){
+    /* The perfect hash of the built-in names: a slot in ExCall_builtin_slots[] */
+    return (3 * (uint32_t)(unsigned char)name[0] + (unsigned char)name[length - 1] + (uint32_t)length) % 8;
+}
+
+
+static uint32_t ExCall_hash(const char *name){
+    /* FNV-1a hash of name, for ExCall_slots[] */
+    uint32_t hash = 2166136261u;
+    for (; *name; name++){
+        hash = (hash ^ (unsigned char)*name) * 16777619u;
+    }
+    return hash;
+}
+
+
+static int32_t ExCall_lookup(const char *name){
+    /* Return the id of the function called name, or -1 if there's no such function */
+    size_t length = strlen(name);
+    if (!length){
+        return -1;
+    }
+    uint8_t builtin = ExCall_builtin_slots[ExCall_builtin_hash(name, length)];
+    if (builtin && strcmp(ExCall_functions[builtin - 1].name, name) == 0){
+        return builtin - 1;
+    }
+    if (ExCall_count == ExCall_BUILTINS){
+        return -1;
+    }
+    uint32_t mask = sizeof(ExCall_slots) - 1;
+    for (uint32_t slot = ExCall_hash(name) & mask; ExCall_slots[slot]; slot = (slot + 1) & mask){
+        if (strcmp(ExCall_functions[ExCall_slots[slot] - 1].name, name) == 0){
+            return ExCall_slots[slot] - 1;
+        }
+    }
+    return -1;
+}
+
+
+static bool ExCall_is_function(char *token){
+    /* Determine whether token is the name of a function */
+    return ExP_is_name_start(token[0]) && !ExP_is_operator_token(token) && ExCall_lookup(token) >= 0;
+}
+
+
+static uint32_t ExCall_arguments(ExTree list, ExTree arguments[]){
+    /* Store in arguments[] the arguments in the argument list of a function
+       call (the left child of the call node), in order, and return their number.
+       The list is a left-deep chain of , nodes: the last argument is the
+       right operand of the topmost one.
+    */
+    uint32_t count = 1;
+    for (ExTree node = list; ExTree_opcode(node) == ExP_OP_ARGS; node = node->left){
+        count++;
+    }
+    for (uint32_t i = count - 1; i > 0; i--){
+        arguments[i] = list->right;
+        list = list->left;
+    }
+    arguments[0] = list;
+
+    return count;
+}
+
+
+static int32_t ExCall_apply(uint32_t function, const int32_t arguments[], uint32_t count){
+    /* Call the function with id function on count arguments and return the result */
+    return ExCall_functions[function].function(arguments, count);
+}
+
+
+
+/*               * * * ExPrint functions * * *                         */
+
+/* The structural fingerprint of an expression tree (see ExP_fingerprint()):
+   a 128-bit hash of the tree, computed bottom-up, in which operands are
+   keyed by their value (or name) and operators by their opcode, so that 
+   spacing, parentheses and notation don't matter. 
+   
+   The operands of a chain of + or of *, e.g. the four of a + (b + c) + d,
+   are hashed in sorted order: with 32-bit arithmetic wrapping around, 
+   those operators are associative and commutative, so any order and 
+   grouping of the operands gives the same result. The two operands of ==
+   and !=, and the arguments of min() and max(), are sorted too. && and ||
+   are left alone, since the order of their operands decides which ones 
+   are evaluated.
+*/
+
+
+static uint64_t ExPrint_mix(uint64_t hash){
+    /* Scramble the bits of hash (the murmur3 64-bit finalizer) */
+    hash ^= hash >> 33;
+    hash *= 0xFF51AFD7ED558CCDULL;
+    hash ^= hash >> 33;
+    hash *= 0xC4CEB9FE1A85EC53ULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+
+static void ExPrint_add(ex_fingerprint *print, uint64_t high, uint64_t low){
+    /* Mix (high, low) into *print. Each half takes in both, with 
+       different multipliers, so that they're independent of each other.
+    */
+    print->high = ExPrint_mix((print->high ^ high) * 0x9E3779B97F4A7C15ULL + low);
+    print->low = ExPrint_mix((print->low ^ low) * 0xC2B2AE3D27D4EB4FULL + high);
+}
+
+
+static void ExPrint_add_text(ex_fingerprint *print, const char *text){
+    /* Mix the characters of text into *print, 8 at a time */
+    size_t length = strlen(text);
+    for (size_t i = 0; i < length; i += 8){
+        uint64_t chunk = 0;
+        memcpy(&chunk, &text[i], length - i < 8 ? length - i : 8);
+        ExPrint_add(print, chunk, length);
+    }
+}
+
+
+static int ExPrint_compare(const void *first_arg, const void *second_arg){
+    /* qsort() comparator ordering fingerprints */
+    const ex_fingerprint *first = first_arg, *second = second_arg;
+    if (first->high != second->high){
+        return first->high < second->high ? -1 : 1;
+    }
+    return (first->low > second->low) - (first->low < second->low);
+}
+
+
+static uint32_t ExPrint_count_chain(ExTree tree, uint8_t opcode){
+    /* Return the number of operands of the chain of opcode operators at
+       tree, walked as in ExTree_chain_length(); 0 if memory for that 
+       couldn't be allocated.
+    */
+    struct expression_tree_walk walk;
+    uint32_t count = 0;
+
+    ExTree_walk_init(&walk, tree);
+    while (walk.count && !walk.failed){
+        ExTree node = walk.frames[--walk.count].node;
+        if (ExTree_opcode(node) != opcode){
+            count++;
+            continue;
+        }
+        ExTree_walk_push(&walk, node->right);
+        ExTree_walk_push(&walk, node->left);
+    }
+    ExTree_walk_free(&walk);
+
+    return walk.failed ? 0 : count;
+}
+
+
+static void ExPrint_add_sorted(ex_fingerprint *print, ex_fingerprint prints[], uint32_t count){
+    /* Sort prints[], then mix their count and them into *print */
+    qsort(prints, count, sizeof(ex_fingerprint), ExPrint_compare);
+
+    ExPrint_add(print, count, count);
+    for (uint32_t i = 0; i < count; i++){
+        ExPrint_add(print, prints[i].high, prints[i].low);
+    }
+}
+
+
+static ex_fingerprint ExPrint_tree(ExTree tree, bool *failed){
+    /* Return the fingerprint of tree. Set *failed if memory couldn't be
+       allocated.
+
+       The tree is walked without recursion, the fingerprints of the subtrees
+       done so far being kept on a stack. The inner nodes of a chain of + or
+       of * leave those of their operands there, for the root of the chain 
+       to sort; the arguments of min() and max() are taken one at a time
+       and sorted the same way.
+    */
+    struct expression_tree_walk walk;
+    ex_fingerprint local_prints[ExSpan_LOCAL];
+    ex_fingerprint *prints = local_prints;
+    uint32_t count = 0, size = ExSpan_LOCAL;
+
+    ExTree_walk_init(&walk, tree);
+    while (walk.count && !walk.failed){
+        // every step pushes at most one fingerprint
+        if (!ExSpan_reserve((void **)&prints, local_prints, &size, count + 1, sizeof(ex_fingerprint))){
+            walk.failed = true;
+            ExCheck_fail(ExP_ERROR_MEMORY, 0);
+            break;
+        }
+        struct expression_tree_frame *frame = &walk.frames[walk.count - 1];
+        ExTree node = frame->node;
+        uint8_t opcode = ExTree_opcode(node);
+        ex_fingerprint print = {opcode, ~(uint64_t)opcode};
+
+        if (opcode == ExP_OP_LITERAL){
+            if (ExP_is_name_start(node->token[0])){
+                ExPrint_add_text(&print, node->token);
+            }
+            else{
+                ExPrint_add(&print, (uint64_t)(int64_t)str_to_int(node->token), 0);
+            }
+            prints[count++] = print;
+            walk.count--;
+            continue;
+        }
+
+        if (opcode == ExP_OP_CALL){
+            ExTree arguments[ExP_MAX_ARGUMENTS];
+            int32_t function = ExCall_lookup(node->token);
+            bool sorted = function == ExCall_MIN || function == ExCall_MAX;
+            uint32_t operands = sorted ? ExCall_arguments(node->left, arguments) : 1;
+
+            // the argument list of the other functions is hashed as a whole
+            if (frame->state < operands){
+                ExTree_walk_push(&walk, sorted ? arguments[frame->state] : node->left);
+                frame->state++;
+                continue;
+            }
+            count -= operands;
+            ExPrint_add_text(&print, node->token);
+            if (sorted){
+                ExPrint_add_sorted(&print, &prints[count], operands);
+            }
+            else{
+                ExPrint_add(&print, prints[count].high, prints[count].low);
+            }
+            prints[count++] = print;
+            walk.count--;
+            continue;
+        }
+
+        if (frame->state < 2){
+            ExTree_walk_push(&walk, frame->state++ ? node->right : node->left);
+            continue;
+        }
+        bool chain = opcode == ExP_OP_ADD || opcode == ExP_OP_MUL;
+        walk.count--;
+        if (chain && walk.count && ExTree_opcode(walk.frames[walk.count - 1].node) == opcode){
+            continue;   // not the root of its chain
+        }
+
+        if (chain){
+            uint32_t operands = ExPrint_count_chain(node, opcode);
+            if (!operands){
+                walk.failed = true;
+                break;
+            }
+            count -= operands;
+            ExPrint_add_sorted(&print, &prints[count], operands);
+        }
+        else{
+            count -= 2;
+            ex_fingerprint left = prints[count], right = prints[count + 1];
+            if ((opcode == ExP_OP_EQ || opcode == ExP_OP_NE) && ExPrint_compare(&left, &right) > 0){
+                ex_fingerprint swap = left;
+                left = right;
+                right = swap;
+            }
+            ExPrint_add(&print, left.high, left.low);
+            ExPrint_add(&print, right.high, right.low);
+        }
+        prints[count++] = print;
+    }
+    ExTree_walk_free(&walk);
+
+    *failed |= walk.failed;
+    ex_fingerprint result = count ? prints[0] : (ex_fingerprint){0, 0};
+    if (prints != local_prints){
+        free(prints);
+    }
+    return result;
+}
+
+
+
+/*               * * * ExP functions * * *                         */
+
+
+static bool ExP_is_operator(char the_char){
+    /* Determine whether the_char is an operator.
+       If it is, return true, else false.
+    */
+    switch(the_char){
+        case '+':
+            return true;
+            break;  // not needed
+
+        case '-':
+            return true;
+            break;
+
+        case '*':
+        case 'x':
+            return true;
+            break;
+
+        case '/':
+            return true;
+            break;
+
+        case '^':
+            return true;
+            break;
+
+        // comparison and conditional operators that are a single character;
+        // <= == != && || are two (see ExP_operator_length())
+        case '<':
+        case '?':
+        case ':':
+            return true;
+            break;
+
+        // separates the arguments of a function call
+        case ',':
+            return true;
+            break;
+
+        // for the purposes of parsing infix expressions, the parenthesis
+        // is considered an operator and so true is returned upon testing
+        case '(':
+        case ')':
+            return true;
+            break;
+
+        default:
+            return false;
+            break;
+    }
+}
+
+
+static uint32_t ExP_operator_length(const char *string, size_t length){
+    /* Return the length of the operator (or parenthesis) at the start of 
+       string, of which at most length characters are looked at: 2 for
+       <= == != && ||, 1 for the single-character ones (see ExP_is_operator()), 
+       0 if string doesn't start with an operator.
+    */
+    if (length >= 2){
+        char first = string[0], second = string[1];
+        if ((second == '=' && (first == '<' || first == '=' || first == '!')) || \
+                (first == '&' && second == '&') || (first == '|' && second == '|')){
+            return 2;
+        }
+    }
+    return (length >= 1 && ExP_is_operator(string[0])) ? 1 : 0;
+}
+
+
+static bool ExP_is_operator_token(char *token){
+    /* Determine whether token, a whole token as returned by ExP_tokenize(),
+       is an operator, and nothing else. Operands that merely start
+       with one, like the variable name 'xs', aren't.
+    */
+    uint32_t length = ExP_operator_length(token, token[0] ? 2 : 0);
+    return length && token[length] == '\0';
+}
+
+
+static bool ExP_is_name_start(char the_char){
+    /* Determine whether the_char can start a variable name: a letter or '_' */
+    return (the_char >= 'a' && the_char <= 'z') || (the_char >= 'A' && the_char <= 'Z') || the_char == '_';
+}
+
+
+static bool ExP_is_plain(char the_char){
+    /* Determine whether the_char is a digit, a letter other than 'x', or '_':
+       part of an operand whatever is around it, so it can be copied or 
+       skipped over without looking for operators
+    */
+    return (the_char >= '0' && the_char <= '9') || (the_char != 'x' && ExP_is_name_start(the_char));
+}
+
+
+static bool ExP_is_variable(char *token){
+    /* Determine whether the operand token is a variable name rather than a number */
+    return ExP_is_name_start(token[0]);
+}
+
+
+
+static uint8_t ExP_get_precedence(char *operator){
+    /*Look up the precedence for operator, and return that. 
+      Meant to be called from ExP_has_higher_precedence().
+      The relative order is the same as in C. The , between the arguments
+      of a function call has the lowest precedence, 0, like the parentheses.
+
+    */
+    uint8_t precedence = 0;
+    switch (operator[0]){
+
+        case '?':
+        case ':':
+            precedence = 1;
+            break;
+
+        case '|':
+            precedence = 2;
+            break;
+
+        case '&':
+            precedence = 3;
+            break;
+
+        case '=':
+        case '!':
+            precedence = 4;
+            break;
+
+        case '<':
+            precedence = 5;
+            break;
+
+        case '+':
+        case '-':
+            precedence = 6;
+            break;
+
+        case '*':
+        case 'x':
+        case '/':
+            precedence = 7;
+            break;
+
+        case '^':
+            precedence = 8;
+            break;
+    }
+    return precedence;
+}
+
+
+static bool ExP_has_higher_precedence(char *operator1, char *operator2){
+    /* Return true if operator1 has higher precedence than operator2,
+       else false.
+    */
+    return (ExP_get_precedence(operator1) > ExP_get_precedence(operator2)) ? true : false;
+}
+
+
+static bool ExP_binds_tighter(char *operator1, char *operator2){
+    /* Return true if, in infix, operator1 coming after operator2 takes its 
+       operands first: if it has higher precedence, or the same precedence 
+       and is right-associative. ?: is the only right-associative operator 
+       (a ? b : c ? d : e is a ? b : (c ? d : e)); all the others are
+       left-associative.
+    */
+    return ExP_has_higher_precedence(operator1, operator2) || \
+           (operator1[0] == '?' && ExP_get_precedence(operator2) == ExP_get_precedence(operator1));
+}
+
+
+static bool ExP_has_same_precedence(char *operator1, char *operator2){
+    /* Return true if operator1 and operator2 have the same precedence,
+       lse otherwise.
+    */
+    return (ExP_get_precedence(operator1) == ExP_get_precedence(operator2)) ? true : false;
+}
+
+
+
+
+static char ExP_chain_operator(char *token){
+    /* If token is an associative operator, return the character that
+       identifies the chains it can be part of, else return 0.
+       '*' and 'x' are the same operator, so they both return '*'.
+       Used by ExTree_rebalance().
+    */
+    if (!ExP_is_operator_token(token)){
+        return 0;
+    }
+    switch (token[0]){
+        case '+':
+            return '+';
+
+        case '*':
+        case 'x':
+            return '*';
+
+        default:
+            return 0;
+    }
+}
+
+
+
+static uint8_t ExP_opcode(char *operator){
+    /* Return the opcode (ExP_OP_*) corresponding to the operator token operator,
+       or ExP_OP_LITERAL if it's not an operator, i.e. it's an operand.
+    */
+    switch (operator[0]){
+        case '+':
+            return ExP_OP_ADD;
+
+        case '-':
+            return ExP_OP_SUB;
+
+        case '*':
+        case 'x':
+            return ExP_OP_MUL;
+
+        case '/':
+            return ExP_OP_DIV;
+
+        case '^':
+            return ExP_OP_POW;
+
+        case '<':
+            return operator[1] == '=' ? ExP_OP_LE : ExP_OP_LT;
+
+        case '=':
+            return ExP_OP_EQ;
+
+        case '!':
+            return ExP_OP_NE;
+
+        case '&':
+            return ExP_OP_AND;
+
+        case '|':
+            return ExP_OP_OR;
+
+        case '?':
+            return ExP_OP_COND;
+
+        case ':':
+            return ExP_OP_ELSE;
+
+        case ',':
+            return ExP_OP_ARGS;
+
+        default:
+            return ExP_OP_LITERAL;
+    }
+}
+
+
+static int32_t ExP_power(int32_t base, int32_t exponent){
+    /* Return base raised to the power exponent, by repeated squaring.
+       Like + - and *, it wraps around on overflow.
+       With a negative exponent, the result is 1/base^-exponent truncated 
+       towards 0, like integer division: so 0, except when base is 1 or -1.
+    */
+    if (exponent < 0){
+        if (base == 1 || base == -1){
+            return (exponent & 1) ? base : 1;
+        }
+        return 0;
+    }
+    uint32_t result = 1;
+    uint32_t square = (uint32_t)base;
+
+    while (exponent){
+        if (exponent & 1){
+            result *= square;
+        }
+        square *= square;
+        exponent >>= 1;
+    }
+    return (int32_t)result;
+}
+
+
+static int32_t ExP_divide(int32_t dividend, int32_t divisor){
+    /* Return dividend / divisor. Dividing by 0, or INT32_MIN by -1, would
+       trap: instead, that's recorded with ExCheck_fail() and the result is 0.
+    */
+    if (divisor == 0){
+        ExCheck_fail(ExP_ERROR_DIVISION, 0);
+        return 0;
+    }
+    if (divisor == -1 && dividend == INT32_MIN){
+        ExCheck_fail(ExP_ERROR_OVERFLOW, 0);
+        return 0;
+    }
+    return dividend / divisor;
+}
+
+
+static int32_t ExP_apply(uint8_t opcode, int32_t left_operand, int32_t right_operand){
+    /* Apply the operator identified by opcode (one of ExP_OP_*) to the two
+       operands and return the result.
+
+       +, - and * are done on uint32_t and converted back, so overflow
+       wraps around (mod 2^32) instead of being undefined. ExTree_rebalance()
+       relies on this to reassociate + and * chains without changing the result.
+    */
+    int32_t result;
+    switch (opcode){
+        case ExP_OP_ADD:
+            result = (int32_t)((uint32_t)left_operand + (uint32_t)right_operand); 
+            break;  
+
+        case ExP_OP_SUB:
+            result = (int32_t)((uint32_t)left_operand - (uint32_t)right_operand); 
+            break;
+
+        case ExP_OP_MUL:
+            result = (int32_t)((uint32_t)left_operand * (uint32_t)right_operand); 
+            break;
+
+        case ExP_OP_DIV:
+            result = ExP_divide(left_operand, right_operand); 
+            break;
+
+        case ExP_OP_POW:   // exponentiation
+            result = ExP_power(left_operand, right_operand);
+            break;
+
+        case ExP_OP_LT:
+            result = left_operand < right_operand;
+            break;
+
+        case ExP_OP_LE:
+            result = left_operand <= right_operand;
+            break;
+
+        case ExP_OP_EQ:
+            result = left_operand == right_operand;
+            break;
+
+        case ExP_OP_NE:
+            result = left_operand != right_operand;
+            break;
+
+        // both operands already evaluated: the evaluators handle the
+        // short-circuiting themselves before getting here
+        case ExP_OP_AND:
+            result = left_operand && right_operand;
+            break;
+
+        case ExP_OP_OR:
+            result = left_operand || right_operand;
+            break;
+
+        default:
+            return false;
+            break;
+    }
+    return result;
+}
+
+
+static int32_t ExP_eval(char *operator, int32_t left_operand, int32_t right_operand){
+// PV: static char *ExP_eval(char *operator, char *left_operand, char *right_operand)
+    /* Evaluate the expression consisting of the two operands and
+       operator and return the result.
+    
+       The operands are int32_t integers. The calling function has to convert its
+       data, if it's in char-array format instead, to int32_t types by calling
+       str_to_int().
+
+       The actual computing is done by ExP_apply(), which is shared with the
+       evaluation of compiled ExPrograms.
+    */
+    // PV: return str_from_int(result);
+    return ExP_apply(ExP_opcode(operator), left_operand, right_operand);
+}
+
+static char *ExP_refine(const char *unformatted, size_t length, ex_notation NOTATION){
+    /* Copy the contents from the unformatted array into another array,
+       allocated dynamically, but add whitespace around the operator
+       tokens as needed.
+       Only the first length characters of unformatted are copied (fewer
+       if a NUL comes first), so it doesn't need to be NUL-terminated.
+
+       Return this 'refined' array to the caller for safe parsing.
+       Called to 'sanitize' the input to be fed to ExP_tokenize().
+    */
+    size_t size = 2*length + 1;
+    char *refined = calloc(size, sizeof(char));     // allocate and initialize everything to 0
+        if (!refined){
+            return NULL;
+        }
+
+    uint32_t ind_refined = 0;   // track the position in the 'refined' array
+    refined[ind_refined] = '\0';    // initialize to NUL
+
+    // whether the characters being copied are part of a variable name. 
+    // 'x' is the multiplication operator, except inside a name ('max') or 
+    // at the start of one ('xs'; but 'x1' is x followed by 1).
+    bool in_name = false;
+
+
+    for (size_t i = 0; i < length && unformatted[i] != '\0'; i++){
+
+        if (ExP_is_plain(unformatted[i])){
+            in_name = in_name || unformatted[i] > '9';
+            refined[ind_refined] = unformatted[i];
+            ind_refined++;
+            continue;
+        }
+
+        bool name_x = unformatted[i] == 'x' && \
+                      (in_name || (i + 1 < length && ExP_is_name_start(unformatted[i+1])));
+
+        if(unformatted[i] == ' '){
+            in_name = false;
+            // don't add space if there's one just before
+            if (ind_refined > 0 && refined[ind_refined-1] != ' '){     // if the previous char is not whitespace
+                refined[ind_refined] = ' ';     // then add whitespace here
+                ind_refined++;
+            }
+        }
+
+        // if current is operator or parenthesis, make sure it has white space before and
+        // after
+        else if((ExP_is_operator(unformatted[i]) && !name_x) || \
+                (unformatted[i] == '(' || unformatted[i] == ')') || \
+                ExP_operator_length(&unformatted[i], length - i) == 2
+                ){
+            in_name = false;
+            uint32_t operator_length = ExP_operator_length(&unformatted[i], length - i);
+            //add space before it if there's no space at that index in the array already
+            //added. no out-of-bounds error can occur since the left-most element is 
+            //always an operand in a valid postfix expression 
+            // edit: it will crash, of course, if it's a prefix expression, since the
+            // first char is an operator there
+            if (ind_refined > 0 && refined[ind_refined-1] != ' '){
+                refined[ind_refined] = ' ';
+                ind_refined++;
+            }
+            refined[ind_refined] = unformatted[i];
+            ind_refined++;
+            if (operator_length == 2){
+                i++;
+                refined[ind_refined] = unformatted[i];
+                ind_refined++;
+            }
+            //add a space after it as well
+            refined[ind_refined] = ' ';
+            ind_refined++;
+        }
+            // if it's not whitespace or an operator, insert it as it is. 
+            // this counts on the input being an otherwise valid expression and not
+            // containing non-numeric character and whatnot
+        else{
+            in_name = in_name || ExP_is_name_start(unformatted[i]);
+            refined[ind_refined] = unformatted[i];
+            ind_refined++;
+        }
+
+    } 
+    // postfix expressions always end with an operator, so white space will be added after
+    // it, and the index in the array incremented to after that newly-added space. 
+    // ind-refined-1 below thus refers to the white space. Set it to null, since the
+    // expression ends here. (Unless they end with a function name: no space after that.)
+    if (NOTATION == POSTFIX && ind_refined > 0 && refined[ind_refined-1] == ' '){
+        refined[ind_refined-1] = '\0';
+    }
+    return refined;
+}
+
+
+static char *ExP_tokenize(char string_arg[], char delimiter){
+    /* Return the next token in string_arg when called.
+
+       A token is a substring delimitated by delimiter.
+       e.g. 'my_name_is_x' has 4 tokens and 3 delimiter
+       instances..
+
+       The initial call to the function has to specify the 
+       string to tokenize. After that, unless another string
+       needs to be tokenized, the function is called with NULL
+       as the first argument, to indicate that it should continue
+       tokenizing the same string.
+
+       The function maintains internal state by using static variables.
+       Since the whole input string is not tokenized at once, but bit by
+       bit with each call, this is a form of lazy evaluation.
+       The static variables are thread-local, so that several threads can
+       each be parsing their own expression at the same time.
+    */
+
+    // static variables, only initialized when string_arg is not NULL 
+    static _Thread_local char *input_string;
+    static _Thread_local char *token;    // a pointer to the next token found;
+    static _Thread_local int32_t index;
+    static _Thread_local char *res;
+
+    // if string_arg is not NULL, (re) initialize the static variables (internal state)
+     if (string_arg){
+        input_string = string_arg;
+        token = input_string;
+        index = 0;
+        res = NULL;
+     }
+   
+
+    while(input_string[index] != '\0'){
+        if (input_string[index] == delimiter){
+            res = token; 
+            input_string[index] = '\0';  // replace the delimiter with a NUL, to terminate the string (token) here
+            token = &input_string[index+1]; // make token point to the first char after NULL
+            index++;
+
+            return res;
+        }
+        index++;
+    }
+    // the loop is exhausted; last token -> return it
+    // NOTE: what's left here is the rest of the original input string from after the last token
+    // until the final Nul
+
+    // return this last bit
+    res = token;
+    // then set token to null, so that on the next call the reurn value is null
+    token = NULL;
+    return res;
+}
+
+
+
+static ExTreeWrapper ExP_parse_postfix(const char postfix_expression[], size_t length){
+    /* Parse postfix_expression and build an expression 
+       tree out of it. Wrap the expression tree inside
+       an ExTreeWrapper, and return that.
+
+       postfix_expression is assumed to be a valid 
+       expression in polish postfix notation. The first
+       character is always an operand and the last character
+       is always an operator. 
+       
+       Blank spaces are used to separate operands. I.e.
+       '374+' is not a valid expression, since it could be
+       either 37+4 or 3+74, depending on how the parsing is
+       done. '3 7+' and '3 7 +', on the other hand, are both
+       valid expressins. Spaces are necessary between operands,
+       but not necessary between operators or an operator and an
+       operand. 
+
+       Only the first length characters of postfix_expression are 
+       parsed, so it doesn't need to be Nul-terminated.
+
+       The operands waiting for their operator are kept in an array, on 
+       the C stack unless there are more than ExSpan_LOCAL of them.
+    */
+    ExTree local_operands[ExSpan_LOCAL];
+    ExTree *operands = local_operands;
+    uint32_t operands_count = 0, operands_size = ExSpan_LOCAL;
+
+    char *refined = ExP_refine(postfix_expression, length, POSTFIX); 
+
+    // ExTree wrapper with a pointer to an exp tree and a pointer to the expression char
+    // array it's based on -- tracks both for deallocation purposes
+    ExTreeWrapper tree_wrapper;
+    ExTree_init(&tree_wrapper, refined);
+
+    ExTree result = NULL;
+    char *current = ExP_tokenize(refined, ' ');
+
+    while(current){
+        // current is a function: it takes a single operand, its argument list
+        if (ExCall_is_function(current)){
+            ExTree new_tree = ExTree_new(current);
+            new_tree = ExTree_insert_left(new_tree, operands[--operands_count]);
+            result = new_tree;
+
+            operands[operands_count++] = new_tree;
+
+            current = ExP_tokenize(NULL, ' '); 
+        }
+        // current is an operand
+        else if(!ExP_is_operator_token(current)){
+            // make current a new tree with no children
+            ExTree new = ExTree_new(current);
+            
+            // push this new childless tree onto the stack
+            if (!ExSpan_reserve((void **)&operands, local_operands, &operands_size, \
+                        operands_count + 1, sizeof(ExTree))){
+                free(new);
+                break;
+            }
+            operands[operands_count++] = new;
+
+            current = ExP_tokenize(NULL, ' '); 
+        }
+        else{   // current is an operator, compute
+            // make a new tree with the operator as the key and 
+            // the two operands as its children
+            ExTree new_tree = ExTree_new(current);
+            // get the children from the stack
+            ExTree right_operand = operands[--operands_count];
+            ExTree left_operand = operands[--operands_count];
+            
+            // assign the children to the parent tree
+            new_tree = ExTree_insert_right(new_tree, right_operand);
+            new_tree = ExTree_insert_left(new_tree, left_operand);
+            result = new_tree;
+
+            // push the tree onto the stack
+            operands[operands_count++] = new_tree;
+
+            current = ExP_tokenize(NULL, ' '); 
+        }
+    }
+    // an expression without any operators, like '5' (or '(5)' in infix), 
+    // is a single operand
+    if (!result && operands_count == 1){
+        result = operands[0];
+    }
+    // out of memory: the result, if any, is one of them
+    if (current){
+        result = NULL;
+        while (operands_count){
+            ExTree_cut_down(operands[--operands_count]);
+        }
+    }
+    if (operands != local_operands){
+        free(operands);
+    }
+    tree_wrapper->expression_tree = result; 
+    return tree_wrapper; 
+}
+
+
+
+static char *ExP_infix_shunt(const char infix_exp[], size_t length){
+    /* Turn infix expression into a postfix expression
+       using the shunting-yard algorithm.
+
+       Once in postfix notation, this can either be returned as is,
+       if the request if for the conversion of an infix-notation
+       expression into a postfix-notation expression, 
+       or the postfix-notation functions can be called 
+       to deal with the newly-obtained postfix expression
+       in order to build a syntax tree out of it and/or
+       to convert it to a prefix-notation string.
+       
+       infix_expression is assumed to be a valid infix-notation
+       expression. 
+       Operands must be white-space separated, but there's no
+       such requirement between operands or an operand and 
+       and an operator or anything and parentheses.
+
+       Only the first length characters of infix_exp are parsed, 
+       so it doesn't need to be Nul-terminated.
+    
+       The value returned is a dynamically-allocated char array.
+       The caller is responsible for freeing it when no longer
+       needed.
+    */
+    Stack operators_stack;
+    Stack_init(&operators_stack);
+    
+    // string for str_tokenize() to operate on and modify; used as the 'input' string
+    char *refined_ex = ExP_refine(infix_exp, length, INFIX); 
+    // use infix_expression as the output string i.e. for writing the new, resultant postfix expression.
+
+    // allocate memory for a new array, double the size of the string argument, to play it
+    // safe, since white space is going to be added
+    // this is what's going to be returned at the end
+    char *infix_expression = malloc(sizeof(char) * (length * 2 + 1));
+    if (!infix_expression){
+        return NULL;
+    }
+    // index is used to track the current position in infix_expression (aforementioned)
+    char *index = infix_expression;
+
+    char *current = ExP_tokenize(refined_ex, ' ');
+
+    ////////////////////////////// PARSE ///////////////////////////
+
+    while(current != NULL){
+        // current is the name of a function: push it onto the stack; it's popped
+        // when the parenthesis closing its arguments is, and written after them
+        if (ExCall_is_function(current)){
+            StackItem new = Stack_make_item(current);
+            Stack_push(operators_stack, new);
+
+            current = ExP_tokenize(NULL, ' ');
+        }
+        // current is an operand, copy it to the output
+        else if(!ExP_is_operator_token(current)){
+            index += str_copy(index, current);
+            
+            current = ExP_tokenize(NULL, ' '); 
+        }
+
+        else{// if current is an operator
+            
+            // if the stack is empty, or if current is a left parenthesis, or if the
+            // top of the stack is a left parenthesis, push current onto the stack
+            // (unless it's a right parenthesis, closing that left one: '((1))')
+            if (current[0] != ')' && \
+                    (Stack_count(operators_stack) == 0 || \
+                    *current == '(' || \
+                    *(char *)Stack_peek(operators_stack) == '(') \
+                ){
+                StackItem new = Stack_make_item(current);
+                Stack_push(operators_stack, new);
+
+                current = ExP_tokenize(NULL, ' ');
+            }
+            // if current is a right parenthesis, pop from the stack until a matching left
+            // parenthesis is found, sending everything in between the parentheses to the
+            // output
+            else if (current[0] == ')'){
+                while (true){
+                    char *popped = Stack_pop(operators_stack);
+                    if (*popped == '('){
+                        break;
+                    }
+                    index += str_copy(index, popped);
+                    // add whitespace
+                    *index = ' ';
+                    index++;
+                }
+                // if these were the parentheses of a function call, the function
+                // (the only operand ever pushed) comes next
+                if (Stack_count(operators_stack) && !ExP_is_operator_token((char *)Stack_peek(operators_stack))){
+                    index += str_copy(index, (char *)Stack_pop(operators_stack));
+                    *index = ' ';
+                    index++;
+                }
+                current = ExP_tokenize(NULL, ' ');
+                }
+
+            // if current is the : of a ?:, pop everything down to the ? it belongs
+            // to: all the other operators bind tighter, and so does every ?: 
+            // already completed (a : on top of its ?), as in a ? b ? c : d : e
+            else if (current[0] == ':'){
+                while (Stack_count(operators_stack) && \
+                        *(char *)Stack_peek(operators_stack) != '(' && \
+                        *(char *)Stack_peek(operators_stack) != '?'){
+                    char *popped = Stack_pop(operators_stack);
+                    index += str_copy(index, popped);
+                    *index = ' ';
+                    index++;
+                    if (*popped == ':' && Stack_count(operators_stack)){
+                        // and the ? of that :
+                        index += str_copy(index, (char *)Stack_pop(operators_stack));
+                        *index = ' ';
+                        index++;
+                    }
+                }
+                StackItem new = Stack_make_item(current);
+                Stack_push(operators_stack, new);
+
+                current = ExP_tokenize(NULL, ' ');
+            }
+
+            // if current binds tighter than the top of the stack (higher precedence,
+            // or right-associativity), push it onto the stack
+            else if (ExP_binds_tighter(current, (char *)Stack_peek(operators_stack))){
+                StackItem new = Stack_make_item(current);
+                Stack_push(operators_stack, new);
+
+                current = ExP_tokenize(NULL, ' ');
+            }
+            // else if the top of the stack and current have the same precedence (left
+            // associativity is assumed) or the top of the stack has higher 
+            // precedence than current, pop from the stack and write to the output
+            // string until that's no longer the case
+            else if (!ExP_binds_tighter(current, (char *)Stack_peek(operators_stack))){
+                while (true){
+                    char *popped = Stack_pop(operators_stack);
+                    index += str_copy(index, popped);
+                    // add whitespace as well
+                    *index = ' ';
+                    index++;
+
+                    // stop popping when the condition becomes false, i.e. a
+                    // lower-precedence top-of-the-stack is found or the stack is empty
+                    if ((!Stack_count(operators_stack)) || \
+                        (ExP_binds_tighter(current, (char *)Stack_peek(operators_stack))) || \
+                        (*(char *)Stack_peek(operators_stack) == '(') \
+                        ){
+                        break;
+                    }
+                }
+                // it's safe now to push current onto the stack
+                StackItem new = Stack_make_item(current);
+                Stack_push(operators_stack, new);
+
+                current = ExP_tokenize(NULL, ' ');
+            } 
+        }
+        // add whitespace after evey single token, if the previous char isn't white space
+        // but only if it's not the first index in the string
+        if (index != infix_expression && *(index-1) != ' '){
+            *index = ' ';
+            index++;
+        }
+    }
+    // the loop is finished, current is NULL: the expression has been parsed
+    // if there are any operators left over on the stack, pop them all and write
+    // them to the output string
+    while (Stack_count(operators_stack)){
+        index += str_copy(index, (char *)Stack_pop(operators_stack));
+        // add white space after each operator as well
+        *index = ' ';
+        index++;
+    }
+    // NULL - terminate the output string; the char at the previous index is whitespace,
+    // so put the NUL there
+    *(--index) = '\0';
+
+    // free the allocated memory: the operator stack, the 'input' string
+    Stack_destroy(&operators_stack);
+    free(refined_ex);
+
+    return infix_expression;
+}
+
+
+
+
+static bool ExP_prefix_build_et(ExTree *tree_ref, char *token){
+    /* Called from inside ExP_parse_prefix(). 
+
+       It builds the tree back in the caller's space, at *tree_ref, out of
+       token and the tokens ExP_tokenize() returns after it: each one
+       goes in the first place in the tree still empty, in pre-order.
+       Those places are kept on a stack rather than recursed into, so that
+       no expression is too deep for it: an operator pushes the places of
+       its right and left operands, a function that of its argument list.
+
+       Return false if memory couldn't be allocated.
+    */
+    ExTree *local_places[ExSpan_LOCAL];
+    ExTree **places = local_places;
+    uint32_t count = 0, size = ExSpan_LOCAL;
+    bool built = true;
+
+    places[count++] = tree_ref;
+    while (token){
+        ExTree tree = ExTree_new(token);
+        if (!tree || !ExSpan_reserve((void **)&places, local_places, &size, count + 1, sizeof(ExTree *))){
+            free(tree);
+            built = false;
+            break;
+        }
+        *places[--count] = tree;
+
+        // a function has a single operand, its argument list; an operator
+        // two, the left one coming first
+        if (ExCall_is_function(token)){
+            places[count++] = &tree->left;
+        }
+        else if (ExP_is_operator_token(token)){
+            places[count++] = &tree->right;
+            places[count++] = &tree->left;
+        }
+        // the tree is complete once there's no place left to fill in
+        token = count ? ExP_tokenize(NULL, ' ') : NULL;
+    }
+    if (places != local_places){
+        free(places);
+    }
+    return built;
+}
+
+
+
+static ExTreeWrapper ExP_parse_prefix(const char *exp, size_t length){
+    /* Parse the prefix expression exp and build an expression 
+       tree out of it. Wrap the expression tree inside
+       an ExTreeWrapper, and return that.
+
+       prefix_expression is assumed to be a valid 
+       expression in prefix notation. The first
+       character is always an operator and the last character
+       is always an operand. 
+       
+       Blank spaces are used to separate operands. I.e.
+       '+374' is not a valid expression, since it could be
+       either 37+4 or 3+74, depending on how the parsing is
+       done. '+3 7' and '+  3 7 ', on the other hand, are both
+       valid expressions. Spaces are necessary between operands,
+       but not necessary between operators or an operator and an
+       operand. 
+
+       Only the first length characters of exp are parsed, so it
+       doesn't need to be Nul-terminated.
+    */
+      
+    // if the current char in exp is NULL : end of the expression 
+    char *refined = ExP_refine(exp, length, PREFIX);
+    if (!refined){
+        return NULL;
+    }
+    // declare and initialize a tree wrapper that tracks the refined expression and the 
+    // exp tree that will be built from it, for deallocation purposes
+    ExTreeWrapper tree_wrapper;
+    ExTree_init(&tree_wrapper, refined);
+
+    char *token = ExP_tokenize(refined, ' ');
+    if (!ExP_prefix_build_et(&tree_wrapper->expression_tree, token)){
+        ExTree_destroy(&tree_wrapper);
+        return NULL;
+    }
+
+    // the refined expression string: no longer needed
+     // free(exp);
+    
+    return tree_wrapper;
+} 
+
+
+
+static bool ExP_infix_reduce(ExTree operands[], uint32_t *count, char *token){
+    /* Called from inside ExP_parse_infix(), with token an operator or a 
+       function name it popped off its operators stack. Do with token what 
+       ExP_parse_postfix() would, had ExP_infix_shunt() written it out: pop its
+       operands (a function has one, its argument list) off the *count 
+       operands, and push the tree with token as the key and them as its 
+       children.
+
+       Return false if an operand is missing or memory couldn't be allocated;
+       the operands are then left as they were.
+    */
+    bool is_call = ExCall_is_function(token);
+    if (*count < (is_call ? 1u : 2u)){
+        return false;
+    }
+    ExTree new_tree = ExTree_new(token);
+    if (!new_tree){
+        return false;
+    }
+    if (!is_call){
+        new_tree = ExTree_insert_right(new_tree, operands[--*count]);
+    }
+    new_tree = ExTree_insert_left(new_tree, operands[--*count]);
+
+    operands[(*count)++] = new_tree;
+    return true;
+}
+
+
+
+static ExTreeWrapper ExP_parse_infix(const char expression[], size_t length){
+    /* Parse the infix expression and build an expression tree out of it, 
+       in a single pass: the shunting-yard algorithm, exactly as in 
+       ExP_infix_shunt(), but instead of writing each operand and each
+       popped operator to a postfix string, which would then have to be
+       refined and tokenized all over again, build the tree nodes right away
+       on a stack of operands (see ExP_infix_reduce()). Both stacks are
+       arrays, on the C stack unless the expression nests deeper than 
+       ExSpan_LOCAL operators, so that the only allocations are the nodes.
+
+       Only the first length characters of expression are parsed, so it 
+       doesn't need to be Nul-terminated.
+
+       Return NULL if memory couldn't be allocated, or if expression is
+       malformed in a way that leaves an operator without its operands or 
+       a parenthesis unmatched.
+    */
+    ExP_phase(ExP_PHASE_BUILD, 1);
+    char *refined = ExP_refine(expression, length, INFIX);
+    if (!refined){
+        ExP_phase(ExP_PHASE_BUILD, 0);
+        return NULL;
+    }
+    char *local_operators[ExSpan_LOCAL];
+    char **operators = local_operators;
+    uint32_t operators_count = 0, operators_size = ExSpan_LOCAL;
+    ExTree local_operands[ExSpan_LOCAL];
+    ExTree *operands = local_operands;
+    uint32_t operands_count = 0, operands_size = ExSpan_LOCAL;
+
+    bool ok = true;
+    char *current = ExP_tokenize(refined, ' ');
+
+    while (ok && current){
+        // an empty token, after a space the refined expression ends in: nothing to do
+        if (!*current){
+        }
+        // current is the name of a function: push it onto the stack; it's popped
+        // when the parenthesis closing its arguments is
+        else if (ExCall_is_function(current)){
+            ok = ExSpan_reserve((void **)&operators, local_operators, &operators_size, \
+                                operators_count + 1, sizeof(char *));
+            if (ok){
+                operators[operators_count++] = current;
+            }
+        }
+        // current is an operand: a new tree with no children
+        else if (!ExP_is_operator_token(current)){
+            ExTree new_tree = ExTree_new(current);
+            ok = new_tree && ExSpan_reserve((void **)&operands, local_operands, &operands_size, \
+                                            operands_count + 1, sizeof(ExTree));
+            if (ok){
+                operands[operands_count++] = new_tree;
+            }
+            else{
+                free(new_tree);
+            }
+        }
+        // a left parenthesis, or an operator with nothing below it to compare to 
+        // (the stack is empty, or its top is a left parenthesis): push it
+        else if (current[0] != ')' && \
+                    (operators_count == 0 || \
+                    *current == '(' || \
+                    *operators[operators_count-1] == '(') \
+                ){
+            ok = ExSpan_reserve((void **)&operators, local_operators, &operators_size, \
+                                operators_count + 1, sizeof(char *));
+            if (ok){
+                operators[operators_count++] = current;
+            }
+        }
+        // a right parenthesis: reduce everything down to the matching left one,
+        // then the function whose arguments these were, if any
+        else if (current[0] == ')'){
+            while (true){
+                if (!operators_count){
+                    ok = false;
+                    break;
+                }
+                char *popped = operators[--operators_count];
+                if (*popped == '('){
+                    break;
+                }
+                if (!ExP_infix_reduce(operands, &operands_count, popped)){
+                    ok = false;
+                    break;
+                }
+            }
+            if (ok && operators_count && !ExP_is_operator_token(operators[operators_count-1])){
+                ok = ExP_infix_reduce(operands, &operands_count, operators[--operators_count]);
+            }
+        }
+        // the : of a ?: : reduce everything down to the ? it belongs to, 
+        // including every ?: already completed (a : on top of its ?)
+        else if (current[0] == ':'){
+            while (ok && operators_count && \
+                    *operators[operators_count-1] != '(' && \
+                    *operators[operators_count-1] != '?'){
+                char *popped = operators[--operators_count];
+                ok = ExP_infix_reduce(operands, &operands_count, popped);
+                if (ok && *popped == ':' && operators_count){
+                    ok = ExP_infix_reduce(operands, &operands_count, operators[--operators_count]);
+                }
+            }
+            // the : replaces nothing popped, so it may need more room
+            ok = ok && ExSpan_reserve((void **)&operators, local_operators, &operators_size, \
+                                      operators_count + 1, sizeof(char *));
+            if (ok){
+                operators[operators_count++] = current;
+            }
+        }
+        // any other operator: reduce the operators on the stack it doesn't bind
+        // tighter than, down to a left parenthesis, then push it
+        else{
+            while (ok && operators_count && \
+                    *operators[operators_count-1] != '(' && \
+                    !ExP_binds_tighter(current, operators[operators_count-1])){
+                ok = ExP_infix_reduce(operands, &operands_count, operators[--operators_count]);
+            }
+            ok = ok && ExSpan_reserve((void **)&operators, local_operators, &operators_size, \
+                                      operators_count + 1, sizeof(char *));
+            if (ok){
+                operators[operators_count++] = current;
+            }
+        }
+        current = ExP_tokenize(NULL, ' ');
+    }
+    // the whole expression has been read: reduce the operators left over
+    // (a left parenthesis among them was never closed)
+    while (ok && operators_count){
+        char *popped = operators[--operators_count];
+        ok = *popped != '(' && ExP_infix_reduce(operands, &operands_count, popped);
+    }
+    // what's left is the whole tree, or what was built of it before failing
+    ExTree result = NULL;
+    if (ok && operands_count == 1){
+        result = operands[--operands_count];
+    }
+    while (operands_count){
+        ExTree_cut_down(operands[--operands_count]);
+    }
+    if (operators != local_operators){
+        free(operators);
+    }
+    if (operands != local_operands){
+        free(operands);
+    }
+
+    ExTreeWrapper tree_wrapper = NULL;
+    if (result){
+        ExTree_init(&tree_wrapper, refined);
+    }
+    if (!tree_wrapper){
+        ExTree_cut_down(result);
+        free(refined);
+    }
+    else{
+        tree_wrapper->expression_tree = result;
+    }
+    ExP_phase(ExP_PHASE_BUILD, 0);
+
+    return tree_wrapper;
+}
+
+
+// forward declarations, from the ExParallel, ExLimit, ExSpan and ExCheck sections below
+static ExTreeWrapper ExParallel_parse(const char expression[], size_t length);
+static bool ExLimit_check(const char expression[], size_t length, ex_notation NOTATION);
+static int64_t ExSpan_to_sink(const char expression[], size_t length, ex_notation NOTATION, ExSink sink);
+static size_t ExCheck_operand(const char expression[], size_t start, size_t end, uint8_t kind, uint8_t operands);
+static bool ExCheck_limits(const char expression[], size_t length, ex_notation NOTATION);
+static bool ExCheck_expression(const char expression[], size_t length, ex_notation NOTATION, uint8_t operands);
+
+// the limits of the calling thread (0 for none), set with ExP_set_limits(),
+// and whether the last expression it parsed went over them
+static _Thread_local ex_limits ExLimit_limits;
+static _Thread_local bool ExLimit_exceeded = false;
+
+// why the last expression checked on the calling thread was rejected
+static _Thread_local ex_error ExCheck_error;
+
+
+static ExTreeWrapper ExP_parse(const char expression[], size_t length, ex_notation NOTATION, uint8_t operands){
+    /* Build an expression tree out of the first length characters of 
+       expression, whatever its notation, and return it wrapped in an ExTreeWrapper.
+       Infix expressions are built straight into a tree with the shunting-yard
+       algorithm (see ExP_parse_infix()); large ones are parsed on several threads if
+       they can be (see ExParallel_parse()).
+
+       The expression is checked first (see ExCheck_expression()), so that
+       nothing is allocated for it unless it's well formed and within the
+       limits of the calling thread; operands tells what it can have besides
+       integers (see enum expression_operands): names (variables) unless
+       it's going to be computed, fractions only if that's in double.
+       Return NULL if it isn't (ExP_last_error() tells why), or if memory 
+       couldn't be allocated.
+    */
+    ExTreeWrapper expression_tree_wrapper = NULL;
+
+    if (!ExCheck_expression(expression, length, NOTATION, operands)){
+        return NULL;
+    }
+
+    switch(NOTATION){
+        case(PREFIX):
+            ExP_phase(ExP_PHASE_BUILD, 1);
+            expression_tree_wrapper = ExP_parse_prefix(expression, length);
+            ExP_phase(ExP_PHASE_BUILD, 0);
+            break;
+
+        case(POSTFIX):
+            ExP_phase(ExP_PHASE_BUILD, 1);
+            expression_tree_wrapper = ExP_parse_postfix(expression, length);
+            ExP_phase(ExP_PHASE_BUILD, 0);
+            break;
+
+        case(INFIX):
+            if (length >= ExP_PARALLEL_MIN_LENGTH){
+                expression_tree_wrapper = ExParallel_parse(expression, length);
+            }
+            // NULL as well if it couldn't be parsed in parallel
+            if (!expression_tree_wrapper){
+                expression_tree_wrapper = ExP_parse_infix(expression, length);
+            }
+            break;
+
+        default:
+            return NULL;
+    }
+    // well formed, so only memory can have been missing
+    if (expression_tree_wrapper && !expression_tree_wrapper->expression_tree){
+        ExTree_destroy(&expression_tree_wrapper);
+    }
+    if (!expression_tree_wrapper){
+        ExCheck_fail(ExP_ERROR_MEMORY, 0);
+    }
+    return expression_tree_wrapper;
+}
+
+
+
+static int64_t ExP_convert_to_sink(const char expression[], size_t length, ex_notation NOTATION, ex_targets TARGET,
+                                   ExSink sink){
+    /* Parse the first length characters of expression and write its conversion
+       to the one notation in TARGET to sink, then flush it.
+       Return the number of bytes written, or -1 on failure.
+    */
+    if (!expression || (TARGET != ExP_TO_PREFIX && TARGET != ExP_TO_INFIX && TARGET != ExP_TO_POSTFIX)){
+        return -1;
+    }
+    // between prefix and postfix, no tree is needed
+    if ((NOTATION == PREFIX && TARGET == ExP_TO_POSTFIX) || (NOTATION == POSTFIX && TARGET == ExP_TO_PREFIX)){
+        return ExSpan_to_sink(expression, length, NOTATION, sink);
+    }
+    ExTreeWrapper expression_tree_wrapper = ExP_parse(expression, length, NOTATION, ExCheck_NAMES | ExCheck_FRACTIONS);
+    if (!expression_tree_wrapper){
+        return ExLimit_exceeded ? ExP_LIMIT_EXCEEDED : -1;
+    }
+    ExTree tree = expression_tree_wrapper->expression_tree;
+    if (tree){
+        ExP_phase(ExP_PHASE_WRITE, 1);
+        ExTree_write(tree, TARGET, sink);
+        ExSink_flush(sink);
+        ExP_phase(ExP_PHASE_WRITE, 0);
+    }
+    ExTree_destroy(&expression_tree_wrapper);
+
+    return (tree && !sink->failed) ? (int64_t)sink->written : -1;
+}
+
+
+
+/*               * * * ExParallel functions * * *                         */
+
+/* Parsing a large infix expression on several threads. The expression is
+   cut at its lowest-precedence operators outside of any parentheses, which
+   are all left-associative (?: and , are never cut at), so that it's
+   p0 op p1 op p2 ... op pn, and its tree is (((p0 op p1) op p2) ... op pn).
+   Each part p0 ... pn, itself a chain of one or more operands joined by 
+   those operators, is parsed by ExP_parse_infix() on a thread of its own,
+   and the op between two parts becomes a new node, inserted at the bottom 
+   of the chain that the part after it starts with.
+
+   The tree is exactly the one ExP_parse_infix() builds from the whole
+   expression, as long as every operator has its two operands: so 
+   expressions with a token out of place, like a unary -, are left to it
+   (to be rejected).
+*/
+
+
+// how many threads to parse large infix expressions on; 0 for one per online CPU
+static uint32_t ExParallel_threads = 0;
+
+#define ExParallel_MAX_THREADS 64
+
+
+static size_t ExParallel_token(const char expression[], size_t length, size_t start, uint8_t *kind){
+    /* Return the end of the token starting at expression[start] (not a space),
+       split off as ExP_refine() does it, and set *kind to what kind of token 
+       it is. length is the length of the whole expression.
+    */
+    bool name_x = expression[start] == 'x' && start + 1 < length && ExP_is_name_start(expression[start+1]);
+    uint32_t operator_length = ExP_is_plain(expression[start]) ? 0 : \
+                               ExP_operator_length(&expression[start], length - start);
+    if (operator_length && !name_x){
+        *kind = expression[start] == '(' ? ExParallel_OPEN : \
+                expression[start] == ')' ? ExParallel_CLOSE : ExParallel_OPERATOR;
+        return start + operator_length;
+    }
+
+    // an operand: everything up to the next space or operator ('x' only
+    // being one outside of names)
+    *kind = ExP_is_name_start(expression[start]) ? ExParallel_NAME : ExParallel_NUMBER;
+    bool in_name = false;
+    size_t end = start;
+    while (end < length && expression[end] != ' '){
+        if (ExP_is_plain(expression[end])){
+            in_name = in_name || expression[end] > '9';
+            end++;
+            continue;
+        }
+        name_x = expression[end] == 'x' && \
+                 (in_name || (end + 1 < length && ExP_is_name_start(expression[end+1])));
+        if (ExP_operator_length(&expression[end], length - end) && !name_x){
+            break;
+        }
+        in_name = in_name || ExP_is_name_start(expression[end]);
+        end++;
+    }
+
+    char name[sizeof(ExCall_functions[0].name)];
+    if (*kind == ExParallel_NAME && end - start < sizeof(name)){
+        memcpy(name, &expression[start], end - start);
+        name[end - start] = '\0';
+        *kind = ExCall_is_function(name) ? ExParallel_FUNCTION : ExParallel_NAME;
+    }
+    return end;
+}
+
+
+static bool ExParallel_may_follow(uint8_t previous, uint8_t current){
+    /* Whether a token of kind current can come right after one of kind
+       previous (ExParallel_NONE: at the start of the expression).
+    */
+    bool after_operand = previous == ExParallel_NUMBER || previous == ExParallel_NAME || \
+                         previous == ExParallel_CLOSE;
+
+    // the name of a function is always followed by the ( of its arguments
+    if (previous == ExParallel_FUNCTION){
+        return current == ExParallel_OPEN;
+    }
+    switch (current){
+        case ExParallel_OPERATOR:
+        case ExParallel_CLOSE:
+            return after_operand;
+
+        default:
+            return !after_operand;
+    }
+}
+
+
+static void *ExParallel_lex(void *chunk_arg){
+    /* First pass over a chunk: find how the depth changes over it, and 
+       whether each of its tokens can follow the one before it.
+       Run on a thread of its own.
+    */
+    struct expression_parallel_chunk *chunk = chunk_arg;
+    uint8_t previous = ExParallel_NONE;
+    int64_t depth = 0;
+
+    chunk->min_depth = 0;
+    chunk->first = ExParallel_NONE;
+    chunk->irregular = false;
+
+    size_t i = chunk->start;
+    while (i < chunk->end){
+        if (chunk->expression[i] == ' '){
+            i++;
+            continue;
+        }
+        uint8_t kind;
+        i = ExParallel_token(chunk->expression, chunk->length, i, &kind);
+
+        // the first token is checked against the last one of the chunk before
+        if (previous == ExParallel_NONE){
+            chunk->first = kind;
+        }
+        else if (!ExParallel_may_follow(previous, kind)){
+            chunk->irregular = true;
+        }
+        previous = kind;
+
+        if (kind == ExParallel_OPEN){
+            depth++;
+        }
+        else if (kind == ExParallel_CLOSE && --depth < chunk->min_depth){
+            chunk->min_depth = depth;
+        }
+    }
+    chunk->depth = depth;
+    chunk->last = previous;
+
+    return NULL;
+}
+
+
+static void *ExParallel_split(void *chunk_arg){
+    /* Second pass over a chunk, once chunk->depth is the depth at its start:
+       find the lowest precedence of its operators outside of any parentheses,
+       where the first of them is, and how many there are.
+       Run on a thread of its own.
+    */
+    struct expression_parallel_chunk *chunk = chunk_arg;
+    int64_t depth = chunk->depth;
+
+    chunk->precedence = UINT8_MAX;
+    chunk->splits = 0;
+
+    size_t i = chunk->start;
+    while (i < chunk->end){
+        if (chunk->expression[i] == ' '){
+            i++;
+            continue;
+        }
+        uint8_t kind;
+        size_t start = i;
+        i = ExParallel_token(chunk->expression, chunk->length, start, &kind);
+
+        if (kind == ExParallel_OPEN){
+            depth++;
+        }
+        else if (kind == ExParallel_CLOSE){
+            depth--;
+        }
+        else if (kind == ExParallel_OPERATOR && depth == 0){
+            uint8_t precedence = ExP_get_precedence((char *)&chunk->expression[start]);
+            if (precedence < chunk->precedence){
+                chunk->precedence = precedence;
+                chunk->split = start;
+                chunk->splits = 0;
+            }
+            if (precedence == chunk->precedence){
+                chunk->splits++;
+            }
+        }
+    }
+    return NULL;
+}
+
+
+static void *ExParallel_parse_part(void *part_arg){
+    /* Parse one of the parts the expression is cut into. Run on a thread of its own. */
+    struct expression_parallel_part *part = part_arg;
+    part->wrapper = ExP_parse_infix(&part->expression[part->start], part->end - part->start);
+
+    return NULL;
+}
+
+
+static void ExParallel_run(void *(*work)(void *), void *items, size_t item_size, uint32_t count){
+    /* Call work on each of the count items (of item_size bytes each) of the 
+       array items, each on a thread of its own but the first one, worked on
+       by the calling thread. Return once they're all done.
+       If a thread can't be created, the calling thread does its work as well.
+    */
+    pthread_t threads[ExParallel_MAX_THREADS + 1];
+    bool started[ExParallel_MAX_THREADS + 1];
+    char *item = items;
+
+    for (uint32_t i = 1; i < count; i++){
+        started[i] = pthread_create(&threads[i], NULL, work, item + i*item_size) == 0;
+    }
+    work(item);
+    for (uint32_t i = 1; i < count; i++){
+        if (started[i]){
+            pthread_join(threads[i], NULL);
+        }
+        else{
+            work(item + i*item_size);
+        }
+    }
+}
+
+
+static ExTreeWrapper ExParallel_parse(const char expression[], size_t length){
+    /* Parse the first length characters of the infix expression on several
+       threads at once (see above), if it can be: return NULL if it can't 
+       (it should be parsed by ExP_parse_infix() then), and if it's malformed
+       or memory couldn't be allocated.
+    */
+    uint32_t threads = ExParallel_threads;
+    if (!threads){
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (uint32_t)cpus : 1;
+    }
+    if (threads > ExParallel_MAX_THREADS){
+        threads = ExParallel_MAX_THREADS;
+    }
+    // ExP_refine() stops at a NUL
+    const char *nul = memchr(expression, '\0', length);
+    if (nul){
+        length = nul - expression;
+    }
+    if (threads < 2 || length < threads){
+        return NULL;
+    }
+
+    // cut the expression into chunks of about the same size, but only 
+    // before a character no token goes on past: a space, a parenthesis, 
+    // or an operator that doesn't start a longer one (or end one)
+    struct expression_parallel_chunk chunks[ExParallel_MAX_THREADS];
+    size_t start = 0;
+    for (uint32_t i = 0; i < threads; i++){
+        size_t end = (i + 1 == threads) ? length : length / threads * (i + 1);
+        if (end < start){
+            end = start;
+        }
+        while (end < length && !strchr(" ()+-*/^,?:", expression[end])){
+            end++;
+        }
+        chunks[i] = (struct expression_parallel_chunk){.expression = expression, .length = length, \
+                                                       .start = start, .end = end};
+        start = end;
+    }
+
+    ExParallel_run(ExParallel_lex, chunks, sizeof(chunks[0]), threads);
+
+    // the depth at the start of a chunk is the sum of the changes over the
+    // chunks before it (a prefix sum). It mustn't go below 0 anywhere, and
+    // must be back to 0 at the end. Tokens on either side of a cut between
+    // chunks must be able to follow one another as well.
+    int64_t depth = 0;
+    uint8_t previous = ExParallel_NONE;
+    for (uint32_t i = 0; i < threads; i++){
+        int64_t change = chunks[i].depth;
+        chunks[i].depth = depth;
+        if (chunks[i].irregular || depth + chunks[i].min_depth < 0){
+            return NULL;
+        }
+        if (chunks[i].first != ExParallel_NONE){
+            if (!ExParallel_may_follow(previous, chunks[i].first)){
+                return NULL;
+            }
+            previous = chunks[i].last;
+        }
+        depth += change;
+    }
+    if (depth || (previous != ExParallel_NUMBER && previous != ExParallel_NAME && previous != ExParallel_CLOSE)){
+        return NULL;
+    }
+
+    ExParallel_run(ExParallel_split, chunks, sizeof(chunks[0]), threads);
+
+    uint8_t precedence = UINT8_MAX;
+    for (uint32_t i = 0; i < threads; i++){
+        if (chunks[i].precedence < precedence){
+            precedence = chunks[i].precedence;
+        }
+    }
+    if (precedence == UINT8_MAX || precedence <= ExP_get_precedence(":")){
+        return NULL;
+    }
+
+    // cut the expression at the first operator of that precedence in each
+    // chunk that has any; the other ones are inside the parts
+    struct expression_parallel_part parts[ExParallel_MAX_THREADS + 1];
+    uint32_t count = 0;
+    uint32_t operators = 0;
+    start = 0;
+    for (uint32_t i = 0; i < threads; i++){
+        if (chunks[i].precedence != precedence){
+            continue;
+        }
+        parts[count++] = (struct expression_parallel_part){.expression = expression, .start = start, \
+                                                           .end = chunks[i].split, .operators = operators};
+        start = chunks[i].split + ExP_operator_length(&expression[chunks[i].split], length - chunks[i].split);
+        operators = chunks[i].splits - 1;
+    }
+    parts[count++] = (struct expression_parallel_part){.expression = expression, .start = start, \
+                                                       .end = length, .operators = operators};
+
+    ExParallel_run(ExParallel_parse_part, parts, sizeof(parts[0]), count);
+
+    // the nodes of the operators between the parts, whose tokens are copied
+    // to a string of their own, and where each goes in the part after it:
+    // in place of the leftmost operand of its chain of operators
+    char *tokens = malloc(3 * (count - 1));
+    ExTreeWrapper *wrappers = malloc(count * sizeof(ExTreeWrapper));
+    ExTree joints[ExParallel_MAX_THREADS];
+    ExTree *places[ExParallel_MAX_THREADS];
+    ExTreeWrapper tree_wrapper = NULL;
+    uint32_t joint_count = 0;
+
+    bool failed = !tokens || !wrappers;
+    for (uint32_t i = 0; i < count; i++){
+        failed = failed || !parts[i].wrapper || !parts[i].wrapper->expression_tree;
+    }
+    for (uint32_t i = 1; i < count && !failed; i++){
+        char *token = &tokens[3 * (i - 1)];
+        size_t at = parts[i-1].end;
+        uint32_t token_length = ExP_operator_length(&expression[at], length - at);
+        memcpy(token, &expression[at], token_length);
+        token[token_length] = '\0';
+
+        joints[i-1] = ExTree_new(token);
+        failed = !joints[i-1];
+        joint_count += !failed;
+
+        ExTree part = parts[i].wrapper->expression_tree;
+        places[i-1] = NULL;
+        for (uint32_t j = 1; j < parts[i].operators && part; j++){
+            part = part->left;
+        }
+        if (parts[i].operators){
+            failed = failed || !part || !part->left;
+            places[i-1] = part ? &part->left : NULL;
+        }
+    }
+    if (!failed){
+        ExTree_init(&tree_wrapper, tokens);
+    }
+    if (!tree_wrapper){
+        for (uint32_t i = 0; i < joint_count; i++){
+            free(joints[i]);
+        }
+        for (uint32_t i = 0; i < count; i++){
+            ExTree_destroy(&parts[i].wrapper);
+        }
+        free(tokens);
+        free(wrappers);
+        return NULL;
+    }
+
+    ExTree tree = parts[0].wrapper->expression_tree;
+    for (uint32_t i = 1; i < count; i++){
+        ExTree part = parts[i].wrapper->expression_tree;
+        ExTree joint = joints[i-1];
+        joint->left = tree;
+        if (places[i-1]){
+            joint->right = *places[i-1];
+            *places[i-1] = joint;
+            tree = part;
+        }
+        else{
+            joint->right = part;
+            tree = joint;
+        }
+    }
+    for (uint32_t i = 0; i < count; i++){
+        wrappers[i] = parts[i].wrapper;
+    }
+    tree_wrapper->expression_tree = tree;
+    tree_wrapper->parts = wrappers;
+    tree_wrapper->part_count = count;
+
+    return tree_wrapper;
+}
+
+
+
+/*               * * * ExLimit functions * * *                         */
+
+/* The limits set with ExP_set_limits(), enforced by ExP_parse() before it 
+   allocates anything: one pass over the tokens of the expression, split 
+   off the same way as ExP_refine() does it (see ExParallel_token()), that 
+   stops as soon as a limit is exceeded.
+*/
+
+
+static size_t ExLimit_bytes(size_t length, size_t tokens, ex_notation NOTATION){
+    /* An upper bound of the memory allocated to parse an expression of 
+       length characters and tokens tokens in NOTATION: the refined string,
+       plus for infix the postfix string ExP_to_postfix() writes; the tree
+       wrapper; a node and a stack item per token (for infix, another
+       stack item for the operators stack).
+    */
+    size_t bytes = 2*length + 1;
+    size_t per_token = sizeof(struct expression_tree) + sizeof(struct stackitem);
+
+    if (NOTATION == INFIX){
+        bytes += 2*length + 1;
+        per_token += sizeof(struct stackitem);
+    }
+    return bytes + sizeof(struct expression_tree_wrapper) + tokens * per_token;
+}
+
+
+static bool ExLimit_check(const char expression[], size_t length, ex_notation NOTATION){
+    /* Whether the first length characters of expression (fewer if a NUL
+       comes first) are within the limits of the calling thread. Record
+       the answer for ExP_limit_exceeded().
+    */
+    ex_limits limits = ExLimit_limits;
+    ExLimit_exceeded = false;
+
+    if (!limits.max_tokens && !limits.max_depth && !limits.max_bytes){
+        return true;
+    }
+    const char *end = memchr(expression, '\0', length);
+    if (end){
+        length = end - expression;
+    }
+    // the bound with no tokens at all already says no
+    if (limits.max_bytes && ExLimit_bytes(length, 0, NOTATION) > limits.max_bytes){
+        ExLimit_exceeded = true;
+        return false;
+    }
+
+    size_t tokens = 0;
+    int64_t depth = 0;
+    bool within = true;
+
+    // prefix: for each operator waiting for its operands, a bit telling
+    // whether it needs another one after the one being read (no more than 
+    // max_depth + 1 bits are ever needed; a bitmap that can't be allocated
+    // is taken as the expression being over the limits)
+    uint64_t local_waiting[ExSpan_LOCAL];
+    uint64_t *waiting = local_waiting;
+    uint32_t waiting_size = ExSpan_LOCAL;
+
+    size_t i = 0;
+    while (i < length && within){
+        if (expression[i] == ' '){
+            i++;
+            continue;
+        }
+        uint8_t kind;
+        size_t start = i;
+        i = ExParallel_token(expression, length, start, &kind);
+        tokens++;
+
+        // infix: the parentheses; postfix: the operands waiting for an 
+        // operator; prefix: the operators waiting for their operands
+        switch (NOTATION){
+            case INFIX:
+                depth += kind == ExParallel_OPEN ? 1 : kind == ExParallel_CLOSE ? -1 : 0;
+                break;
+
+            case POSTFIX:
+                depth += kind == ExParallel_NUMBER || kind == ExParallel_NAME ? 1 : \
+                         kind == ExParallel_OPERATOR ? -1 : 0;
+                break;
+
+            default:
+                if (!limits.max_depth){
+                    break;
+                }
+                if (kind == ExParallel_OPERATOR || kind == ExParallel_FUNCTION){
+                    if (!ExSpan_reserve((void **)&waiting, local_waiting, &waiting_size, \
+                                (uint32_t)(depth / 64) + 1, sizeof(uint64_t))){
+                        within = false;
+                        break;
+                    }
+                    // a function takes a single operand, its argument list
+                    uint64_t bit = (uint64_t)1 << (depth % 64);
+                    waiting[depth / 64] = kind == ExParallel_OPERATOR ? waiting[depth / 64] | bit : \
+                                                                          waiting[depth / 64] & ~bit;
+                    depth++;
+                }
+                else if (kind == ExParallel_NUMBER || kind == ExParallel_NAME){
+                    // the operand completes the operators that needed nothing
+                    // else, and is the first one of the next operator up
+                    while (depth && !(waiting[(depth - 1) / 64] & ((uint64_t)1 << ((depth - 1) % 64)))){
+                        depth--;
+                    }
+                    if (depth){
+                        waiting[(depth - 1) / 64] &= ~((uint64_t)1 << ((depth - 1) % 64));
+                    }
+                }
+                break;
+        }
+        if ((limits.max_tokens && tokens > limits.max_tokens) || \
+                (limits.max_depth && depth > 0 && (uint64_t)depth > limits.max_depth)){
+            within = false;
+        }
+    }
+    if (waiting != local_waiting){
+        free(waiting);
+    }
+    if (within && limits.max_bytes && ExLimit_bytes(length, tokens, NOTATION) > limits.max_bytes){
+        within = false;
+    }
+    ExLimit_exceeded = !within;
+    return within;
+}
+
+
+
+/*               * * * ExStream functions * * *                         */
+
+
+static bool ExStream_reserve(void **array, uint32_t *size, uint32_t needed, size_t item_size){
+    /* Make sure *array, currently with room for *size items of item_size bytes,
+       has room for at least needed items, doubling it as necessary.
+       Return false if memory couldn't be allocated.
+    */
+    if (needed <= *size){
+        return true;
+    }
+    uint32_t new_size = *size ? *size : 16;
+    while (new_size < needed){
+        new_size *= 2;
+    }
+    void *new_array = realloc(*array, new_size * item_size);
+    if (!new_array){
+        return false;
+    }
+    *array = new_array;
+    *size = new_size;
+
+    return true;
+}
+
+
+static void ExStream_write_token(ExStream stream, const char *token, size_t length){
+    /* Write token to the stream's output, preceded by a space unless it's 
+       the first token written. Used for prefix and postfix output.
+    */
+    if (stream->wrote_token){
+        stream->output(" ", 1, stream->context);
+    }
+    stream->output(token, length, stream->context);
+    stream->wrote_token = true;
+}
+
+
+static void ExStream_write_infix(ExStream stream, const char *token, size_t length){
+    /* Write token to the stream's output, for infix output: x, the operator,
+       gets spaces around it, which keep it apart from a name (see 
+       ExTree_traverse_inorder()); nothing else needs any.
+    */
+    if (token[0] == 'x' && length == 1){
+        stream->output(" x ", 3, stream->context);
+    }else{
+        stream->output(token, length, stream->context);
+    }
+}
+
+
+static const char *ExStream_frame_token(struct expression_stream_frame *frame){
+    /* Return the token of frame: the name of its function, or its operator */
+    return frame->function >= 0 ? ExCall_functions[frame->function].name : frame->operator;
+}
+
+
+static struct expression_stream_value ExStream_apply(char *operator, struct expression_stream_value left,
+                                                     struct expression_stream_value right){
+    /* Apply the binary operator to the operands, as ExTree_traverse() does:
+       the result is that of the first operand that divides by 0, if any,
+       but && and || only look at their right operand when they need it.
+       A division by 0, or of INT32_MIN by -1, is only recorded in the 
+       result: it fails the value if it's used, but never the conversion.
+    */
+    struct expression_stream_value result = {0, ExP_ERROR_NONE, 0, false};
+    uint8_t opcode = ExP_opcode(operator);
+
+    if (left.error){
+        result.error = left.error;
+        return result;
+    }
+    if ((opcode == ExP_OP_AND && !left.value) || (opcode == ExP_OP_OR && left.value)){
+        result.value = opcode == ExP_OP_OR;
+        return result;
+    }
+    if (right.error){
+        result.error = right.error;
+        return result;
+    }
+    if (opcode == ExP_OP_DIV && (right.value == 0 || (right.value == -1 && left.value == INT32_MIN))){
+        result.error = right.value ? ExP_ERROR_OVERFLOW : ExP_ERROR_DIVISION;
+        return result;
+    }
+    result.value = ExP_apply(opcode, left.value, right.value);
+    return result;
+}
+
+
+static bool ExStream_reduce(ExStream stream, char *operator, int32_t function){
+    /* Apply operator, or the function with id function unless it's -1, to
+       the values on top of the stack, leaving the result there instead.
+       , and : compute nothing: they only mark the values as an argument
+       list, or as the branches of a ?:, which are what a call and a ? 
+       take, and all they take. c ? a : b is only the branch that's taken.
+       Return false if those values can't be the operands of operator.
+    */
+    struct expression_stream_value *values = stream->values;
+    uint32_t count = stream->values_count;
+
+    if (function >= 0){
+        if (!count || values[count - 1].is_else){
+            return false;
+        }
+        uint32_t arguments = values[count - 1].arguments ? values[count - 1].arguments : 1;
+        if (arguments < ExCall_functions[function].min_arguments || \
+                arguments > ExCall_functions[function].max_arguments){
+            return false;
+        }
+        struct expression_stream_value *first = &values[count - arguments];
+        int32_t list[ExP_MAX_ARGUMENTS];
+        ex_error_kind error = ExP_ERROR_NONE;
+
+        for (uint32_t i = 0; i < arguments; i++){
+            list[i] = first[i].value;
+            error = error ? error : first[i].error;
+        }
+        first->value = error ? 0 : ExCall_apply(function, list, arguments);
+        first->error = error;
+        first->arguments = 0;
+        stream->values_count = count - arguments + 1;
+        return true;
+    }
+
+    if (count < (operator[0] == '?' ? 3u : 2u)){     // not enough operands for the operator
+        return false;
+    }
+    struct expression_stream_value *left = &values[count - 2], *right = &values[count - 1];
+
+    if (operator[0] == '?'){
+        struct expression_stream_value *condition = &values[count - 3];
+        if (!right->is_else || left->is_else || left->arguments || condition->is_else || condition->arguments){
+            return false;
+        }
+        if (!condition->error){
+            *condition = condition->value ? *left : *right;
+            condition->is_else = false;
+        }
+        stream->values_count -= 2;
+        return true;
+    }
+    // no argument list anywhere but in a call, and no branch but under a ?
+    if (left->is_else || right->is_else || right->arguments || (left->arguments && operator[0] != ',')){
+        return false;
+    }
+    switch (operator[0]){
+        case ':':
+            right->is_else = true;
+            return true;
+
+        case ',':
+            right->arguments = (left->arguments ? left->arguments : 1) + 1;
+            return right->arguments <= ExP_MAX_ARGUMENTS;
+
+        default:
+            *left = ExStream_apply(operator, *left, *right);
+            stream->values_count--;
+            return true;
+    }
+}
+
+
+static void ExStream_postfix_token(ExStream stream, uint8_t kind, const char *text, size_t length, int32_t value){
+    /* Handle the next token of a postfix token stream: either the input
+       itself, or what the shunting-yard produces from infix input.
+       kind is the kind of the token (see ExParallel_token()), and value 
+       the value of an operand, or the id of a function.
+
+       The operands' values are kept on a stack until the operator they
+       belong to arrives; that stack is also what detects malformed input, so
+       it's maintained even when the value isn't requested.
+    */
+    if (kind == ExParallel_OPERATOR || kind == ExParallel_FUNCTION){
+        char operator[3] = {0};
+        memcpy(operator, text, kind == ExParallel_OPERATOR ? length : 0);
+
+        if (!ExStream_reduce(stream, operator, kind == ExParallel_FUNCTION ? value : -1)){
+            stream->failed = true;
+            return;
+        }
+    }
+    else{
+        if (!ExStream_reserve((void **)&stream->values, &stream->values_size, \
+                    stream->values_count + 1, sizeof(struct expression_stream_value))){
+            stream->failed = true;
+            return;
+        }
+        stream->values[stream->values_count++] = (struct expression_stream_value){value, ExP_ERROR_NONE, 0, false};
+    }
+
+    if (stream->TARGETS & ExP_TO_POSTFIX){
+        ExStream_write_token(stream, text, length);
+    }
+}
+
+
+static void ExStream_prefix_token(ExStream stream, uint8_t kind, const char *text, size_t length, int32_t value){
+    /* Handle the next token of a prefix input stream.
+
+       Operators are pushed as frames, waiting for their operands. When an
+       operand completes a frame's right side, the frame is reduced, which
+       may in turn complete its parent's right side, and so on up. A call
+       takes a single operand, its argument list.
+       Postfix output falls out of the same process: an operator is written
+       when its frame is reduced. So does infix output: the name of a 
+       function and '(' when it arrives, the operator itself after its left
+       operand, ')' on reduction. An operator only gets parentheses where 
+       ExTree_traverse_inorder() would put them: that depends only on it, on 
+       the operator below it, and on which operand of that one it is, all
+       known as soon as it arrives.
+    */
+    if (stream->complete){     // tokens past the end of the expression
+        stream->failed = true;
+        return;
+    }
+    if (stream->TARGETS & ExP_TO_PREFIX){
+        ExStream_write_token(stream, text, length);
+    }
+
+    if (kind == ExParallel_OPERATOR || kind == ExParallel_FUNCTION){
+        if (!ExStream_reserve((void **)&stream->frames, &stream->frames_size, \
+                    stream->frames_count + 1, sizeof(struct expression_stream_frame))){
+            stream->failed = true;
+            return;
+        }
+        struct expression_stream_frame *frame = &stream->frames[stream->frames_count++];
+        memset(frame->operator, 0, sizeof(frame->operator));
+        memcpy(frame->operator, text, kind == ExParallel_OPERATOR ? length : 0);
+        frame->function = kind == ExParallel_FUNCTION ? value : -1;
+        frame->have_left = false;
+        frame->parenthesized = false;
+
+        if (stream->TARGETS & ExP_TO_INFIX){
+            // the operands of a call are already in its parentheses
+            struct expression_stream_frame *parent = stream->frames_count > 1 ? frame - 1 : NULL;
+            if (frame->function >= 0){
+                stream->output(text, length, stream->context);
+                stream->output("(", 1, stream->context);
+            }
+            else if (parent && parent->function < 0){
+                frame->parenthesized = ExP_needs_parentheses(parent->operator, frame->operator, parent->have_left);
+                if (frame->parenthesized){
+                    stream->output("(", 1, stream->context);
+                }
+            }
+        }
+        return;
+    }
+
+    if (stream->TARGETS & ExP_TO_INFIX){
+        stream->output(text, length, stream->context);
+    }
+    // the postfix output is written here, the operand being its own postfix token
+    ExStream_postfix_token(stream, kind, text, length, value);
+
+    // the operand is complete: reduce as far up as it goes
+    while (stream->frames_count && !stream->failed){
+        struct expression_stream_frame *frame = &stream->frames[stream->frames_count - 1];
+
+        if (frame->function < 0 && !frame->have_left){
+            frame->have_left = true;
+            if (stream->TARGETS & ExP_TO_INFIX){
+                ExStream_write_infix(stream, frame->operator, strlen(frame->operator));
+            }
+            return;
+        }
+        if (!ExStream_reduce(stream, frame->operator, frame->function)){
+            stream->failed = true;
+            return;
+        }
+        stream->frames_count--;
+
+        if (stream->TARGETS & ExP_TO_POSTFIX){
+            ExStream_write_token(stream, ExStream_frame_token(frame), strlen(ExStream_frame_token(frame)));
+        }
+        if ((stream->TARGETS & ExP_TO_INFIX) && (frame->function >= 0 || frame->parenthesized)){
+            stream->output(")", 1, stream->context);
+        }
+    }
+    // no operator left waiting: that was the whole expression
+    stream->complete = !stream->failed;
+}
+
+
+static void ExStream_pop_operator(ExStream stream){
+    /* Pop the operator on top of the shunting-yard stack and pass it on */
+    struct expression_stream_frame *frame = &stream->frames[--stream->frames_count];
+    const char *token = ExStream_frame_token(frame);
+
+    ExStream_postfix_token(stream, frame->function >= 0 ? ExParallel_FUNCTION : ExParallel_OPERATOR, \
+                           token, strlen(token), frame->function);
+}
+
+
+static void ExStream_infix_token(ExStream stream, uint8_t kind, const char *text, size_t length, int32_t value){
+    /* Handle the next token of an infix input stream: run the shunting-yard
+       algorithm, exactly as ExP_infix_shunt() does, but passing the postfix 
+       tokens it produces straight on to ExStream_postfix_token() instead of 
+       writing them to a string. Whether each token can come after the one
+       before it is checked as it arrives, as ExCheck_infix() does.
+       Infix output is the input itself, token by token: its parentheses 
+       are kept, only the whitespace is normalized.
+    */
+    if (!ExParallel_may_follow(stream->previous, kind)){
+        stream->failed = true;
+        return;
+    }
+    stream->previous = kind;
+    if (stream->TARGETS & ExP_TO_INFIX){
+        ExStream_write_infix(stream, text, length);
+    }
+
+    if (kind == ExParallel_NUMBER || kind == ExParallel_NAME){
+        ExStream_postfix_token(stream, kind, text, length, value);
+        return;
+    }
+
+    if (kind == ExParallel_CLOSE){
+        // pop until the matching left parenthesis
+        while (true){
+            if (!stream->frames_count || stream->failed){     // no matching parenthesis
+                stream->failed = true;
+                return;
+            }
+            if (stream->frames[stream->frames_count - 1].operator[0] == '('){
+                stream->frames_count--;
+                break;
+            }
+            ExStream_pop_operator(stream);
+        }
+
+        // if these were the parentheses of a function call, the function comes next
+        if (stream->frames_count && stream->frames[stream->frames_count - 1].function >= 0){
+            ExStream_pop_operator(stream);
+        }
+        return;
+    }
+
+    if (kind == ExParallel_OPERATOR && text[0] == ':'){
+        // pop everything down to the ? it belongs to: all the other operators
+        // bind tighter, and so does every ?: already complete (a : on top of its ?)
+        while (stream->frames_count && !stream->failed && \
+                stream->frames[stream->frames_count - 1].operator[0] != '(' && \
+                stream->frames[stream->frames_count - 1].operator[0] != '?'){
+            bool is_else = stream->frames[stream->frames_count - 1].operator[0] == ':';
+            ExStream_pop_operator(stream);
+            if (is_else && stream->frames_count && stream->frames[stream->frames_count - 1].operator[0] == '?'){
+                ExStream_pop_operator(stream);
+            }
+        }
+    }
+    else if (kind == ExParallel_OPERATOR){
+        char operator[3] = {0};
+        memcpy(operator, text, length);
+
+        // pop everything current doesn't bind tighter than
+        while (stream->frames_count && !stream->failed && \
+                stream->frames[stream->frames_count - 1].operator[0] != '(' && \
+                !ExP_binds_tighter(operator, stream->frames[stream->frames_count - 1].operator)){
+            ExStream_pop_operator(stream);
+        }
+    }
+    if (stream->failed || !ExStream_reserve((void **)&stream->frames, &stream->frames_size, \
+                stream->frames_count + 1, sizeof(struct expression_stream_frame))){
+        stream->failed = true;
+        return;
+    }
+    struct expression_stream_frame *frame = &stream->frames[stream->frames_count++];
+    memset(frame->operator, 0, sizeof(frame->operator));
+    memcpy(frame->operator, text, kind == ExParallel_FUNCTION ? 0 : length);
+    frame->function = kind == ExParallel_FUNCTION ? value : -1;
+    frame->have_left = false;
+    frame->parenthesized = false;
+}
+
+
+static bool ExStream_within_limits(ExStream stream){
+    /* Whether stream is still within its limits, counted as ExLimit_check()
+       does, with the memory it holds as the bytes. If not, fail it and 
+       record that for ExP_limit_exceeded().
+    */
+    ex_limits limits = stream->limits;
+    uint64_t depth = stream->NOTATION == INFIX ? stream->parentheses : \
+                     stream->NOTATION == POSTFIX ? stream->values_count : stream->frames_count;
+    uint64_t bytes = (uint64_t)stream->values_size * sizeof(struct expression_stream_value) + \
+                     (uint64_t)stream->frames_size * sizeof(struct expression_stream_frame) + \
+                     stream->token_size;
+
+    if ((limits.max_tokens && stream->tokens > limits.max_tokens) || \
+            (limits.max_depth && depth > limits.max_depth) || \
+            (limits.max_bytes && bytes > limits.max_bytes)){
+        stream->exceeded = true;
+        stream->failed = true;
+        ExLimit_exceeded = true;
+        return false;
+    }
+    return true;
+}
+
+
+static void ExStream_token(ExStream stream, uint8_t kind, const char *text, size_t length, int32_t value){
+    /* Pass the next token on to the handler for the stream's notation, 
+       then check the stream against its limits
+    */
+    stream->tokens++;
+    if (kind == ExParallel_OPEN){
+        stream->parentheses++;
+    }
+    else if (kind == ExParallel_CLOSE && stream->parentheses){
+        stream->parentheses--;
+    }
+    switch (stream->NOTATION){
+        case PREFIX:
+            ExStream_prefix_token(stream, kind, text, length, value);
+            break;
+
+        case POSTFIX:
+            ExStream_postfix_token(stream, kind, text, length, value);
+            break;
+
+        case INFIX:
+            ExStream_infix_token(stream, kind, text, length, value);
+            break;
+    }
+    if (!stream->failed){
+        ExStream_within_limits(stream);
+    }
+}
+
+
+static void ExStream_end_operand(ExStream stream){
+    /* If an operand is being read, it ends here: check it, and pass it on.
+       A name is either that of a function, or a variable, which has no
+       value: that fails the stream if the value was requested.
+    */
+    uint32_t length = stream->token_length;
+    if (!length){
+        return;
+    }
+    stream->token[length] = '\0';
+    stream->token_length = 0;
+    stream->in_name = false;
+
+    uint8_t kind = ExP_is_name_start(stream->token[0]) ? ExParallel_NAME : ExParallel_NUMBER;
+    uint8_t operands = stream->TARGETS & ExP_TO_VALUE ? ExCheck_INTEGERS : ExCheck_NAMES | ExCheck_FRACTIONS;
+    if (ExCheck_operand(stream->token, 0, length, kind, operands | ExCheck_NAMES) < length){
+        stream->failed = true;
+        return;
+    }
+    int32_t value = 0;
+    if (kind == ExParallel_NUMBER){
+        value = str_to_int(stream->token);
+    }
+    else if (length < sizeof(ExCall_functions[0].name) && ExCall_is_function(stream->token)){
+        kind = ExParallel_FUNCTION;
+        value = ExCall_lookup(stream->token);
+    }
+    else if (stream->TARGETS & ExP_TO_VALUE){
+        stream->failed = true;
+        return;
+    }
+    ExStream_token(stream, kind, stream->token, length, value);
+}
+
+
+static size_t ExStream_char(ExStream stream, char current, char next){
+    /* Read the character current of the input, next being the one after it
+       ('\0' at the end of the input): split the input into tokens as 
+       ExParallel_token() does. Return how many characters were used: 2 for 
+       a two-character operator (<= == != && ||), 1 otherwise.
+    */
+    if (current == ' ' || current == '\t' || current == '\n' || current == '\r'){
+        ExStream_end_operand(stream);
+        return 1;
+    }
+    // 'x' is multiplication, unless it's in a name or starts one
+    char pair[2] = {current, next};
+    bool name_x = current == 'x' && (stream->in_name || ExP_is_name_start(next));
+    uint32_t operator_length = (ExP_is_plain(current) || name_x) ? 0 : ExP_operator_length(pair, 2);
+
+    if (operator_length){
+        ExStream_end_operand(stream);
+        uint8_t kind = current == '(' ? ExParallel_OPEN : current == ')' ? ExParallel_CLOSE : ExParallel_OPERATOR;
+
+        // parentheses only make sense in infix notation
+        if (kind != ExParallel_OPERATOR && stream->NOTATION != INFIX){
+            stream->failed = true;
+        }
+        else if (!stream->failed){
+            ExStream_token(stream, kind, pair, operator_length, 0);
+        }
+        return operator_length;
+    }
+
+    // part of an operand, checked once it's complete (only its size, which
+    // counts against the limits, as it grows)
+    uint32_t token_size = stream->token_size;
+    if (!ExStream_reserve((void **)&stream->token, &stream->token_size, stream->token_length + 2, sizeof(char))){
+        stream->failed = true;
+        return 1;
+    }
+    if (stream->token_size != token_size && !ExStream_within_limits(stream)){
+        return 1;
+    }
+    stream->token[stream->token_length++] = current;
+    stream->in_name = stream->in_name || ExP_is_name_start(current);
+    return 1;
+}
+
+  
+ 
+ 
+
+    
+/*               * * * ExSpan functions * * *                         */
+
+/* Prefix and postfix expressions both write every operator next to its 
+   operands, so either one can be rewritten into the other directly: no
+   tree, only a stack of the operators still waiting for operands.
+
+   Prefix to postfix is a single pass: each operand is written out as it
+   comes, and so is each operator once its last operand is complete. 
+   Postfix to prefix is the same pass, backwards: read from its end, a 
+   postfix expression is the prefix expression of the tree with the 
+   operands of every operator swapped, so the pass yields the postfix 
+   expression of that tree, which, written from the end of the output 
+   towards its start, is the prefix expression sought. The length of the 
+   output (that of the input, spaced out) is known up front.
+
+   Function calls are checked (a known function, with a number of arguments
+   it accepts, and , only in argument lists), so is every ? having its :,
+   and the expression has to be complete: every operator with all its operands,
+   and nothing after the last one.
+*/
+
+
+static size_t ExSpan_trim(const char expression[], size_t length){
+    /* The length of expression: length, or less if a NUL comes first */
+    const char *end = memchr(expression, '\0', length);
+    return end ? (size_t)(end - expression) : length;
+}
+
+
+static int64_t ExSpan_measure(const char expression[], size_t length){
+    /* Return the length of expression, a prefix or postfix expression of
+       length characters, once its tokens are separated by single spaces:
+       the length of its conversion. -1 if it has no tokens.
+    */
+    int64_t needed = -1;
+    size_t i = 0;
+    while (i < length){
+        if (expression[i] == ' '){
+            i++;
+            continue;
+        }
+        uint8_t kind;
+        size_t start = i;
+        i = ExParallel_token(expression, length, start, &kind);
+        needed += (i - start) + 1;
+    }
+    return needed;
+}
+
+
+static void ExSpan_init(ExSpan span, const char expression[], size_t length, ex_notation NOTATION){
+    /* Set up span to read expression, in NOTATION (PREFIX or POSTFIX), 
+       without any output yet
+    */
+    span->expression = expression;
+    span->length = length;
+    span->backwards = NOTATION == POSTFIX;
+    span->position = span->backwards ? length : 0;
+    span->failed = false;
+    span->operands = ExCheck_NAMES | ExCheck_FRACTIONS;
+
+    span->run = span->local_run;
+    span->run_count = 0;
+    span->run_size = ExSpan_LOCAL;
+    span->run_end = 0;
+
+    span->sink = NULL;
+    span->cursor = NULL;
+    span->wrote_token = false;
+
+    span->frames = span->local_frames;
+    span->frames_count = 0;
+    span->frames_size = ExSpan_LOCAL;
+}
+
+
+static void ExSpan_free(ExSpan span){
+    /* Free the stacks of span, if they had to move to the heap */
+    if (span->run != span->local_run){
+        free(span->run);
+    }
+    if (span->frames != span->local_frames){
+        free(span->frames);
+    }
+    span->run = span->local_run;
+    span->frames = span->local_frames;
+}
+
+
+static bool ExSpan_reserve(void **array, void *local, uint32_t *size, uint32_t needed, size_t item_size){
+    /* ExStream_reserve(), for an array that starts out as local, a buffer 
+       of *size items that can't be reallocated: the first time it's 
+       outgrown, it's copied to the heap.
+    */
+    if (needed <= *size || *array != local){
+        return ExStream_reserve(array, size, needed, item_size);
+    }
+    uint32_t new_size = *size * 2;
+    while (new_size < needed){
+        new_size *= 2;
+    }
+    void *heap = malloc(new_size * item_size);
+    if (!heap){
+        return false;
+    }
+    memcpy(heap, local, *size * item_size);
+    *array = heap;
+    *size = new_size;
+
+    return true;
+}
+
+
+static bool ExSpan_next(ExSpan span, size_t *start, size_t *end, uint8_t *kind){
+    /* Read the next token of the expression, in span's direction: set 
+       [*start, *end) to where it is and *kind to its kind (see 
+       ExParallel_token()). Return false at the end of the input, or if
+       memory couldn't be allocated (span->failed).
+    */
+    const char *expression = span->expression;
+
+    if (!span->backwards){
+        while (span->position < span->length && expression[span->position] == ' '){
+            span->position++;
+        }
+        if (span->position == span->length){
+            return false;
+        }
+        *start = span->position;
+        *end = span->position = ExParallel_token(expression, span->length, *start, kind);
+        return true;
+    }
+
+    if (!span->run_count){
+        // tokens can only be split from their start ('x' is multiplication
+        // or part of a name depending on what comes before it), so take the
+        // next run without spaces to the left, and split that
+        size_t run_end = span->position;
+        while (run_end && expression[run_end-1] == ' '){
+            run_end--;
+        }
+        if (!run_end){
+            return false;
+        }
+        size_t run_start = run_end;
+        while (run_start && expression[run_start-1] != ' '){
+            run_start--;
+        }
+        for (size_t i = run_start; i < run_end; span->run_count++){
+            if (!ExSpan_reserve((void **)&span->run, span->local_run, &span->run_size, \
+                        span->run_count + 1, sizeof(size_t))){
+                span->failed = true;
+                return false;
+            }
+            span->run[span->run_count] = i;
+            i = ExParallel_token(expression, run_end, i, kind);
+        }
+        span->position = run_start;
+        span->run_end = run_end;
+    }
+    *start = span->run[--span->run_count];
+    *end = ExParallel_token(expression, span->run_end, *start, kind);
+    return true;
+}
+
+
+static void ExSpan_write(ExSpan span, size_t start, size_t end){
+    /* Write the token expression[start, end) to span's output */
+    size_t length = end - start;
+
+    if (span->sink){
+        if (span->wrote_token){
+            ExSink_write(span->sink, " ", 1);
+        }
+        ExSink_write(span->sink, &span->expression[start], length);
+    }
+    else if (span->cursor){
+        if (span->wrote_token){
+            *--span->cursor = ' ';
+        }
+        span->cursor -= length;
+        memcpy(span->cursor, &span->expression[start], length);
+    }
+    span->wrote_token = true;
+}
+
+
+static ex_error_kind ExSpan_reduce(ExSpan span, struct expression_span_frame *frame, uint32_t *arguments, bool *is_else){
+    /* The last operand of frame has just been completed: *arguments is 
+       how many arguments it is a list of if it's a ',', else 0, and 
+       *is_else whether it's the : of a ?:. Check that frame's operands can
+       be those of its operator (no argument list anywhere but in a call), and that
+       every : is the right operand of a ? and the other way around. Set 
+       *arguments and *is_else to those of frame.
+       Return ExP_ERROR_NONE, or what's wrong.
+    */
+    if (frame->is_call){
+        char name[sizeof(ExCall_functions[0].name)];
+        memcpy(name, &span->expression[frame->start], frame->length);
+        name[frame->length] = '\0';
+
+        int32_t function = ExCall_lookup(name);
+        uint32_t count = *arguments ? *arguments : 1;
+        bool was_else = *is_else;
+        *arguments = 0;
+        *is_else = false;
+        if (was_else){
+            return ExP_ERROR_CONDITIONAL;
+        }
+        return (function >= 0 && count >= ExCall_functions[function].min_arguments && \
+                count <= ExCall_functions[function].max_arguments) ? ExP_ERROR_NONE : ExP_ERROR_CALL;
+    }
+    // the operands in the order of the expression, not of reading
+    uint32_t left = span->backwards ? *arguments : frame->first_arguments;
+    uint32_t right = span->backwards ? frame->first_arguments : *arguments;
+    bool left_else = span->backwards ? *is_else : frame->first_is_else;
+    bool right_else = span->backwards ? frame->first_is_else : *is_else;
+
+    char operator = span->expression[frame->start];
+    *arguments = 0;
+    *is_else = operator == ':';
+
+    if (operator == '?' ? (left_else || !right_else) : (left_else || right_else)){
+        return ExP_ERROR_CONDITIONAL;
+    }
+    // , only in argument lists, which are left-deep chains of them
+    if (operator == ','){
+        *arguments = (left ? left : 1) + 1;
+        return right ? ExP_ERROR_CALL : ExP_ERROR_NONE;
+    }
+    return (left || right) ? ExP_ERROR_CALL : ExP_ERROR_NONE;
+}
+
+
+static bool ExSpan_convert(ExSpan span){
+    /* Convert the expression of span, writing every operand as it's read
+       and every operator once its last operand is (see ExSpan_write()).
+       Return false if the expression is malformed, or memory couldn't be
+       allocated, recording why with ExCheck_fail().
+    */
+    size_t start, end;
+    uint8_t kind;
+    bool complete = false;
+    uint32_t arguments = 0;
+    bool is_else = false;
+    size_t root = 0;        // where the root of the last subtree completed is
+    bool writing = span->sink || span->cursor;
+
+    while (ExSpan_next(span, &start, &end, &kind)){
+        size_t invalid = (kind == ExParallel_NAME || kind == ExParallel_NUMBER) ? \
+                         ExCheck_operand(span->expression, start, end, kind, span->operands) : end;
+        if (invalid < end){
+            return ExCheck_fail(ExP_ERROR_CHARACTER, invalid);
+        }
+        if (complete){      // a whole expression already, and more
+            return ExCheck_fail(ExP_ERROR_OPERATOR, start);
+        }
+        if (kind == ExParallel_OPEN || kind == ExParallel_CLOSE){
+            return ExCheck_fail(ExP_ERROR_PARENTHESIS, start);
+        }
+        if (kind == ExParallel_OPERATOR || kind == ExParallel_FUNCTION){
+            if (span->frames_count == span->frames_size && \
+                    !ExSpan_reserve((void **)&span->frames, span->local_frames, &span->frames_size, \
+                        span->frames_count + 1, sizeof(struct expression_span_frame))){
+                return ExCheck_fail(ExP_ERROR_MEMORY, start);
+            }
+            struct expression_span_frame *frame = &span->frames[span->frames_count++];
+            frame->start = start;
+            frame->length = end - start;
+            frame->is_call = kind == ExParallel_FUNCTION;
+            frame->have_first = false;
+            frame->first_is_else = false;
+            frame->first_arguments = 0;
+            continue;
+        }
+        if (writing){
+            ExSpan_write(span, start, end);
+        }
+        arguments = 0;
+        is_else = false;
+        root = start;
+
+        // the operand is complete: reduce as far up as it goes
+        while (span->frames_count){
+            struct expression_span_frame *frame = &span->frames[span->frames_count - 1];
+
+            if (!frame->is_call && !frame->have_first){
+                frame->have_first = true;
+                frame->first_arguments = arguments;
+                frame->first_is_else = is_else;
+                break;
+            }
+            ex_error_kind error = ExSpan_reduce(span, frame, &arguments, &is_else);
+            if (error != ExP_ERROR_NONE){
+                return ExCheck_fail(error, frame->start);
+            }
+            if (writing){
+                ExSpan_write(span, frame->start, frame->start + frame->length);
+            }
+            root = frame->start;
+            span->frames_count--;
+        }
+        // no operator left waiting: that was the whole expression
+        complete = !span->frames_count;
+    }
+
+    if (span->failed){
+        return ExCheck_fail(ExP_ERROR_MEMORY, span->position);
+    }
+    if (span->frames_count){
+        // an operator is missing operands: in prefix, at the end; in
+        // postfix, the operator read last has none before it
+        return ExCheck_fail(ExP_ERROR_OPERAND, span->backwards ? \
+                            span->frames[span->frames_count - 1].start : span->length);
+    }
+    if (!complete){
+        return ExCheck_fail(ExP_ERROR_EMPTY, 0);
+    }
+    if (arguments || is_else){
+        return ExCheck_fail(arguments ? ExP_ERROR_CALL : ExP_ERROR_CONDITIONAL, root);
+    }
+    return true;
+}
+
+
+static int64_t ExSpan_into(const char expression[], size_t length, ex_notation NOTATION, char buffer[], size_t size){
+    /* Convert the first length characters of expression, in PREFIX or
+       POSTFIX notation, to the other one, and write the conversion into
+       buffer if it fits, with its NUL, as ExP_convert_into() does (if it
+       doesn't, the expression is still checked). Return the length of 
+       the conversion, -1 if the expression is malformed or memory couldn't
+       be allocated, ExP_LIMIT_EXCEEDED if it goes over the limits of the 
+       calling thread.
+    */
+    length = ExSpan_trim(expression, length);
+    if (!ExCheck_limits(expression, length, NOTATION)){
+        return ExP_LIMIT_EXCEEDED;
+    }
+    int64_t needed = ExSpan_measure(expression, length);
+    if (needed < 0){
+        ExCheck_fail(ExP_ERROR_EMPTY, 0);
+        return -1;
+    }
+    ExP_phase(ExP_PHASE_WRITE, 1);
+    struct expression_span span;
+    ExSpan_init(&span, expression, length, NOTATION);
+
+    struct expression_sink sink;
+    bool fits = (size_t)needed < size;
+    if (fits && span.backwards){
+        span.cursor = buffer + needed;
+    }
+    else if (fits){
+        ExSink_init(&sink, buffer, needed, NULL, NULL, -1);
+        span.sink = &sink;
+    }
+    bool converted = ExSpan_convert(&span);
+    ExSpan_free(&span);
+    if (fits && converted){
+        buffer[needed] = '\0';
+    }
+    ExP_phase(ExP_PHASE_WRITE, 0);
+
+    return converted ? needed : -1;
+}
+
+
+static int64_t ExSpan_to_sink(const char expression[], size_t length, ex_notation NOTATION, ExSink sink){
+    /* Same as ExSpan_into(), writing the conversion to sink, then flushing 
+       it. Return the number of bytes written, or -1 on failure.
+
+       From prefix, the conversion is passed on as it's produced (so part
+       of it may have been by the time malformed input is found). To 
+       prefix, it's written backwards, so it's built in memory first.
+    */
+    length = ExSpan_trim(expression, length);
+    if (!ExCheck_limits(expression, length, NOTATION)){
+        return ExP_LIMIT_EXCEEDED;
+    }
+    if (NOTATION == POSTFIX){
+        int64_t needed = ExSpan_measure(expression, length);
+        char *buffer = needed >= 0 ? malloc(needed + 1) : NULL;
+        if (!buffer){
+            ExCheck_fail(needed >= 0 ? ExP_ERROR_MEMORY : ExP_ERROR_EMPTY, 0);
+            return -1;
+        }
+        bool converted = ExSpan_into(expression, length, NOTATION, buffer, needed + 1) >= 0;
+        if (converted){
+            ExSink_write(sink, buffer, needed);
+            ExSink_flush(sink);
+        }
+        free(buffer);
+        return (converted && !sink->failed) ? (int64_t)sink->written : -1;
+    }
+
+    ExP_phase(ExP_PHASE_WRITE, 1);
+    struct expression_span span;
+    ExSpan_init(&span, expression, length, NOTATION);
+    span.sink = sink;
+
+    bool converted = ExSpan_convert(&span);
+    ExSpan_free(&span);
+    ExSink_flush(sink);
+    ExP_phase(ExP_PHASE_WRITE, 0);
+
+    return (converted && !sink->failed) ? (int64_t)sink->written : -1;
+}
+
+  
+ 
+ 
+
+    
+/*               * * * ExCheck functions * * *                         */
+
+/* Checking expressions before they're parsed: one pass over their tokens,
+   split off as ExP_refine() does it (see ExParallel_token()), that stops
+   at the first one out of place, so that malformed input is rejected 
+   before anything is allocated for it, with what's wrong and where (see 
+   ExP_last_error()). Whatever passes the check parses into a tree whose
+   function calls are all valid and whose every ? has its :.
+
+   Infix goes through a state machine: either an operand or an operator
+   is expected next, and each level of parentheses keeps what's needed to
+   close it (whether it's a call, how many arguments it has so far, how
+   many ? still need their :). Prefix and postfix go through 
+   ExSpan_convert(), without output. The stacks of both live on the C 
+   stack or in the span, only moving to the heap past ExSpan_LOCAL levels.
+*/
+
+
+// a level of parentheses of an infix expression being checked
+struct expression_check_level{
+    size_t start;           // where its ( is, or the name of the function
+    int32_t function;       // the id of the function called, -1 if none
+    uint32_t arguments;     // how many , it has had, plus 1
+    uint32_t conditionals;  // how many of its ? are still waiting for their :
+};
+
+
+static bool ExCheck_fail(ex_error_kind kind, size_t offset){
+    /* Record the error found in the expression being checked. Return false. */
+    ExCheck_error.kind = kind;
+    ExCheck_error.offset = offset;
+    return false;
+}
+
+
+static size_t ExCheck_operand(const char expression[], size_t start, size_t end, uint8_t kind, uint8_t operands){
+    /* Check the operand token expression[start, end) of the given kind (see
+       ExParallel_token()), as one of operands (see enum expression_operands):
+       a name is made of letters, digits and '_', a number of digits, with an
+       optional fractional part and exponent (e.g. 2.5e3) if it may have
+       them. Return the offset of the first character that can't be there,
+       end if there's none.
+    */
+    size_t i = start;
+    if (kind == ExParallel_NAME && !(operands & ExCheck_NAMES)){
+        return start;
+    }
+    if (!(operands & ExCheck_FRACTIONS) && kind != ExParallel_NAME){
+        while (i < end && expression[i] >= '0' && expression[i] <= '9'){
+            i++;
+        }
+        return i;
+    }
+    if (kind == ExParallel_NAME){
+        while (i < end && (ExP_is_name_start(expression[i]) || (expression[i] >= '0' && expression[i] <= '9'))){
+            i++;
+        }
+        return i;
+    }
+    bool point = false;
+    size_t digits = 0;
+    while (i < end && ((expression[i] >= '0' && expression[i] <= '9') || (expression[i] == '.' && !point))){
+        point = point || expression[i] == '.';
+        digits += expression[i] != '.';
+        i++;
+    }
+    if (!digits){
+        return start;
+    }
+    if (i < end && (expression[i] == 'e' || expression[i] == 'E')){
+        size_t exponent = ++i;
+        while (i < end && expression[i] >= '0' && expression[i] <= '9'){
+            i++;
+        }
+        if (i == exponent){
+            return i < end ? i : exponent - 1;
+        }
+    }
+    return i;
+}
+
+
+static bool ExCheck_limits(const char expression[], size_t length, ex_notation NOTATION){
+    /* ExLimit_check(), starting the check of expression: the error is reset,
+       then set to ExP_ERROR_LIMIT if it's over the limits.
+    */
+    ExCheck_error.kind = ExP_ERROR_NONE;
+    ExCheck_error.offset = 0;
+    return ExLimit_check(expression, length, NOTATION) || ExCheck_fail(ExP_ERROR_LIMIT, 0);
+}
+
+
+static bool ExCheck_close_conditionals(struct expression_check_level *level, size_t offset){
+    /* The operand of level (or the argument of its call) ends at offset: 
+       each of its ? has to have had its :
+    */
+    return !level->conditionals || ExCheck_fail(ExP_ERROR_CONDITIONAL, offset);
+}
+
+
+static bool ExCheck_infix(const char expression[], size_t length, uint8_t operands){
+    /* Check the infix expression of length characters (see the 
+       section's comment), whose operands can be integers and what's in
+       operands (see enum expression_operands). Return whether it's well formed.
+    */
+    struct expression_check_level local_levels[ExSpan_LOCAL];
+    struct expression_check_level *levels = local_levels;
+    uint32_t levels_size = ExSpan_LOCAL;
+    uint32_t depth = 0;     // levels[0] is the top level, outside of any parentheses
+    levels[0] = (struct expression_check_level){0, -1, 1, 0};
+
+    bool expect_operand = true;
+    bool any = false;
+    int32_t function = -1;  // the function named by the last token, if it was one
+    size_t function_start = 0;
+    uint8_t previous = ExParallel_NONE;
+    size_t previous_start = 0;
+    bool valid = true;
+
+    size_t i = 0;
+    while (valid && i < length){
+        if (expression[i] == ' '){
+            i++;
+            continue;
+        }
+        uint8_t kind;
+        size_t start = i;
+        i = ExParallel_token(expression, length, start, &kind);
+        any = true;
+        struct expression_check_level *level = &levels[depth];
+        char name[sizeof(ExCall_functions[0].name)];
+        size_t invalid;
+        bool after_name = previous == ExParallel_NAME;
+        size_t name_start = previous_start;
+        previous = kind;
+        previous_start = start;
+
+        if (function >= 0 && kind != ExParallel_OPEN){
+            // a function's name without its arguments
+            valid = ExCheck_fail(ExP_ERROR_CALL, function_start);
+            break;
+        }
+
+        if (expect_operand){
+            switch (kind){
+                case ExParallel_NUMBER:
+                case ExParallel_NAME:
+                    invalid = ExCheck_operand(expression, start, i, kind, operands);
+                    valid = invalid == i || ExCheck_fail(ExP_ERROR_CHARACTER, invalid);
+                    expect_operand = false;
+                    break;
+
+                case ExParallel_FUNCTION:
+                    memcpy(name, &expression[start], i - start);
+                    name[i - start] = '\0';
+                    function = ExCall_lookup(name);
+                    function_start = start;
+                    break;
+
+                case ExParallel_OPEN:
+                    if (!ExSpan_reserve((void **)&levels, local_levels, &levels_size, depth + 2, \
+                                sizeof(struct expression_check_level))){
+                        valid = ExCheck_fail(ExP_ERROR_MEMORY, start);
+                        break;
+                    }
+                    levels[++depth] = (struct expression_check_level){
+                        function >= 0 ? function_start : start, function, 1, 0};
+                    function = -1;
+                    break;
+
+                default:    // ) or an operator, where an operand should be
+                    valid = ExCheck_fail(ExP_ERROR_OPERAND, start);
+                    break;
+            }
+            continue;
+        }
+
+        switch (kind){
+            case ExParallel_CLOSE:
+                if (!depth){
+                    valid = ExCheck_fail(ExP_ERROR_PARENTHESIS, start);
+                    break;
+                }
+                valid = ExCheck_close_conditionals(level, start);
+                if (valid && level->function >= 0 && \
+                        (level->arguments < ExCall_functions[level->function].min_arguments || \
+                         level->arguments > ExCall_functions[level->function].max_arguments)){
+                    valid = ExCheck_fail(ExP_ERROR_CALL, level->start);
+                }
+                depth--;
+                break;
+
+            case ExParallel_OPERATOR:
+                expect_operand = true;
+                if (expression[start] == ','){
+                    valid = level->function >= 0 ? ExCheck_close_conditionals(level, start) : \
+                                                   ExCheck_fail(ExP_ERROR_CALL, start);
+                    level->arguments++;
+                }
+                else if (expression[start] == '?'){
+                    level->conditionals++;
+                }
+                // a : belongs to the last ? without one, as in C
+                else if (expression[start] == ':'){
+                    valid = level->conditionals || ExCheck_fail(ExP_ERROR_CONDITIONAL, start);
+                    level->conditionals -= valid;
+                }
+                break;
+
+            case ExParallel_OPEN:
+                // after a name, an unknown function being called
+                valid = after_name ? ExCheck_fail(ExP_ERROR_CALL, name_start) : \
+                                     ExCheck_fail(ExP_ERROR_OPERATOR, start);
+                break;
+
+            default:    // an operand right after another one
+                invalid = kind == ExParallel_FUNCTION ? i : ExCheck_operand(expression, start, i, kind, operands);
+                valid = invalid < i ? ExCheck_fail(ExP_ERROR_CHARACTER, invalid) : \
+                                      ExCheck_fail(ExP_ERROR_OPERATOR, start);
+                break;
+        }
+    }
+
+    if (valid){
+        if (!any){
+            valid = ExCheck_fail(ExP_ERROR_EMPTY, 0);
+        }
+        else if (expect_operand || function >= 0){
+            valid = ExCheck_fail(function >= 0 ? ExP_ERROR_CALL : ExP_ERROR_OPERAND, \
+                                 function >= 0 ? function_start : length);
+        }
+        else if (depth){
+            valid = ExCheck_fail(ExP_ERROR_PARENTHESIS, levels[depth].start);
+        }
+        else{
+            valid = ExCheck_close_conditionals(&levels[0], length);
+        }
+    }
+    if (levels != local_levels){
+        free(levels);
+    }
+    return valid;
+}
+
+
+static bool ExCheck_expression(const char expression[], size_t length, ex_notation NOTATION, uint8_t operands){
+    /* Check the first length characters of expression (fewer if a NUL 
+       comes first) in NOTATION, against the limits of the calling thread 
+       too, recording the outcome for ExP_last_error() and 
+       ExP_limit_exceeded(). Its operands can be integers and what's in
+       operands (see enum expression_operands): to be computed, an 
+       expression needs numbers only, and a name is then an 
+       ExP_ERROR_CHARACTER at its start; so is a '.' or an exponent in a
+       number, unless it's computed in double.
+       Return whether it's well formed and within the limits.
+    */
+    if (NOTATION != PREFIX && NOTATION != POSTFIX && NOTATION != INFIX){
+        ExLimit_exceeded = false;
+        return ExCheck_fail(ExP_ERROR_NOTATION, 0);
+    }
+    length = ExSpan_trim(expression, length);
+    if (!ExCheck_limits(expression, length, NOTATION)){
+        return false;
+    }
+    if (NOTATION == INFIX){
+        return ExCheck_infix(expression, length, operands);
+    }
+    struct expression_span span;
+    ExSpan_init(&span, expression, length, NOTATION);
+    span.operands = operands;
+    bool valid = ExSpan_convert(&span);
+    ExSpan_free(&span);
+
+    return valid;
+}
+
+  
+ 
+ 
+
+    
+/*               * * * Typed evaluation functions * * *                         */
+
+/* ExTree_traverse() evaluates in int32_t. The functions below evaluate the
+   same trees in other numeric types: int64_t (wrapping around on overflow),
+   int64_t checked for overflow, and double.
+   Each type has its own apply function and its own traversal, generated by
+   ExTyped_DEFINE_TRAVERSE() for the integer types, the same way a template 
+   would be instantiated: there's no run-time check of the type, only of 
+   the operator.
+   All of them set *failed, and stop, when the result can't be computed:
+   a variable, an invalid literal, a division by 0, a call to a registered
+   function, or (checked) an overflow.
+*/
+
+
+static bool ExTyped_parse_int64(char *token, int64_t *value, bool *fits){
+    /* Convert the operand token to an int64_t, stored in *value (wrapped 
+       around if it's too large, in which case *fits is set to false). 
+       Return false if it's not a number made of digits.
+    */
+    uint64_t result = 0;
+    *fits = true;
+
+    for (uint32_t i = 0; token[i] != '\0'; i++){
+        if (token[i] < '0' || token[i] > '9'){
+            return false;
+        }
+        *fits = *fits && result <= (uint64_t)(INT64_MAX - (token[i] - '0')) / 10;
+        result = result * 10 + (token[i] - '0');
+    }
+    *value = (int64_t)result;
+    return token[0] != '\0';
+}
+
+
+static bool ExTyped_literal_int64(char *token, int64_t *value){
+    /* Literals for int64_t evaluation: too large ones wrap around, as in ExTree_traverse() */
+    bool fits;
+    return ExTyped_parse_int64(token, value, &fits);
+}
+
+
+static bool ExTyped_literal_checked(char *token, int64_t *value){
+    /* Literals for checked evaluation: too large ones are an overflow,
+       recorded with ExCheck_fail()
+    */
+    bool fits;
+    if (!ExTyped_parse_int64(token, value, &fits)){
+        return false;
+    }
+    return fits || ExCheck_fail(ExP_ERROR_OVERFLOW, 0);
+}
+
+
+static int64_t ExTyped_apply_int64(uint8_t opcode, int64_t left_operand, int64_t right_operand, bool *failed){
+    /* ExP_apply() for int64_t: +, -, * and ^ wrap around on overflow */
+    switch (opcode){
+        case ExP_OP_ADD:
+            return (int64_t)((uint64_t)left_operand + (uint64_t)right_operand);
+
+        case ExP_OP_SUB:
+            return (int64_t)((uint64_t)left_operand - (uint64_t)right_operand);
+
+        case ExP_OP_MUL:
+            return (int64_t)((uint64_t)left_operand * (uint64_t)right_operand);
+
+        case ExP_OP_DIV:
+            if (right_operand == 0){
+                *failed = !ExCheck_fail(ExP_ERROR_DIVISION, 0);
+                return 0;
+            }
+            // INT64_MIN / -1 overflows: wrap around, like the other operators
+            if (right_operand == -1){
+                return (int64_t)(0 - (uint64_t)left_operand);
+            }
+            return left_operand / right_operand;
+
+        case ExP_OP_POW:
+        {
+            if (right_operand < 0){
+                if (left_operand == 1 || left_operand == -1){
+                    return (right_operand & 1) ? left_operand : 1;
+                }
+                return 0;
+            }
+            uint64_t result = 1, square = (uint64_t)left_operand;
+            for (; right_operand; right_operand >>= 1){
+                if (right_operand & 1){
+                    result *= square;
+                }
+                square *= square;
+            }
+            return (int64_t)result;
+        }
+
+        case ExP_OP_LT:
+            return left_operand < right_operand;
+
+        case ExP_OP_LE:
+            return left_operand <= right_operand;
+
+        case ExP_OP_EQ:
+            return left_operand == right_operand;
+
+        case ExP_OP_NE:
+            return left_operand != right_operand;
+
+        case ExP_OP_AND:
+            return left_operand && right_operand;
+
+        case ExP_OP_OR:
+            return left_operand || right_operand;
+
+        default:
+            *failed = true;
+            return 0;
+    }
+}
+
+
+static int64_t ExTyped_checked(bool overflowed, int64_t result, bool *failed){
+    /* Return result, unless computing it overflowed: then set *failed, 
+       record that with ExCheck_fail(), and return 0
+    */
+    if (overflowed){
+        *failed = !ExCheck_fail(ExP_ERROR_OVERFLOW, 0);
+        return 0;
+    }
+    return result;
+}
+
+
+static int64_t ExTyped_apply_checked(uint8_t opcode, int64_t left_operand, int64_t right_operand, bool *failed){
+    /* ExP_apply() for int64_t, failing with ExP_ERROR_OVERFLOW instead of
+       wrapping around
+    */
+    int64_t result = 0;
+    bool overflowed = false;
+
+    switch (opcode){
+        case ExP_OP_ADD:
+            overflowed = __builtin_add_overflow(left_operand, right_operand, &result);
+            return ExTyped_checked(overflowed, result, failed);
+
+        case ExP_OP_SUB:
+            overflowed = __builtin_sub_overflow(left_operand, right_operand, &result);
+            return ExTyped_checked(overflowed, result, failed);
+
+        case ExP_OP_MUL:
+            overflowed = __builtin_mul_overflow(left_operand, right_operand, &result);
+            return ExTyped_checked(overflowed, result, failed);
+
+        case ExP_OP_DIV:
+            if (right_operand == 0 || (left_operand == INT64_MIN && right_operand == -1)){
+                *failed = !ExCheck_fail(right_operand ? ExP_ERROR_OVERFLOW : ExP_ERROR_DIVISION, 0);
+                return 0;
+            }
+            return left_operand / right_operand;
+
+        case ExP_OP_POW:
+        {
+            if (right_operand < 0){
+                if (left_operand == 1 || left_operand == -1){
+                    return (right_operand & 1) ? left_operand : 1;
+                }
+                return 0;
+            }
+            int64_t square = left_operand;
+            result = 1;
+            while (right_operand && !overflowed){
+                if (right_operand & 1){
+                    overflowed = __builtin_mul_overflow(result, square, &result);
+                }
+                right_operand >>= 1;
+                // only square again if it's going to be used
+                if (right_operand && !overflowed){
+                    overflowed = __builtin_mul_overflow(square, square, &square);
+                }
+            }
+            return ExTyped_checked(overflowed, result, failed);
+        }
+
+        case ExP_OP_LT:
+            return left_operand < right_operand;
+
+        case ExP_OP_LE:
+            return left_operand <= right_operand;
+
+        case ExP_OP_EQ:
+            return left_operand == right_operand;
+
+        case ExP_OP_NE:
+            return left_operand != right_operand;
+
+        case ExP_OP_AND:
+            return left_operand && right_operand;
+
+        case ExP_OP_OR:
+            return left_operand || right_operand;
+
+        default:
+            *failed = true;
+            return 0;
+    }
+}
+
+
+#define ExTyped_DEFINE_CALL(NAME, TYPE, APPLY)                                      \
+static TYPE NAME(int32_t function, const TYPE arguments[], uint32_t count, bool *failed){ \
+    /* Call the built-in function with id function, computing in TYPE; the */      \
+    /* registered functions only take int32_t, so they fail */                      \
+    TYPE result = arguments[0];                                                     \
+    switch (function){                                                              \
+        case ExCall_MIN:                                                            \
+            for (uint32_t i = 1; i < count; i++){                                   \
+                result = arguments[i] < result ? arguments[i] : result;             \
+            }                                                                       \
+            return result;                                                          \
+                                                                                    \
+        case ExCall_MAX:                                                            \
+            for (uint32_t i = 1; i < count; i++){                                   \
+                result = arguments[i] > result ? arguments[i] : result;             \
+            }                                                                       \
+            return result;                                                          \
+                                                                                    \
+        case ExCall_ABS:                                                            \
+            return result < 0 ? APPLY(ExP_OP_SUB, 0, result, failed) : result;      \
+                                                                                    \
+        case ExCall_CLAMP:                                                          \
+            result = result < arguments[1] ? arguments[1] : result;                 \
+            return result > arguments[2] ? arguments[2] : result;                   \
+                                                                                    \
+        default:                                                                    \
+            *failed = true;                                                         \
+            return 0;                                                               \
+    }                                                                               \
+}
+
+
+ExTyped_DEFINE_CALL(ExTyped_call_int64, int64_t, ExTyped_apply_int64)
+ExTyped_DEFINE_CALL(ExTyped_call_checked, int64_t, ExTyped_apply_checked)
+
+
+#define ExTyped_DEFINE_TRAVERSE(NAME, TYPE, LITERAL, APPLY, CALL)                   \
+static TYPE NAME(ExTree tree, bool *failed){                                        \
+    /* ExTree_traverse(), evaluating in TYPE, short-circuiting the same way */      \
+    /* and walking the tree without recursion the same way too */                   \
+    struct expression_tree_walk walk;                                               \
+    TYPE local_values[ExSpan_LOCAL];                                                \
+    TYPE *values = local_values;                                                    \
+    uint32_t values_count = 0, values_size = ExSpan_LOCAL;                          \
+                                                                                    \
+    ExTree_walk_init(&walk, tree);                                                  \
+    while (walk.count && !walk.failed && !*failed){                                 \
+        /* every step pushes at most one value */                                   \
+        if (!ExSpan_reserve((void **)&values, local_values, &values_size,           \
+                            values_count + 1, sizeof(TYPE))){                       \
+            walk.failed = true;                                                     \
+            ExCheck_fail(ExP_ERROR_MEMORY, 0);                                      \
+            break;                                                                  \
+        }                                                                           \
+        struct expression_tree_frame *frame = &walk.frames[walk.count - 1];         \
+        ExTree node = frame->node;                                                  \
+        uint8_t opcode = ExTree_opcode(node);                                       \
+        TYPE left = frame->state == 1 ? values[values_count - 1] : 0;               \
+                                                                                    \
+        if (opcode == ExP_OP_LITERAL){                                              \
+            TYPE value = 0;                                                         \
+            *failed |= !LITERAL(node->token, &value);                               \
+            values[values_count++] = value;                                         \
+            walk.count--;                                                           \
+        }                                                                           \
+        else if (opcode == ExP_OP_CALL){                                            \
+            ExTree arguments[ExP_MAX_ARGUMENTS];                                    \
+            uint32_t count = ExCall_arguments(node->left, arguments);               \
+            if (frame->state < count){                                              \
+                ExTree_walk_push(&walk, arguments[frame->state++]);                 \
+                continue;                                                           \
+            }                                                                       \
+            values_count -= count;                                                  \
+            values[values_count] = CALL(ExCall_lookup(node->token), &values[values_count], count, failed); \
+            values_count++;                                                         \
+            walk.count--;                                                           \
+        }                                                                           \
+        else if (frame->state == 0){                                                \
+            frame->state = 1;                                                       \
+            ExTree_walk_push(&walk, node->left);                                    \
+        }                                                                           \
+        else if (frame->state == 1 && ((opcode == ExP_OP_AND && !left) || (opcode == ExP_OP_OR && left))){ \
+            values[values_count - 1] = opcode == ExP_OP_OR;                         \
+            walk.count--;                                                           \
+        }                                                                           \
+        else if (frame->state == 1 && opcode == ExP_OP_COND){                       \
+            ExTree branches = node->right;                                          \
+            if (!branches->left || ExP_opcode(branches->token) != ExP_OP_ELSE){     \
+                *failed = true;                                                     \
+                break;                                                              \
+            }                                                                       \
+            /* the node is replaced with the branch taken */                        \
+            values_count--;                                                         \
+            *frame = (struct expression_tree_frame){left ? branches->left : branches->right, 0}; \
+        }                                                                           \
+        else if (frame->state == 1){                                                \
+            frame->state = 2;                                                       \
+            ExTree_walk_push(&walk, node->right);                                   \
+        }                                                                           \
+        else{                                                                       \
+            values_count--;                                                         \
+            values[values_count - 1] = APPLY(opcode, values[values_count - 1], values[values_count], failed); \
+            walk.count--;                                                           \
+        }                                                                           \
+    }                                                                               \
+    ExTree_walk_free(&walk);                                                        \
+    *failed |= walk.failed;                                                         \
+    TYPE result = (*failed || !values_count) ? 0 : values[0];                       \
+    if (values != local_values){                                                    \
+        free(values);                                                               \
+    }                                                                               \
+    return result;                                                                  \
+}
+
+
+ExTyped_DEFINE_TRAVERSE(ExTyped_traverse_int64, int64_t, ExTyped_literal_int64, ExTyped_apply_int64, ExTyped_call_int64)
+ExTyped_DEFINE_TRAVERSE(ExTyped_traverse_checked, int64_t, ExTyped_literal_checked, ExTyped_apply_checked, ExTyped_call_checked)
+
+
+static double ExTyped_power_double(double base, double exponent){
+    /* Return base raised to the power exponent: by repeated squaring for 
+       integer exponents (exact whenever the result is representable), 
+       pow() otherwise
+    */
+    if (exponent != (double)(int64_t)exponent || fabs(exponent) > 1e18){
+        return pow(base, exponent);
+    }
+    int64_t n = (int64_t)exponent;
+    uint64_t remaining = n < 0 ? 0 - (uint64_t)n : (uint64_t)n;
+    double result = 1.0, square = base;
+
+    for (; remaining; remaining >>= 1){
+        if (remaining & 1){
+            result *= square;
+        }
+        square *= square;
+    }
+    return n < 0 ? 1.0 / result : result;
+}
+
+
+static double ExTyped_apply_double(uint8_t opcode, double left, double right, bool *failed){
+    /* ExP_apply(), in double; division by 0 fails */
+    switch (opcode){
+        case ExP_OP_ADD:
+            return left + right;
+
+        case ExP_OP_SUB:
+            return left - right;
+
+        case ExP_OP_MUL:
+            return left * right;
+
+        case ExP_OP_DIV:
+            if (right == 0.0){
+                *failed = !ExCheck_fail(ExP_ERROR_DIVISION, 0);
+                return 0.0;
+            }
+            return left / right;
+
+        case ExP_OP_POW:
+            return ExTyped_power_double(left, right);
+
+        case ExP_OP_LT:
+            return left < right;
+
+        case ExP_OP_LE:
+            return left <= right;
+
+        case ExP_OP_EQ:
+            return left == right;
+
+        case ExP_OP_NE:
+            return left != right;
+
+        case ExP_OP_AND:
+            return left != 0.0 && right != 0.0;
+
+        case ExP_OP_OR:
+            return left != 0.0 || right != 0.0;
+
+        default:
+            *failed = true;
+            return 0.0;
+    }
+}
+
+
+ExTyped_DEFINE_CALL(ExTyped_call_double, double, ExTyped_apply_double)
+
+
+static double ExTyped_traverse_double(ExTree tree, bool *failed){
+    /* ExTree_traverse(), evaluating in double. Literals may have a fractional
+       part (e.g. 2.5), and division is exact rather than truncating.
+
+       a*b + c, c + a*b, a*b - c and c - a*b are contracted into a single
+       fma(), which rounds once instead of twice: both faster and more accurate.
+       Their three operands a, b and c are then evaluated one at a time, like 
+       the arguments of a call.
+
+       The tree is walked without recursion, as in ExTree_traverse().
+    */
+    struct expression_tree_walk walk;
+    double local_values[ExSpan_LOCAL];
+    double *values = local_values;
+    uint32_t values_count = 0, values_size = ExSpan_LOCAL;
+
+    ExTree_walk_init(&walk, tree);
+    while (walk.count && !walk.failed && !*failed){
+        // every step pushes at most one value
+        if (!ExSpan_reserve((void **)&values, local_values, &values_size, values_count + 1, sizeof(double))){
+            walk.failed = true;
+            ExCheck_fail(ExP_ERROR_MEMORY, 0);
+            break;
+        }
+        struct expression_tree_frame *frame = &walk.frames[walk.count - 1];
+        ExTree node = frame->node;
+        uint8_t opcode = ExTree_opcode(node);
+
+        if (opcode == ExP_OP_LITERAL){
+            char *end;
+            values[values_count++] = strtod(node->token, &end);
+            *failed |= end == node->token || *end != '\0' || ExP_is_variable(node->token);
+            walk.count--;
+            continue;
+        }
+        if (opcode == ExP_OP_CALL){
+            ExTree arguments[ExP_MAX_ARGUMENTS];
+            uint32_t count = ExCall_arguments(node->left, arguments);
+            if (frame->state < count){
+                ExTree_walk_push(&walk, arguments[frame->state++]);
+                continue;
+            }
+            values_count -= count;
+            values[values_count] = ExTyped_call_double(ExCall_lookup(node->token), &values[values_count], count, failed);
+            values_count++;
+            walk.count--;
+            continue;
+        }
+
+        bool left_product = (opcode == ExP_OP_ADD || opcode == ExP_OP_SUB) && ExTree_opcode(node->left) == ExP_OP_MUL;
+        bool right_product = (opcode == ExP_OP_ADD || opcode == ExP_OP_SUB) && ExTree_opcode(node->right) == ExP_OP_MUL;
+        if (left_product || right_product){
+            // a*b + c, a*b - c, or c + a*b, c - a*b: the operands in the order written
+            ExTree operands[3] = {node->left->left, node->left->right, node->right};
+            if (!left_product){
+                operands[0] = node->left;
+                operands[1] = node->right->left;
+                operands[2] = node->right->right;
+            }
+            if (frame->state < 3){
+                ExTree_walk_push(&walk, operands[frame->state++]);
+                continue;
+            }
+            values_count -= 3;
+            double *v = &values[values_count];
+            values[values_count++] = left_product ? fma(v[0], v[1], opcode == ExP_OP_ADD ? v[2] : -v[2]) :
+                                                    fma(opcode == ExP_OP_ADD ? v[1] : -v[1], v[2], v[0]);
+            walk.count--;
+            continue;
+        }
+
+        if (frame->state == 0){
+            frame->state = 1;
+            ExTree_walk_push(&walk, node->left);
+            continue;
+        }
+        double left = values[values_count - 1];
+
+        // short-circuiting, as in ExTree_traverse()
+        if (frame->state == 1 && ((opcode == ExP_OP_AND && left == 0.0) || (opcode == ExP_OP_OR && left != 0.0))){
+            values[values_count - 1] = opcode == ExP_OP_OR;
+            walk.count--;
+        }
+        else if (frame->state == 1 && opcode == ExP_OP_COND){
+            ExTree branches = node->right;
+            if (!branches->left || ExP_opcode(branches->token) != ExP_OP_ELSE){
+                *failed = true;
+                break;
+            }
+            values_count--;
+            *frame = (struct expression_tree_frame){left != 0.0 ? branches->left : branches->right, 0};
+        }
+        else if (frame->state == 1){
+            frame->state = 2;
+            ExTree_walk_push(&walk, node->right);
+        }
+        else{
+            values_count--;
+            values[values_count - 1] = ExTyped_apply_double(opcode, values[values_count - 1], values[values_count], failed);
+            walk.count--;
+        }
+    }
+    ExTree_walk_free(&walk);
+    *failed |= walk.failed;
+    double result = (*failed || !values_count) ? 0.0 : values[0];
+    if (values != local_values){
+        free(values);
+    }
+    return result;
+}
+
+
+
+/*               * * * Code generation functions * * *                         */
+
+
+// written once at the top of every generated file: the operators, with the
+// same semantics as ExP_apply() (a division that would trap gives 0, as in
+// ExP_divide(), though there's nothing to report it to); the C compiler 
+// inlines them
+static const char ExGen_prelude[] = 
+    "#include <stdint.h>\n"
+    "\n"
+    "static inline int32_t ExP_gen_add(int32_t a, int32_t b){ return (int32_t)((uint32_t)a + (uint32_t)b); }\n"
+    "static inline int32_t ExP_gen_sub(int32_t a, int32_t b){ return (int32_t)((uint32_t)a - (uint32_t)b); }\n"
+    "static inline int32_t ExP_gen_mul(int32_t a, int32_t b){ return (int32_t)((uint32_t)a * (uint32_t)b); }\n"
+    "static inline int32_t ExP_gen_div(int32_t a, int32_t b){\n"
+    "    return (b == 0 || (b == -1 && a == INT32_MIN)) ? 0 : a / b;\n"
+    "}\n"
+    "static inline int32_t ExP_gen_pow(int32_t base, int32_t exponent){\n"
+    "    if (exponent < 0){\n"
+    "        return (base == 1 || base == -1) ? ((exponent & 1) ? base : 1) : 0;\n"
+    "    }\n"
+    "    uint32_t result = 1, square = (uint32_t)base;\n"
+    "    for (; exponent; exponent >>= 1){\n"
+    "        if (exponent & 1){\n"
+    "            result *= square;\n"
+    "        }\n"
+    "        square *= square;\n"
+    "    }\n"
+    "    return (int32_t)result;\n"
+    "}\n"
+    "static inline int32_t ExP_gen_min(int32_t a, int32_t b){ return a < b ? a : b; }\n"
+    "static inline int32_t ExP_gen_max(int32_t a, int32_t b){ return a > b ? a : b; }\n"
+    "static inline int32_t ExP_gen_abs(int32_t a){ return a < 0 ? (int32_t)(0u - (uint32_t)a) : a; }\n"
+    "static inline int32_t ExP_gen_clamp(int32_t a, int32_t low, int32_t high){ return ExP_gen_min(ExP_gen_max(a, low), high); }\n";
+
+
+// the C keywords (C23 included), and the type names the generated code uses
+static const char *ExGen_reserved[] = {
+    "auto", "break", "case", "char", "const", "continue", "default", "do", 
+    "double", "else", "enum", "extern", "float", "for", "goto", "if", 
+    "inline", "int", "long", "register", "restrict", "return", "short", 
+    "signed", "sizeof", "static", "struct", "switch", "typedef", "union", 
+    "unsigned", "void", "volatile", "while", 
+    "alignas", "alignof", "bool", "constexpr", "false", "nullptr", 
+    "static_assert", "thread_local", "true", "typeof", "typeof_unqual",
+    "int32_t", "uint32_t",
+};
+
+
+static bool ExGen_is_identifier(const char *name){
+    /* Determine whether name can be used as the name of a C function */
+    if (!name || !ExP_is_name_start(name[0])){
+        return false;
+    }
+    for (uint32_t i = 1; name[i] != '\0'; i++){
+        if (!ExP_is_name_start(name[i]) && !(name[i] >= '0' && name[i] <= '9')){
+            return false;
+        }
+    }
+    return true;
+}
+
+
+static bool ExGen_is_usable(const char *name){
+    /* Determine whether name can be used in the generated code, as the name
+       of a function or of a parameter: an identifier that isn't a keyword
+       or a type name, nor reserved -- by C (starting with _ and a capital 
+       letter or another _), or for the ExP_gen_* operators and the 
+       parameters of the batch functions (starting with ExP_)
+    */
+    if (!ExGen_is_identifier(name) || strncmp(name, "ExP_", 4) == 0 || \
+            (name[0] == '_' && (name[1] == '_' || (name[1] >= 'A' && name[1] <= 'Z')))){
+        return false;
+    }
+    for (uint32_t i = 0; i < sizeof(ExGen_reserved) / sizeof(ExGen_reserved[0]); i++){
+        if (strcmp(name, ExGen_reserved[i]) == 0){
+            return false;
+        }
+    }
+    return true;
+}
+
+
+static bool ExGen_is_batch_of(const char *name, const char *other){
+    /* Determine whether name is other followed by _batch: the name of the
+       batch version of other
+    */
+    size_t length = strlen(other);
+    return strncmp(name, other, length) == 0 && strcmp(&name[length], "_batch") == 0;
+}
+
+
+static bool ExGen_check_names(const char *names[], uint32_t index){
+    /* Determine whether names[index] can be the name of a generated function:
+       usable (see ExGen_is_usable()), not one of the functions registered
+       with ExP_register_function(), and not clashing with names[0] to 
+       names[index - 1] or their batch versions
+    */
+    const char *name = names[index];
+    if (!ExGen_is_usable(name) || ExCall_lookup(name) >= ExCall_BUILTINS){
+        return false;
+    }
+    for (uint32_t i = 0; i < index; i++){
+        if (strcmp(name, names[i]) == 0 || ExGen_is_batch_of(name, names[i]) || \
+                ExGen_is_batch_of(names[i], name)){
+            return false;
+        }
+    }
+    return true;
+}
+
+
+static bool ExGen_check_variables(ExTree tree, const char *name){
+    /* Determine whether every variable in tree can be a parameter of the
+       function called name computing it: usable (see ExGen_is_usable()),
+       and hiding neither that function, which its batch version calls, 
+       nor a registered function it calls. The tree is walked without 
+       recursion; return false if memory for that couldn't be allocated.
+    */
+    struct expression_tree_walk walk;
+    bool usable = true;
+
+    ExTree_walk_init(&walk, tree);
+    for (ExTree node = ExTree_walk_next(&walk); node && usable; node = ExTree_walk_next(&walk)){
+        if (node->left || node->right || !ExP_is_variable(node->token)){
+            continue;
+        }
+        usable = ExGen_is_usable(node->token) && strcmp(node->token, name) != 0 && \
+                 ExCall_lookup(node->token) < ExCall_BUILTINS;
+    }
+    ExTree_walk_free(&walk);
+
+    return usable && !walk.failed;
+}
+
+
+static bool ExGen_is_branches(ExTree tree){
+    /* Determine whether tree is a : node with both of its operands */
+    return tree && tree->left && tree->right && ExP_opcode(tree->token) == ExP_OP_ELSE;
+}
+
+
+static bool ExGen_is_well_formed(ExTree tree){
+    /* Determine whether every ? in tree has a : as its right operand, and 
+       every : is the right operand of a ?
+       The tree is walked without recursion; return false if memory for that 
+       couldn't be allocated.
+    */
+    struct expression_tree_walk walk;
+    bool well_formed = !ExGen_is_branches(tree);
+
+    ExTree_walk_init(&walk, tree);
+    for (ExTree node = ExTree_walk_next(&walk); node && well_formed; node = ExTree_walk_next(&walk)){
+        // a function call has its arguments on the left (already checked by ExP_parse())
+        bool is_conditional = node->right && ExP_opcode(node->token) == ExP_OP_COND;
+        well_formed = (node->left || !node->right) && !ExGen_is_branches(node->left) && \
+                      ExGen_is_branches(node->right) == is_conditional;
+    }
+    ExTree_walk_free(&walk);
+
+    return well_formed && !walk.failed;
+}
+
+
+static bool ExGen_collect_variables(ExTree tree, char ***variables, uint32_t *count, uint32_t *size){
+    /* Add to *variables the names of the variables in tree that aren't in 
+       it already, in the order they appear in the expression (left to right).
+       Return false if memory couldn't be allocated.
+    */
+    struct expression_tree_walk walk;
+    bool collected = true;
+
+    // the leaves come in post-order from left to right
+    ExTree_walk_init(&walk, tree);
+    for (ExTree node = ExTree_walk_next(&walk); node && collected; node = ExTree_walk_next(&walk)){
+        if (node->left || node->right || !ExP_is_variable(node->token)){
+            continue;
+        }
+        bool listed = false;
+        for (uint32_t i = 0; i < *count && !listed; i++){
+            listed = strcmp((*variables)[i], node->token) == 0;
+        }
+        if (listed){
+            continue;
+        }
+        collected = ExStream_reserve((void **)variables, size, *count + 1, sizeof(char *));
+        if (collected){
+            (*variables)[(*count)++] = node->token;
+        }
+    }
+    ExTree_walk_free(&walk);
+
+    return collected && !walk.failed;
+}
+
+
+static bool ExGen_emit_tree(ExTree tree, FILE *file){
+    /* Write tree to file as a C expression: a call to the ExP_gen_* function
+       of each operator, with variables used as they are (they're the 
+       parameters of the generated function).
+
+       The tree is walked without recursion, each node writing its text 
+       around and between its operands as they're done. Return false if 
+       memory for that couldn't be allocated.
+    */
+    static const char *operators[] = {
+        [ExP_OP_LT] = " < ",
+        [ExP_OP_LE] = " <= ",
+        [ExP_OP_EQ] = " == ",
+        [ExP_OP_NE] = " != ",
+        [ExP_OP_AND] = " && ",
+        [ExP_OP_OR] = " || ",
+    };
+    static const char *functions[] = {
+        [ExP_OP_ADD] = "ExP_gen_add",
+        [ExP_OP_SUB] = "ExP_gen_sub",
+        [ExP_OP_MUL] = "ExP_gen_mul",
+        [ExP_OP_DIV] = "ExP_gen_div",
+        [ExP_OP_POW] = "ExP_gen_pow",
+    };
+    struct expression_tree_walk walk;
+
+    ExTree_walk_init(&walk, tree);
+    while (walk.count && !walk.failed){
+        struct expression_tree_frame *frame = &walk.frames[walk.count - 1];
+        ExTree node = frame->node;
+        uint8_t opcode = ExTree_opcode(node);
+        uint8_t state = frame->state++;
+
+        if (opcode == ExP_OP_LITERAL){
+            if (ExP_is_variable(node->token)){
+                fputs(node->token, file);
+            }else{
+                // the value ExTree_traverse() would use; written as unsigned if
+                // it wrapped around to a negative number
+                int32_t literal = str_to_int(node->token);
+                if (literal >= 0){
+                    fprintf(file, "%" PRId32, literal);
+                }else{
+                    fprintf(file, "(int32_t)%" PRIu32 "u", (uint32_t)literal);
+                }
+            }
+            walk.count--;
+            continue;
+        }
+
+        // the built-in functions are ExP_gen_* functions too, nested for more
+        // than two arguments: min(a, b, c) is ExP_gen_min(ExP_gen_min(a, b), c).
+        // Registered functions are called the same way as by ExCall_apply().
+        if (opcode == ExP_OP_CALL){
+            ExTree arguments[ExP_MAX_ARGUMENTS];
+            uint32_t count = ExCall_arguments(node->left, arguments);
+            int32_t function = ExCall_lookup(node->token);
+            bool nested = function == ExCall_MIN || function == ExCall_MAX;
+            bool registered = function >= ExCall_BUILTINS;
+
+            if (state == 0 && nested){
+                for (uint32_t i = 1; i < count; i++){
+                    fprintf(file, "ExP_gen_%s(", node->token);
+                }
+            }
+            else if (state == 0){
+                fprintf(file, registered ? "%s((const int32_t[]){" : "ExP_gen_%s(", node->token);
+            }
+            if (nested && state >= 2){
+                fputc(')', file);
+            }
+            if (state < count){
+                fputs(state ? ", " : "", file);
+                ExTree_walk_push(&walk, arguments[state]);
+                continue;
+            }
+            if (registered){
+                fprintf(file, "}, %" PRIu32 ")", count);
+            }else if (!nested){
+                fputc(')', file);
+            }
+            walk.count--;
+            continue;
+        }
+
+        // ?: && and || are written as the C operators, which short-circuit 
+        // the same way; the others as calls
+        bool is_conditional = opcode == ExP_OP_COND;
+        bool is_operator = opcode >= ExP_OP_LT && opcode <= ExP_OP_OR;
+        ExTree operands[3] = {node->left, node->right, NULL};
+        const char *separators[3] = {"", is_conditional ? " ? " : is_operator ? operators[opcode] : ", ", " : "};
+        if (is_conditional){
+            operands[1] = node->right->left;
+            operands[2] = node->right->right;
+        }
+        if (state == 0){
+            fprintf(file, "%s(", is_conditional || is_operator ? "" : functions[opcode]);
+        }
+        if (state < (is_conditional ? 3 : 2)){
+            fputs(separators[state], file);
+            ExTree_walk_push(&walk, operands[state]);
+            continue;
+        }
+        fputc(')', file);
+        walk.count--;
+    }
+    ExTree_walk_free(&walk);
+
+    return !walk.failed;
+}
+
+
+static bool ExGen_declare_functions(ExTree tree, uint64_t *declared, FILE *file){
+    /* Write to file a declaration of every registered function called in 
+       tree that hasn't been declared yet, in the order they're called in: 
+       bit i of *declared is set once the function with id i has been.
+       Return false if memory for walking the tree couldn't be allocated.
+    */
+    struct expression_tree_walk walk;
+
+    ExTree_walk_init(&walk, tree);
+    while (walk.count && !walk.failed){
+        struct expression_tree_frame *frame = &walk.frames[walk.count - 1];
+        ExTree node = frame->node;
+
+        // a call is declared before the calls in its arguments
+        if (frame->state == 0 && node->left && !node->right){
+            int32_t function = ExCall_lookup(node->token);
+            if (function >= ExCall_BUILTINS && !((*declared >> function) & 1)){
+                *declared |= (uint64_t)1 << function;
+                fprintf(file, "\nint32_t %s(const int32_t arguments[], uint32_t count);\n", node->token);
+            }
+        }
+        if (frame->state < 2){
+            ExTree child = frame->state++ ? node->right : node->left;
+            if (child){
+                ExTree_walk_push(&walk, child);
+            }
+            continue;
+        }
+        walk.count--;
+    }
+    ExTree_walk_free(&walk);
+
+    return !walk.failed;
+}
+
+
+static bool ExGen_emit_function(ExTree tree, const char *name, char *variables[], uint32_t count, FILE *file){
+    /* Write the function called name computing tree to file, followed by its
+       batch version if it has parameters. Return false if memory for 
+       walking the tree couldn't be allocated.
+    */
+    fprintf(file, "\nint32_t %s(", name);
+    for (uint32_t i = 0; i < count; i++){
+        fprintf(file, "%sint32_t %s", i ? ", " : "", variables[i]);
+    }
+    fprintf(file, "%s){\n    return ", count ? "" : "void");
+    bool emitted = ExGen_emit_tree(tree, file);
+    fputs(";\n}\n", file);
+
+    if (!count || !emitted){
+        return emitted;
+    }
+    // a plain counted loop over restrict-qualified arrays, calling the function
+    // above (which gets inlined): a shape compilers auto-vectorize
+    // its own parameters and loop index are named ExP_*, which variables 
+    // can't be (see ExGen_is_usable())
+    fprintf(file, "\nvoid %s_batch(uint32_t ExP_count, ", name);
+    for (uint32_t i = 0; i < count; i++){
+        fprintf(file, "const int32_t *restrict %s, ", variables[i]);
+    }
+    fprintf(file, "int32_t *restrict ExP_results){\n"
+                  "    for (uint32_t ExP_i = 0; ExP_i < ExP_count; ExP_i++){\n"
+                  "        ExP_results[ExP_i] = %s(", name);
+    for (uint32_t i = 0; i < count; i++){
+        fprintf(file, "%s%s[ExP_i]", i ? ", " : "", variables[i]);
+    }
+    fputs(");\n    }\n}\n", file);
+    return true;
+}
+
+
+/*               * * * ExFormula functions * * *                         */
+
+/* Formula sets (see struct expression_formulas). Recalculation starts from
+   the formulas changed since the last one (the dirty ones), marks everything
+   depending on them, directly or not, as affected, and computes the affected
+   formulas level by level (Kahn's algorithm): first those whose sources are 
+   all up to date, then those that only waited for the ones just computed, 
+   and so on. Formulas left over when no level remains are on a cycle, or
+   depend on one. The formulas of a level don't depend on each other, so 
+   large levels are shared out among the threads of the set's pool.
+*/
+
+
+// levels with fewer formulas than this are computed on the calling thread
+#define ExFormula_PARALLEL_MIN 256
+
+// how many formulas a thread takes from a level at a time
+#define ExFormula_CHUNK 32
+
+
+static bool ExFormula_is_name(const char *name){
+    /* Determine whether a formula can refer to name: an identifier that
+       refine() keeps in one piece as a variable -- not the operator x 
+       followed by a digit, like x1 -- and not the name of a function
+    */
+    return ExGen_is_identifier(name) && !(name[0] == 'x' && !ExP_is_name_start(name[1])) && \
+           ExCall_lookup(name) < 0;
+}
+
+
+static uint32_t ExFormula_hash(const char *name){
+    /* Hash name (FNV-1a) */
+    uint32_t hash = 2166136261u;
+    for (uint32_t i = 0; name[i] != '\0'; i++){
+        hash = (hash ^ (uint8_t)name[i]) * 16777619u;
+    }
+    return hash;
+}
+
+
+static bool ExFormula_grow_table(ExFormulas set){
+    /* Double the hash table of set's names (or make the first one), 
+       reinserting the names. Return false if memory couldn't be allocated.
+    */
+    uint32_t size = set->table_size ? 2 * set->table_size : 64;
+    uint32_t *table = calloc(size, sizeof(uint32_t));
+    if (!table){
+        return false;
+    }
+    for (uint32_t i = 0; i < set->count; i++){
+        uint32_t slot = ExFormula_hash(set->formulas[i].name) & (size - 1);
+        while (table[slot]){
+            slot = (slot + 1) & (size - 1);
+        }
+        table[slot] = i + 1;
+    }
+    free(set->table);
+    set->table = table;
+    set->table_size = size;
+
+    return true;
+}
+
+
+static uint32_t ExFormula_find(ExFormulas set, const char *name, bool add){
+    /* Return the index of the formula called name in set. If there's none,
+       add an undefined one if add is true, else return UINT32_MAX; 
+       UINT32_MAX as well if memory couldn't be allocated.
+    */
+    uint32_t slot = 0;
+    if (set->table_size){
+        slot = ExFormula_hash(name) & (set->table_size - 1);
+        while (set->table[slot]){
+            if (strcmp(set->formulas[set->table[slot] - 1].name, name) == 0){
+                return set->table[slot] - 1;
+            }
+            slot = (slot + 1) & (set->table_size - 1);
+        }
+    }
+    if (!add){
+        return UINT32_MAX;
+    }
+
+    size_t length = strlen(name);
+    char *copy = malloc(length + 1);
+    if (!copy || \
+            !ExStream_reserve((void **)&set->formulas, &set->formulas_size, set->count + 1, sizeof(struct expression_formula)) || \
+            !ExStream_reserve((void **)&set->values, &set->values_size, set->count + 1, sizeof(int32_t))){
+        free(copy);
+        return UINT32_MAX;
+    }
+    if (2 * (set->count + 1) >= set->table_size){
+        if (!ExFormula_grow_table(set)){
+            free(copy);
+            return UINT32_MAX;
+        }
+        slot = ExFormula_hash(name) & (set->table_size - 1);
+        while (set->table[slot]){
+            slot = (slot + 1) & (set->table_size - 1);
+        }
+    }
+    memcpy(copy, name, length + 1);
+
+    uint32_t index = set->count++;
+    set->formulas[index] = (struct expression_formula){.name = copy};
+    set->values[index] = 0;
+    set->table[slot] = index + 1;
+
+    return index;
+}
+
+
+static void ExFormula_clear(ExFormulas set, uint32_t index){
+    /* Forget what formula index computes: its program, and its edges to
+       the formulas it refers to
+    */
+    struct expression_formula *formula = &set->formulas[index];
+
+    for (uint32_t i = 0; i < formula->source_count; i++){
+        struct expression_formula *source = &set->formulas[formula->sources[i]];
+        for (uint32_t j = 0; j < source->dependent_count; j++){
+            if (source->dependents[j] == index){
+                source->dependents[j] = source->dependents[--source->dependent_count];
+                break;
+            }
+        }
+    }
+    free(formula->sources);
+    formula->sources = NULL;
+    formula->source_count = 0;
+    ExP_program_destroy(&formula->program);
+}
+
+
+static bool ExFormula_collect_leaves(ExTree tree, char *leaves[], uint32_t *count){
+    /* Store the tokens of the operands of tree in leaves[], from left to 
+       right: the order ExProgram_emit_tree() emits their nodes in.
+       Return false if memory for walking the tree couldn't be allocated.
+    */
+    struct expression_tree_walk walk;
+
+    ExTree_walk_init(&walk, tree);
+    for (ExTree node = ExTree_walk_next(&walk); node; node = ExTree_walk_next(&walk)){
+        if (!node->left && !node->right){
+            leaves[(*count)++] = node->token;
+        }
+    }
+    ExTree_walk_free(&walk);
+
+    return !walk.failed;
+}
+
+
+static bool ExFormula_bind(ExFormulas set, uint32_t index, ExTree tree){
+    /* Compile tree into the program of formula index, with every variable
+       in it becoming an ExP_OP_REFERENCE to the formula of that name (added
+       if it's not in the set yet), and link the two in the graph.
+       Return false if memory couldn't be allocated.
+    */
+    uint32_t nodes = ExTree_count_nodes(tree);
+    char **leaves = nodes ? malloc(nodes * sizeof(char *)) : NULL;
+    uint32_t *sources = nodes ? malloc(nodes * sizeof(uint32_t)) : NULL;
+    ExProgram program = nodes ? ExProgram_from_tree(tree) : NULL;
+    uint32_t leaf_count = 0, source_count = 0;
+    if (!leaves || !sources || !program || !ExFormula_collect_leaves(tree, leaves, &leaf_count)){
+        free(leaves);
+        free(sources);
+        ExP_program_destroy(&program);
+        return false;
+    }
+
+    bool failed = false;
+    for (uint32_t i = 0, leaf = 0; i < program->count && !failed; i++){
+        if (program->opcodes[i] != ExP_OP_LITERAL){
+            continue;
+        }
+        char *token = leaves[leaf++];
+        if (!ExP_is_variable(token)){
+            continue;
+        }
+        uint32_t source = ExFormula_find(set, token, true);
+        failed = source == UINT32_MAX;
+        program->opcodes[i] = ExP_OP_REFERENCE;
+        program->left[i] = source;
+        program->right[i] = 0;
+
+        bool listed = false;
+        for (uint32_t j = 0; j < source_count && !listed; j++){
+            listed = sources[j] == source;
+        }
+        if (!failed && !listed){
+            sources[source_count++] = source;
+        }
+    }
+    free(leaves);
+
+    // and the other way round: formula index depends on each source
+    for (uint32_t i = 0; i < source_count && !failed; i++){
+        struct expression_formula *source = &set->formulas[sources[i]];
+        failed = !ExStream_reserve((void **)&source->dependents, &source->dependent_size, \
+                                   source->dependent_count + 1, sizeof(uint32_t));
+        if (!failed){
+            source->dependents[source->dependent_count++] = index;
+        }
+    }
+
+    struct expression_formula *formula = &set->formulas[index];
+    formula->program = program;
+    formula->sources = sources;
+    formula->source_count = source_count;
+    if (failed){
+        ExFormula_clear(set, index);
+        return false;
+    }
+    // the references aren't constants, so they're never specialized
+    ExProgram_specialize(program);
+
+    return true;
+}
+
+
+static void ExFormula_compute(ExFormulas set, uint32_t index){
+    /* Compute formula index from the current values of its sources */
+    ExProgram program = set->formulas[index].program;
+    if (program){
+        program->inputs = set->values;
+        set->values[index] = ExProgram_evaluate(program);
+    }
+}
+
+
+static void ExFormula_work(ExFormulas set){
+    /* Compute the formulas of set->work[], a chunk at a time, until none are left */
+    while (true){
+        uint32_t start = atomic_fetch_add(&set->next, ExFormula_CHUNK);
+        if (start >= set->work_count){
+            return;
+        }
+        uint32_t end = start + ExFormula_CHUNK < set->work_count ? start + ExFormula_CHUNK : set->work_count;
+        for (uint32_t i = start; i < end; i++){
+            ExFormula_compute(set, set->work[i]);
+        }
+    }
+}
+
+
+static void *ExFormula_worker(void *set_arg){
+    /* A thread of the pool: wait for each batch of work, take part in it,
+       and report when done, until the set is destroyed
+    */
+    ExFormulas set = set_arg;
+    uint64_t generation = 0;
+
+    pthread_mutex_lock(&set->lock);
+    while (true){
+        while (!set->stopping && set->generation == generation){
+            pthread_cond_wait(&set->start, &set->lock);
+        }
+        if (set->stopping){
+            break;
+        }
+        generation = set->generation;
+        pthread_mutex_unlock(&set->lock);
+
+        ExFormula_work(set);
+
+        pthread_mutex_lock(&set->lock);
+        if (--set->busy == 0){
+            pthread_cond_signal(&set->finished);
+        }
+    }
+    pthread_mutex_unlock(&set->lock);
+
+    return NULL;
+}
+
+
+static void ExFormula_start(ExFormulas set){
+    /* Start the threads of set's pool. If some can't be, there are fewer. */
+    set->started = true;
+
+    uint32_t threads = set->threads;
+    if (!threads){
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (uint32_t)cpus : 1;
+    }
+    if (threads > ExParallel_MAX_THREADS){
+        threads = ExParallel_MAX_THREADS;
+    }
+    set->workers = threads > 1 ? malloc((threads - 1) * sizeof(pthread_t)) : NULL;
+    if (!set->workers){
+        return;
+    }
+    for (uint32_t i = 0; i < threads - 1; i++){
+        if (pthread_create(&set->workers[set->worker_count], NULL, ExFormula_worker, set) == 0){
+            set->worker_count++;
+        }
+    }
+}
+
+
+static void ExFormula_compute_level(ExFormulas set, const uint32_t level[], uint32_t count){
+    /* Compute the count formulas in level[], none of which depends on another:
+       on the pool if there are enough of them, else on the calling thread.
+    */
+    if (count >= ExFormula_PARALLEL_MIN && set->threads != 1 && !set->started){
+        ExFormula_start(set);
+    }
+    if (count < ExFormula_PARALLEL_MIN || !set->worker_count){
+        for (uint32_t i = 0; i < count; i++){
+            ExFormula_compute(set, level[i]);
+        }
+        return;
+    }
+
+    pthread_mutex_lock(&set->lock);
+    set->work = level;
+    set->work_count = count;
+    atomic_store(&set->next, 0);
+    set->busy = set->worker_count;
+    set->generation++;
+    pthread_cond_broadcast(&set->start);
+    pthread_mutex_unlock(&set->lock);
+
+    ExFormula_work(set);
+
+    pthread_mutex_lock(&set->lock);
+    while (set->busy){
+        pthread_cond_wait(&set->finished, &set->lock);
+    }
+    pthread_mutex_unlock(&set->lock);
+}
+
+
+
+/*               * * * ExShape functions * * *                         */
+
+/* Shape caches (see struct expression_shapes). Looking an expression up
+   is a single scan over it, splitting its tokens off as the parser does
+   (see ExParallel_token()), that writes its shape and collects its
+   literals, then a hash table probe. Replacing an operand made of digits
+   by other digits doesn't change how the rest of the expression is split
+   into tokens, nor whether it's well formed, so a shape that compiled once
+   compiles every time: only expressions of a new shape are checked, parsed
+   and compiled.
+
+   The programs are compiled without ExP_OPT_* passes, which could merge or
+   reorder literals, and their literals aren't constants, so divisions
+   and powers by them aren't specialized.
+*/
+
+
+static uint32_t ExShape_scan(ExShapes shapes, const char expression[], size_t length,
+                             uint32_t *key_length, uint32_t *hash){
+    /* Write the shape of the first length characters of expression (fewer
+       if a NUL comes first) to shapes->key, hashing it (FNV-1a) into *hash,
+       and its literals to shapes->literals, converted as str_to_int() does
+       it (wrapping around). Return the number of literals, or UINT32_MAX if 
+       the expression can't be cached: if it contains ExShape_SLOT, or memory
+       couldn't be allocated.
+    */
+    const char *nul = memchr(expression, '\0', length);
+    if (nul){
+        length = nul - expression;
+    }
+    if (length >= UINT32_MAX || \
+            !ExStream_reserve((void **)&shapes->key, &shapes->key_size, (uint32_t)length + 1, sizeof(char))){
+        return UINT32_MAX;
+    }
+    uint32_t count = 0, written = 0;
+    uint32_t h = 2166136261u;
+    size_t i = 0;
+
+    while (i < length){
+        uint8_t kind = ExParallel_NONE;
+        size_t end = expression[i] == ' ' ? i + 1 : ExParallel_token(expression, length, i, &kind);
+
+        bool literal = kind == ExParallel_NUMBER;
+        uint32_t value = 0;
+        for (size_t j = i; literal && j < end; j++){
+            literal = expression[j] >= '0' && expression[j] <= '9';
+            value = value * 10 + (uint32_t)(expression[j] - '0');
+        }
+        if (literal){
+            if (!ExStream_reserve((void **)&shapes->literals, &shapes->literals_size, count + 1, sizeof(int32_t))){
+                return UINT32_MAX;
+            }
+            shapes->literals[count++] = (int32_t)value;
+            shapes->key[written++] = ExShape_SLOT;
+            h = (h ^ (uint8_t)ExShape_SLOT) * 16777619u;
+            i = end;
+        }
+        for (; i < end; i++){
+            if (expression[i] == ExShape_SLOT){
+                return UINT32_MAX;
+            }
+            shapes->key[written++] = expression[i];
+            h = (h ^ (uint8_t)expression[i]) * 16777619u;
+        }
+    }
+    *key_length = written;
+    *hash = h;
+
+    return count;
+}
+
+
+static uint32_t ExShape_find(ExShapes shapes, uint32_t key_length, uint32_t hash, ex_notation NOTATION){
+    /* Return the index of the shape just scanned (in shapes->key) in 
+       NOTATION, or UINT32_MAX if it's not in the cache
+    */
+    if (!shapes->table_size){
+        return UINT32_MAX;
+    }
+    uint32_t slot = hash & (shapes->table_size - 1);
+    while (shapes->table[slot]){
+        struct expression_shape *shape = &shapes->shapes[shapes->table[slot] - 1];
+        if (shape->hash == hash && shape->key_length == key_length && shape->notation == NOTATION && \
+                memcmp(shape->key, shapes->key, key_length) == 0){
+            return shapes->table[slot] - 1;
+        }
+        slot = (slot + 1) & (shapes->table_size - 1);
+    }
+    return UINT32_MAX;
+}
+
+
+static bool ExShape_grow_table(ExShapes shapes){
+    /* Double the hash table of shapes (or make the first one), reinserting
+       the shapes. Return false if memory couldn't be allocated.
+    */
+    uint32_t size = shapes->table_size ? 2 * shapes->table_size : 64;
+    uint32_t *table = calloc(size, sizeof(uint32_t));
+    if (!table){
+        return false;
+    }
+    for (uint32_t i = 0; i < shapes->count; i++){
+        uint32_t slot = shapes->shapes[i].hash & (size - 1);
+        while (table[slot]){
+            slot = (slot + 1) & (size - 1);
+        }
+        table[slot] = i + 1;
+    }
+    free(shapes->table);
+    shapes->table = table;
+    shapes->table_size = size;
+
+    return true;
+}
+
+
+static bool ExShape_is_literal(const char *token){
+    /* Determine whether the operand token is made only of digits */
+    uint32_t i = 0;
+    while (token[i] >= '0' && token[i] <= '9'){
+        i++;
+    }
+    return i && token[i] == '\0';
+}
+
+
+static bool ExShape_has_lanes(ExProgram program){
+    /* Determine whether program can be evaluated by ExShape_evaluate_lanes():
+       whether it has no control flow and calls no functions
+    */
+    if (program->count > UINT32_MAX / ExShape_LANES){
+        return false;
+    }
+    for (uint32_t i = 0; i < program->count; i++){
+        switch (program->opcodes[i]){
+            case ExP_OP_AND:
+            case ExP_OP_OR:
+            case ExP_OP_COND:
+            case ExP_OP_ELSE:
+            case ExP_OP_ARGS:
+            case ExP_OP_CALL:
+            case ExP_OP_SKIP_FALSE:
+            case ExP_OP_SKIP_TRUE:
+            case ExP_OP_JUMP:
+                return false;
+
+            default:
+                break;
+        }
+    }
+    return true;
+}
+
+
+static ExProgram ExShape_compile(ExShapes shapes, const char expression[], size_t length, ex_notation NOTATION,
+                                 uint32_t literals, bool *abstracted){
+    /* Parse and compile expression, whose literals ExShape_scan() just 
+       collected (literals of them; UINT32_MAX if it couldn't), into a
+       program whose literals are ExP_OP_REFERENCE nodes, the i-th one reading
+       inputs[i], and set *abstracted to true. If the literals of the tree
+       aren't those that were collected, which shouldn't happen, or weren't
+       collected, they're left in the program and *abstracted is set to false.
+       Return NULL if expression is malformed or memory couldn't be allocated.
+    */
+    *abstracted = false;
+    ExTreeWrapper expression_tree_wrapper = ExP_parse(expression, length, NOTATION, ExCheck_INTEGERS);
+    if (!expression_tree_wrapper){
+        return NULL;
+    }
+    ExP_phase(ExP_PHASE_COMPILE, 1);
+    ExTree tree = expression_tree_wrapper->expression_tree;
+    uint32_t nodes = ExTree_count_nodes(tree);
+    char **leaves = nodes ? malloc(nodes * sizeof(char *)) : NULL;
+    ExProgram program = nodes ? ExProgram_from_tree(tree) : NULL;
+    uint32_t leaf_count = 0, found = 0;
+    if (!leaves || !program || !ExFormula_collect_leaves(tree, leaves, &leaf_count)){
+        free(leaves);
+        ExP_program_destroy(&program);
+        ExP_phase(ExP_PHASE_COMPILE, 0);
+        ExTree_destroy(&expression_tree_wrapper);
+        ExCheck_fail(ExP_ERROR_MEMORY, 0);
+        return NULL;
+    }
+
+    bool matching = literals != UINT32_MAX;
+    for (uint32_t i = 0; i < leaf_count && matching; i++){
+        if (ExShape_is_literal(leaves[i])){
+            matching = found < literals && str_to_int(leaves[i]) == shapes->literals[found];
+            found++;
+        }
+    }
+    if (matching && found == literals){
+        *abstracted = true;
+        for (uint32_t i = 0, leaf = 0, slot = 0; i < program->count; i++){
+            if (program->opcodes[i] != ExP_OP_LITERAL || !ExShape_is_literal(leaves[leaf++])){
+                continue;
+            }
+            program->opcodes[i] = ExP_OP_REFERENCE;
+            program->left[i] = slot++;
+            program->right[i] = 0;
+        }
+    }
+    free(leaves);
+    ExTree_destroy(&expression_tree_wrapper);
+
+    ExProgram_specialize(program);
+    ExP_phase(ExP_PHASE_COMPILE, 0);
+
+    return program;
+}
+
+
+static uint32_t ExShape_add(ExShapes shapes, uint32_t key_length, uint32_t hash, ex_notation NOTATION,
+                            uint32_t literals, ExProgram program){
+    /* Add the shape just scanned, in NOTATION, with its compiled program,
+       to the cache, and return its index; UINT32_MAX if the cache is full 
+       or memory couldn't be allocated (the program then isn't added)
+    */
+    if (shapes->count >= shapes->capacity){
+        return UINT32_MAX;
+    }
+    char *key = malloc(key_length);
+    if (!key || \
+            !ExStream_reserve((void **)&shapes->shapes, &shapes->shapes_size, shapes->count + 1, sizeof(struct expression_shape)) || \
+            (2 * (shapes->count + 1) >= shapes->table_size && !ExShape_grow_table(shapes))){
+        free(key);
+        return UINT32_MAX;
+    }
+    memcpy(key, shapes->key, key_length);
+
+    uint32_t slot = hash & (shapes->table_size - 1);
+    while (shapes->table[slot]){
+        slot = (slot + 1) & (shapes->table_size - 1);
+    }
+    uint32_t index = shapes->count++;
+    shapes->shapes[index] = (struct expression_shape){
+        .key = key, .key_length = key_length, .hash = hash, .notation = NOTATION,
+        .program = program, .literals = literals, .lanes = ExShape_has_lanes(program)
+    };
+    shapes->table[slot] = index + 1;
+
+    return index;
+}
+
+
+static int32_t ExShape_get(ExShapes shapes, const char expression[], size_t length, ex_notation NOTATION,
+                           uint32_t *index, ExProgram *program){
+    /* Find the shape of expression in shapes, compiling and adding it if
+       it's not there yet, and leave its literals in shapes->literals.
+       Set *index to the index of the shape; or, if the expression can't be
+       cached, to UINT32_MAX, with *program set to a program compiled for it 
+       alone, for the caller to destroy.
+       Return 0, or -1 if expression is malformed or memory couldn't be
+       allocated (ExP_LIMIT_EXCEEDED if it's over the limits).
+    */
+    uint32_t key_length = 0, hash = 0;
+    uint32_t literals = ExShape_scan(shapes, expression, length, &key_length, &hash);
+
+    *program = NULL;
+    *index = literals == UINT32_MAX ? UINT32_MAX : ExShape_find(shapes, key_length, hash, NOTATION);
+    if (*index != UINT32_MAX){
+        return 0;
+    }
+
+    bool abstracted;
+    *program = ExShape_compile(shapes, expression, length, NOTATION, literals, &abstracted);
+    if (!*program){
+        return ExLimit_exceeded ? ExP_LIMIT_EXCEEDED : -1;
+    }
+    if (abstracted){
+        *index = ExShape_add(shapes, key_length, hash, NOTATION, literals, *program);
+        if (*index != UINT32_MAX){
+            *program = NULL;
+        }
+    }
+    return 0;
+}
+
+
+// evaluate expression, in which l is the lane, for each of the ExShape_LANES lanes
+#define ExShape_LANEWISE(expression)                            \
+    for (uint32_t l = 0; l < ExShape_LANES; l++){               \
+        value[l] = (expression);                                \
+    }
+
+static uint32_t ExShape_evaluate_lanes(ExProgram program, const int32_t inputs[], int32_t values[]){
+    /* Evaluate program, which has to pass ExShape_has_lanes(), for 
+       ExShape_LANES sets of inputs at once: input i of lane l is 
+       inputs[i * ExShape_LANES + l]. values has room for ExShape_LANES 
+       values per node, those of node i starting at values[i * ExShape_LANES];
+       the results are the values of the last node.
+       Each node is one loop over the lanes, of constant length and without
+       branches, which the compiler can vectorize.
+       Return the lanes that divided by 0, or INT32_MIN by -1: bit l for lane l.
+    */
+    uint32_t divided = 0;
+    for (uint32_t i = 0; i < program->count; i++){
+        uint8_t opcode = program->opcodes[i];
+        uint32_t right = program->right[i];
+        int32_t *value = &values[(size_t)i * ExShape_LANES];
+
+        if (opcode == ExP_OP_LITERAL){
+            int32_t literal = (int32_t)ExProgram_literal(program, i);
+            ExShape_LANEWISE(literal);
+            continue;
+        }
+        if (opcode == ExP_OP_REFERENCE){
+            const int32_t *input = &inputs[(size_t)program->left[i] * ExShape_LANES];
+            ExShape_LANEWISE(input[l]);
+            continue;
+        }
+        // for the operators specialized by ExProgram_specialize(), right 
+        // isn't the index of a node: b is only used by the others
+        const int32_t *a = &values[(size_t)program->left[i] * ExShape_LANES];
+        size_t b = (size_t)right * ExShape_LANES;
+
+        switch (opcode){
+            case ExP_OP_ADD:
+                ExShape_LANEWISE((int32_t)((uint32_t)a[l] + (uint32_t)values[b + l]));
+                break;
+
+            case ExP_OP_SUB:
+                ExShape_LANEWISE((int32_t)((uint32_t)a[l] - (uint32_t)values[b + l]));
+                break;
+
+            case ExP_OP_MUL:
+                ExShape_LANEWISE((int32_t)((uint32_t)a[l] * (uint32_t)values[b + l]));
+                break;
+
+            case ExP_OP_DIV:
+                // a failing lane divides by 1 instead, so as not to trap
+                for (uint32_t l = 0; l < ExShape_LANES; l++){
+                    int32_t divisor = values[b + l];
+                    bool fails = divisor == 0 || (divisor == -1 && a[l] == INT32_MIN);
+                    divided |= (uint32_t)fails << l;
+                    value[l] = a[l] / (fails ? 1 : divisor);
+                }
+                break;
+
+            case ExP_OP_LT:
+                ExShape_LANEWISE(a[l] < values[b + l]);
+                break;
+
+            case ExP_OP_LE:
+                ExShape_LANEWISE(a[l] <= values[b + l]);
+                break;
+
+            case ExP_OP_EQ:
+                ExShape_LANEWISE(a[l] == values[b + l]);
+                break;
+
+            case ExP_OP_NE:
+                ExShape_LANEWISE(a[l] != values[b + l]);
+                break;
+
+            case ExP_OP_MUL_POW2:
+                ExShape_LANEWISE((int32_t)((uint32_t)a[l] << right));
+                break;
+
+            case ExP_OP_DIV_POW2:
+                ExShape_LANEWISE(ExProgram_divide_pow2(a[l], right));
+                break;
+
+            case ExP_OP_DIV_MAGIC:
+                ExShape_LANEWISE(ExProgram_divide_magic(a[l], &program->divisors[right]));
+                break;
+
+            case ExP_OP_POW_CONST:
+                ExShape_LANEWISE(ExProgram_power(a[l], right));
+                break;
+
+            default:    // ^
+                ExShape_LANEWISE(ExP_apply(opcode, a[l], values[b + l]));
+                break;
+        }
+    }
+    return divided;
+}
+
+#undef ExShape_LANEWISE
+
+
+static uint32_t ExShape_flush(ExShapes shapes, uint32_t index, int32_t results[]){
+    /* Evaluate the expressions waiting in the lanes of shape index together,
+       and store their results: -1 for those dividing by 0. Return how many
+       of them do.
+    */
+    struct expression_shape *shape = &shapes->shapes[index];
+    if (!shape->lane_count){
+        return 0;
+    }
+    // the lanes left over compute the first expression again, rather
+    // than whatever inputs they had before, which could divide by 0
+    for (uint32_t i = 0; i < shape->literals; i++){
+        int32_t *inputs = &shape->lane_inputs[(size_t)i * ExShape_LANES];
+        for (uint32_t l = shape->lane_count; l < ExShape_LANES; l++){
+            inputs[l] = inputs[0];
+        }
+    }
+    ExP_phase(ExP_PHASE_RUN, 1);
+    uint32_t divided = ExShape_evaluate_lanes(shape->program, shape->lane_inputs, shapes->lane_values);
+    ExP_phase(ExP_PHASE_RUN, 0);
+
+    const int32_t *value = &shapes->lane_values[(size_t)(shape->program->count - 1) * ExShape_LANES];
+    uint32_t failed = 0;
+    for (uint32_t l = 0; l < shape->lane_count; l++){
+        bool lane_failed = divided & (1u << l);
+        results[shape->lane_results[l]] = lane_failed ? -1 : value[l];
+        failed += lane_failed;
+    }
+    shape->lane_count = 0;
+
+    return failed;
+}
+
+
+static bool ExShape_queue(ExShapes shapes, uint32_t index, uint32_t result, int32_t results[], uint32_t *failed){
+    /* Put the expression whose literals are in shapes->literals, and whose
+       result is results[result], in a lane of shape index; evaluate the 
+       lanes once they're all taken, adding those that fail to *failed.
+       Return false if memory couldn't be allocated (the expression then 
+       isn't queued).
+    */
+    struct expression_shape *shape = &shapes->shapes[index];
+
+    if (!shape->lane_inputs){
+        // (one more input than needed, so as to never malloc(0))
+        shape->lane_inputs = malloc(((size_t)shape->literals + 1) * ExShape_LANES * sizeof(int32_t));
+        if (!shape->lane_inputs){
+            return false;
+        }
+    }
+    if (!ExStream_reserve((void **)&shapes->lane_values, &shapes->lane_values_size, \
+                          shape->program->count * ExShape_LANES, sizeof(int32_t))){
+        return false;
+    }
+    if (!shape->lane_count){
+        if (!ExStream_reserve((void **)&shapes->waiting, &shapes->waiting_size, shapes->waiting_count + 1, sizeof(uint32_t))){
+            return false;
+        }
+        shapes->waiting[shapes->waiting_count++] = index;
+    }
+    for (uint32_t i = 0; i < shape->literals; i++){
+        shape->lane_inputs[(size_t)i * ExShape_LANES + shape->lane_count] = shapes->literals[i];
+    }
+    shape->lane_results[shape->lane_count++] = result;
+
+    if (shape->lane_count == ExShape_LANES){
+        *failed += ExShape_flush(shapes, index, results);
+    }
+    return true;
+}
+
+
+/* ------------------------- END PRIVATE ----------------------------- */
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+int32_t ExP_compute(char expression[], ex_notation NOTATION){
+    /* Parse the postfix_expression, build an expression tree,
+       then traverse this tree and evaluate the expression,
+       then return the computed result.
+    */
+    return ExP_compute_with(expression, NOTATION, ExP_OPT_NONE);
+}
+
+
+
+int32_t ExP_register_function(const char *name, ex_function function, uint32_t min_arguments, uint32_t max_arguments){
+    /* Add function to ExCall_functions[] under name, or replace the 
+       function already registered under name.
+    */
+    if (!name || !function || min_arguments < 1 || min_arguments > max_arguments || max_arguments > ExP_MAX_ARGUMENTS){
+        return -1;
+    }
+    // a name refine() keeps in one piece: 'x' followed by anything but a
+    // letter or '_' is the operator x
+    size_t length = strlen(name);
+    if (length == 0 || length >= sizeof(ExCall_functions[0].name) || !ExP_is_name_start(name[0]) || \
+            (name[0] == 'x' && !ExP_is_name_start(name[1]))){
+        return -1;
+    }
+    for (size_t i = 1; i < length; i++){
+        if (!ExP_is_name_start(name[i]) && !(name[i] >= '0' && name[i] <= '9')){
+            return -1;
+        }
+    }
+
+    int32_t id = ExCall_lookup(name);
+    if (id >= 0 && id < ExCall_BUILTINS){
+        return -1;
+    }
+    if (id < 0){
+        if (ExCall_count == sizeof(ExCall_functions) / sizeof(ExCall_functions[0])){
+            return -1;
+        }
+        id = ExCall_count++;
+        memcpy(ExCall_functions[id].name, name, length + 1);
+
+        uint32_t mask = sizeof(ExCall_slots) - 1;
+        uint32_t slot = ExCall_hash(name) & mask;
+        while (ExCall_slots[slot]){
+            slot = (slot + 1) & mask;
+        }
+        ExCall_slots[slot] = id + 1;
+    }
+    ExCall_functions[id].function = function;
+    ExCall_functions[id].min_arguments = min_arguments;
+    ExCall_functions[id].max_arguments = max_arguments;
+
+    return 0;
+}
+
+
+
+void ExP_set_parse_threads(uint32_t threads){
+    /* Set ExParallel_threads */
+    ExParallel_threads = threads > ExParallel_MAX_THREADS ? ExParallel_MAX_THREADS : threads;
+}
+
+
+
+void ExP_set_phase_hook(ex_phase_hook hook, void *context){
+    /* Set ExP_phase_hook and its context */
+    ExP_phase_hook = hook;
+    ExP_phase_context = context;
+}
+
+
+
+void ExP_set_limits(const ex_limits *limits){
+    /* Set the calling thread's ExLimit_limits; none if limits is NULL */
+    ExLimit_limits = limits ? *limits : (ex_limits){0};
+}
+
+
+
+int ExP_limit_exceeded(void){
+    /* Whether ExLimit_check() rejected the last expression parsed on this thread */
+    return ExLimit_exceeded;
+}
+
+
+
+ex_error ExP_last_error(void){
+    /* What ExCheck_expression() found wrong with the last expression parsed on this thread */
+    return ExCheck_error;
+}
+
+
+
+int32_t ExP_validate(const char expression[], size_t length, ex_notation NOTATION, ex_validation MODE, ex_error *error){
+    /* Check expression as ExP_parse() does it before building its tree,
+       without building it: with names and fractions, unless it's to be 
+       computed (MODE).
+       Return 0 if it's well formed, else -1 (or ExP_LIMIT_EXCEEDED).
+    */
+    uint8_t operands = MODE == ExP_VALIDATE_COMPUTE ? ExCheck_INTEGERS : ExCheck_NAMES | ExCheck_FRACTIONS;
+    bool valid = expression ? ExCheck_expression(expression, length, NOTATION, operands) : \
+                              ExCheck_fail(ExP_ERROR_EMPTY, 0);
+    if (error){
+        *error = ExCheck_error;
+    }
+    return valid ? 0 : ExLimit_exceeded ? ExP_LIMIT_EXCEEDED : -1;
+}
+
+
+
+int32_t ExP_compute_with(char expression[], ex_notation NOTATION, ex_options OPTIONS){
+    /* Same as ExP_compute(), except the expression tree is run through
+       the optional passes selected in OPTIONS before it's evaluated.
+    */
+    return ExP_compute_stats(expression, NOTATION, OPTIONS, NULL);
+}
+
+
+
+int32_t ExP_compute_stats(char expression[], ex_notation NOTATION, ex_options OPTIONS, ex_stats *stats){
+    /* Same as ExP_compute_with(), and if stats is not NULL, fill it in with 
+       information about the tree that was evaluated.
+    */
+    int32_t res = 0;
+
+    ExTreeWrapper expression_tree_wrapper = ExP_parse(expression, str_len(expression), NOTATION, ExCheck_INTEGERS);
+    if (!expression_tree_wrapper){
+        return -1;
+    }
+
+    if (OPTIONS & ExP_OPT_REBALANCE){
+        expression_tree_wrapper->expression_tree = ExTree_rebalance(expression_tree_wrapper->expression_tree);
+    }
+    if (stats){
+        stats->nodes = ExTree_count_nodes(expression_tree_wrapper->expression_tree);
+        stats->deduplicated = 0;
+    }
+
+    ExP_phase(ExP_PHASE_EVALUATE, 1);
+    ExDag dag = NULL;
+    if (OPTIONS & ExP_OPT_SHARE){
+        dag = ExDag_new(expression_tree_wrapper->expression_tree);
+    }
+
+    // if the DAG couldn't be built, fall back to evaluating the tree
+    if (dag){
+        res = ExDag_evaluate(dag);
+        if (stats){
+            stats->deduplicated = dag->deduplicated;
+        }
+        ExDag_destroy(&dag);
+    }
+    else{
+        res = ExTree_traverse(expression_tree_wrapper->expression_tree);
+    }
+    ExP_phase(ExP_PHASE_EVALUATE, 0);
+    ExTree_destroy(&expression_tree_wrapper);
+
+    // parsing reset ExCheck_error: it's only set if the evaluation divided by 0
+    return ExCheck_error.kind == ExP_ERROR_NONE ? res : -1;
+}
+
+
+
+int32_t ExP_compute_int64(char expression[], ex_notation NOTATION, int64_t *result){
+    /* Parse expression and evaluate its tree in int64_t arithmetic */
+    ExTreeWrapper expression_tree_wrapper = ExP_parse(expression, str_len(expression), NOTATION, ExCheck_INTEGERS);
+    if (!expression_tree_wrapper){
+        return ExLimit_exceeded ? ExP_LIMIT_EXCEEDED : -1;
+    }
+    // an expression without operators doesn't build a tree
+    bool failed = !expression_tree_wrapper->expression_tree;
+    ExP_phase(ExP_PHASE_EVALUATE, 1);
+    int64_t value = failed ? 0 : ExTyped_traverse_int64(expression_tree_wrapper->expression_tree, &failed);
+    ExP_phase(ExP_PHASE_EVALUATE, 0);
+    ExTree_destroy(&expression_tree_wrapper);
+
+    // *result is left as it is on failure
+    if (failed){
+        return -1;
+    }
+    *result = value;
+    return 0;
+}
+
+
+
+int32_t ExP_compute_checked(char expression[], ex_notation NOTATION, int64_t *result){
+    /* Parse expression and evaluate its tree in int64_t arithmetic, 
+       checking every operation for overflow
+    */
+    ExTreeWrapper expression_tree_wrapper = ExP_parse(expression, str_len(expression), NOTATION, ExCheck_INTEGERS);
+    if (!expression_tree_wrapper){
+        return ExLimit_exceeded ? ExP_LIMIT_EXCEEDED : -1;
+    }
+    // an expression without operators doesn't build a tree
+    bool failed = !expression_tree_wrapper->expression_tree;
+    ExP_phase(ExP_PHASE_EVALUATE, 1);
+    int64_t value = failed ? 0 : ExTyped_traverse_checked(expression_tree_wrapper->expression_tree, &failed);
+    ExP_phase(ExP_PHASE_EVALUATE, 0);
+    ExTree_destroy(&expression_tree_wrapper);
+
+    // *result is left as it is on failure
+    if (failed){
+        return -1;
+    }
+    *result = value;
+    return 0;
+}
+
+
+
+int32_t ExP_compute_double(char expression[], ex_notation NOTATION, double *result){
+    /* Parse expression and evaluate its tree in double arithmetic */
+    ExTreeWrapper expression_tree_wrapper = ExP_parse(expression, str_len(expression), NOTATION, ExCheck_FRACTIONS);
+    if (!expression_tree_wrapper){
+        return ExLimit_exceeded ? ExP_LIMIT_EXCEEDED : -1;
+    }
+    // an expression without operators doesn't build a tree
+    bool failed = !expression_tree_wrapper->expression_tree;
+    ExP_phase(ExP_PHASE_EVALUATE, 1);
+    double value = failed ? 0 : ExTyped_traverse_double(expression_tree_wrapper->expression_tree, &failed);
+    ExP_phase(ExP_PHASE_EVALUATE, 0);
+    ExTree_destroy(&expression_tree_wrapper);
+
+    // *result is left as it is on failure
+    if (failed){
+        return -1;
+    }
+    *result = value;
+    return 0;
+}
+
+
+
+int64_t ExP_compute_to_string(char expression[], ex_notation NOTATION, char *buffer, size_t size){
+    /* Parse expression, evaluate its tree as ExP_compute() does, and 
+       format the result into buffer with ExFormat_int64()
+    */
+    if (!expression || (!buffer && size)){
+        return -1;
+    }
+    ExTreeWrapper expression_tree_wrapper = ExP_parse(expression, str_len(expression), NOTATION, ExCheck_INTEGERS);
+    if (!expression_tree_wrapper){
+        return ExLimit_exceeded ? ExP_LIMIT_EXCEEDED : -1;
+    }
+    if (!expression_tree_wrapper->expression_tree){
+        ExTree_destroy(&expression_tree_wrapper);
+        return -1;
+    }
+    ExP_phase(ExP_PHASE_EVALUATE, 1);
+    int32_t result = ExTree_traverse(expression_tree_wrapper->expression_tree);
+    ExP_phase(ExP_PHASE_EVALUATE, 0);
+    ExTree_destroy(&expression_tree_wrapper);
+    if (ExCheck_error.kind != ExP_ERROR_NONE){     // divided by 0
+        return -1;
+    }
+
+    char text[ExP_INT_STRING];
+    uint32_t length = ExFormat_int64(result, text);
+    if (length < size){
+        memcpy(buffer, text, length + 1);
+    }
+    return length;
+}
+
+
+
+uint32_t ExP_format_int(int64_t value, char buffer[]){
+    /* Format value with ExFormat_int64() */
+    return ExFormat_int64(value, buffer);
+}
+
+
+
+int32_t ExP_fingerprint(const char expression[], size_t length, ex_notation NOTATION, ex_fingerprint *fingerprint){
+    /* Parse expression and compute the fingerprint of its tree with ExPrint_tree() */
+    if (!expression || !fingerprint){
+        return -1;
+    }
+    ExTreeWrapper expression_tree_wrapper = ExP_parse(expression, length, NOTATION, ExCheck_NAMES);
+    if (!expression_tree_wrapper){
+        return ExLimit_exceeded ? ExP_LIMIT_EXCEEDED : -1;
+    }
+    bool failed = !expression_tree_wrapper->expression_tree;
+    if (!failed){
+        *fingerprint = ExPrint_tree(expression_tree_wrapper->expression_tree, &failed);
+    }
+    ExTree_destroy(&expression_tree_wrapper);
+
+    return failed ? -1 : 0;
+}
+
+
+
+ExProgram ExP_compile(char expression[], ex_notation NOTATION, ex_options OPTIONS){
+    /* Compile the Nul-terminated expression; see ExP_compile_n() */
+    return ExP_compile_n(expression, str_len(expression), NOTATION, OPTIONS);
+}
+
+
+
+ExProgram ExP_compile_n(const char expression[], size_t length, ex_notation NOTATION, ex_options OPTIONS){
+    /* Parse the first length characters of expression, run the passes selected 
+       in OPTIONS on the tree, then compile it into an ExProgram and return that.
+       The expression tree (and the refined expression string) is freed
+       before returning: the program doesn't refer to it.
+    */
+    ExTreeWrapper expression_tree_wrapper = ExP_parse(expression, length, NOTATION, ExCheck_INTEGERS);
+    if (!expression_tree_wrapper){
+        return NULL;
+    }
+
+    if (OPTIONS & ExP_OPT_REBALANCE){
+        expression_tree_wrapper->expression_tree = ExTree_rebalance(expression_tree_wrapper->expression_tree);
+    }
+
+    ExP_phase(ExP_PHASE_COMPILE, 1);
+    ExProgram program = NULL;
+    if (OPTIONS & ExP_OPT_SHARE){
+        ExDag dag = ExDag_new(expression_tree_wrapper->expression_tree);
+        if (dag){
+            program = ExProgram_from_dag(dag);
+            ExDag_destroy(&dag);
+        }
+    }
+    if (!program){
+        program = ExProgram_from_tree(expression_tree_wrapper->expression_tree);
+    }
+    if (program){
+        ExProgram_specialize(program);
+    }
+    ExP_phase(ExP_PHASE_COMPILE, 0);
+    ExTree_destroy(&expression_tree_wrapper);
+
+    return program;
+}
+
+
+
+int32_t ExP_run(ExProgram program){
+    /* Evaluate the compiled expression program and return the result.
+       ExP_divide() records a division by 0 with ExCheck_fail().
+    */
+    ExCheck_error = (ex_error){ExP_ERROR_NONE, 0};
+    ExP_phase(ExP_PHASE_RUN, 1);
+    int32_t result = ExProgram_evaluate(program);
+    ExP_phase(ExP_PHASE_RUN, 0);
+
+    return result;
+}
+
+
+
+void ExP_run_batch(ExProgram programs[], uint32_t count, int32_t results[]){
+    /* Evaluate count compiled programs, storing the result of programs[i] 
+       in results[i].
+    */
+    ExCheck_error = (ex_error){ExP_ERROR_NONE, 0};
+    ExP_phase(ExP_PHASE_RUN, 1);
+    for (uint32_t i = 0; i < count; i++){
+        results[i] = ExProgram_evaluate(programs[i]);
+    }
+    ExP_phase(ExP_PHASE_RUN, 0);
+}
+
+
+
+void ExP_program_destroy(ExProgram *program_ref){
+    /* Free the heap memory associated with *program_ref, then set *program_ref to NULL */
+    if (program_ref == NULL || *program_ref == NULL){
+        return;
+    }
+    free((*program_ref)->divisors);
+    free(*program_ref);
+    *program_ref = NULL;
+}
+
+
+
+char *ExP_to_postfix(char expression[], ex_notation NOTATION){
+    /* Convert expression to postfix expression.
+       Expression is either a prefix or infix expression.
+    */
+    // make it twice the size of expression, to play it safe and be able to add proper
+    // spacing
+
+    if (!expression){
+        return NULL;
+    }
+   
+    switch (NOTATION){
+        case INFIX:
+            {
+                // if expression is in infix notation, don't build a parse tree for the
+                // conversion to postfix, but simply return the postfix expression obtained 
+                // with the shunting yard algorithm
+                if (!ExCheck_expression(expression, str_len(expression), INFIX, ExCheck_NAMES | ExCheck_FRACTIONS)){
+                    return NULL;
+                }
+                ExP_phase(ExP_PHASE_SHUNT, 1);
+                char *postfix = ExP_infix_shunt(expression, str_len(expression));
+                ExP_phase(ExP_PHASE_SHUNT, 0);
+                return postfix;
+            }
+
+        case POSTFIX:
+            {
+                // the expression is already in postfix notation: check it, and return
+                // a copy, to be freed like any other conversion
+                size_t length = str_len(expression);
+                if (!ExCheck_expression(expression, length, POSTFIX, ExCheck_NAMES | ExCheck_FRACTIONS)){
+                    return NULL;
+                }
+                char *postfix = malloc(sizeof(char) * (length + 1));
+                if (!postfix){
+                    ExCheck_fail(ExP_ERROR_MEMORY, 0);
+                    return NULL;
+                }
+                memcpy(postfix, expression, length + 1);
+                return postfix;
+            }
+
+        case PREFIX:
+            {
+                ex_conversions conversions;
+                // only one notation requested, so the block returned starts
+                // with the postfix string
+                return ExP_convert_all(expression, NOTATION, ExP_TO_POSTFIX, &conversions);
+            }
+
+        default:
+            return NULL;
+    }
+}
+
+
+
+char *ExP_to_prefix(char expression[], ex_notation NOTATION){
+    /* Convert expression to prefix.
+       expression is either a postfix or infix notation expression.
+    */
+    ex_conversions conversions;
+    // only one notation requested, so the block returned starts
+    // with the prefix string
+    return ExP_convert_all(expression, NOTATION, ExP_TO_PREFIX, &conversions);
+}
+
+
+char *ExP_to_infix(char expression[], ex_notation NOTATION){
+    /* Convert expression to Infix. 
+        expression is either a prefix or postfix notation expression.
+    */
+    ex_conversions conversions;
+    // only one notation requested, so the block returned starts
+    // with the infix string
+    return ExP_convert_all(expression, NOTATION, ExP_TO_INFIX, &conversions);
+}
+
+
+
+char *ExP_convert_all(char expression[], ex_notation NOTATION, ex_targets TARGETS, ex_conversions *conversions){
+    /* Parse expression once, then produce from the one expression tree
+       all the notations requested in TARGETS (and its value, if requested),
+       storing them in *conversions.
+
+       The exact size of each output string is computed up front, so they're 
+       all written into a single allocated block, which is returned. 
+       Freeing that block frees all the strings.
+    */
+    conversions->prefix = NULL;
+    conversions->infix = NULL;
+    conversions->postfix = NULL;
+    conversions->value = 0;
+
+    if (!expression){
+        return NULL;
+    }
+    // between prefix and postfix, no tree is needed: convert straight into
+    // a block of the exact size
+    if ((NOTATION == PREFIX && TARGETS == ExP_TO_POSTFIX) || (NOTATION == POSTFIX && TARGETS == ExP_TO_PREFIX)){
+        size_t length = str_len(expression);
+        int64_t needed = ExSpan_measure(expression, length);
+        char *block = needed >= 0 ? malloc(sizeof(char) * (needed + 1)) : NULL;
+        if (block && ExSpan_into(expression, length, NOTATION, block, needed + 1) < 0){
+            free(block);
+            block = NULL;
+        }
+        if (NOTATION == PREFIX){
+            conversions->postfix = block;
+        }else{
+            conversions->prefix = block;
+        }
+        return block;
+    }
+
+    // the value is computed as by ExP_compute(), in integers
+    uint8_t operands = (TARGETS & ExP_TO_VALUE) ? ExCheck_INTEGERS : ExCheck_NAMES | ExCheck_FRACTIONS;
+    ExTreeWrapper expression_tree_wrapper = ExP_parse(expression, str_len(expression), NOTATION, operands);
+    if (!expression_tree_wrapper){
+        return NULL;
+    }
+    ExTree tree = expression_tree_wrapper->expression_tree;
+
+    ExP_phase(ExP_PHASE_WRITE, 1);
+    // token_chars: the number of characters in all the tokens put together
+    uint32_t token_chars = 0, nodes = 0, parentheses = 0;
+    if (!ExTree_measure(tree, &token_chars, &nodes, &parentheses)){
+        ExP_phase(ExP_PHASE_WRITE, 0);
+        ExTree_destroy(&expression_tree_wrapper);
+        return NULL;
+    }
+
+    // prefix and postfix: every token followed by a space, except the last one, 
+    // followed by the NUL instead.
+    // infix: every token, plus the pairs of parentheses, plus the NUL
+    size_t size = 1;    // so that the block is never empty (when only the value is requested)
+    if (TARGETS & ExP_TO_PREFIX){
+        size += token_chars + nodes;
+    }
+    if (TARGETS & ExP_TO_INFIX){
+        size += token_chars + 2 * parentheses + 1;
+    }
+    if (TARGETS & ExP_TO_POSTFIX){
+        size += token_chars + nodes;
+    }
+
+    char *block = malloc(sizeof(char) * size);
+    if (!block){
+        ExP_phase(ExP_PHASE_WRITE, 0);
+        ExTree_destroy(&expression_tree_wrapper);
+        return NULL;
+    }
+    // each string is written through a sink over its own part of the block,
+    // of its exact size, then NUL-terminated; the next one starts after the NUL
+    struct expression_sink sink;
+    char *next = block;
+    bool failed = false;     // a tree walk couldn't allocate its stack
+
+    if (TARGETS & ExP_TO_PREFIX){
+        conversions->prefix = next;
+        ExSink_init(&sink, next, token_chars + nodes, NULL, NULL, -1);
+        ExTree_traverse_preorder(tree, &sink);
+        failed = failed || sink.failed;
+        next[sink.used] = '\0';
+        next += sink.used + 1;
+    }
+    if (TARGETS & ExP_TO_INFIX){
+        conversions->infix = next;
+        ExSink_init(&sink, next, token_chars + 2 * parentheses, NULL, NULL, -1);
+        ExTree_traverse_inorder(tree, &sink);
+        failed = failed || sink.failed;
+        next[sink.used] = '\0';
+        next += sink.used + 1;
+    }
+    if (TARGETS & ExP_TO_POSTFIX){
+        conversions->postfix = next;
+        ExSink_init(&sink, next, token_chars + nodes, NULL, NULL, -1);
+        ExTree_traverse_postorder(tree, &sink);
+        failed = failed || sink.failed;
+        next[sink.used] = '\0';
+    }
+    ExP_phase(ExP_PHASE_WRITE, 0);
+    if ((TARGETS & ExP_TO_VALUE) && !failed){
+        ExP_phase(ExP_PHASE_EVALUATE, 1);
+        conversions->value = ExTree_traverse(tree);
+        ExP_phase(ExP_PHASE_EVALUATE, 0);
+
+        // parsing reset ExCheck_error: it's only set if the evaluation failed
+        // (dividing by 0, or INT32_MIN by -1)
+        failed = ExCheck_error.kind != ExP_ERROR_NONE;
+    }
+
+    ExTree_destroy(&expression_tree_wrapper);
+    if (failed){
+        free(block);
+        *conversions = (ex_conversions){NULL, NULL, NULL, 0};
+        return NULL;
+    }
+    return block;
+}
+
+
+
+
+int64_t ExP_convert_into(const char expression[], size_t length, ex_notation NOTATION, ex_targets TARGET,
+                         char buffer[], size_t size){
+    /* Parse the first length characters of expression and write its conversion
+       to the one notation in TARGET into buffer, if it fits (with its NUL).
+       The exact length of the conversion is known from the tree before anything
+       is written, so a buffer that's too small is left untouched.
+       Return the length of the conversion, not counting the NUL, or -1 on failure.
+    */
+    if (!expression || (TARGET != ExP_TO_PREFIX && TARGET != ExP_TO_INFIX && TARGET != ExP_TO_POSTFIX)){
+        return -1;
+    }
+    // between prefix and postfix, no tree is needed
+    if ((NOTATION == PREFIX && TARGET == ExP_TO_POSTFIX) || (NOTATION == POSTFIX && TARGET == ExP_TO_PREFIX)){
+        return ExSpan_into(expression, length, NOTATION, buffer, size);
     }
-    // NULL - terminate the output string; the char at the previous index is whitespace,
-    // so put the NUL there
-    *(--index) = '\0';
 
-    // free the allocated memory: the operator stack, the 'input' string
-    Stack_destroy(&operators_stack);
-    free(refined_ex);
+    ExTreeWrapper expression_tree_wrapper = ExP_parse(expression, length, NOTATION, ExCheck_NAMES | ExCheck_FRACTIONS);
+    if (!expression_tree_wrapper){
+        return ExLimit_exceeded ? ExP_LIMIT_EXCEEDED : -1;
+    }
+    ExTree tree = expression_tree_wrapper->expression_tree;
 
-    return infix_expression;
+    ExP_phase(ExP_PHASE_WRITE, 1);
+    uint32_t token_chars = 0, nodes = 0, parentheses = 0;
+    if (!ExTree_measure(tree, &token_chars, &nodes, &parentheses)){
+        nodes = 0;
+    }
+
+    // same sizes as in ExP_convert_all(), minus the NUL
+    int64_t needed;
+    if (TARGET == ExP_TO_INFIX){
+        needed = (int64_t)token_chars + 2 * parentheses;
+    }else{
+        needed = (int64_t)token_chars + nodes - 1;
+    }
+
+    if (nodes && (size_t)needed < size){
+        struct expression_sink sink;
+        ExSink_init(&sink, buffer, needed, NULL, NULL, -1);
+        ExTree_write(tree, TARGET, &sink);
+        buffer[needed] = '\0';
+        if (sink.failed){
+            nodes = 0;
+        }
+    }
+    ExP_phase(ExP_PHASE_WRITE, 0);
+
+    ExTree_destroy(&expression_tree_wrapper);
+    return nodes ? needed : -1;
 }
 
 
 
 
-static void ExP_prefix_build_et(ExTree *tree_ref, char *token){
-    /* Called from inside ExP_parse_prefix(). 
 
-       It returns nothing, as it builds a tree back in the caller's space,
-       as it traverses it.
+int64_t ExP_convert_to(const char expression[], size_t length, ex_notation NOTATION, ex_targets TARGET,
+                       ex_stream_output output, void *context){
+    /* Convert expression, passing the output to output in chunks of a fixed-size buffer */
+    if (!output){
+        return -1;
+    }
+    char buffer[4096];
+    struct expression_sink sink;
+    ExSink_init(&sink, buffer, sizeof(buffer), output, context, -1);
+
+    return ExP_convert_to_sink(expression, length, NOTATION, TARGET, &sink);
+}
 
-       Used to build the expression tree for ExP_parse_prefix(). The calling
-       function in this case serves as a nonlocal-scope providing wrapper.
-    */
-    if (!token){ // token is NULL
-       return; 
+
+
+int64_t ExP_convert_to_file(const char expression[], size_t length, ex_notation NOTATION, ex_targets TARGET,
+                            FILE *file){
+    /* Convert expression, writing the output to file */
+    if (!file){
+        return -1;
     }
-    else{
-        if (!(*tree_ref)){  // if the place in the tree is void, continue building
-            ExTree tree = ExTree_new(token);
-            *tree_ref = tree;
-        }
+    char buffer[4096];
+    struct expression_sink sink;
+    ExSink_init(&sink, buffer, sizeof(buffer), ExSink_file_output, file, -1);
 
-            // we've placed this subtree in the right place.
-            // now : either return, if the token is an operand,
-            // or recurse, if the token is an operator
+    int64_t written = ExP_convert_to_sink(expression, length, NOTATION, TARGET, &sink);
+    return ferror(file) ? -1 : written;
+}
 
-            // if token[0] is an operator (accepted operators are always one-char wide here)
-        if (!ExP_is_operator(*token)){
-            return;
-        }
-        else{   // the token is an operator: recurse, and advance down the expression string by getting the next token
-            // recurse first to the left, then to the right
-            // because the first operand found is the left operand, the next one the right one
 
-            //arguments: 1) a pointer to the 'left' pointer field  of the tree pointer
-            //that tree_ref points to (pretty difficult to succintly explain)
-            // 2) a call to ExP_tokenize() which returns the next token in the expression
-            ExP_prefix_build_et(&(*tree_ref)->left, ExP_tokenize(NULL, ' '));
-            // recurse and go down the right child node in *tree_ref
-            ExP_prefix_build_et(&(*tree_ref)->right, ExP_tokenize(NULL, ' '));
-        }
+
+int64_t ExP_convert_to_fd(const char expression[], size_t length, ex_notation NOTATION, ex_targets TARGET, int fd){
+    /* Convert expression, writing the output to the file descriptor fd */
+    if (fd < 0){
+        return -1;
     }
+    char buffer[4096];
+    struct expression_sink sink;
+    ExSink_init(&sink, buffer, sizeof(buffer), NULL, NULL, fd);
+
+    return ExP_convert_to_sink(expression, length, NOTATION, TARGET, &sink);
 }
 
 
 
-static ExTreeWrapper ExP_parse_prefix(char* exp){
-    /* Parse the prefix expression exp and build an expression 
-       tree out of it. Wrap the expression tree inside
-       an ExTreeWrapper, and return that.
+ExStream ExP_stream_new(ex_notation NOTATION, ex_targets TARGETS, ex_stream_output output, void *context){
+    /* Create an ExStream for parsing an expression in NOTATION that will
+       be fed to it piece by piece with ExP_stream_feed().
 
-       prefix_expression is assumed to be a valid 
-       expression in prefix notation. The first
-       character is always an operator and the last character
-       is always an operand. 
-       
-       Blank spaces are used to separate operands. I.e.
-       '+374' is not a valid expression, since it could be
-       either 37+4 or 3+74, depending on how the parsing is
-       done. '+3 7' and '+  3 7 ', on the other hand, are both
-       valid expressions. Spaces are necessary between operands,
-       but not necessary between operators or an operator and an
-       operand. 
+       TARGETS says what to produce: ExP_TO_VALUE and/or at most one 
+       notation, written through output as the input is consumed.
+       Only the conversions that can be done with memory bounded by the
+       nesting depth are supported: any notation to itself, prefix to
+       postfix or infix, and infix to postfix. Postfix to prefix or infix
+       needs the whole expression tree, since the first character of
+       the output depends on the last token of the input.
 
-       The postfix_expression argument is a string, and as such
-       it has to be Nul-terminated, or it's not valid input.
+       Return NULL if the combination isn't supported or memory couldn't
+       be allocated.
     */
-      
-    // if the current char in exp is NULL : end of the expression 
-    exp = ExP_refine(exp, PREFIX);
-    if (!exp){
+    ex_targets notations = TARGETS & (ExP_TO_PREFIX | ExP_TO_INFIX | ExP_TO_POSTFIX);
+
+    // at most one notation, and something to write it to
+    if ((notations & (notations - 1)) || (notations && !output)){
         return NULL;
     }
-    // declare and initialize a tree wrapper that tracks exp and the exp tree that will be
-    // built from it, for deallocation purposes
-    ExTreeWrapper tree_wrapper;
-    ExTree_init(&tree_wrapper, exp);
+    switch (NOTATION){
+        case PREFIX:
+            break;
 
-    char *token = ExP_tokenize(exp, ' ');
-    ExP_prefix_build_et(&tree_wrapper->expression_tree, token);
+        case INFIX:
+            if (notations & ExP_TO_PREFIX){
+                return NULL;
+            }
+            break;
 
-    // the refined expression string: no longer needed
-     // free(exp);
-    
-    return tree_wrapper;
-} 
-  
- 
- 
+        case POSTFIX:
+            if (notations & (ExP_TO_PREFIX | ExP_TO_INFIX)){
+                return NULL;
+            }
+            break;
 
-    
-/* ------------------------- END PRIVATE ----------------------------- */
-/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+        default:
+            return NULL;
+    }
 
+    ExStream stream = calloc(1, sizeof(struct expression_stream));
+    if (!stream){
+        return NULL;
+    }
+    stream->NOTATION = NOTATION;
+    stream->TARGETS = TARGETS;
+    stream->output = output;
+    stream->context = context;
+    stream->limits = ExLimit_limits;
+    ExLimit_exceeded = false;
+
+    return stream;
+}
 
-int32_t ExP_compute(char expression[], ex_notation NOTATION){
-    /* Parse the postfix_expression, build an expression tree,
-       then traverse this tree and evaluate the expression,
-       then return the computed result.
-    */
-    int32_t res = 0;
 
 
-    switch(NOTATION){
+int32_t ExP_stream_feed(ExStream stream, const char chunk[], size_t length){
+    /* Feed the next length bytes of the expression to stream.
+       Tokens can be split across chunks in any way: an operand that's
+       still being read when the chunk ends is carried over to the next one,
+       and so is the chunk's last character, until the next one tells 
+       whether that's '<' or "<=", and whether an 'x' starts a name.
 
-        case(PREFIX):
-        {
-            ExTreeWrapper expression_tree_wrapper = ExP_parse_prefix(expression);
-            res = ExTree_traverse(expression_tree_wrapper->expression_tree);
-            ExTree_destroy(&expression_tree_wrapper);
+       Return 0, -1 if the input is malformed, or ExP_LIMIT_EXCEEDED if it 
+       goes over the limits the stream was created with (in either case,
+       every subsequent call fails as well).
+    */
+    size_t i = 0;
+    if (stream->holding && length && !stream->failed){
+        stream->holding = false;
+        i = ExStream_char(stream, stream->held, chunk[0]) - 1;
+    }
+    while (i < length && !stream->failed){
+        if (i + 1 == length){
+            stream->held = chunk[i];
+            stream->holding = true;
             break;
         }
+        i += ExStream_char(stream, chunk[i], chunk[i+1]);
+    }
+    return stream->exceeded ? ExP_LIMIT_EXCEEDED : stream->failed ? -1 : 0;
+}
 
-        case(POSTFIX):
-        {
-            ExTreeWrapper expression_tree_wrapper = ExP_parse_postfix(expression);
-            res = ExTree_traverse(expression_tree_wrapper->expression_tree);
-            ExTree_destroy(&expression_tree_wrapper);
-            break;
-       }
 
-        case(INFIX):
-        {
-            // first convert infix to postfix, then handle the postfix expression
-            char *postfix = ExP_infix_shunt(expression);
-            ExTreeWrapper expression_tree_wrapper = ExP_parse_postfix(postfix);
-            res = ExTree_traverse(expression_tree_wrapper->expression_tree);
-            ExTree_destroy(&expression_tree_wrapper);
-            break;
-       }
 
+int32_t ExP_stream_finish(ExStream stream, int32_t *value){
+    /* Signal the end of the input to stream. If the value was requested
+       and value is not NULL, store the result of the expression in *value.
 
-        default:
-        {
-            printf("Function incorrectly called.\n");
+       Return 0, ExP_LIMIT_EXCEEDED if the input went over the limits, or 
+       -1 if it was malformed or incomplete, or if the value was requested
+       and divides by 0 (recorded with ExCheck_fail()).
+    */
+    if (stream->holding && !stream->failed){
+        stream->holding = false;
+        ExStream_char(stream, stream->held, '\0');
+    }
+    ExStream_end_operand(stream);
+
+    if (stream->NOTATION == INFIX && !stream->failed){
+        // the expression ends with an operand, or a parenthesis closing one
+        if (stream->previous != ExParallel_NUMBER && stream->previous != ExParallel_NAME && \
+                stream->previous != ExParallel_CLOSE){
+            stream->failed = true;
+        }
+        // the leftover operators
+        while (stream->frames_count && !stream->failed){
+            if (stream->frames[stream->frames_count - 1].operator[0] == '('){    // unclosed parenthesis
+                stream->failed = true;
+                break;
+            }
+            ExStream_pop_operator(stream);
         }
     }
+    if (stream->NOTATION == PREFIX && !stream->complete){
+        stream->failed = true;
+    }
+    // exactly one value left, and not an argument list or the branches of a ?:
+    if (stream->values_count != 1 || stream->values[0].arguments || stream->values[0].is_else){
+        stream->failed = true;
+    }
 
-    if (!res){
+    if (stream->exceeded){
+        return ExP_LIMIT_EXCEEDED;
+    }
+    if (stream->failed){
         return -1;
-    }else{
-        return res;
     }
+    if ((stream->TARGETS & ExP_TO_VALUE) && stream->values[0].error){
+        return ExCheck_fail(stream->values[0].error, 0) ? 0 : -1;
+    }
+    if (value && (stream->TARGETS & ExP_TO_VALUE)){
+        *value = stream->values[0].value;
+    }
+    return 0;
 }
 
 
 
-char *ExP_to_postfix(char expression[], ex_notation NOTATION){
-    /* Convert expression to postfix expression.
-       Expression is either a prefix or infix expression.
+void ExP_stream_destroy(ExStream *stream_ref){
+    /* Free all heap memory associated with *stream_ref, then set it to NULL */
+    if (stream_ref == NULL || *stream_ref == NULL){
+        return;
+    }
+    free((*stream_ref)->token);
+    free((*stream_ref)->values);
+    free((*stream_ref)->frames);
+    free(*stream_ref);
+
+    *stream_ref = NULL;
+}
+
+
+
+int32_t ExP_generate_c(FILE *file, uint32_t count, const char *names[], const char *expressions[], ex_notation NOTATION){
+    /* Parse every expression and write its C translation to file, as
+       described in C_ex_parser.h.
+       Nothing is written if any of the names or expressions is invalid, so
+       a failure doesn't leave a half-generated file behind.
     */
-    // make it twice the size of expression, to play it safe and be able to add proper
-    // spacing
+    ExTreeWrapper *trees = calloc(count ? count : 1, sizeof(ExTreeWrapper));
+    if (!trees){
+        return -1;
+    }
+    int32_t res = 0;
 
-    if (!expression){
+    for (uint32_t i = 0; i < count && res == 0; i++){
+        if (!ExGen_check_names(names, i) || !expressions[i]){
+            res = -1;
+            break;
+        }
+        trees[i] = ExP_parse(expressions[i], strlen(expressions[i]), NOTATION, ExCheck_NAMES);
+        if (!trees[i] || !trees[i]->expression_tree || !ExGen_is_well_formed(trees[i]->expression_tree) || \
+                !ExGen_check_variables(trees[i]->expression_tree, names[i])){
+            res = ExLimit_exceeded ? ExP_LIMIT_EXCEEDED : -1;
+        }
+    }
+
+    if (res == 0){
+        fprintf(file, "/* Generated by ExP_generate_c() */\n\n%s", ExGen_prelude);
+    }
+    char **variables = NULL;
+    uint32_t variables_size = 0;
+    uint64_t declared = 0;  // the registered functions declared so far
+
+    for (uint32_t i = 0; i < count && res == 0; i++){
+        uint32_t variables_count = 0;
+        if (!ExGen_collect_variables(trees[i]->expression_tree, &variables, &variables_count, &variables_size)){
+            res = -1;
+            break;
+        }
+        if (!ExGen_declare_functions(trees[i]->expression_tree, &declared, file) || \
+            !ExGen_emit_function(trees[i]->expression_tree, names[i], variables, variables_count, file)){
+            res = -1;
+        }
+    }
+    if (res == 0 && ferror(file)){
+        res = -1;
+    }
+
+    free(variables);
+    for (uint32_t i = 0; i < count; i++){
+        ExTree_destroy(&trees[i]);
+    }
+    free(trees);
+    return res;
+}
+
+
+
+ExFormulas ExP_formulas_new(uint32_t threads){
+    /* Create an empty formula set, recalculated on up to threads threads */
+    ExFormulas set = calloc(1, sizeof(struct expression_formulas));
+    if (!set){
         return NULL;
     }
-   
-    switch (NOTATION){
-        case INFIX:
-            {
-                // if expression is in infix notation, don't build a parse tree for the
-                // conversion to postfix, but simply return the postfix expression obtained 
-                // with the shunting yard algorithm
-                return ExP_infix_shunt(expression);
-                break; // not needed
-            }
+    set->threads = threads > ExParallel_MAX_THREADS ? ExParallel_MAX_THREADS : threads;
+    atomic_init(&set->next, 0);
+    pthread_mutex_init(&set->lock, NULL);
+    pthread_cond_init(&set->start, NULL);
+    pthread_cond_init(&set->finished, NULL);
 
-        case POSTFIX:
-            {
-                // the expression is already in postfix notation. return it without doing
-                // anything else
-                return expression;
-                break;
-            }
+    return set;
+}
 
-        case PREFIX:
-            {
-                uint8_t size = str_len(expression) * 2;
 
-                // this pointer will be changed by ExTree_traverse_postorder()
-                // so a second pointer, left intact, pointing to the start of the string, is needed
-                char *changeable = malloc(sizeof(char) * size); 
-                char *intact = changeable;
 
+int32_t ExP_formulas_set(ExFormulas set, const char *name, const char expression[], ex_notation NOTATION){
+    /* Parse expression and make it the formula called name, compiled with
+       ExFormula_bind(); mark it dirty
+    */
+    if (!set || !ExFormula_is_name(name) || !expression){
+        return -1;
+    }
+    ExTreeWrapper expression_tree_wrapper = ExP_parse(expression, strlen(expression), NOTATION, ExCheck_NAMES);
+    if (!expression_tree_wrapper){
+        return ExLimit_exceeded ? ExP_LIMIT_EXCEEDED : -1;
+    }
+    uint32_t index = UINT32_MAX;
+    if (expression_tree_wrapper->expression_tree){
+        index = ExFormula_find(set, name, true);
+    }
+    if (index == UINT32_MAX){
+        ExTree_destroy(&expression_tree_wrapper);
+        return -1;
+    }
+
+    ExP_phase(ExP_PHASE_COMPILE, 1);
+    ExFormula_clear(set, index);
+    bool bound = ExFormula_bind(set, index, expression_tree_wrapper->expression_tree);
+    ExP_phase(ExP_PHASE_COMPILE, 0);
+    ExTree_destroy(&expression_tree_wrapper);
+
+    set->formulas[index].defined = bound;
+    set->formulas[index].dirty = true;
 
-                if(!changeable){
-                    return NULL;
-                }
+    return bound ? 0 : -1;
+}
 
-                ExTreeWrapper expression_tree_wrapper = ExP_parse_prefix(expression);
-                ExTree_traverse_postorder(expression_tree_wrapper->expression_tree, &changeable);
 
-                ExTree_destroy(&expression_tree_wrapper);
 
-                // changeable will at this point point to where traverse_postorder() left off : a
-                // white space was inserted at n, then changeable was incremented to n+1. 
-                // Thus the string actually ends at n, so a NUL has to be inserted there
-                *(--changeable) = '\0';     // decrement changeable and set the char at that index to NUL
-             
-                return intact;
-            }
+int32_t ExP_formulas_set_value(ExFormulas set, const char *name, int32_t value){
+    /* Make name a plain value, with no program, and mark it dirty */
+    if (!set || !ExFormula_is_name(name)){
+        return -1;
+    }
+    uint32_t index = ExFormula_find(set, name, true);
+    if (index == UINT32_MAX){
+        return -1;
     }
+    ExFormula_clear(set, index);
+    set->values[index] = value;
+    set->formulas[index].defined = true;
+    set->formulas[index].dirty = true;
+
+    return 0;
 }
 
 
 
+int64_t ExP_formulas_recalculate(ExFormulas set){
+    /* Recompute the dirty formulas and all those depending on them, level by
+       level (see the ExFormula functions)
+    */
+    if (!set){
+        return -1;
+    }
+    // two lists of up to count formulas: the stack for finding the affected
+    // ones, then the current and the next level
+    uint32_t *lists = malloc(2 * (set->count ? set->count : 1) * sizeof(uint32_t));
+    if (!lists){
+        return -1;
+    }
+    struct expression_formula *formulas = set->formulas;
+    uint32_t *stack = lists, *level = lists, *next = lists + set->count;
+    uint32_t depth = 0, affected = 0;
+
+    for (uint32_t i = 0; i < set->count; i++){
+        if (formulas[i].dirty && !formulas[i].affected){
+            formulas[i].affected = true;
+            stack[depth++] = i;
+        }
+        while (depth){
+            struct expression_formula *formula = &formulas[stack[--depth]];
+            affected++;
+            for (uint32_t j = 0; j < formula->dependent_count; j++){
+                if (!formulas[formula->dependents[j]].affected){
+                    formulas[formula->dependents[j]].affected = true;
+                    stack[depth++] = formula->dependents[j];
+                }
+            }
+        }
+    }
+
+    // formulas referring to names that aren't defined can't be computed
+    bool undefined = false;
+    for (uint32_t i = 0; i < set->count; i++){
+        formulas[i].pending = 0;
+        for (uint32_t j = 0; formulas[i].affected && j < formulas[i].source_count; j++){
+            undefined = undefined || !formulas[formulas[i].sources[j]].defined;
+            formulas[i].pending += formulas[formulas[i].sources[j]].affected;
+        }
+    }
+    uint32_t level_count = 0;
+    for (uint32_t i = 0; i < set->count && !undefined; i++){
+        if (formulas[i].affected && !formulas[i].pending){
+            level[level_count++] = i;
+        }
+    }
+
+    ExP_phase(ExP_PHASE_RUN, 1);
+    uint32_t computed = 0;
+    while (level_count){
+        ExFormula_compute_level(set, level, level_count);
+
+        uint32_t next_count = 0;
+        for (uint32_t i = 0; i < level_count; i++){
+            struct expression_formula *formula = &formulas[level[i]];
+            formula->dirty = false;
+            formula->affected = false;
+            for (uint32_t j = 0; j < formula->dependent_count; j++){
+                struct expression_formula *dependent = &formulas[formula->dependents[j]];
+                if (dependent->affected && --dependent->pending == 0){
+                    next[next_count++] = formula->dependents[j];
+                }
+            }
+        }
+        computed += level_count;
+
+        uint32_t *swap = level;
+        level = next;
+        next = swap;
+        level_count = next_count;
+    }
+    ExP_phase(ExP_PHASE_RUN, 0);
+
+    // whatever is left is on a cycle, depends on one, or on an undefined
+    // name: it stays dirty, to be computed once that's fixed
+    for (uint32_t i = 0; i < set->count; i++){
+        if (formulas[i].affected){
+            formulas[i].affected = false;
+            formulas[i].dirty = true;
+        }
+    }
+    free(lists);
 
+    return computed == affected ? (int64_t)computed : -1;
+}
 
 
-char *ExP_to_prefix(char expression[], ex_notation NOTATION){
-    /* Convert expression to postfix */
-    // make it twice the size of expression, to play it safe and be able to add proper
-    // spacing
 
-    uint8_t size = str_len(expression) * 2;
+int32_t ExP_formulas_get(ExFormulas set, const char *name, int32_t *value){
+    /* Store the value of the formula called name in *value */
+    uint32_t index = set && name ? ExFormula_find(set, name, false) : UINT32_MAX;
+    if (index == UINT32_MAX || !set->formulas[index].defined){
+        return -1;
+    }
+    *value = set->values[index];
+    return 0;
+}
 
-    // this pointer will be changed by ExTree_traverse_postorder()
-    // so a second pointer, left intact, pointing to the start of the string, is needed
-    char *changeable = malloc(sizeof(char) * size); 
-    char *intact = changeable;
 
 
-    if(!changeable){
-        return NULL;
+void ExP_formulas_destroy(ExFormulas *set_ref){
+    /* Stop the pool's threads, free all the heap memory associated with 
+       *set_ref, then set it to NULL
+    */
+    if (set_ref == NULL || *set_ref == NULL){
+        return;
     }
-    /////////////////////////////////////////////////////////////////////////////////
-    // if NOTATION is infix, first convert it to postfix notation, then do the below as is
-    if (NOTATION == INFIX){
-        expression = ExP_infix_shunt(expression);
+    ExFormulas set = *set_ref;
+
+    pthread_mutex_lock(&set->lock);
+    set->stopping = true;
+    pthread_cond_broadcast(&set->start);
+    pthread_mutex_unlock(&set->lock);
+    for (uint32_t i = 0; i < set->worker_count; i++){
+        pthread_join(set->workers[i], NULL);
+    }
+    pthread_mutex_destroy(&set->lock);
+    pthread_cond_destroy(&set->start);
+    pthread_cond_destroy(&set->finished);
+
+    for (uint32_t i = 0; i < set->count; i++){
+        free(set->formulas[i].name);
+        free(set->formulas[i].sources);
+        free(set->formulas[i].dependents);
+        ExP_program_destroy(&set->formulas[i].program);
     }
-    /////////////////////////////////////////////////////////////////////////////////
+    free(set->formulas);
+    free(set->values);
+    free(set->table);
+    free(set->workers);
+    free(set);
+    *set_ref = NULL;
+}
 
-    // parse an expression in postfix notation and produce (return) an expression tree
-    ExTreeWrapper  expression_tree_wrapper = ExP_parse_postfix(expression);
-    // traverse this tree in preorder, which wil produce a prefix expression
-    ExTree_traverse_preorder(expression_tree_wrapper->expression_tree, &changeable);
 
-    ExTree_destroy(&expression_tree_wrapper);
 
-    // changeable will at this point point to where traverse_preorder() left off : a
-    // white space was inserted at n, then changeable was incremented to n+1. 
-    // Thus the string actually ends at n, so a NUL has to be inserted there
-    *(--changeable) = '\0';     // decrement changeable and set the char at that index to NUL
+ExShapes ExP_shapes_new(uint32_t capacity){
+    /* Create an empty shape cache, keeping up to capacity shapes */
+    ExShapes shapes = calloc(1, sizeof(struct expression_shapes));
+    if (!shapes){
+        return NULL;
+    }
+    shapes->capacity = capacity;
 
-    // intact was left intact, so it sstill points to the start of the string
-    return intact;
+    return shapes;
 }
 
 
-char *ExP_to_infix(char expression[], ex_notation NOTATION){
-    /* Convert expression to Infix. 
-        expression is either a prefix or postfix notation expression.
+
+int32_t ExP_shapes_compute(ExShapes shapes, const char expression[], size_t length, ex_notation NOTATION, int32_t *value){
+    /* Look the shape of expression up with ExShape_get(), and run its 
+       program on the literals of expression
     */
+    if (!shapes || !expression || !value){
+        return -1;
+    }
+    uint32_t index;
+    ExProgram program;
+    int32_t status = ExShape_get(shapes, expression, length, NOTATION, &index, &program);
+    if (status){
+        return status;
+    }
+    ExProgram run = program ? program : shapes->shapes[index].program;
+    run->inputs = shapes->literals;
+    *value = ExP_run(run);
+    ExP_program_destroy(&program);
 
-    // make it twice the size of expression, to play it safe and be able to add proper
-    // spacing
-    uint8_t size = str_len(expression) * 2;
+    return ExCheck_error.kind == ExP_ERROR_NONE ? 0 : -1;     // -1 if it divided by 0
+}
 
-    // this pointer will be changed by ExTree_traverse_postorder()
-    // so a second pointer, left intact, pointing to the start of the string, is needed
-    char *changeable = malloc(sizeof(char) * size); 
-    char *intact = changeable;
 
 
-    if(!changeable){
-        return NULL;
+uint32_t ExP_shapes_compute_batch(ExShapes shapes, const char *expressions[], const size_t lengths[], uint32_t count,
+                                  ex_notation NOTATION, int32_t results[]){
+    /* Look the shape of each expression up with ExShape_get(). Those whose
+       program has no control flow are queued in the lanes of their shape
+       (see ExShape_queue()) and evaluated ExShape_LANES at a time; the 
+       others, and those that can't be queued, are run right away. 
+       The lanes left partly filled are evaluated at the end.
+    */
+    if (!shapes){
+        for (uint32_t i = 0; i < count; i++){
+            results[i] = -1;
+        }
+        return count;
     }
-   
-    // build a syntax tree out of expression
-    ExTreeWrapper expression_tree_wrapper;
-
-    if (NOTATION == PREFIX){
-        expression_tree_wrapper = ExP_parse_prefix(expression);
-    }else if (NOTATION == POSTFIX){
-        expression_tree_wrapper = ExP_parse_postfix(expression);
-    }
-    // traverse  the syntax tree in-order, to produce an infix-notation expression
-    ExTree_traverse_inorder(expression_tree_wrapper->expression_tree, &changeable);
-    // free the memory associated with the syntax tree, as well as the refined syntax
-    // expression it's based on
-    ExTree_destroy(&expression_tree_wrapper);
+    uint32_t failed = 0;
 
-    // changeable points to where traverse_inorder() left off. i.e. where NULL has to be
-    // inserted.
-    *changeable = '\0';
-    
-    // intact was left intact, so it sstill points to the start of the string
-    return intact;
+    for (uint32_t i = 0; i < count; i++){
+        uint32_t index;
+        ExProgram program = NULL;
+        size_t length = expressions[i] ? (lengths ? lengths[i] : strlen(expressions[i])) : 0;
+
+        if (!expressions[i] || ExShape_get(shapes, expressions[i], length, NOTATION, &index, &program) != 0){
+            results[i] = -1;
+            failed++;
+            continue;
+        }
+        if (program || !shapes->shapes[index].lanes || !ExShape_queue(shapes, index, i, results, &failed)){
+            ExProgram run = program ? program : shapes->shapes[index].program;
+            run->inputs = shapes->literals;
+            results[i] = ExP_run(run);
+            ExP_program_destroy(&program);
+
+            if (ExCheck_error.kind != ExP_ERROR_NONE){     // divided by 0
+                results[i] = -1;
+                failed++;
+            }
+        }
+    }
+    for (uint32_t i = 0; i < shapes->waiting_count; i++){
+        failed += ExShape_flush(shapes, shapes->waiting[i], results);
+    }
+    shapes->waiting_count = 0;
+
+    return failed;
 }
 
 
 
+void ExP_shapes_destroy(ExShapes *shapes_ref){
+    /* Free all the heap memory associated with *shapes_ref, then set it to NULL */
+    if (shapes_ref == NULL || *shapes_ref == NULL){
+        return;
+    }
+    ExShapes shapes = *shapes_ref;
+
+    for (uint32_t i = 0; i < shapes->count; i++){
+        free(shapes->shapes[i].key);
+        free(shapes->shapes[i].lane_inputs);
+        ExP_program_destroy(&shapes->shapes[i].program);
+    }
+    free(shapes->shapes);
+    free(shapes->table);
+    free(shapes->key);
+    free(shapes->literals);
+    free(shapes->lane_values);
+    free(shapes->waiting);
+    free(shapes);
+    *shapes_ref = NULL;
+}
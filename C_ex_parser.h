@@ -1,9 +1,140 @@
 #include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
 
 
 // enum used for specifying the type of notation (e.g. in ExP_compute())
 typedef enum expression_notation{PREFIX, INFIX, POSTFIX} ex_notation;
 
+// bit flags selecting optional passes run on the expression tree (e.g. in
+// ExP_compute_with()); combine them with |
+typedef enum expression_options{
+    ExP_OPT_NONE = 0,
+    ExP_OPT_REBALANCE = 1 << 0,  // reassociate chains of + and of * into balanced trees
+    ExP_OPT_SHARE = 1 << 1,      // evaluate identical subexpressions only once
+} ex_options;
+
+// bit flags selecting the outputs ExP_convert_all() produces; combine them with |
+typedef enum expression_targets{
+    ExP_TO_PREFIX = 1 << 0,
+    ExP_TO_INFIX = 1 << 1,
+    ExP_TO_POSTFIX = 1 << 2,
+    ExP_TO_VALUE = 1 << 3,
+} ex_targets;
+
+// filled in by ExP_convert_all(); outputs that weren't requested are NULL (or 0)
+typedef struct expression_conversions{
+    char *prefix;
+    char *infix;
+    char *postfix;
+    int32_t value;
+} ex_conversions;
+
+// a compiled expression, returned by ExP_compile()
+typedef struct expression_program *ExProgram;
+
+// an incremental parser, created by ExP_stream_new()
+typedef struct expression_stream *ExStream;
+
+// a set of named formulas referring to each other, created by ExP_formulas_new()
+typedef struct expression_formulas *ExFormulas;
+
+// a cache of programs compiled for the shapes of expressions, created by ExP_shapes_new()
+typedef struct expression_shapes *ExShapes;
+
+// called by an ExStream to write length bytes of converted output;
+// context is whatever was passed to ExP_stream_new()
+typedef void (*ex_stream_output)(const char *text, size_t length, void *context);
+
+// a function callable from expressions, registered with ExP_register_function();
+// it gets the values of its count arguments
+typedef int32_t (*ex_function)(const int32_t arguments[], uint32_t count);
+
+// the most arguments a function call can have
+#define ExP_MAX_ARGUMENTS 16
+
+// infix expressions at least this long (in bytes) are parsed on several
+// threads at once (see ExP_set_parse_threads())
+#ifndef ExP_PARALLEL_MIN_LENGTH
+#define ExP_PARALLEL_MIN_LENGTH (1 << 20)
+#endif
+
+// the phases of the library's work on an expression, reported to the hook
+// set with ExP_set_phase_hook()
+typedef enum expression_phase{
+    ExP_PHASE_SHUNT,        // converting infix to postfix text (ExP_to_postfix())
+    ExP_PHASE_BUILD,        // building the expression tree (from infix, with shunting-yard)
+    ExP_PHASE_EVALUATE,     // evaluating the tree (or its DAG, with ExP_OPT_SHARE)
+    ExP_PHASE_COMPILE,      // turning the tree into an ExProgram
+    ExP_PHASE_RUN,          // running ExPrograms
+    ExP_PHASE_WRITE,        // writing out a conversion
+    ExP_PHASE_DESTROY,      // freeing the expression tree
+    ExP_PHASES              // how many there are
+} ex_phase;
+
+// called at the start (starting is 1) and at the end (0) of each phase;
+// context is whatever was passed to ExP_set_phase_hook()
+typedef void (*ex_phase_hook)(ex_phase phase, int starting, void *context);
+
+// limits on the expressions accepted on a thread, set with ExP_set_limits();
+// 0 for no limit
+typedef struct expression_limits{
+    size_t max_tokens;      // operands, operators and parentheses
+    size_t max_depth;       // how deeply the expression nests (see ExP_set_limits())
+    size_t max_bytes;       // memory allocated to parse it
+} ex_limits;
+
+// returned instead of -1 by the functions returning a status or a length
+// when the expression goes over the limits set with ExP_set_limits()
+#define ExP_LIMIT_EXCEEDED (-2)
+
+// what's wrong with a rejected expression, see ExP_last_error()
+typedef enum expression_error_kind{
+    ExP_ERROR_NONE,         // it was accepted
+    ExP_ERROR_EMPTY,        // it has no tokens
+    ExP_ERROR_CHARACTER,    // a character that can't be in a number or a name
+    ExP_ERROR_OPERAND,      // an operator (or parenthesis) is missing an operand
+    ExP_ERROR_OPERATOR,     // an operator is missing between two operands
+    ExP_ERROR_PARENTHESIS,  // a parenthesis without its match (or any, in prefix or postfix)
+    ExP_ERROR_CONDITIONAL,  // a ? without its :, or the other way around
+    ExP_ERROR_CALL,         // an unknown function, the wrong number of arguments, or a , outside of a call
+    ExP_ERROR_LIMIT,        // over the limits of the thread (see ExP_set_limits())
+    ExP_ERROR_MEMORY,       // memory couldn't be allocated
+    ExP_ERROR_NOTATION,     // not a valid ex_notation
+    ExP_ERROR_DIVISION,     // computing it divides by 0
+    ExP_ERROR_OVERFLOW,     // computing it divides INT32_MIN by -1, or overflows int64_t in ExP_compute_checked()
+} ex_error_kind;
+
+// what ExP_validate() checks an expression for
+typedef enum expression_validation{
+    ExP_VALIDATE_SYNTAX,    // that it's well formed, so it can be converted
+    ExP_VALIDATE_COMPUTE,   // that it's well formed with integers only, so it can be computed too
+} ex_validation;
+
+// a rejected expression: what's wrong, and the byte offset in the
+// expression where it was found (0 for ExP_ERROR_DIVISION and
+// ExP_ERROR_OVERFLOW, found while computing it)
+typedef struct expression_error{
+    ex_error_kind kind;
+    size_t offset;
+} ex_error;
+
+// the size of the buffer ExP_format_int() needs: a sign, 19 digits and the NUL
+#define ExP_INT_STRING 21
+
+// the structural fingerprint of an expression, computed by ExP_fingerprint();
+// low on its own is a 64-bit one
+typedef struct expression_fingerprint{
+    uint64_t high;
+    uint64_t low;
+} ex_fingerprint;
+
+// filled in by ExP_compute_stats()
+typedef struct expression_stats{
+    uint32_t nodes;         // number of nodes in the expression tree
+    uint32_t deduplicated;  // how many of those were duplicates merged by ExP_OPT_SHARE
+} ex_stats;
+
 
 
 /* Compute expression. Expression can be either a (valid, properly formatted),
@@ -23,19 +154,575 @@ typedef enum expression_notation{PREFIX, INFIX, POSTFIX} ex_notation;
  * I.e.|  +47 3 | is easily parsable, but +473 is not, since
  * it's impossible to tell with any certainty which and how many
  * digits belong to which operator.
+ *
+ * Besides the arithmetic operators + - * (or x) / ^, expressions can use,
+ * from the highest precedence to the lowest, as in C:
+ *      < <=        comparisons, 1 if true, 0 if false
+ *      == !=
+ *      &&          logical and/or, 1 or 0; the right operand is only
+ *      ||          evaluated if the left one doesn't decide the result
+ *      c ? a : b   a if c is not 0, else b; only one of a and b is evaluated
+ * In prefix and postfix, c ? a : b is written '? c : a b' and 'c a b : ?'.
+ *
+ * Expressions can also call functions, with up to ExP_MAX_ARGUMENTS
+ * arguments: the built-in
+ *      min(a, b, ...)  max(a, b, ...)
+ *      abs(a)          (wraps around for INT32_MIN, like the operators)
+ *      clamp(a, low, high)     min(max(a, low), high)
+ * and any function registered with ExP_register_function().
+ * In prefix and postfix the arguments are joined by the ',' operator,
+ * and the function name comes before or after them like an operator with
+ * one operand: max(1, 2, 3) is 'max , , 1 2 3' and '1 2 , 3 , max'.
+ *
+ * Return the result, or -1 on failure: as -1 can be a result too, 
+ * ExP_last_error() tells them apart, its kind being ExP_ERROR_NONE 
+ * only after a success. The expression fails if it's malformed, over
+ * the limits (ExP_ERROR_LIMIT) or memory couldn't be allocated 
+ * (ExP_ERROR_MEMORY). A division by 0, or of INT32_MIN by -1, makes
+ * it fail too (ExP_ERROR_DIVISION or ExP_ERROR_OVERFLOW) instead of
+ * trapping. So does a name that isn't a function ('a + 1'): it has no
+ * value (ExP_ERROR_CHARACTER, at the name), and a number that isn't an
+ * integer ('2.5', '1e3': ExP_ERROR_CHARACTER at the '.' or 'e'). The same
+ * goes for every function computing an expression or compiling it into 
+ * an ExProgram, except ExP_compute_double() for the numbers; converting 
+ * it accepts both.
 */
 int32_t ExP_compute(char expression[], ex_notation NOTATION);
 
-/* Convert a prefix or infix expression to a postfix expression */
+/* Make function callable from expressions as name(...), with between
+ * min_arguments (at least 1) and max_arguments (at most ExP_MAX_ARGUMENTS)
+ * arguments; calls with another number of arguments are malformed.
+ * name is copied. It must be made of letters, digits and '_', not start
+ * with a digit, nor with 'x' followed by a digit (that's x, the operator), 
+ * and be at most 31 characters long. Registering a name again replaces 
+ * the function; the built-in functions can't be replaced.
+ *
+ * Registration isn't thread-safe: register every function before
+ * expressions are parsed. Calls to a registered function are only
+ * evaluated in int32_t (ExP_compute_int64() and the like fail on them).
+ *
+ * Return 0, or -1 if the name or the number of arguments is invalid or
+ * too many functions have been registered.
+ *
+ * Example
+ *      int32_t sum(const int32_t arguments[], uint32_t count){ ... }
+ *      ExP_register_function("sum", sum, 1, ExP_MAX_ARGUMENTS);
+ *      ExP_compute("sum(1, 2, 3) * 2", INFIX);     // 12
+*/
+int32_t ExP_register_function(const char *name, ex_function function, uint32_t min_arguments, uint32_t max_arguments);
+
+/* Set how many threads (at most 64) an infix expression of at least
+ * ExP_PARALLEL_MIN_LENGTH bytes is parsed on: 0, the default, for one per
+ * online CPU, 1 to always parse on the calling thread.
+ *
+ * The expression is cut at its lowest-precedence operators outside of any
+ * parentheses, e.g. at every + in 'a * b + c * d + ...', and the parts 
+ * are parsed concurrently, then joined. The tree is exactly the one the
+ * single-threaded parser builds. Expressions that can't be cut that way 
+ * (whose top level is a ?: or a single parenthesized expression, or that
+ * are malformed) are parsed on the calling thread.
+ *
+ * Like ExP_register_function(), call it before expressions are parsed.
+*/
+void ExP_set_parse_threads(uint32_t threads);
+
+/* Have hook called at the start and at the end of each phase of the work
+ * on an expression (see ex_phase), e.g. to read performance counters
+ * there; NULL to stop. Phases don't nest, but the build phases of an 
+ * expression parsed on several threads (see ExP_set_parse_threads()) are
+ * reported from each of them, at the same time.
+ *
+ * Like ExP_register_function(), call it while no expressions are being
+ * processed. ExP_perf.c is a profiler using it.
+*/
+void ExP_set_phase_hook(ex_phase_hook hook, void *context);
+
+/* Limit the expressions parsed on the calling thread from now on; NULL
+ * (or all 0) to remove the limits. An expression that goes over any of 
+ * them is rejected before anything is allocated for it, after one pass 
+ * over its tokens that stops at the first limit exceeded: the functions
+ * returning a status or a length return ExP_LIMIT_EXCEEDED, the others
+ * fail as they do on malformed expressions (0, NULL), and 
+ * ExP_limit_exceeded() tells those failures apart.
+ *
+ * max_depth is, in infix, how deeply parentheses nest (those of function
+ * calls included); in postfix, the most operands waiting for their 
+ * operator; in prefix, the most operators waiting for their operands.
+ * The expression tree itself can be as tall as there are tokens, e.g. 
+ * for 1 + 2 + ... + n, so the passes over it (evaluating, converting, 
+ * compiling, ExP_OPT_SHARE and ExP_OPT_REBALANCE, the shapes, the formulas,
+ * ExP_generate_c(), ExP_fingerprint()) walk it without recursion: a tall tree costs them a 
+ * stack on the heap, growing with its height, not the call stack.
+ * max_bytes is checked against an upper bound of what parsing allocates,
+ * computed from the length of the expression and its number of tokens.
+ *
+ * Each thread has its own limits, e.g. one set per tenant by the worker
+ * serving it; expressions parsed on several threads (see 
+ * ExP_set_parse_threads()) are checked against those of the caller, and
+ * streams (see ExP_stream_new()) against those of the thread creating them.
+*/
+void ExP_set_limits(const ex_limits *limits);
+
+// 1 if the last expression parsed on the calling thread was rejected for
+// going over its limits, else 0
+int ExP_limit_exceeded(void);
+
+/* Why the last expression parsed (or converted, or compiled) on the calling
+ * thread was rejected, and where: kind is ExP_ERROR_NONE if it wasn't.
+ * Expressions are checked while they're tokenized, before anything is
+ * allocated for them, so a rejected expression costs no allocation; the
+ * offset is that of the first token found to be wrong (the length of the
+ * expression if it ends too soon).
+ *
+ * E.g. "2 * (3 + )" is ExP_ERROR_OPERAND at 9, the ) missing its operand,
+ * and "1 + clamp(2)" ExP_ERROR_CALL at 4, the call.
+*/
+ex_error ExP_last_error(void);
+
+/* Check the first length characters of expression (less if a NUL comes
+ * first) in NOTATION, without parsing it: only one pass over its tokens,
+ * that allocates nothing unless it nests more than 32 levels deep.
+ * With ExP_VALIDATE_SYNTAX, names ('a + 1') and numbers that aren't 
+ * integers ('2.5', '1e3') are accepted, as they are by the conversions;
+ * with ExP_VALIDATE_COMPUTE, they're ExP_ERROR_CHARACTER (at the name, or
+ * at the '.' or 'e'), as in ExP_compute() and ExP_compile(). (A division
+ * by 0 can still make computing it fail.)
+ * If error isn't NULL, it's set to the outcome, as ExP_last_error() would.
+ * Return 0 if the expression is well formed, -1 if not, or 
+ * ExP_LIMIT_EXCEEDED if it goes over the limits of the calling thread.
+ *
+ * Example
+ *      ExP_validate("a + 1", 5, INFIX, ExP_VALIDATE_SYNTAX, NULL);     // 0
+ *      ExP_validate("a + 1", 5, INFIX, ExP_VALIDATE_COMPUTE, &error);  // -1, ExP_ERROR_CHARACTER at 0
+*/
+int32_t ExP_validate(const char expression[], size_t length, ex_notation NOTATION, ex_validation MODE, ex_error *error);
+
+/* Same as ExP_compute(), but with the optional passes in OPTIONS enabled.
+ *
+ * ExP_OPT_REBALANCE: long chains of the same associative operator,
+ * e.g. 1 + 2 + 3 + ... + n, normally parse into a tree n levels deep.
+ * With this flag they're reassociated into a balanced tree, log2(n)
+ * levels deep, before evaluation. The result is exactly the same,
+ * including when the computation overflows and wraps around.
+ *
+ * ExP_OPT_SHARE: the tree is hash-consed into a DAG, where structurally
+ * identical subexpressions, e.g. every (1 + 11) in a large expression, 
+ * are stored once. Each of them is then evaluated only once and its 
+ * result reused everywhere it appears. Expressions using && || or ?:
+ * aren't shared, so that they can short-circuit.
+*/
+int32_t ExP_compute_with(char expression[], ex_notation NOTATION, ex_options OPTIONS);
+
+/* Same as ExP_compute_with(), but also fill in *stats (if not NULL):
+ * the number of nodes in the expression tree and, with ExP_OPT_SHARE,
+ * how many of them were deduplicated.
+*/
+int32_t ExP_compute_stats(char expression[], ex_notation NOTATION, ex_options OPTIONS, ex_stats *stats);
+
+/* Same as ExP_compute(), but evaluating in 64-bit integer arithmetic, so
+ * results that don't fit in 32 bits are computed correctly (64-bit results
+ * still wrap around on overflow). The result is stored in *result.
+ * Return 0, or -1 if the expression couldn't be evaluated (including
+ * division by 0, reported by ExP_last_error() as ExP_ERROR_DIVISION);
+ * *result is left as it is then.
+*/
+int32_t ExP_compute_int64(char expression[], ex_notation NOTATION, int64_t *result);
+
+/* Same as ExP_compute_int64(), but every operation is checked: return -1
+ * instead of wrapping around if any result or literal overflows int64_t,
+ * with ExP_last_error() reporting ExP_ERROR_OVERFLOW.
+*/
+int32_t ExP_compute_checked(char expression[], ex_notation NOTATION, int64_t *result);
+
+/* Same as ExP_compute_int64(), but evaluating in double: literals can have
+ * a fractional part (2.5) and division isn't truncated. a*b+c, a*b-c,
+ * c+a*b and c-a*b are computed with fma(), rounding only once.
+ * Programs using it need to be linked with -lm.
+*/
+int32_t ExP_compute_double(char expression[], ex_notation NOTATION, double *result);
+
+/* Same as ExP_compute(), but write the result in decimal, NUL-terminated,
+ * into buffer, a caller-owned array of size bytes; ExP_INT_STRING is always
+ * enough. Only parsing the expression allocates memory, not the result.
+ *
+ * Return the length of the result, not counting the NUL, or -1 on failure
+ * (ExP_LIMIT_EXCEEDED if the expression is over the limits, see 
+ * ExP_set_limits()). If the length is size or more, buffer is left
+ * untouched, as in ExP_convert_into().
+*/
+int64_t ExP_compute_to_string(char expression[], ex_notation NOTATION, char *buffer, size_t size);
+
+/* Write value in decimal, NUL-terminated, into buffer, which has room for
+ * at least ExP_INT_STRING bytes, without allocating any memory (unlike 
+ * str_from_int()). Return the length written, not counting the NUL.
+*/
+uint32_t ExP_format_int(int64_t value, char buffer[]);
+
+/* Compute the fingerprint of the first length characters of expression
+ * (in notation NOTATION), a 128-bit hash of its expression tree, and store
+ * it in *fingerprint. Expressions that differ only in spacing, redundant
+ * parentheses, notation or leading zeros, or in the order and grouping of 
+ * the operands of + and of *, the order of the two sides of == and != or 
+ * of the arguments of min() and max(), get the same fingerprint: 'a+b' and '(b + a)', '1 + (2 + 3) * 4' and 
+ * '4 x (3 + 2) + 1', '2 3 +' in postfix and '+ 3 2' in prefix. Those all 
+ * compute the same result with ExP_compute(), so a batch can compute one 
+ * expression per fingerprint and share its result with the others.
+ * (In ExP_compute_double(), a different grouping can round differently.)
+ *
+ * Return 0, or -1 if the expression is malformed or memory couldn't be
+ * allocated (ExP_LIMIT_EXCEEDED if it's over the limits, see ExP_set_limits()).
+*/
+int32_t ExP_fingerprint(const char expression[], size_t length, ex_notation NOTATION, ex_fingerprint *fingerprint);
+
+/* Compile expression (in notation NOTATION, with the optional passes in
+ * OPTIONS applied; see ExP_compute_with()) into an ExProgram, a compact 
+ * representation of the expression tree that can be evaluated any number 
+ * of times with ExP_run() without parsing the expression again.
+ *
+ * Operations with a constant right operand are specialized: division by a
+ * constant becomes a multiplication by its reciprocal, or a shift for
+ * powers of 2, multiplication by a power of 2 becomes a shift, and
+ * exponentiation to a constant power is unrolled. The results are
+ * exactly the same as for the generic operators.
+ *
+ * Return NULL on failure. The program has to be freed with 
+ * ExP_program_destroy() when no longer needed.
+ *
+ * Example
+ *      ExProgram program = ExP_compile(expression, INFIX, ExP_OPT_NONE);
+ *      int32_t result = ExP_run(program);
+ *      ExP_program_destroy(&program);
+*/
+ExProgram ExP_compile(char expression[], ex_notation NOTATION, ex_options OPTIONS);
+
+/* Same as ExP_compile(), but only the first length characters of
+ * expression are read, so it doesn't need to be NUL-terminated (e.g. a
+ * slice of a larger buffer). It is never modified.
+*/
+ExProgram ExP_compile_n(const char expression[], size_t length, ex_notation NOTATION, ex_options OPTIONS);
+
+/* Evaluate a program returned by ExP_compile() and return the result.
+ * A division by 0, or of INT32_MIN by -1, doesn't trap: its result is 0,
+ * and ExP_last_error() reports ExP_ERROR_DIVISION or ExP_ERROR_OVERFLOW
+ * (it reports ExP_ERROR_NONE after a run without either).
+ * Evaluation uses scratch space inside the program, so the same
+ * program must not be run from several threads at the same time.
+*/
+int32_t ExP_run(ExProgram program);
+
+/* Evaluate count programs returned by ExP_compile(), storing the result of
+ * programs[i] in results[i]. ExP_last_error() reports whether any of them
+ * divided by 0, as for ExP_run().
+*/
+void ExP_run_batch(ExProgram programs[], uint32_t count, int32_t results[]);
+
+/* Free all the memory associated with *program_ref, then set it to NULL */
+void ExP_program_destroy(ExProgram *program_ref);
+
+/* Convert a prefix or infix expression to a postfix expression.
+ * From prefix, no expression tree is built: the conversion is written
+ * straight out, using memory proportional to the nesting depth of the
+ * expression besides the result. From postfix, the expression is checked
+ * and copied as is. The result has to be freed in every case.
+*/
 char *ExP_to_postfix(char expression[], ex_notation NOTATION);
 
-/* Convert a postfix or infix expression to a prefix expression */
+/* Convert a postfix or infix expression to a prefix expression.
+ * From postfix, no expression tree is built either (see ExP_to_postfix()).
+*/
 char *ExP_to_prefix(char expression[], ex_notation NOTATION);
 
-/* Convert a postfix or prefix expression to an infix notation expression */
+/* Convert a postfix or prefix expression to an infix notation expression.
+ * Parentheses are only written where precedence and associativity need
+ * them, e.g. '1 2 + 3 *' becomes '(1+2)*3' and '1 2 3 * +' becomes '1+2*3'; 
+ * the result parses back into the same expression tree.
+*/
 char *ExP_to_infix(char expression[], ex_notation NOTATION);
 
+/* Convert expression (in notation NOTATION) to all the notations requested
+ * in TARGETS at once, and/or evaluate it (ExP_TO_VALUE), storing the results
+ * in *conversions. The expression is parsed only once.
+ *
+ * All the strings are stored in a single allocated block, which is returned
+ * (NULL on failure). Free that block, and only that block, when the strings
+ * are no longer needed.
+ *
+ * With ExP_TO_VALUE, the value is computed as by ExP_compute(): the
+ * expression can only have integers, not variables or fractions, and if
+ * evaluating it fails (dividing by 0, or INT32_MIN by -1), NULL is returned
+ * too, ExP_last_error() telling why. On failure, the fields of *conversions
+ * are all NULL (and 0).
+ *
+ * Example
+ *      ex_conversions out;
+ *      char *block = ExP_convert_all(expression, INFIX, ExP_TO_PREFIX | ExP_TO_POSTFIX, &out);
+ *      printf("%s\n%s\n", out.prefix, out.postfix);
+ *      free(block);
+*/
+char *ExP_convert_all(char expression[], ex_notation NOTATION, ex_targets TARGETS, ex_conversions *conversions);
+
+/* Convert the first length characters of expression (in notation NOTATION;
+ * it doesn't need to be NUL-terminated) to the one notation in TARGET, 
+ * ExP_TO_PREFIX, ExP_TO_INFIX or ExP_TO_POSTFIX, and write the result, 
+ * NUL-terminated, into buffer, a caller-owned array of size bytes.
+ *
+ * Return the length of the result, not counting the NUL, or -1 on failure.
+ * If that's size or more, the result didn't fit and buffer is left untouched;
+ * like snprintf(), call again with a large enough buffer.
+ *
+ * Example
+ *      char buffer[256];
+ *      int64_t length = ExP_convert_into(expression, n, INFIX, ExP_TO_POSTFIX, buffer, sizeof(buffer));
+ *      if (length >= 0 && length < (int64_t)sizeof(buffer)){ ... }
+*/
+int64_t ExP_convert_into(const char expression[], size_t length, ex_notation NOTATION, ex_targets TARGET,
+                         char buffer[], size_t size);
+
+/* Same as ExP_convert_into(), but instead of being built in memory, the
+ * conversion is passed to output as it's produced, through a fixed-size
+ * buffer (4 KB, on the stack): output gets it in chunks of at most that
+ * size, except for longer tokens, with no NUL at the end. The memory used 
+ * doesn't depend on the size of the output, and the first bytes are 
+ * passed on before the rest of the conversion is done.
+ * The one exception is postfix to prefix, whose output is produced last 
+ * token first: it's built in memory, then passed on. From prefix to
+ * postfix, on the other hand, the output may already have been partly
+ * passed on when the expression turns out to be malformed.
+ *
+ * Return the number of bytes written, or -1 on failure.
+*/
+int64_t ExP_convert_to(const char expression[], size_t length, ex_notation NOTATION, ex_targets TARGET,
+                       ex_stream_output output, void *context);
+
+/* Same as ExP_convert_to(), writing the conversion to file. Return -1 if
+ * writing failed as well.
+*/
+int64_t ExP_convert_to_file(const char expression[], size_t length, ex_notation NOTATION, ex_targets TARGET,
+                            FILE *file);
+
+/* Same as ExP_convert_to(), writing the conversion to the file descriptor fd
+ * (e.g. a socket or a pipe): whenever the buffer fills up, it's written
+ * together with the rest of the token that didn't fit in a single writev().
+ * Return -1 if writing failed as well.
+*/
+int64_t ExP_convert_to_fd(const char expression[], size_t length, ex_notation NOTATION, ex_targets TARGET, int fd);
+
+/* Create an incremental parser for an expression in notation NOTATION
+ * that arrives piece by piece, e.g. over a pipe, and may be far too large
+ * to keep in memory. The memory used is proportional to the nesting depth
+ * of the expression (and the length of its longest operand), not to its size.
+ *
+ * TARGETS is ExP_TO_VALUE to evaluate the expression, and/or one notation 
+ * to convert it to; the converted text is passed to output as the input is
+ * consumed. Supported conversions: prefix to postfix or infix, infix
+ * to postfix, and any notation to itself (normalizing whitespace; infix 
+ * keeps its parentheses). Infix output from prefix only has the 
+ * parentheses it needs, as ExP_to_infix() writes it.
+ * The whole syntax of ExP_compute() is accepted, comparisons, && || ?:
+ * and function calls included, and names too when only converting (a
+ * name has no value, so with ExP_TO_VALUE it makes the input malformed, 
+ * and so does a number that isn't an integer).
+ * As in ExP_compute(), a division by 0 only fails the value if it's in
+ * a branch of ?:, or an operand of && and ||, that's computed.
+ *
+ * The stream is held to the limits of the calling thread (see 
+ * ExP_set_limits()) as they are when it's created: tokens and depth are
+ * counted as the input comes, and max_bytes bounds the memory the stream
+ * holds.
+ *
+ * Return NULL if TARGETS isn't supported for NOTATION. The stream has 
+ * to be freed with ExP_stream_destroy() when no longer needed.
+ *
+ * Example
+ *      ExStream stream = ExP_stream_new(POSTFIX, ExP_TO_VALUE, NULL, NULL);
+ *      while ((n = read(fd, buffer, sizeof(buffer))) > 0){
+ *          ExP_stream_feed(stream, buffer, n);
+ *      }
+ *      int32_t result;
+ *      if (ExP_stream_finish(stream, &result) == 0){ ... }
+ *      ExP_stream_destroy(&stream);
+*/
+ExStream ExP_stream_new(ex_notation NOTATION, ex_targets TARGETS, ex_stream_output output, void *context);
+
+/* Feed the next length bytes of the expression to stream. The chunk
+ * doesn't need to be NUL-terminated, and can end anywhere, even in the
+ * middle of an operand. Return 0, -1 if the input is malformed, or 
+ * ExP_LIMIT_EXCEEDED if it goes over the limits of the stream.
+*/
+int32_t ExP_stream_feed(ExStream stream, const char chunk[], size_t length);
 
+/* Signal the end of the input. With ExP_TO_VALUE, the result is stored in
+ * *value. Return 0, ExP_LIMIT_EXCEEDED if the input went over the limits
+ * of the stream, or -1 if it was malformed or incomplete, or if with 
+ * ExP_TO_VALUE it divides by 0 (see ExP_run(); the conversion is written
+ * out all the same).
+*/
+int32_t ExP_stream_finish(ExStream stream, int32_t *value);
 
+/* Free all the memory associated with *stream_ref, then set it to NULL */
+void ExP_stream_destroy(ExStream *stream_ref);
 
+/* Generate C source code computing expressions ahead of time, for
+ * expressions that are known at build time (e.g. deployed formula sets):
+ * compile the generated file into the program to evaluate them at native
+ * speed, without parsing anything at run time.
+ *
+ * For every i < count, expressions[i] (in notation NOTATION) becomes a
+ * function called names[i]. Variables in the expression (names made of 
+ * letters, digits and '_', not starting with a digit) become its int32_t
+ * parameters, in the order they first appear:
+ *
+ *      int32_t <name>(int32_t <variable>, ...);
+ *
+ * Expressions with variables also get a batch version, evaluating the
+ * expression for count sets of values, written as a simple loop over
+ * arrays that compilers auto-vectorize:
+ *
+ *      void <name>_batch(uint32_t ExP_count, const int32_t *restrict <variable>, ..., int32_t *restrict ExP_results);
+ *
+ * The names of the functions and of the variables must be valid C 
+ * identifiers, and not C keywords (those of C23 included), int32_t or 
+ * uint32_t, nor start with ExP_ (reserved for the generated code) or with
+ * what C reserves (_ and a capital letter, or __). The names of the 
+ * functions must all be different, none can be another's followed by 
+ * _batch, and none can be that of a registered function. A variable can't
+ * be named like the function it's a parameter of, or a registered function.
+ *
+ * Where ExP_compute() succeeds, the generated code computes exactly what
+ * it would, wrapping around on overflow. It has no way of reporting errors,
+ * though: dividing by 0, or INT32_MIN by -1, gives 0 (as ExP_compute()
+ * would for that division) where ExP_compute() fails. It only needs 
+ * <stdint.h>, and the functions registered with ExP_register_function()
+ * that the expressions call, which it declares and calls the same way 
+ * (with an array of arguments and their count).
+ *
+ * Return 0, or -1 if an expression or a name is invalid (nothing is
+ * written then) or writing to file failed.
+ *
+ * Example
+ *      const char *names[] = {"area", "perimeter"};
+ *      const char *expressions[] = {"width * height", "2 * (width + height)"};
+ *      ExP_generate_c(file, 2, names, expressions, INFIX);
+*/
+int32_t ExP_generate_c(FILE *file, uint32_t count, const char *names[], const char *expressions[], ex_notation NOTATION);
+
+/* Create an empty set of named formulas that refer to each other by name,
+ * like the cells of a spreadsheet, e.g. 
+ *
+ *      total = net + tax       tax = net * rate / 100      net = 1200
+ *
+ * Each formula is parsed and compiled once, when it's set. The references
+ * between them make a dependency graph: ExP_formulas_recalculate() only 
+ * recomputes the formulas that changed and those depending on them, each 
+ * after all the ones it refers to. Formulas that don't depend on each other
+ * are computed in parallel, on a pool of up to threads threads (the 
+ * caller's included; 0 for one per online CPU, 1 to never start any), 
+ * started the first time there are enough of them.
+ *
+ * Return NULL if memory couldn't be allocated. The set has to be freed 
+ * with ExP_formulas_destroy() when no longer needed; it's not to be used
+ * from several threads at once.
+*/
+ExFormulas ExP_formulas_new(uint32_t threads);
+
+/* Set the formula called name (letters, digits and '_', not starting with
+ * a digit, nor with x and a digit, and not the name of a function, as 
+ * expressions couldn't refer to it) to expression, in notation NOTATION, 
+ * replacing the one it had.
+ * The variables in expression are the names of the formulas it refers to;
+ * they don't need to be set yet, but must be before it's recalculated.
+ * Formulas are computed with the same semantics as ExP_compute().
+ *
+ * Return 0, or -1 if name or expression is invalid or memory couldn't be
+ * allocated (ExP_LIMIT_EXCEEDED if the expression is over the limits, see
+ * ExP_set_limits()).
+*/
+int32_t ExP_formulas_set(ExFormulas set, const char *name, const char expression[], ex_notation NOTATION);
+
+/* Set the formula called name to the constant value, without parsing 
+ * anything: the way to change the inputs of the set. Return 0, or -1 if 
+ * name is invalid (see ExP_formulas_set()) or memory couldn't be allocated.
+*/
+int32_t ExP_formulas_set_value(ExFormulas set, const char *name, int32_t value);
+
+/* Recompute every formula set since the last recalculation, and those that
+ * depend on them, directly or not, in topological order.
+ *
+ * Return how many formulas were computed, or -1 if some couldn't be: those
+ * on a cycle of references (a = b + 1, b = a * 2), or depending on one, or
+ * on a name that was never set. The others are still computed; those that
+ * couldn't be keep their previous values, and are computed by the next
+ * recalculation once the cycle is broken.
+*/
+int64_t ExP_formulas_recalculate(ExFormulas set);
+
+/* Store the value of the formula called name, as of the last recalculation,
+ * in *value. Return 0, or -1 if there's no such formula.
+ *
+ * Example
+ *      ExFormulas set = ExP_formulas_new(0);
+ *      ExP_formulas_set(set, "total", "net + tax", INFIX);
+ *      ExP_formulas_set(set, "tax", "net * rate / 100", INFIX);
+ *      ExP_formulas_set_value(set, "rate", 20);
+ *      ExP_formulas_set_value(set, "net", 1200);
+ *      ExP_formulas_recalculate(set);         // 4: total is 1440
+ *      ExP_formulas_set_value(set, "net", 1500);
+ *      ExP_formulas_recalculate(set);         // 3: rate isn't recomputed
+ *      ExP_formulas_get(set, "total", &total);     // 1800
+*/
+int32_t ExP_formulas_get(ExFormulas set, const char *name, int32_t *value);
+
+/* Free all the memory associated with *set_ref, and stop its threads, then set it to NULL */
+void ExP_formulas_destroy(ExFormulas *set_ref);
+
+/* Create an empty shape cache. The shape of an expression is what's left
+ * of it once its integer literals are taken out: '1 * (2 + 3 / 4)' and 
+ * '7 * (5 + 9 / 2)' have the same shape, '_ * (_ + _ / _)'. The cache keeps
+ * a program compiled for each shape, which reads the literals as 
+ * parameters, so that computing an expression of a shape already seen
+ * takes one scan over it, to collect its literals, a hash table lookup
+ * and the evaluation: it's neither checked nor parsed nor compiled again.
+ *
+ * Expressions are computed with the same semantics as ExP_compute(). 
+ * The spaces are part of the shape, so '1+2' and '1 + 2' are two shapes.
+ * Variables and numbers that aren't integers ('2.5', '1e3') make it fail,
+ * as in ExP_compute().
+ * At most capacity shapes are kept: once that many are, expressions of 
+ * new shapes are still computed, but compiled every time.
+ *
+ * Return NULL if memory couldn't be allocated. The cache has to be freed 
+ * with ExP_shapes_destroy() when no longer needed; it's not to be used 
+ * from several threads at once.
+*/
+ExShapes ExP_shapes_new(uint32_t capacity);
+
+/* Compute the first length characters of expression, in notation NOTATION,
+ * with the program of its shape in shapes (compiled and added first, if 
+ * it's a new shape), and store the result in *value.
+ *
+ * Return 0, or -1 if expression is malformed, divides by 0 (see ExP_run())
+ * or memory couldn't be allocated (ExP_LIMIT_EXCEEDED if it's over the 
+ * limits, which are only checked when its shape is new; see ExP_set_limits()).
+ *
+ * Example
+ *      ExShapes shapes = ExP_shapes_new(1024);
+ *      ExP_shapes_compute(shapes, "1 * (2 + 3 / 4)", 15, INFIX, &value);    // 2: compiled
+ *      ExP_shapes_compute(shapes, "7 * (5 + 9 / 2)", 15, INFIX, &value);    // 63: looked up
+*/
+int32_t ExP_shapes_compute(ExShapes shapes, const char expression[], size_t length, ex_notation NOTATION, int32_t *value);
+
+/* Compute count expressions, in notation NOTATION, as ExP_shapes_compute()
+ * does, storing the result of expressions[i] in results[i] (-1 if it 
+ * can't be computed, dividing by 0 included). lengths[i] is the length
+ * of expressions[i]; lengths can be NULL if they're all NUL-terminated.
+ * Expressions of the same shape without && || ?: or function calls are 
+ * evaluated side by side, several at a time, in loops the compiler can
+ * vectorize: a batch is best made of many expressions of few shapes.
+ *
+ * Return the number of expressions that couldn't be computed.
+*/
+uint32_t ExP_shapes_compute_batch(ExShapes shapes, const char *expressions[], const size_t lengths[], uint32_t count,
+                                  ex_notation NOTATION, int32_t results[]);
 
+/* Free all the memory associated with *shapes_ref, then set it to NULL */
+void ExP_shapes_destroy(ExShapes *shapes_ref);
@@ -0,0 +1,142 @@
+#ifndef C_EX_PARSER_HPP
+#define C_EX_PARSER_HPP
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+
+extern "C" {
+#include "C_ex_parser.h"
+}
+
+
+/* ************************************************************* */
+/* ------------------------ OVERVIEW --------------------------- */
+
+/* C++ (17 or later) layer over the C API, header-only.
+ *
+ * - Expressions are taken as std::string_view: no const_cast, no copy
+ *   to NUL-terminate them (ExP_compile_n() and ExP_convert_into() read
+ *   exactly the given characters and never modify them).
+ * - Compiled expressions are move-only CompiledExpression objects that
+ *   own their ExProgram (the program and, for one that divides by 
+ *   constants, its table of divisors) and free it when destroyed.
+ * - Conversions are written into a caller-owned string, std::string or
+ *   std::pmr::string or any other std::basic_string<char>, which is reused
+ *   from one call to the next: once its capacity has grown to fit the
+ *   largest result, no more memory is allocated for the output.
+ *
+ * Errors are reported as in the C API, by return value: an empty
+ * CompiledExpression, or false.
+ *
+ * Example
+ *      ExP::CompiledExpression area = ExP::compile(line.substr(6), INFIX);
+ *      if (area){
+ *          int32_t result = area.run();
+ *      }
+ *
+ *      std::pmr::string postfix{&arena};
+ *      for (std::string_view expression : expressions){
+ *          if (ExP::convert(expression, INFIX, ExP_TO_POSTFIX, postfix)){ ... }
+ *      }
+
+ * ************************************************************* */
+
+
+namespace ExP {
+
+class CompiledExpression{
+public:
+    CompiledExpression() noexcept = default;
+
+    // takes ownership of program
+    explicit CompiledExpression(ExProgram program) noexcept : program_(program) {}
+
+    CompiledExpression(const CompiledExpression &) = delete;
+    CompiledExpression &operator=(const CompiledExpression &) = delete;
+
+    CompiledExpression(CompiledExpression &&other) noexcept : program_(other.release()) {}
+
+    CompiledExpression &operator=(CompiledExpression &&other) noexcept{
+        if (this != &other){
+            ExP_program_destroy(&program_);
+            program_ = other.release();
+        }
+        return *this;
+    }
+
+    ~CompiledExpression(){
+        ExP_program_destroy(&program_);
+    }
+
+    // false if the expression couldn't be compiled (or was moved from)
+    explicit operator bool() const noexcept{
+        return program_ != nullptr;
+    }
+
+    /* Evaluate the expression; see ExP_run(). Not const: evaluation uses
+     * scratch space inside the program, so one CompiledExpression must
+     * not be run from several threads at the same time.
+     */
+    std::int32_t run() noexcept{
+        return ExP_run(program_);
+    }
+
+    ExProgram get() const noexcept{
+        return program_;
+    }
+
+    // give up ownership of the program, which the caller then has to destroy
+    ExProgram release() noexcept{
+        return std::exchange(program_, nullptr);
+    }
+
+private:
+    ExProgram program_ = nullptr;
+};
+
+
+
+/* Compile expression (see ExP_compile()). The result is empty if
+ * expression is malformed or memory couldn't be allocated.
+ */
+inline CompiledExpression compile(std::string_view expression, ex_notation notation,
+                                  ex_options options = ExP_OPT_NONE) noexcept{
+    return CompiledExpression(ExP_compile_n(expression.data(), expression.size(), notation, options));
+}
+
+
+
+/* Convert expression to the one notation in target (ExP_TO_PREFIX,
+ * ExP_TO_INFIX or ExP_TO_POSTFIX), replacing the contents of out.
+ * The conversion is written straight into out's buffer, over its current
+ * contents; a longer result is measured first (ExP_convert_into() leaves
+ * the buffer untouched), out is resized to that length, and the conversion
+ * is done again. out only allocates if the result is longer than its 
+ * current capacity.
+ * Return false on failure (out is then empty).
+ */
+template <typename Allocator>
+bool convert(std::string_view expression, ex_notation notation, ex_targets target,
+             std::basic_string<char, std::char_traits<char>, Allocator> &out){
+    // data()[size()] is where the NUL goes
+    std::int64_t length = ExP_convert_into(expression.data(), expression.size(), notation, target,
+                                           out.data(), out.size() + 1);
+    if (length >= 0 && (std::size_t)length > out.size()){
+        // didn't fit: grow to the length measured, and convert again
+        out.resize(length);
+        length = ExP_convert_into(expression.data(), expression.size(), notation, target,
+                                  out.data(), out.size() + 1);
+    }
+    if (length < 0){
+        out.clear();
+        return false;
+    }
+    out.resize(length);
+    return true;
+}
+
+} // namespace ExP
+
+#endif
@@ -0,0 +1,249 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "ExP_client.h"
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/* ------------------ Structs and Typedefs ------------------- */
+
+struct expression_client{
+    int fd;         // the connected socket
+
+    // responses are read in bulk into this buffer, then split into lines
+    char buffer[4096];
+    size_t start;   // where the unconsumed data in buffer starts
+    size_t end;     // where it ends
+    bool skipping;  // dropping the rest of a line too long for the buffer
+    uint32_t next_id;   // used by ExP_client_compute()
+};
+
+
+// --------------------------------------------------------------------------------
+// ||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// --------------------------------------------------------------------------------
+
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/* ----------------------- Private Functions ------------------------- */
+
+
+static const char *ExClient_notation_name(ex_notation NOTATION){
+    /* Return the protocol name of NOTATION */
+    switch (NOTATION){
+        case PREFIX:
+            return "PREFIX";
+
+        case POSTFIX:
+            return "POSTFIX";
+
+        default:
+            return "INFIX";
+    }
+}
+
+
+static int32_t ExClient_write_all(int fd, const char *data, size_t length){
+    /* Write all length bytes of data to fd, retrying on short writes.
+       Return 0, or -1 on failure.
+    */
+    while (length){
+        ssize_t written = write(fd, data, length);
+        if (written < 0){
+            if (errno == EINTR){
+                continue;
+            }
+            return -1;
+        }
+        data += written;
+        length -= written;
+    }
+    return 0;
+}
+
+
+
+static bool ExClient_parse_reply(const char *line, uint32_t *id, char reply[], size_t size){
+    /* Split the NUL-terminated response line into its id, stored in *id, 
+       and the text after it, copied into reply (size bytes).
+       Return whether that text had to be truncated.
+    */
+    char *rest;
+    *id = (uint32_t)strtoul(line, &rest, 10);
+    if (*rest == ' '){
+        rest++;
+    }
+    size_t length = strlen(rest);
+    if (size){
+        snprintf(reply, size, "%s", rest);
+    }
+    return length >= size;
+}
+
+/* ------------------------- END PRIVATE ----------------------------- */
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+
+ExClient ExP_client_connect(const char *socket_path){
+    /* Connect to the server listening at socket_path and return the
+       new ExClient, or NULL on failure.
+    */
+    struct sockaddr_un address;
+    if (strlen(socket_path) >= sizeof(address.sun_path)){
+        return NULL;
+    }
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, socket_path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0){
+        return NULL;
+    }
+    if (connect(fd, (struct sockaddr *)&address, sizeof(address)) < 0){
+        close(fd);
+        return NULL;
+    }
+
+    ExClient client = malloc(sizeof(struct expression_client));
+    if (!client){
+        close(fd);
+        return NULL;
+    }
+    client->fd = fd;
+    client->start = 0;
+    client->end = 0;
+    client->skipping = false;
+    client->next_id = 0;
+
+    return client;
+}
+
+
+
+int32_t ExP_client_send(ExClient client, uint32_t id, const char *verb, ex_notation NOTATION, const char *expression){
+    /* Format the request line and send it */
+    if (strcmp(verb, "STATS") == 0){
+        char line[32];
+        int length = snprintf(line, sizeof(line), "%u STATS\n", id);
+        return ExClient_write_all(client->fd, line, length);
+    }
+
+    // the expression can be of any length, so only the prefix goes through snprintf()
+    char header[64];
+    int length = snprintf(header, sizeof(header), "%u %s %s ", id, verb, ExClient_notation_name(NOTATION));
+    if (length < 0 || (size_t)length >= sizeof(header)){
+        return -1;
+    }
+    // a newline inside the expression would split it into two requests
+    if (strchr(expression, '\n')){
+        return -1;
+    }
+
+    if (ExClient_write_all(client->fd, header, length) < 0 || \
+            ExClient_write_all(client->fd, expression, strlen(expression)) < 0 || \
+            ExClient_write_all(client->fd, "\n", 1) < 0){
+        return -1;
+    }
+    return 0;
+}
+
+
+
+int32_t ExP_client_receive(ExClient client, uint32_t *id, char reply[], size_t size){
+    /* Read the next response line, refilling the buffer as needed. A line
+       that doesn't fit in the buffer is replied with as soon as the buffer 
+       is full, truncated, and the rest of it is skipped on the next calls.
+    */
+    while (true){
+        char *newline = memchr(client->buffer + client->start, '\n', client->end - client->start);
+
+        if (newline && client->skipping){
+            // the end of a line already replied with, truncated
+            client->start = newline + 1 - client->buffer;
+            client->skipping = false;
+            continue;
+        }
+        if (newline){
+            *newline = '\0';
+            char *line = client->buffer + client->start;
+            client->start = newline + 1 - client->buffer;
+
+            return ExClient_parse_reply(line, id, reply, size) ? 1 : 0;
+        }
+
+        if (client->skipping){
+            // still in the line being dropped
+            client->start = 0;
+            client->end = 0;
+        }
+        else{
+            // no complete line: move the partial one to the front and read some more
+            memmove(client->buffer, client->buffer + client->start, client->end - client->start);
+            client->end -= client->start;
+            client->start = 0;
+
+            if (client->end == sizeof(client->buffer)){
+                // a line longer than the whole buffer: reply with its head (the
+                // id and the status are there), and drop the rest as it comes
+                client->buffer[client->end - 1] = '\0';
+                ExClient_parse_reply(client->buffer, id, reply, size);
+                client->end = 0;
+                client->skipping = true;
+                return 1;
+            }
+        }
+        ssize_t received = read(client->fd, client->buffer + client->end, sizeof(client->buffer) - client->end);
+        if (received < 0 && errno == EINTR){
+            continue;
+        }
+        if (received <= 0){
+            return -1;
+        }
+        client->end += received;
+    }
+}
+
+
+
+int32_t ExP_client_compute(ExClient client, const char *expression, ex_notation NOTATION, int32_t *result){
+    /* Send a COMPUTE request and wait for its response */
+    uint32_t id = client->next_id++;
+    if (ExP_client_send(client, id, "COMPUTE", NOTATION, expression) < 0){
+        return -1;
+    }
+
+    char reply[64];
+    uint32_t reply_id;
+    if (ExP_client_receive(client, &reply_id, reply, sizeof(reply)) < 0 || reply_id != id){
+        return -1;
+    }
+    if (strncmp(reply, "OK ", 3) != 0){
+        return -1;
+    }
+    *result = (int32_t)strtol(reply + 3, NULL, 10);
+
+    return 0;
+}
+
+
+
+void ExP_client_close(ExClient *client_ref){
+    /* Close the socket, free the client, then set *client_ref to NULL */
+    if (client_ref == NULL || *client_ref == NULL){
+        return;
+    }
+    close((*client_ref)->fd);
+    free(*client_ref);
+
+    *client_ref = NULL;
+}
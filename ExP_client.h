@@ -0,0 +1,103 @@
+#include <stdint.h>
+#include <stddef.h>
+
+#include "C_ex_parser.h"
+
+
+/* ************************************************************* */
+/* ------------------------ OVERVIEW --------------------------- */
+
+/* Client side of the ExP_server protocol.
+ * ExP_server (see ExP_server.c) is a long-running process that listens
+ * on a Unix domain socket and computes/converts expressions on behalf
+ * of its clients, keeping the compiled expressions cached.
+ *
+ * The protocol is line-based. Every request is one line:
+ *
+ *      <id> <verb> <notation> <expression>\n
+ *
+ * where <id> is any number chosen by the client, <verb> is one of
+ * COMPUTE, TO_PREFIX, TO_INFIX, TO_POSTFIX, and <notation> is one of
+ * PREFIX, INFIX, POSTFIX. A line '<id> STATS\n' asks for the server
+ * statistics instead.
+ *
+ * Every request gets exactly one response line:
+ *
+ *      <id> OK <result>\n      or      <id> ERR <reason>\n
+ *
+ * For a malformed expression, <reason> tells what's wrong and the byte
+ * offset in <expression> where it was found, e.g. for '7 COMPUTE INFIX 
+ * 2 * (3 + )': 'cannot compile expression: missing operand at 9'. An
+ * expression dividing by 0 gets 'division by zero' (and one dividing the
+ * smallest int32_t by -1, 'division overflow').
+ *
+ * A request line over 1 MB gets '<id> ERR request too long', and the
+ * connection is closed.
+ *
+ * Requests can be pipelined: any number of them can be sent before
+ * reading the responses. The server stops reading them, though, while 
+ * too many responses are waiting for the client to read them. Responses to the requests sent on one connection
+ * may arrive in a different order than the requests; use the ids to
+ * match them up.
+
+ * ************************************************************* */
+
+
+/* ExClient is a typedef for a POINTER to a struct expression_client,
+ * for the same reasons Stack is (see stack.h)
+ */
+typedef struct expression_client *ExClient;
+
+
+
+
+/* *************** FUNCTION PROTOTYPES ***************** */
+/* ----------------------------------------------------- */
+
+
+/* Connect to the ExP_server listening on the Unix domain socket at
+ * socket_path.
+ * Return NULL if the connection couldn't be established.
+ *
+ * Example
+ *      ExClient client = ExP_client_connect("/tmp/exp.sock");
+ */
+ExClient ExP_client_connect(const char *socket_path);
+
+
+
+/* Send a request without waiting for the response (pipelining).
+ * verb is "COMPUTE", "TO_PREFIX", "TO_INFIX", "TO_POSTFIX" or "STATS"
+ * (in which case NOTATION and expression are ignored).
+ * Return 0, or -1 if the request couldn't be sent.
+ */
+int32_t ExP_client_send(ExClient client, uint32_t id, const char *verb, ex_notation NOTATION, const char *expression);
+
+
+
+/* Wait for the next response and store its id in *id and the text
+ * after the id ("OK <result>" or "ERR <reason>") in reply, a buffer of
+ * size bytes. Longer replies are truncated, and so are those over the
+ * client's own buffer (4 KB): their id and status are kept, and the rest
+ * of the line is skipped.
+ * Return 0, 1 if the reply was truncated, or -1 if the connection was 
+ * closed or failed.
+ */
+int32_t ExP_client_receive(ExClient client, uint32_t *id, char reply[], size_t size);
+
+
+
+/* Compute expression on the server and store the result in *result.
+ * This is the synchronous, non-pipelined convenience version of
+ * ExP_client_send() + ExP_client_receive(); it must not be mixed with
+ * pipelined requests still awaiting their responses.
+ * Return 0, or -1 on failure (including the server rejecting the expression).
+ */
+int32_t ExP_client_compute(ExClient client, const char *expression, ex_notation NOTATION, int32_t *result);
+
+
+
+/* Close the connection and free all the memory associated with
+ * *client_ref, then set it to NULL.
+ */
+void ExP_client_close(ExClient *client_ref);
@@ -0,0 +1,353 @@
+#ifndef EXP_CONSTEXPR_HPP
+#define EXP_CONSTEXPR_HPP
+
+#include <cstdint>
+#include <cstddef>
+
+
+/* ************************************************************* */
+/* ------------------------ OVERVIEW --------------------------- */
+
+/* Compile-time front end (C++20, header-only) for expressions that are
+ * fixed in the source code. Instead of
+ *
+ *      int32_t r = ExP_compute(expression, INFIX);     // parsed at run time, every time
+ *
+ * write
+ *
+ *      constexpr int32_t r = ExP::value<"7 * ((2 / 1) * (3 - 1) * 4 - (1 + 11))">;
+ *
+ * The infix expression is parsed by the compiler (consteval). Only the
+ * arithmetic subset of the C parser's syntax is implemented (+ - * x / ^
+ * and parentheses: no comparisons, && || ?: or function calls), with the
+ * same relative precedence as ExP_get_precedence() gives those operators
+ * and the same left-associativity as ExP_infix_shunt(). The result is a type
+ * encoding the expression tree, which evaluates with the same semantics
+ * as ExP_compute(): 32-bit arithmetic wrapping around on overflow,
+ * division truncating towards 0, ^ as integer power.
+ *
+ * Expressions can also contain variables: names made of letters, digits
+ * and '_', starting with a letter or '_'. They become the parameters of
+ * the expression's function call operator, in order of first appearance;
+ * the call inlines to straight-line arithmetic.
+ *
+ *      constexpr auto area = ExP::expression<"width * height / 2">;
+ *      int32_t a = area(w, h);
+ *
+ * ('x' is still multiplication wherever an operator is expected, e.g.
+ * "2 x width"; anywhere else it's part of a name.)
+ *
+ * A malformed expression is a compile-time error.
+
+ * ************************************************************* */
+
+
+namespace ExP {
+
+namespace detail {
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/* ------------------ Structs and Typedefs ------------------- */
+
+// a string literal usable as a template argument
+template <std::size_t N>
+struct fixed_string{
+    char text[N];
+
+    consteval fixed_string(const char (&string)[N]){
+        for (std::size_t i = 0; i < N; i++){
+            text[i] = string[i];
+        }
+    }
+    static constexpr std::size_t length = N - 1;
+};
+
+
+// a node of the expression tree, as produced by the parser
+struct node{
+    char op = 0;            // '+', '-', '*', '/', '^'; 'n' for a number, 'v' for a variable
+    std::int32_t value = 0; // the number, or the index of the variable
+    int left = -1;
+    int right = -1;
+};
+
+
+// the whole parsed expression; N is the length of the source, an upper
+// bound on the number of nodes and variables
+template <std::size_t N>
+struct parsed{
+    node nodes[N ? N : 1] = {};
+    int count = 0;
+    int root = -1;
+
+    // variable i is source[variable_start[i], variable_start[i] + variable_length[i])
+    int variable_start[N ? N : 1] = {};
+    int variable_length[N ? N : 1] = {};
+    int variables = 0;
+};
+
+
+// --------------------------------------------------------------------------------
+// ||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// --------------------------------------------------------------------------------
+
+
+
+/*               * * * Parser (consteval) * * *                         */
+
+// Called on malformed input. Not being a constant expression, it turns
+// the consteval parse into a compile-time error that names it.
+inline void malformed_expression(const char *) {}
+
+
+consteval int precedence(char op){
+    // the arithmetic operators only, ranked as ExP_get_precedence() ranks them
+    switch (op){
+        case '+':
+        case '-':
+            return 1;
+
+        case '*':
+        case 'x':
+        case '/':
+            return 2;
+
+        case '^':
+            return 3;
+
+        default:
+            return 0;
+    }
+}
+
+consteval bool is_space(char c){
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+consteval bool is_digit(char c){
+    return c >= '0' && c <= '9';
+}
+
+consteval bool is_name_start(char c){
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+
+template <std::size_t N>
+struct parser{
+    const char *source;
+    int position = 0;
+    parsed<N> result{};
+
+    consteval char peek(){
+        while (position < (int)N && is_space(source[position])){
+            position++;
+        }
+        return position < (int)N ? source[position] : '\0';
+    }
+
+    consteval int add(node new_node){
+        result.nodes[result.count] = new_node;
+        return result.count++;
+    }
+
+    consteval int variable(int start, int length){
+        // the index of the variable called source[start, start + length),
+        // adding it if it's the first time it appears
+        for (int i = 0; i < result.variables; i++){
+            bool same = result.variable_length[i] == length;
+            for (int j = 0; same && j < length; j++){
+                same = source[result.variable_start[i] + j] == source[start + j];
+            }
+            if (same){
+                return i;
+            }
+        }
+        result.variable_start[result.variables] = start;
+        result.variable_length[result.variables] = length;
+        return result.variables++;
+    }
+
+    consteval int operand(){
+        // a number, a variable, or a parenthesized expression
+        char c = peek();
+
+        if (c == '('){
+            position++;
+            int inner = expression(1);
+            if (peek() != ')'){
+                malformed_expression("missing closing parenthesis");
+            }
+            position++;
+            return inner;
+        }
+        if (is_digit(c)){
+            std::int64_t value = 0;
+            while (position < (int)N && is_digit(source[position])){
+                value = value * 10 + (source[position++] - '0');
+                if (value > INT32_MAX){
+                    malformed_expression("number too large for int32_t");
+                }
+            }
+            return add(node{'n', (std::int32_t)value});
+        }
+        if (is_name_start(c)){
+            int start = position;
+            while (position < (int)N && (is_name_start(source[position]) || is_digit(source[position]))){
+                position++;
+            }
+            return add(node{'v', variable(start, position - start)});
+        }
+        malformed_expression("operand expected");
+        return -1;
+    }
+
+    consteval int expression(int minimum_precedence){
+        // precedence climbing; every operator is left-associative, as in
+        // ExP_infix_shunt(), so the right operand only takes operators of
+        // strictly higher precedence
+        int left = operand();
+
+        while (true){
+            char op = peek();
+            int op_precedence = precedence(op);
+            if (!op_precedence || op_precedence < minimum_precedence){
+                return left;
+            }
+            position++;
+            int right = expression(op_precedence + 1);
+            left = add(node{op == 'x' ? '*' : op, 0, left, right});
+        }
+    }
+};
+
+
+template <fixed_string S>
+consteval auto parse(){
+    parser<S.length> the_parser{S.text};
+    the_parser.result.root = the_parser.expression(1);
+    if (the_parser.peek() != '\0'){
+        malformed_expression("unexpected character after the end of the expression");
+    }
+    return the_parser.result;
+}
+
+
+
+/*               * * * Evaluation * * *                         */
+
+// the operators, with the same semantics as ExP_apply()
+constexpr std::int32_t power(std::int32_t base, std::int32_t exponent){
+    if (exponent < 0){
+        if (base == 1 || base == -1){
+            return (exponent & 1) ? base : 1;
+        }
+        return 0;
+    }
+    std::uint32_t result = 1;
+    std::uint32_t square = (std::uint32_t)base;
+    while (exponent){
+        if (exponent & 1){
+            result *= square;
+        }
+        square *= square;
+        exponent >>= 1;
+    }
+    return (std::int32_t)result;
+}
+
+template <char Op>
+constexpr std::int32_t apply(std::int32_t left, std::int32_t right){
+    if constexpr (Op == '+'){
+        return (std::int32_t)((std::uint32_t)left + (std::uint32_t)right);
+    }else if constexpr (Op == '-'){
+        return (std::int32_t)((std::uint32_t)left - (std::uint32_t)right);
+    }else if constexpr (Op == '*'){
+        return (std::int32_t)((std::uint32_t)left * (std::uint32_t)right);
+    }else if constexpr (Op == '/'){
+        return left / right;
+    }else{
+        return power(left, right);
+    }
+}
+
+
+// the type-encoded expression tree
+template <std::int32_t Value>
+struct number{
+    template <std::size_t V>
+    static constexpr std::int32_t evaluate(const std::int32_t (&)[V]){
+        return Value;
+    }
+};
+
+template <int Index>
+struct variable{
+    template <std::size_t V>
+    static constexpr std::int32_t evaluate(const std::int32_t (&variables)[V]){
+        return variables[Index];
+    }
+};
+
+template <char Op, typename Left, typename Right>
+struct binary{
+    template <std::size_t V>
+    static constexpr std::int32_t evaluate(const std::int32_t (&variables)[V]){
+        return apply<Op>(Left::evaluate(variables), Right::evaluate(variables));
+    }
+};
+
+
+template <auto Parsed, int Index>
+constexpr auto build(){
+    // the type of the subtree rooted at node Index
+    constexpr node n = Parsed.nodes[Index];
+
+    if constexpr (n.op == 'n'){
+        return number<n.value>{};
+    }else if constexpr (n.op == 'v'){
+        return variable<n.value>{};
+    }else{
+        return binary<n.op, decltype(build<Parsed, n.left>()), decltype(build<Parsed, n.right>())>{};
+    }
+}
+
+} // namespace detail
+
+
+
+/* The compiled expression S: a callable object taking one int32_t per
+ * variable, in order of first appearance.
+ */
+template <typename Tree, int Variables>
+struct compiled{
+    static constexpr int variables = Variables;
+
+    template <typename... Arguments>
+    constexpr std::int32_t operator()(Arguments... arguments) const{
+        static_assert(sizeof...(Arguments) == Variables, "one argument per variable is needed");
+        const std::int32_t values[Variables ? Variables : 1] = {(std::int32_t)arguments...};
+        return Tree::evaluate(values);
+    }
+};
+
+
+template <detail::fixed_string S>
+inline constexpr auto parsed = detail::parse<S>();
+
+template <detail::fixed_string S>
+inline constexpr auto expression = compiled<decltype(detail::build<parsed<S>, parsed<S>.root>()), parsed<S>.variables>{};
+
+/* The value of the expression S, which mustn't have variables; a
+ * compile-time constant.
+ */
+template <detail::fixed_string S>
+inline constexpr std::int32_t value = [](){
+    static_assert(parsed<S>.variables == 0, "ExP::value is for expressions without variables; use ExP::expression");
+    return expression<S>();
+}();
+
+} // namespace ExP
+
+#endif
@@ -0,0 +1,244 @@
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "ExP_client.h"
+
+
+/* ************************************************************* */
+/* ------------------------ OVERVIEW --------------------------- */
+
+/* Load generator for ExP_server, for local testing.
+ *
+ * Usage: ExP_loadgen <socket path> [clients] [pipeline depth] [seconds] [distinct expressions]
+ *
+ * Every client runs on its own thread with its own connection, and keeps
+ * 'pipeline depth' requests in flight: it sends that many, then reads
+ * the responses, and so on. The expressions are drawn from a pool of
+ * 'distinct expressions' generated up front, so the server's cache of
+ * compiled expressions gets exercised; a pool larger than the cache
+ * exercises the misses.
+ * At the end, the throughput and latency percentiles seen by the clients
+ * are printed, followed by the server's own statistics.
+
+ * ************************************************************* */
+
+
+#define LATENCY_BUCKETS 32  // bucket i: latencies in [2^i, 2^(i+1)) microseconds
+
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/* ------------------ Structs and Typedefs ------------------- */
+
+struct load_client{
+    pthread_t thread;
+    const char *socket_path;
+    uint32_t pipeline;
+    double seconds;
+    uint32_t seed;
+
+    // results
+    uint64_t completed;
+    uint64_t errors;
+    uint64_t histogram[LATENCY_BUCKETS];
+};
+
+static char **expressions;
+static ex_notation *notations;
+static uint32_t expression_count;
+
+
+// --------------------------------------------------------------------------------
+// ||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// --------------------------------------------------------------------------------
+
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/* ----------------------- Private Functions ------------------------- */
+
+
+static uint64_t Load_now(void){
+    /* Return a monotonic timestamp in nanoseconds */
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + now.tv_nsec;
+}
+
+
+static uint32_t Load_random(uint32_t *state){
+    /* xorshift32: cheap pseudo-random numbers, one independent state per thread */
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+
+static void Load_generate_expressions(uint32_t count){
+    /* Generate count infix expressions, shaped like the README examples
+       but with random operands; a quarter of them are sent as postfix.
+    */
+    expressions = malloc(sizeof(char *) * count);
+    notations = malloc(sizeof(ex_notation) * count);
+    uint32_t state = 2463534242u;
+
+    for (uint32_t i = 0; i < count; i++){
+        char buffer[128];
+        uint32_t a = Load_random(&state) % 100 + 1, b = Load_random(&state) % 100 + 1;
+        uint32_t c = Load_random(&state) % 100 + 1, d = Load_random(&state) % 100 + 1;
+
+        if (i % 4 == 3){
+            snprintf(buffer, sizeof(buffer), "%u %u %u %u / + *", a, b, c, d);
+            notations[i] = POSTFIX;
+        }else{
+            snprintf(buffer, sizeof(buffer), "%u * ((%u / 1) * (%u - 1) * 4 - (1 + %u))", a, b, c, d);
+            notations[i] = INFIX;
+        }
+        expressions[i] = strdup(buffer);
+    }
+    expression_count = count;
+}
+
+
+static void *Load_client_run(void *argument){
+    /* Client thread: keep 'pipeline' requests in flight until the time is up */
+    struct load_client *load = argument;
+
+    ExClient client = ExP_client_connect(load->socket_path);
+    if (!client){
+        fprintf(stderr, "ExP_loadgen: cannot connect to %s\n", load->socket_path);
+        return NULL;
+    }
+    uint64_t *sent = malloc(sizeof(uint64_t) * load->pipeline);
+    uint64_t deadline = Load_now() + (uint64_t)(load->seconds * 1e9);
+    uint32_t state = load->seed;
+
+    while (Load_now() < deadline){
+        // the id is the request's index within the round, to find when it was sent
+        for (uint32_t i = 0; i < load->pipeline; i++){
+            uint32_t which = Load_random(&state) % expression_count;
+            sent[i] = Load_now();
+            if (ExP_client_send(client, i, "COMPUTE", notations[which], expressions[which]) < 0){
+                load->errors++;
+                goto done;
+            }
+        }
+        for (uint32_t i = 0; i < load->pipeline; i++){
+            uint32_t id;
+            char reply[64];
+            if (ExP_client_receive(client, &id, reply, sizeof(reply)) < 0){
+                load->errors++;
+                goto done;
+            }
+            if (id >= load->pipeline || strncmp(reply, "OK", 2) != 0){
+                load->errors++;
+                continue;
+            }
+            uint64_t microseconds = (Load_now() - sent[id]) / 1000;
+            uint32_t bucket = 0;
+            while (microseconds > 1 && bucket < LATENCY_BUCKETS - 1){
+                microseconds >>= 1;
+                bucket++;
+            }
+            load->histogram[bucket]++;
+            load->completed++;
+        }
+    }
+done:
+    free(sent);
+    ExP_client_close(&client);
+    return NULL;
+}
+
+
+static uint64_t Load_percentile(uint64_t histogram[], uint64_t total, double fraction){
+    /* Return the upper bound, in microseconds, of the histogram bucket
+       the given fraction of the total falls in.
+    */
+    uint64_t seen = 0;
+    for (uint32_t i = 0; i < LATENCY_BUCKETS; i++){
+        seen += histogram[i];
+        if (seen >= fraction * total){
+            return (uint64_t)1 << (i + 1);
+        }
+    }
+    return (uint64_t)1 << LATENCY_BUCKETS;
+}
+
+/* ------------------------- END PRIVATE ----------------------------- */
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+
+int main(int argc, char *argv[]){
+    if (argc < 2){
+        fprintf(stderr, "usage: %s <socket path> [clients] [pipeline depth] [seconds] [distinct expressions]\n", argv[0]);
+        return 1;
+    }
+    uint32_t clients = argc > 2 ? strtoul(argv[2], NULL, 10) : 4;
+    uint32_t pipeline = argc > 3 ? strtoul(argv[3], NULL, 10) : 32;
+    double seconds = argc > 4 ? strtod(argv[4], NULL) : 5;
+    uint32_t distinct = argc > 5 ? strtoul(argv[5], NULL, 10) : 1000;
+    if (!clients || !pipeline || !distinct){
+        fprintf(stderr, "ExP_loadgen: clients, pipeline depth and distinct expressions must be positive\n");
+        return 1;
+    }
+
+    Load_generate_expressions(distinct);
+
+    struct load_client *loads = calloc(clients, sizeof(struct load_client));
+    uint64_t start = Load_now();
+    for (uint32_t i = 0; i < clients; i++){
+        loads[i].socket_path = argv[1];
+        loads[i].pipeline = pipeline;
+        loads[i].seconds = seconds;
+        loads[i].seed = 0x9E3779B9u * (i + 1);
+        pthread_create(&loads[i].thread, NULL, Load_client_run, &loads[i]);
+    }
+
+    uint64_t completed = 0, errors = 0;
+    uint64_t histogram[LATENCY_BUCKETS] = {0};
+    for (uint32_t i = 0; i < clients; i++){
+        pthread_join(loads[i].thread, NULL);
+        completed += loads[i].completed;
+        errors += loads[i].errors;
+        for (uint32_t j = 0; j < LATENCY_BUCKETS; j++){
+            histogram[j] += loads[i].histogram[j];
+        }
+    }
+    double elapsed = (Load_now() - start) / 1e9;
+
+    printf("requests: %lu in %.2f s (%.0f/s), errors: %lu\n",
+            (unsigned long)completed, elapsed, completed / elapsed, (unsigned long)errors);
+    printf("latency (us, upper bound): p50 <= %lu  p90 <= %lu  p99 <= %lu  p99.9 <= %lu\n",
+            (unsigned long)Load_percentile(histogram, completed, 0.5),
+            (unsigned long)Load_percentile(histogram, completed, 0.9),
+            (unsigned long)Load_percentile(histogram, completed, 0.99),
+            (unsigned long)Load_percentile(histogram, completed, 0.999));
+
+    // and what the server saw
+    ExClient client = ExP_client_connect(argv[1]);
+    char reply[1024];
+    uint32_t id;
+    if (client && ExP_client_send(client, 0, "STATS", INFIX, NULL) == 0 && \
+            ExP_client_receive(client, &id, reply, sizeof(reply)) >= 0){
+        printf("server: %s\n", reply);
+    }
+    ExP_client_close(&client);
+
+    for (uint32_t i = 0; i < expression_count; i++){
+        free(expressions[i]);
+    }
+    free(expressions);
+    free(notations);
+    free(loads);
+
+    return errors ? 1 : 0;
+}
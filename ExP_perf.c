@@ -0,0 +1,369 @@
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "C_ex_parser.h"
+
+
+/* ************************************************************* */
+/* ------------------------ OVERVIEW --------------------------- */
+
+/* Hardware performance-counter profile of the library's phases (see
+ * ex_phase), over generated expressions, for local testing (Linux only).
+ *
+ * Usage: ExP_perf [expressions] [operators per expression] [runs per program]
+ *
+ * Random infix expressions are generated up front, then each one is
+ *      computed with ExP_compute()         build, evaluate, destroy
+ *      compiled with ExP_compile_n()       build, compile, destroy
+ *      and run 'runs' times                run
+ *      converted to postfix                build, write, destroy
+ * A hook set with ExP_set_phase_hook() reads the counters at the start
+ * and at the end of every phase and adds the difference to that phase.
+ * At the end, each phase is reported per expression tree node: time,
+ * cycles, instructions (and instructions per cycle), L1 data cache read
+ * misses, last-level cache misses and branch mispredictions. 'evaluate'
+ * against 'run', for instance, compares walking pointer-linked nodes
+ * against sweeping an ExProgram's arrays.
+ *
+ * The counters are opened with perf_event_open(), for this thread, in
+ * user space only. Where that isn't possible (perf_event_paranoid, a
+ * container or a virtual machine without access to the PMU, ...) only
+ * the time is reported; so it is for single events the CPU doesn't have.
+ *
+ * Reading the counters costs a system call at each phase boundary: keep
+ * expressions large enough (the default is 1000 operators) for phases
+ * to take well over a microsecond.
+
+ * ************************************************************* */
+
+
+#define PERF_EVENTS 5
+
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/* ------------------ Structs and Typedefs ------------------- */
+
+struct perf_event{
+    const char *name;
+    uint32_t type;
+    uint64_t config;
+};
+
+static const struct perf_event Perf_events[PERF_EVENTS] = {
+    {"cycles",      PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {"instr",       PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {"L1d miss",    PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | \
+                                        (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+    {"LLC miss",    PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {"br miss",     PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+};
+
+static const char *Perf_phase_names[ExP_PHASES] = {
+    "shunt", "build", "evaluate", "compile", "run", "write", "destroy"
+};
+
+struct perf_phase{
+    uint64_t calls;
+    uint64_t nanoseconds;
+    uint64_t counts[PERF_EVENTS];
+
+    // when the current call started
+    uint64_t started;
+    uint64_t start_counts[PERF_EVENTS];
+};
+
+struct perf_counters{
+    // one file descriptor per event, -1 if it couldn't be opened. The
+    // events that could be are read together, through the first one.
+    int fds[PERF_EVENTS];
+    int leader;
+    uint32_t open;
+    int error;          // errno of the first event that couldn't be opened
+
+    struct perf_phase phases[ExP_PHASES];
+};
+
+
+// --------------------------------------------------------------------------------
+// ||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// --------------------------------------------------------------------------------
+
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/* ----------------------- Private Functions ------------------------- */
+
+
+static uint64_t Perf_now(void){
+    /* Return a monotonic timestamp in nanoseconds */
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + now.tv_nsec;
+}
+
+
+static uint32_t Perf_random(uint32_t *state){
+    /* xorshift32 */
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+
+static size_t Perf_generate(char *buffer, uint32_t operators, uint32_t *state){
+    /* Write a random infix expression with the given number of operators
+       (function calls counting as one) to buffer, parenthesizing every
+       subexpression; return its length. Divisors are always literals from
+       1 to 9, so nothing divides by 0.
+       At most 16 bytes per operator, plus 3, are written; not the NUL.
+    */
+    if (!operators){
+        return sprintf(buffer, "%u", Perf_random(state) % 99 + 1);
+    }
+    static const char *operator_names[] = {" + ", " - ", " * ", " / ", " < ", " == ", " && ", "max"};
+    const char *operator = operator_names[Perf_random(state) % 8];
+    uint32_t left = Perf_random(state) % operators;
+    size_t length = 0;
+
+    if (operator[0] == 'm'){
+        length += sprintf(buffer, "max(");
+        length += Perf_generate(buffer + length, left, state);
+        length += sprintf(buffer + length, ", ");
+        length += Perf_generate(buffer + length, operators - 1 - left, state);
+        buffer[length++] = ')';
+        return length;
+    }
+    if (operator[1] == '/'){
+        left = operators - 1;
+    }
+    buffer[length++] = '(';
+    length += Perf_generate(buffer + length, left, state);
+    length += sprintf(buffer + length, "%s", operator);
+    if (operator[1] == '/'){
+        length += sprintf(buffer + length, "%u", Perf_random(state) % 9 + 1);
+    }
+    else{
+        length += Perf_generate(buffer + length, operators - 1 - left, state);
+    }
+    buffer[length++] = ')';
+    return length;
+}
+
+
+static void Perf_open(struct perf_counters *counters){
+    /* Open the counters of as many of the events as possible, as one group */
+    memset(counters, 0, sizeof(*counters));
+    counters->leader = -1;
+
+    for (uint32_t i = 0; i < PERF_EVENTS; i++){
+        struct perf_event_attr attributes;
+        memset(&attributes, 0, sizeof(attributes));
+        attributes.size = sizeof(attributes);
+        attributes.type = Perf_events[i].type;
+        attributes.config = Perf_events[i].config;
+        attributes.exclude_kernel = 1;
+        attributes.exclude_hv = 1;
+        attributes.read_format = PERF_FORMAT_GROUP;
+        // the whole group is enabled at once, through its leader
+        attributes.disabled = counters->leader < 0;
+
+        counters->fds[i] = syscall(SYS_perf_event_open, &attributes, 0, -1, counters->leader, 0);
+        if (counters->fds[i] < 0){
+            if (!counters->error){
+                counters->error = errno;
+            }
+            continue;
+        }
+        if (counters->leader < 0){
+            counters->leader = counters->fds[i];
+        }
+        counters->open++;
+    }
+    if (counters->leader >= 0){
+        ioctl(counters->leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+}
+
+
+static void Perf_close(struct perf_counters *counters){
+    for (uint32_t i = 0; i < PERF_EVENTS; i++){
+        if (counters->fds[i] >= 0){
+            close(counters->fds[i]);
+        }
+    }
+}
+
+
+static void Perf_read(struct perf_counters *counters, uint64_t values[PERF_EVENTS]){
+    /* Read the current values of the counters into values (0 for the events that aren't counted) */
+    memset(values, 0, sizeof(uint64_t) * PERF_EVENTS);
+    if (counters->leader < 0){
+        return;
+    }
+    // the number of values, then the values, in the order the events were opened
+    uint64_t group[1 + PERF_EVENTS];
+    if (read(counters->leader, group, sizeof(group)) < (ssize_t)sizeof(uint64_t)){
+        return;
+    }
+    for (uint32_t i = 0, j = 0; i < PERF_EVENTS && j < group[0]; i++){
+        if (counters->fds[i] >= 0){
+            values[i] = group[1 + j++];
+        }
+    }
+}
+
+
+static void Perf_hook(ex_phase phase, int starting, void *context){
+    /* The phase hook: the counters are read last when a phase starts and
+       first when it ends, so that as little of the hook as possible is counted.
+    */
+    struct perf_counters *counters = context;
+    struct perf_phase *current = &counters->phases[phase];
+
+    if (starting){
+        current->started = Perf_now();
+        Perf_read(counters, current->start_counts);
+        return;
+    }
+    uint64_t values[PERF_EVENTS];
+    Perf_read(counters, values);
+    current->nanoseconds += Perf_now() - current->started;
+    current->calls++;
+    for (uint32_t i = 0; i < PERF_EVENTS; i++){
+        current->counts[i] += values[i] - current->start_counts[i];
+    }
+}
+
+
+static void Perf_report(struct perf_counters *counters, uint64_t nodes){
+    /* Print the totals of each phase, per node of the trees it worked on
+       (nodes per call)
+    */
+    if (counters->open < PERF_EVENTS){
+        printf("%s: %s\n", counters->open ? "some hardware counters are unavailable" : \
+                "hardware counters are unavailable, reporting time only", strerror(counters->error));
+    }
+    printf("%-10s %10s %10s", "phase", "calls", "ns/node");
+    for (uint32_t i = 0; i < PERF_EVENTS; i++){
+        printf(" %10s", Perf_events[i].name);
+        if (i == 1){
+            printf(" %6s", "IPC");
+        }
+    }
+    printf("\n");
+
+    for (uint32_t phase = 0; phase < ExP_PHASES; phase++){
+        struct perf_phase *current = &counters->phases[phase];
+        if (!current->calls){
+            continue;
+        }
+        double total_nodes = (double)current->calls * nodes;
+        printf("%-10s %10lu %10.2f", Perf_phase_names[phase], (unsigned long)current->calls,
+                current->nanoseconds / total_nodes);
+
+        for (uint32_t i = 0; i < PERF_EVENTS; i++){
+            if (counters->fds[i] >= 0){
+                printf(" %10.3f", current->counts[i] / total_nodes);
+            }
+            else{
+                printf(" %10s", "-");
+            }
+            if (i == 1){
+                if (counters->fds[0] >= 0 && counters->fds[1] >= 0 && current->counts[0]){
+                    printf(" %6.2f", (double)current->counts[1] / current->counts[0]);
+                }
+                else{
+                    printf(" %6s", "-");
+                }
+            }
+        }
+        printf("\n");
+    }
+}
+
+/* ------------------------- END PRIVATE ----------------------------- */
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+
+int main(int argc, char *argv[]){
+    uint32_t count = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000;
+    uint32_t operators = argc > 2 ? strtoul(argv[2], NULL, 10) : 1000;
+    uint32_t runs = argc > 3 ? strtoul(argv[3], NULL, 10) : 10;
+    if (!count || !runs){
+        fprintf(stderr, "usage: %s [expressions] [operators per expression] [runs per program]\n", argv[0]);
+        return 1;
+    }
+
+    size_t size = 16 * (size_t)operators + 4;
+    char **expressions = malloc(sizeof(char *) * count);
+    char *output = malloc(2 * size);
+    if (!expressions || !output){
+        fprintf(stderr, "ExP_perf: out of memory\n");
+        return 1;
+    }
+    uint32_t state = 2463534242u;
+    for (uint32_t i = 0; i < count; i++){
+        expressions[i] = malloc(size);
+        if (!expressions[i]){
+            fprintf(stderr, "ExP_perf: out of memory\n");
+            return 1;
+        }
+        expressions[i][Perf_generate(expressions[i], operators, &state)] = '\0';
+    }
+
+    struct perf_counters counters;
+    Perf_open(&counters);
+
+    // keep every phase on this thread, the one the counters count
+    ExP_set_parse_threads(1);
+    ExP_set_phase_hook(Perf_hook, &counters);
+
+    int64_t checksum = 0;
+    uint32_t failures = 0;
+    for (uint32_t i = 0; i < count; i++){
+        checksum += ExP_compute(expressions[i], INFIX);
+
+        ExProgram program = ExP_compile(expressions[i], INFIX, ExP_OPT_NONE);
+        if (!program){
+            failures++;
+            continue;
+        }
+        for (uint32_t j = 0; j < runs; j++){
+            checksum += ExP_run(program);
+        }
+        ExP_program_destroy(&program);
+
+        if (ExP_convert_into(expressions[i], strlen(expressions[i]), INFIX, ExP_TO_POSTFIX, output, 2 * size) < 0){
+            failures++;
+        }
+    }
+    ExP_set_phase_hook(NULL, NULL);
+
+    // every operator has two operands: function calls have an argument
+    // list node as well, so this is a lower bound
+    printf("%u expressions of %u operators (at least %u nodes), %u runs each; checksum %ld, failures %u\n",
+            count, operators, 2 * operators + 1, runs, (long)checksum, failures);
+    Perf_report(&counters, 2 * (uint64_t)operators + 1);
+
+    Perf_close(&counters);
+    for (uint32_t i = 0; i < count; i++){
+        free(expressions[i]);
+    }
+    free(expressions);
+    free(output);
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,901 @@
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "C_ex_parser.h"
+
+
+/* ************************************************************* */
+/* ------------------------ OVERVIEW --------------------------- */
+
+/* A long-running server computing and converting expressions for
+ * local clients over a Unix domain socket. The protocol is described
+ * in ExP_client.h.
+ *
+ * Usage: ExP_server <socket path> [number of workers]
+ *
+ * - One thread runs an epoll event loop: it accepts connections, reads
+ *   the (possibly pipelined) request lines, and writes the responses.
+ * - All the requests read in one iteration of the event loop are
+ *   coalesced into batches of up to BATCH_MAX requests, which are queued
+ *   for a pool of worker threads.
+ * - Each worker keeps its own cache of compiled expressions (ExPrograms),
+ *   so that an expression seen before isn't parsed again. The caches
+ *   aren't shared, which means no locking, and ExP_run() never sees the
+ *   same program on two threads.
+ * - Each worker rejects expressions over LIMIT_TOKENS tokens, nesting
+ *   deeper than LIMIT_DEPTH or needing more than LIMIT_BYTES of memory to
+ *   parse, before parsing them. Malformed expressions are rejected the
+ *   same way, by the library's check (see ExP_last_error()), and the
+ *   response says what's wrong with them and where.
+ * - A client can't make the server buffer without bound: a request line
+ *   over REQUEST_MAX_LENGTH gets an error response and the connection is
+ *   closed, and the server stops reading from a client while OUT_HIGH_WATER
+ *   bytes of responses (or PENDING_MAX requests) are waiting on it.
+ * - Request latency (from being read to the response being queued) is
+ *   recorded in a histogram; that and the queue depth are reported by
+ *   the STATS request.
+
+ * ************************************************************* */
+
+
+#define BATCH_MAX 64        // requests per batch handed to a worker
+#define CACHE_SIZE 4096     // compiled expressions cached per worker (power of 2)
+#define CACHE_WAYS 4        // entries per cache set
+#define HISTOGRAM_BUCKETS 32    // bucket i: latencies in [2^i, 2^(i+1)) microseconds
+#define READ_CHUNK 65536
+
+// the limits each worker parses expressions within (see ExP_set_limits()),
+// so that one hostile expression can't tie a worker up or exhaust memory
+#define LIMIT_TOKENS (1 << 16)
+#define LIMIT_DEPTH 1024
+#define LIMIT_BYTES (1 << 24)
+
+// the longest request line read; past it, the client gets an error and is
+// disconnected instead of its line being buffered until it ends
+#define REQUEST_MAX_LENGTH (1 << 20)
+// reading from a client stops while this many bytes of responses are
+// waiting for it to read them, or this many of its requests for an answer,
+// and resumes once it has caught up
+#define OUT_HIGH_WATER (1 << 22)
+#define PENDING_MAX 1024
+
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/* ------------------ Structs and Typedefs ------------------- */
+
+typedef struct connection *Connection;
+typedef struct request *Request;
+typedef struct batch *Batch;
+
+struct connection{
+    int fd;
+    pthread_mutex_t lock;   // guards everything below; 'in' is only used by the event loop
+
+    char *in;               // bytes read but not yet split into requests
+    size_t in_length, in_size;
+
+    char *out;              // responses waiting to be written
+    size_t out_length, out_size;
+
+    uint32_t pending;       // requests read but not yet answered
+    bool closing;           // the client hung up (or errored); retire once everything is answered
+    bool dirty;             // on the dirty list, waiting for the event loop to flush it
+    bool retired;           // in the graveyard, to be freed
+    uint32_t events;        // the epoll events currently registered for
+    Connection next_dirty;  // next on the dirty list, or in the graveyard
+};
+
+struct request{
+    Connection connection;
+    uint64_t received;      // when it was read, in nanoseconds
+    Request next;
+    char line[];            // the request line, NUL-terminated
+};
+
+struct batch{
+    Request first;
+    Request last;
+    uint32_t count;
+    Batch next;
+};
+
+struct cache_entry{
+    char *key;              // a byte for the notation followed by the expression
+    ExProgram program;
+};
+
+// state shared by the event loop and the workers
+static struct{
+    pthread_mutex_t queue_lock;
+    pthread_cond_t queue_ready;
+    Batch queue_first;
+    Batch queue_last;
+    atomic_uint_fast64_t queue_depth;   // requests queued but not yet picked up by a worker
+
+    pthread_mutex_t dirty_lock;
+    Connection dirty_first;     // connections with responses to write
+    int event_fd;               // workers signal the event loop through this
+
+    atomic_uint_fast64_t requests;
+    atomic_uint_fast64_t batches;
+    atomic_uint_fast64_t cache_hits;
+    atomic_uint_fast64_t cache_misses;
+    atomic_uint_fast64_t histogram[HISTOGRAM_BUCKETS];
+} server;
+
+
+// --------------------------------------------------------------------------------
+// ||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||
+// --------------------------------------------------------------------------------
+
+
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/* ----------------------- Private Functions ------------------------- */
+
+
+static uint64_t Server_now(void){
+    /* Return a monotonic timestamp in nanoseconds */
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + now.tv_nsec;
+}
+
+
+static bool Server_append(char **buffer, size_t *length, size_t *size, const char *data, size_t data_length){
+    /* Append data to the growable buffer *buffer.
+       Return false if memory couldn't be allocated.
+    */
+    if (*length + data_length > *size){
+        size_t new_size = *size ? *size : 256;
+        while (new_size < *length + data_length){
+            new_size *= 2;
+        }
+        char *new_buffer = realloc(*buffer, new_size);
+        if (!new_buffer){
+            return false;
+        }
+        *buffer = new_buffer;
+        *size = new_size;
+    }
+    memcpy(*buffer + *length, data, data_length);
+    *length += data_length;
+
+    return true;
+}
+
+
+
+/*               * * * Worker functions * * *                         */
+
+
+static uint64_t Cache_hash(const char *key){
+    /* FNV-1a hash of the NUL-terminated key */
+    uint64_t hash = 14695981039346656037u;
+    for (; *key; key++){
+        hash = (hash ^ (unsigned char)*key) * 1099511628211u;
+    }
+    return hash;
+}
+
+
+static ExProgram Cache_lookup(struct cache_entry cache[], char *key, char *expression, ex_notation NOTATION){
+    /* Return the compiled program for expression, from cache if it's there,
+       otherwise compiling it and adding it to the cache.
+       key identifies the expression and its notation.
+
+       The cache is CACHE_WAYS-way set-associative: a key can only be in one of
+       the CACHE_WAYS entries of its set; when they're all taken, a new entry
+       replaces one of them, picked by the other bits of the hash.
+    */
+    uint64_t hash = Cache_hash(key);
+    struct cache_entry *set = &cache[(hash & (CACHE_SIZE / CACHE_WAYS - 1)) * CACHE_WAYS];
+    struct cache_entry *entry = &set[(hash >> 32) % CACHE_WAYS];
+
+    for (uint32_t i = 0; i < CACHE_WAYS; i++){
+        if (set[i].key && strcmp(set[i].key, key) == 0){
+            atomic_fetch_add(&server.cache_hits, 1);
+            return set[i].program;
+        }
+        if (!set[i].key){   // prefer an empty entry
+            entry = &set[i];
+        }
+    }
+    atomic_fetch_add(&server.cache_misses, 1);
+
+    ExProgram program = ExP_compile(expression, NOTATION, ExP_OPT_NONE);
+    if (!program){
+        return NULL;
+    }
+    char *key_copy = strdup(key);
+    if (!key_copy){
+        return program;     // not cached: the caller has to free it
+    }
+    free(entry->key);
+    ExP_program_destroy(&entry->program);
+    entry->key = key_copy;
+    entry->program = program;
+
+    return program;
+}
+
+
+static bool Cache_contains(struct cache_entry cache[], char *key, ExProgram program){
+    /* Return whether program is the one cached for key */
+    struct cache_entry *set = &cache[(Cache_hash(key) & (CACHE_SIZE / CACHE_WAYS - 1)) * CACHE_WAYS];
+    for (uint32_t i = 0; i < CACHE_WAYS; i++){
+        if (set[i].program == program){
+            return true;
+        }
+    }
+    return false;
+}
+
+
+static bool Server_parse_notation(const char *name, ex_notation *NOTATION){
+    /* Store the notation called name in *NOTATION; return false if there's none */
+    if (strcmp(name, "PREFIX") == 0){
+        *NOTATION = PREFIX;
+    }else if (strcmp(name, "INFIX") == 0){
+        *NOTATION = INFIX;
+    }else if (strcmp(name, "POSTFIX") == 0){
+        *NOTATION = POSTFIX;
+    }else{
+        return false;
+    }
+    return true;
+}
+
+
+static void Server_stats(char *text, size_t size){
+    /* Write the server statistics into text, a buffer of size bytes */
+    int written = snprintf(text, size, "requests=%lu batches=%lu queue_depth=%lu cache_hits=%lu cache_misses=%lu latency_us_log2=",
+            (unsigned long)atomic_load(&server.requests), (unsigned long)atomic_load(&server.batches),
+            (unsigned long)atomic_load(&server.queue_depth), (unsigned long)atomic_load(&server.cache_hits),
+            (unsigned long)atomic_load(&server.cache_misses));
+
+    for (uint32_t i = 0; i < HISTOGRAM_BUCKETS && written > 0 && (size_t)written < size; i++){
+        written += snprintf(text + written, size - written, i ? ",%lu" : "%lu",
+                (unsigned long)atomic_load(&server.histogram[i]));
+    }
+}
+
+
+static void Server_reason(char *text, size_t size, const char *action){
+    /* Write to text why the expression just rejected couldn't be handled
+       (action: "compile" or "convert"), from ExP_last_error()
+    */
+    static const char *problems[] = {
+        [ExP_ERROR_EMPTY] = "empty expression",
+        [ExP_ERROR_CHARACTER] = "invalid character",
+        [ExP_ERROR_OPERAND] = "missing operand",
+        [ExP_ERROR_OPERATOR] = "missing operator",
+        [ExP_ERROR_PARENTHESIS] = "unmatched parenthesis",
+        [ExP_ERROR_CONDITIONAL] = "unmatched ? or :",
+        [ExP_ERROR_CALL] = "invalid function call",
+        [ExP_ERROR_MEMORY] = "out of memory",
+        [ExP_ERROR_NOTATION] = "invalid notation",
+    };
+    ex_error error = ExP_last_error();
+
+    if (error.kind == ExP_ERROR_LIMIT){
+        snprintf(text, size, "expression over limits");
+    }
+    else if (error.kind == ExP_ERROR_NONE || error.kind >= sizeof(problems) / sizeof(problems[0])){
+        snprintf(text, size, "cannot %s expression", action);
+    }
+    else{
+        snprintf(text, size, "cannot %s expression: %s at %zu", action, problems[error.kind], error.offset);
+    }
+}
+
+
+static void Server_handle(struct cache_entry cache[], Request request, char **response, size_t *length, size_t *size){
+    /* Carry out request and append the response line to *response */
+    char *line = request->line;
+    char *id = strsep(&line, " ");
+    char *verb = line ? strsep(&line, " ") : NULL;
+
+    char text[512];
+    const char *status = "OK";
+    char *result = NULL;    // a converted expression, when the result is too long for text
+    char *expression = NULL;
+
+    if (verb && strcmp(verb, "STATS") == 0){
+        Server_stats(text, sizeof(text));
+    }
+    else{
+        char *notation = line ? strsep(&line, " ") : NULL;
+        expression = line;
+        ex_notation NOTATION;
+
+        if (!verb || !notation || !expression || !Server_parse_notation(notation, &NOTATION)){
+            status = "ERR";
+            snprintf(text, sizeof(text), "malformed request");
+        }
+        else if (strcmp(verb, "COMPUTE") == 0){
+            // the key is a byte for the notation ('0' + NOTATION: PREFIX and
+            // POSTFIX share their initial) followed by the expression; the
+            // space before the expression is already there to be overwritten
+            char *key = expression - 1;
+            key[0] = (char)('0' + NOTATION);
+
+            ExProgram program = Cache_lookup(cache, key, expression, NOTATION);
+            if (!program){
+                status = "ERR";
+                Server_reason(text, sizeof(text), "compile");
+            }
+            else{
+                int32_t value = ExP_run(program);
+                ex_error_kind error = ExP_last_error().kind;
+
+                // a division by 0 (or of INT32_MIN by -1) has no value to reply with
+                if (error == ExP_ERROR_DIVISION || error == ExP_ERROR_OVERFLOW){
+                    status = "ERR";
+                    snprintf(text, sizeof(text), "%s", error == ExP_ERROR_DIVISION ? \
+                             "division by zero" : "division overflow");
+                }
+                else{
+                    ExP_format_int(value, text);
+                }
+                if (!Cache_contains(cache, key, program)){
+                    ExP_program_destroy(&program);
+                }
+            }
+        }
+        else{
+            char *(*convert)(char[], ex_notation) = NULL;
+            if (strcmp(verb, "TO_PREFIX") == 0){
+                convert = ExP_to_prefix;
+            }else if (strcmp(verb, "TO_INFIX") == 0){
+                convert = ExP_to_infix;
+            }else if (strcmp(verb, "TO_POSTFIX") == 0){
+                convert = ExP_to_postfix;
+            }
+
+            if (!convert){
+                status = "ERR";
+                snprintf(text, sizeof(text), "unknown verb");
+            }
+            else if (!(result = convert(expression, NOTATION))){
+                status = "ERR";
+                Server_reason(text, sizeof(text), "convert");
+            }
+        }
+    }
+
+    // <id> <status> <text>\n
+    const char *body = result ? result : text;
+    Server_append(response, length, size, id, strlen(id));
+    Server_append(response, length, size, " ", 1);
+    Server_append(response, length, size, status, strlen(status));
+    Server_append(response, length, size, " ", 1);
+    Server_append(response, length, size, body, strlen(body));
+    Server_append(response, length, size, "\n", 1);
+
+    free(result);
+}
+
+
+static void Server_respond(Connection connection, const char *response, size_t length, uint32_t answered){
+    /* Queue response, answering 'answered' requests, on connection and
+       make sure the event loop will write it out.
+    */
+    pthread_mutex_lock(&connection->lock);
+
+    Server_append(&connection->out, &connection->out_length, &connection->out_size, response, length);
+    connection->pending -= answered;
+
+    if (!connection->dirty){
+        connection->dirty = true;
+        pthread_mutex_lock(&server.dirty_lock);
+        connection->next_dirty = server.dirty_first;
+        server.dirty_first = connection;
+        pthread_mutex_unlock(&server.dirty_lock);
+    }
+    pthread_mutex_unlock(&connection->lock);
+
+    uint64_t one = 1;
+    (void)write(server.event_fd, &one, sizeof(one));
+}
+
+
+static void Server_record_latency(uint64_t received){
+    /* Add the latency of a request received at 'received' to the histogram */
+    uint64_t microseconds = (Server_now() - received) / 1000;
+    uint32_t bucket = 0;
+    while (microseconds > 1 && bucket < HISTOGRAM_BUCKETS - 1){
+        microseconds >>= 1;
+        bucket++;
+    }
+    atomic_fetch_add(&server.histogram[bucket], 1);
+}
+
+
+static void *Server_worker(void *unused){
+    /* Worker thread: take batches off the queue and carry out their requests.
+       The responses of consecutive requests on the same connection are
+       gathered and handed over together.
+    */
+    (void)unused;
+    ex_limits limits = {.max_tokens = LIMIT_TOKENS, .max_depth = LIMIT_DEPTH, .max_bytes = LIMIT_BYTES};
+    ExP_set_limits(&limits);
+
+    struct cache_entry *cache = calloc(CACHE_SIZE, sizeof(struct cache_entry));
+    if (!cache){
+        return NULL;
+    }
+    char *response = NULL;
+    size_t length = 0, size = 0;
+
+    while (true){
+        pthread_mutex_lock(&server.queue_lock);
+        while (!server.queue_first){
+            pthread_cond_wait(&server.queue_ready, &server.queue_lock);
+        }
+        Batch batch = server.queue_first;
+        server.queue_first = batch->next;
+        if (!server.queue_first){
+            server.queue_last = NULL;
+        }
+        pthread_mutex_unlock(&server.queue_lock);
+        atomic_fetch_sub(&server.queue_depth, batch->count);
+
+        Request request = batch->first;
+        while (request){
+            Connection connection = request->connection;
+            uint32_t answered = 0;
+            length = 0;
+
+            // all the consecutive requests from the same connection
+            while (request && request->connection == connection){
+                Server_handle(cache, request, &response, &length, &size);
+                Server_record_latency(request->received);
+                answered++;
+
+                Request next = request->next;
+                free(request);
+                request = next;
+            }
+            Server_respond(connection, response, length, answered);
+        }
+        free(batch);
+    }
+    return NULL;
+}
+
+
+
+/*               * * * Event loop functions * * *                         */
+
+
+static void Server_enqueue(Batch batch){
+    /* Hand batch over to the workers */
+    atomic_fetch_add(&server.queue_depth, batch->count);
+    atomic_fetch_add(&server.batches, 1);
+
+    pthread_mutex_lock(&server.queue_lock);
+    batch->next = NULL;
+    if (server.queue_last){
+        server.queue_last->next = batch;
+    }else{
+        server.queue_first = batch;
+    }
+    server.queue_last = batch;
+    pthread_cond_signal(&server.queue_ready);
+    pthread_mutex_unlock(&server.queue_lock);
+}
+
+
+static void Server_add_request(Batch *batch_ref, Request request){
+    /* Add request to the batch being gathered, queueing the batch
+       first if it's full.
+    */
+    if (*batch_ref && (*batch_ref)->count == BATCH_MAX){
+        Server_enqueue(*batch_ref);
+        *batch_ref = NULL;
+    }
+    if (!*batch_ref){
+        *batch_ref = calloc(1, sizeof(struct batch));
+        if (!*batch_ref){
+            free(request);
+            return;
+        }
+    }
+    Batch batch = *batch_ref;
+    request->next = NULL;
+    if (batch->last){
+        batch->last->next = request;
+    }else{
+        batch->first = request;
+    }
+    batch->last = request;
+    batch->count++;
+}
+
+
+static void Connection_free(Connection connection){
+    /* Close the connection's socket and free it */
+    close(connection->fd);
+    pthread_mutex_destroy(&connection->lock);
+    free(connection->in);
+    free(connection->out);
+    free(connection);
+}
+
+
+static void Connection_retire(Connection connection, Connection *graveyard){
+    /* connection is done with: add it to the graveyard, to be freed at
+       the end of the current event loop iteration, since events for it
+       may still be pending in the same iteration.
+       Called with connection->lock held.
+    */
+    if (connection->retired){
+        return;
+    }
+    connection->retired = true;
+    connection->next_dirty = *graveyard;
+    *graveyard = connection;
+}
+
+
+static bool Connection_done(Connection connection){
+    /* Return whether connection can be retired: the client hung up, and
+       every request it sent has been answered and the answer written out.
+       Called with connection->lock held.
+    */
+    return connection->closing && connection->pending == 0 && \
+           connection->out_length == 0 && !connection->dirty;
+}
+
+
+static bool Connection_backlogged(Connection connection){
+    /* Return whether the client has to catch up before more of its 
+       requests are read: it has OUT_HIGH_WATER bytes of responses left
+       to read, or PENDING_MAX requests waiting for an answer.
+       Called with connection->lock held.
+    */
+    return connection->out_length >= OUT_HIGH_WATER || connection->pending >= PENDING_MAX;
+}
+
+
+static void Connection_update_events(int epoll_fd, Connection connection){
+    /* Register the connection with epoll for the events it currently needs:
+       EPOLLIN unless the client hung up or is backlogged, EPOLLOUT if 
+       there's output the socket didn't take yet.
+       Called with connection->lock held.
+    */
+    bool reading = !connection->closing && !Connection_backlogged(connection);
+    uint32_t wanted = (reading ? EPOLLIN : 0) | (connection->out_length ? EPOLLOUT : 0);
+    if (wanted == connection->events){
+        return;
+    }
+    struct epoll_event event = {.events = wanted, .data.ptr = connection};
+
+    if (!wanted){
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, connection->fd, NULL);
+    }else if (!connection->events){
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, connection->fd, &event);
+    }else{
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, connection->fd, &event);
+    }
+    connection->events = wanted;
+}
+
+
+static void Connection_flush(int epoll_fd, Connection connection){
+    /* Write as much of the connection's pending output as the socket takes;
+       if some is left over, wait for EPOLLOUT to write the rest.
+       Called with connection->lock held.
+    */
+    size_t written = 0;
+    while (written < connection->out_length){
+        ssize_t count = write(connection->fd, connection->out + written, connection->out_length - written);
+        if (count < 0){
+            if (errno == EINTR){
+                continue;
+            }
+            if (errno != EAGAIN){   // the client is gone: drop its output
+                written = connection->out_length;
+                connection->closing = true;
+            }
+            break;
+        }
+        written += count;
+    }
+    memmove(connection->out, connection->out + written, connection->out_length - written);
+    connection->out_length -= written;
+
+    Connection_update_events(epoll_fd, connection);
+}
+
+
+static void Connection_close(int epoll_fd, Connection connection, Connection *graveyard){
+    /* The client hung up: stop reading from it. The responses to the requests
+       still in flight are written out before the connection is retired.
+    */
+    pthread_mutex_lock(&connection->lock);
+    connection->closing = true;
+    Connection_update_events(epoll_fd, connection);
+    if (Connection_done(connection)){
+        Connection_retire(connection, graveyard);
+    }
+    pthread_mutex_unlock(&connection->lock);
+}
+
+
+static void Connection_split(Connection connection, Batch *batch_ref){
+    /* Turn every complete line read on the connection into a request added
+       to the batch being gathered; keep the rest, the start of a line.
+    */
+    uint64_t now = Server_now();
+    size_t start = 0;
+    char *newline;
+    while ((newline = memchr(connection->in + start, '\n', connection->in_length - start))){
+        size_t line_length = newline - (connection->in + start);
+
+        Request request = malloc(sizeof(struct request) + line_length + 1);
+        if (request){
+            request->connection = connection;
+            request->received = now;
+            memcpy(request->line, connection->in + start, line_length);
+            request->line[line_length] = '\0';
+
+            pthread_mutex_lock(&connection->lock);
+            connection->pending++;
+            pthread_mutex_unlock(&connection->lock);
+
+            atomic_fetch_add(&server.requests, 1);
+            Server_add_request(batch_ref, request);
+        }
+        start += line_length + 1;
+    }
+    memmove(connection->in, connection->in + start, connection->in_length - start);
+    connection->in_length -= start;
+}
+
+
+static void Connection_refuse(int epoll_fd, Connection connection){
+    /* The line being read on the connection is over REQUEST_MAX_LENGTH:
+       drop it, and answer it with an error, under its id if it starts
+       with one (digits, as the client picks them), else under 0.
+    */
+    size_t id_length = 0;
+    while (id_length < connection->in_length && id_length < 20 && \
+            connection->in[id_length] >= '0' && connection->in[id_length] <= '9'){
+        id_length++;
+    }
+    char response[64];
+    int length = snprintf(response, sizeof(response), "%.*s ERR request too long\n", \
+                          id_length ? (int)id_length : 1, id_length ? connection->in : "0");
+    connection->in_length = 0;
+
+    pthread_mutex_lock(&connection->lock);
+    Server_append(&connection->out, &connection->out_length, &connection->out_size, response, length);
+    Connection_flush(epoll_fd, connection);
+    pthread_mutex_unlock(&connection->lock);
+}
+
+
+static void Connection_read(int epoll_fd, Connection connection, Batch *batch_ref, Connection *graveyard){
+    /* Read what's available on the connection, turning every complete line
+       into a request added to the batch being gathered, until the client
+       is backlogged (see Connection_backlogged()): the rest is read once
+       it has caught up. A line over REQUEST_MAX_LENGTH closes the connection.
+    */
+    char chunk[READ_CHUNK];
+    bool hung_up = false;
+    bool too_long = false;
+
+    while (!too_long){
+        pthread_mutex_lock(&connection->lock);
+        bool backlogged = Connection_backlogged(connection);
+        pthread_mutex_unlock(&connection->lock);
+        if (backlogged){
+            break;
+        }
+
+        ssize_t count = read(connection->fd, chunk, sizeof(chunk));
+        if (count < 0 && errno == EINTR){
+            continue;
+        }
+        if (count < 0 && errno == EAGAIN){
+            break;
+        }
+        if (count <= 0 || !Server_append(&connection->in, &connection->in_length, &connection->in_size, chunk, count)){
+            hung_up = true;
+            break;
+        }
+        Connection_split(connection, batch_ref);
+        too_long = connection->in_length > REQUEST_MAX_LENGTH;
+    }
+
+    if (too_long){
+        Connection_refuse(epoll_fd, connection);
+    }
+    if (hung_up || too_long){
+        Connection_close(epoll_fd, connection, graveyard);
+    }
+    else{
+        // stop waiting for EPOLLIN if it's backlogged
+        pthread_mutex_lock(&connection->lock);
+        Connection_update_events(epoll_fd, connection);
+        pthread_mutex_unlock(&connection->lock);
+    }
+}
+
+
+static void Server_flush_dirty(int epoll_fd, Connection *graveyard){
+    /* Write out the responses the workers have queued, and retire the
+       connections that were only waiting for those.
+    */
+    pthread_mutex_lock(&server.dirty_lock);
+    Connection connection = server.dirty_first;
+    server.dirty_first = NULL;
+    pthread_mutex_unlock(&server.dirty_lock);
+
+    while (connection){
+        // read next_dirty before Connection_retire() reuses it
+        Connection next = connection->next_dirty;
+
+        pthread_mutex_lock(&connection->lock);
+        connection->dirty = false;
+        Connection_flush(epoll_fd, connection);
+        if (Connection_done(connection)){
+            Connection_retire(connection, graveyard);
+        }
+        pthread_mutex_unlock(&connection->lock);
+
+        connection = next;
+    }
+}
+
+
+static int Server_listen(const char *socket_path){
+    /* Create a non-blocking Unix domain socket listening at socket_path
+       and return it, or -1 on failure.
+    */
+    struct sockaddr_un address;
+    if (strlen(socket_path) >= sizeof(address.sun_path)){
+        return -1;
+    }
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, socket_path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0){
+        return -1;
+    }
+    unlink(socket_path);
+    if (bind(fd, (struct sockaddr *)&address, sizeof(address)) < 0 || listen(fd, 128) < 0){
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* ------------------------- END PRIVATE ----------------------------- */
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+
+int main(int argc, char *argv[]){
+    if (argc < 2){
+        fprintf(stderr, "usage: %s <socket path> [workers]\n", argv[0]);
+        return 1;
+    }
+    long workers = argc > 2 ? strtol(argv[2], NULL, 10) : sysconf(_SC_NPROCESSORS_ONLN);
+    if (workers < 1){
+        workers = 1;
+    }
+    signal(SIGPIPE, SIG_IGN);   // clients hanging up mid-write are handled via EPIPE
+
+    pthread_mutex_init(&server.queue_lock, NULL);
+    pthread_cond_init(&server.queue_ready, NULL);
+    pthread_mutex_init(&server.dirty_lock, NULL);
+
+    int listen_fd = Server_listen(argv[1]);
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    server.event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (listen_fd < 0 || epoll_fd < 0 || server.event_fd < 0){
+        perror("ExP_server");
+        return 1;
+    }
+
+    // the listening socket and the eventfd are told apart from connections
+    // by their data.ptr: NULL and &server respectively
+    struct epoll_event event = {.events = EPOLLIN, .data.ptr = NULL};
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &event);
+    event.data.ptr = &server;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, server.event_fd, &event);
+
+    for (long i = 0; i < workers; i++){
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, Server_worker, NULL) != 0){
+            perror("ExP_server");
+            return 1;
+        }
+        pthread_detach(thread);
+    }
+    fprintf(stderr, "ExP_server: listening on %s with %ld workers\n", argv[1], workers);
+
+    struct epoll_event events[256];
+    while (true){
+        int ready = epoll_wait(epoll_fd, events, 256, -1);
+        if (ready < 0){
+            if (errno == EINTR){
+                continue;
+            }
+            perror("ExP_server");
+            return 1;
+        }
+
+        // the requests read in this iteration, from all connections
+        Batch batch = NULL;
+        // the connections to free at the end of this iteration
+        Connection graveyard = NULL;
+
+        for (int i = 0; i < ready; i++){
+            if (events[i].data.ptr == NULL){
+                int fd;
+                while ((fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0){
+                    Connection connection = calloc(1, sizeof(struct connection));
+                    if (!connection){
+                        close(fd);
+                        continue;
+                    }
+                    connection->fd = fd;
+                    pthread_mutex_init(&connection->lock, NULL);
+                    Connection_update_events(epoll_fd, connection);
+                }
+            }
+            else if (events[i].data.ptr == &server){
+                uint64_t count;
+                (void)read(server.event_fd, &count, sizeof(count));
+                Server_flush_dirty(epoll_fd, &graveyard);
+            }
+            else{
+                Connection connection = events[i].data.ptr;
+
+                pthread_mutex_lock(&connection->lock);
+                if (events[i].events & EPOLLOUT){
+                    Connection_flush(epoll_fd, connection);
+                }
+                bool reading = !connection->closing && !connection->retired;
+                if (Connection_done(connection)){
+                    Connection_retire(connection, &graveyard);
+                }
+                pthread_mutex_unlock(&connection->lock);
+
+                if (reading && (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))){
+                    Connection_read(epoll_fd, connection, &batch, &graveyard);
+                }
+            }
+        }
+        if (batch){
+            Server_enqueue(batch);
+        }
+        while (graveyard){
+            Connection next = graveyard->next_dirty;
+            Connection_free(graveyard);
+            graveyard = next;
+        }
+    }
+    return 0;
+}